@@ -39,5 +39,14 @@ endif()
 # Check for mmap
 check_symbol_exists(mmap "sys/mman.h" HAVE_MMAP)
 
+# Check for posix_fadvise
+check_symbol_exists(posix_fadvise "fcntl.h" HAVE_POSIX_FADVISE)
+
+# Check for sync_file_range
+set(CMAKE_REQUIRED_DEFINITIONS_SAVE ${CMAKE_REQUIRED_DEFINITIONS})
+set(CMAKE_REQUIRED_DEFINITIONS ${CMAKE_REQUIRED_DEFINITIONS} -D_GNU_SOURCE)
+check_symbol_exists(sync_file_range "fcntl.h" HAVE_SYNC_FILE_RANGE)
+set(CMAKE_REQUIRED_DEFINITIONS ${CMAKE_REQUIRED_DEFINITIONS_SAVE})
+
 # Check for setmode
 check_symbol_exists(setmode "unistd.h" HAVE_SETMODE)
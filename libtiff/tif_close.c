@@ -54,6 +54,8 @@ TIFFCleanup(TIFF* tif)
 
 	if (tif->tif_dirlist)
 		_TIFFfree(tif->tif_dirlist);
+	if (tif->tif_dirextents)
+		_TIFFfree(tif->tif_dirextents);
 
 	/*
          * Clean up client info links.
@@ -69,6 +71,8 @@ TIFFCleanup(TIFF* tif)
 
 	if (tif->tif_rawdata && (tif->tif_flags&TIFF_MYBUFFER))
 		_TIFFfree(tif->tif_rawdata);
+	if (tif->tif_wbuf)
+		_TIFFfree(tif->tif_wbuf);
 	if (isMapped(tif))
 		TIFFUnmapFileContents(tif, tif->tif_base, (toff_t)tif->tif_size);
 
@@ -89,6 +93,7 @@ TIFFCleanup(TIFF* tif)
 
 		_TIFFfree(tif->tif_fields);
 	}
+	_TIFFFreeFieldIndex(tif);
 
         if (tif->tif_nfieldscompat > 0) {
                 uint32_t i;
@@ -71,6 +71,94 @@ void _TIFFsetFloatArray(float** fpp, float* fp, uint32_t n)
 void _TIFFsetDoubleArray(double** dpp, double* dp, uint32_t n)
     { setByteArray((void**) dpp, (void*) dp, n, sizeof (double)); }
 
+/*
+ * The values of a directory being read (TIFF_DIRARENA set) are allocated
+ * from blocks of an arena, freed at once by TIFFFreeDirectory(), instead
+ * of one by one: this is done for those of custom tags and the NDPI
+ * strings, of which files can have many.  Replacing them later only
+ * leaves them in their block.
+ */
+struct TIFFDirArenaBlock {
+	TIFFDirArenaBlock* next;
+	tmsize_t size;			/* bytes of values after the header */
+	tmsize_t used;
+};
+
+#define	ARENA_HEADERSIZE \
+	((tmsize_t) ((sizeof (TIFFDirArenaBlock) + 7) & ~(size_t) 7))
+#define	ARENA_BLOCKSIZE	4096	/* larger values get a block of their own */
+
+static void*
+dirValueAlloc(TIFF* tif, tmsize_t nmemb, tmsize_t elem_size, const char* what)
+{
+	TIFFDirectory* td = &tif->tif_dir;
+	TIFFDirArenaBlock* b = td->td_arena;
+	tmsize_t bytes;
+	void* p;
+
+	if (!(tif->tif_flags & TIFF_DIRARENA))
+		return (_TIFFCheckMalloc(tif, nmemb, elem_size, what));
+	bytes = _TIFFMultiplySSize(NULL, nmemb, elem_size, NULL);
+	if (bytes == 0 || bytes > TIFF_TMSIZE_T_MAX - ARENA_HEADERSIZE - 7)
+		return (_TIFFCheckMalloc(tif, nmemb, elem_size, what));
+	bytes = (bytes + 7) & ~(tmsize_t) 7;
+	if (!b || b->size - b->used < bytes) {
+		tmsize_t size = bytes > ARENA_BLOCKSIZE / 4 ?
+		    bytes : ARENA_BLOCKSIZE;
+
+		b = (TIFFDirArenaBlock*) _TIFFCheckMalloc(tif, 1,
+		    ARENA_HEADERSIZE + size, what);
+		if (!b)
+			return (NULL);
+		b->size = size;
+		b->used = 0;
+		if (size != ARENA_BLOCKSIZE && td->td_arena) {
+			/* Keep on filling the current block */
+			b->next = td->td_arena->next;
+			td->td_arena->next = b;
+		} else {
+			b->next = td->td_arena;
+			td->td_arena = b;
+		}
+	}
+	p = (uint8_t*) b + ARENA_HEADERSIZE + b->used;
+	b->used += bytes;
+	return (p);
+}
+
+static void
+dirValueFree(TIFFDirectory* td, void* p)
+{
+	TIFFDirArenaBlock* b;
+
+	if (!p)
+		return;
+	for (b = td->td_arena; b; b = b->next)
+		if ((uint8_t*) p >= (uint8_t*) b + ARENA_HEADERSIZE &&
+		    (uint8_t*) p < (uint8_t*) b + ARENA_HEADERSIZE + b->size)
+			return;
+	_TIFFfree(p);
+}
+
+static void
+setDirValue(TIFF* tif, void** vpp, const void* vp, tmsize_t nmemb,
+	    tmsize_t elem_size)
+{
+	dirValueFree(&tif->tif_dir, *vpp);
+	*vpp = NULL;
+	if (vp && nmemb > 0) {
+		*vpp = dirValueAlloc(tif, nmemb, elem_size, "for field value");
+		if (*vpp)
+			_TIFFmemcpy(*vpp, vp, nmemb * elem_size);
+	}
+}
+
+static void
+setDirString(TIFF* tif, char** cpp, const char* cp)
+{
+	setDirValue(tif, (void**) cpp, cp, cp ? (tmsize_t) strlen(cp) + 1 : 0, 1);
+}
+
 static void
 setDoubleArrayOneValue(double** vpp, double value, size_t nmemb)
 {
@@ -494,19 +582,20 @@ _TIFFVSetField(TIFF* tif, uint32_t tag, va_list ap)
 		break;
 	case NDPITAG_USERGIVENSLIDELABEL:
 		s = (char*) va_arg(ap, char*);
-		_TIFFsetString(&td->td_ndpiusergivenslidelabel, s);
+		setDirString(tif, &td->td_ndpiusergivenslidelabel, s);
 		break;
 	case NDPITAG_BLANKLANES:
 		td->td_ndpinblanklanes = va_arg(ap, uint32_t);
-		_TIFFsetLongArray(&td->td_ndpiblanklanes, va_arg(ap, uint32_t*), (long) td->td_ndpinblanklanes);
+		setDirValue(tif, (void**) &td->td_ndpiblanklanes, va_arg(ap, uint32_t*),
+		    (tmsize_t) td->td_ndpinblanklanes, sizeof (uint32_t));
 		break;
 	case NDPITAG_COMMENTS:
 		s = (char*) va_arg(ap, char*);
-		_TIFFsetString(&td->td_ndpicomments, s);
+		setDirString(tif, &td->td_ndpicomments, s);
 		break;
 	case NDPITAG_FLUORESCENCE:
 		s = (char*) va_arg(ap, char*);
-		_TIFFsetString(&td->td_ndpifluorescence, s);
+		setDirString(tif, &td->td_ndpifluorescence, s);
 		break;
 	case TIFFTAG_PERSAMPLE:
 		v = (uint16_t) va_arg(ap, uint16_vap);
@@ -545,7 +634,7 @@ _TIFFVSetField(TIFF* tif, uint32_t tag, va_list ap)
 			if (td->td_customValues[iCustom].info->field_tag == tag) {
 				tv = td->td_customValues + iCustom;
 				if (tv->value != NULL) {
-					_TIFFfree(tv->value);
+					dirValueFree(td, tv->value);
 					tv->value = NULL;
 				}
 				break;
@@ -611,7 +700,7 @@ _TIFFVSetField(TIFF* tif, uint32_t tag, va_list ap)
 				ma=(uint32_t)(strlen(mb) + 1);
 			}
 			tv->count=ma;
-			setByteArray(&tv->value,mb,ma,1);
+			setDirValue(tif,&tv->value,mb,ma,1);
 		}
 		else
 		{
@@ -641,7 +730,7 @@ _TIFFVSetField(TIFF* tif, uint32_t tag, va_list ap)
 				goto end;
 			}
 
-			tv->value = _TIFFCheckMalloc(tif, tv->count, tv_size,
+			tv->value = dirValueAlloc(tif, tv->count, tv_size,
 			    "custom tag binary object");
 			if (!tv->value) {
 				status = 0;
@@ -886,7 +975,7 @@ TIFFUnsetField(TIFF* tif, uint32_t tag)
 
         if( i < td->td_customValueCount )
         {
-            _TIFFfree(tv->value);
+            dirValueFree(td, tv->value);
             for( ; i < td->td_customValueCount-1; i++) {
                 td->td_customValues[i] = td->td_customValues[i+1];
             }
@@ -1333,6 +1422,387 @@ TIFFVGetField(TIFF* tif, uint32_t tag, va_list ap)
 	    (*tif->tif_tagmethods.vgetfield)(tif, tag, ap) : 0);
 }
 
+static int
+isExcludedTag(uint32_t tag, const uint32_t* exclude, uint32_t nexclude)
+{
+	uint32_t i;
+
+	for (i = 0; i < nexclude; i++)
+		if (exclude[i] == tag)
+			return (1);
+	return (0);
+}
+
+/* Size of one element of a custom value, as stored by _TIFFVSetField() */
+static int
+customValueSize(const TIFFField* fip)
+{
+	if (fip->field_type == TIFF_RATIONAL ||
+	    fip->field_type == TIFF_SRATIONAL)
+		return (_TIFFSetGetFieldSize(fip->set_field_type));
+	return (_TIFFDataSize(fip->field_type));
+}
+
+/*
+ * Copy a codec-private tag, which lives in the state of the codec rather
+ * than in the directory, through the codec's own methods.
+ */
+static int
+copyCodecField(TIFF* in, TIFF* out, const TIFFField* fip)
+{
+	uint32_t tag = fip->field_tag;
+	uint32_t count, v32;
+	uint16_t v16;
+	double dv;
+	float fv;
+	void* p;
+
+	switch (fip->set_field_type) {
+	case TIFF_SETGET_UINT16:
+		return (!TIFFGetField(in, tag, &v16) ||
+		    TIFFSetField(out, tag, v16));
+	case TIFF_SETGET_UINT32:
+		return (!TIFFGetField(in, tag, &v32) ||
+		    TIFFSetField(out, tag, v32));
+	case TIFF_SETGET_FLOAT:
+		return (!TIFFGetField(in, tag, &fv) ||
+		    TIFFSetField(out, tag, (double) fv));
+	case TIFF_SETGET_DOUBLE:
+		return (!TIFFGetField(in, tag, &dv) ||
+		    TIFFSetField(out, tag, dv));
+	case TIFF_SETGET_ASCII:
+		return (!TIFFGetField(in, tag, &p) ||
+		    TIFFSetField(out, tag, p));
+	case TIFF_SETGET_C32_UINT8:
+	case TIFF_SETGET_C32_UINT32:
+		return (!TIFFGetField(in, tag, &count, &p) ||
+		    TIFFSetField(out, tag, count, p));
+	default:
+		TIFFWarningExt(out->tif_clientdata, "TIFFCopyDirectoryTags",
+		    "%s: Tag \"%s\" not copied", out->tif_name,
+		    fip->field_name);
+		return (1);
+	}
+}
+
+/*
+ * Copy the tags of the current directory of in to the current directory of
+ * out, but for those listed in exclude and for those that locate data in
+ * in (strip and tile offsets and byte counts, SubIFD, EXIF IFD...).
+ *
+ * This is a replacement for a TIFFGetField()/TIFFSetField() pair per tag:
+ * the values that are plain members of the directory are assigned
+ * directly, the arrays are duplicated with no per-tag lookup, and the
+ * custom values are appended to those of out with a single reallocation.
+ * Only the tags whose setting has side effects (Compression,
+ * BitsPerSample, SamplesPerPixel and SampleFormat) and the codec-private
+ * tags, which belong to the codec, go through TIFFSetField().  The latter
+ * are only copied if out ends up with the compression of in, and should
+ * be excluded if out is to get another compression afterwards.
+ *
+ * Excluding one of the tags that share a field bit (ImageWidth and
+ * ImageLength, TileWidth and TileLength, XResolution and YResolution,
+ * XPosition and YPosition) excludes the others.  Array values that
+ * depend on BitsPerSample or SamplesPerPixel are left out, with a
+ * warning, when out ends up with different values for these, and so are
+ * custom tags that out defines with another type or count.
+ */
+int
+TIFFCopyDirectoryTags(TIFF* in, TIFF* out, const uint32_t* exclude,
+    uint32_t nexclude)
+{
+	static const char module[] = "TIFFCopyDirectoryTags";
+	TIFFDirectory* itd = &in->tif_dir;
+	TIFFDirectory* otd = &out->tif_dir;
+	unsigned long fields[FIELD_SETLONGS];
+	TIFFTagValue* tvs;
+	uint32_t i;
+	int bit, k, ncustom, status = 1;
+
+	if (out->tif_flags & TIFF_BEENWRITING) {
+		TIFFErrorExt(out->tif_clientdata, module,
+		    "%s: Cannot copy tags while writing", out->tif_name);
+		return (0);
+	}
+
+	_TIFFmemcpy(fields, itd->td_fieldsset, sizeof(fields));
+	ResetFieldBit(fields, FIELD_IGNORE);
+	ResetFieldBit(fields, FIELD_STRIPOFFSETS);
+	ResetFieldBit(fields, FIELD_STRIPBYTECOUNTS);
+	ResetFieldBit(fields, FIELD_SUBIFD);
+	ResetFieldBit(fields, FIELD_CUSTOM);
+	for (i = 0; i < nexclude; i++) {
+		const TIFFField* fip = TIFFFindField(in, exclude[i], TIFF_ANY);
+
+		/* Codec fields share bits, so those go by tag below */
+		if (fip && fip->field_bit < FIELD_CODEC &&
+		    fip->field_bit != FIELD_CUSTOM)
+			ResetFieldBit(fields, fip->field_bit);
+	}
+
+	for (bit = 1; bit < FIELD_CUSTOM; bit++) {
+		if (!FieldSet(fields, bit))
+			continue;
+		switch (bit) {
+		case FIELD_IMAGEDIMENSIONS:
+			otd->td_imagewidth = itd->td_imagewidth;
+			otd->td_imagelength = itd->td_imagelength;
+			break;
+		case FIELD_TILEDIMENSIONS:
+			otd->td_tilewidth = itd->td_tilewidth;
+			otd->td_tilelength = itd->td_tilelength;
+			out->tif_flags |= TIFF_ISTILED;
+			break;
+		case FIELD_RESOLUTION:
+			otd->td_xresolution = itd->td_xresolution;
+			otd->td_yresolution = itd->td_yresolution;
+			break;
+		case FIELD_POSITION:
+			otd->td_xposition = itd->td_xposition;
+			otd->td_yposition = itd->td_yposition;
+			break;
+		case FIELD_SUBFILETYPE:
+			otd->td_subfiletype = itd->td_subfiletype;
+			break;
+		case FIELD_BITSPERSAMPLE:
+			if (!TIFFSetField(out, TIFFTAG_BITSPERSAMPLE,
+			    itd->td_bitspersample))
+				status = 0;
+			continue;
+		case FIELD_COMPRESSION:
+			if (!TIFFSetField(out, TIFFTAG_COMPRESSION,
+			    itd->td_compression))
+				status = 0;
+			continue;
+		case FIELD_PHOTOMETRIC:
+			otd->td_photometric = itd->td_photometric;
+			break;
+		case FIELD_THRESHHOLDING:
+			otd->td_threshholding = itd->td_threshholding;
+			break;
+		case FIELD_FILLORDER:
+			otd->td_fillorder = itd->td_fillorder;
+			break;
+		case FIELD_ORIENTATION:
+			otd->td_orientation = itd->td_orientation;
+			break;
+		case FIELD_SAMPLESPERPIXEL:
+			if (!TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL,
+			    itd->td_samplesperpixel))
+				status = 0;
+			continue;
+		case FIELD_ROWSPERSTRIP:
+			otd->td_rowsperstrip = itd->td_rowsperstrip;
+			if (!TIFFFieldSet(out, FIELD_TILEDIMENSIONS)) {
+				otd->td_tilelength = otd->td_rowsperstrip;
+				otd->td_tilewidth = otd->td_imagewidth;
+			}
+			break;
+		case FIELD_MINSAMPLEVALUE:
+			otd->td_minsamplevalue = itd->td_minsamplevalue;
+			break;
+		case FIELD_MAXSAMPLEVALUE:
+			otd->td_maxsamplevalue = itd->td_maxsamplevalue;
+			break;
+		case FIELD_PLANARCONFIG:
+			otd->td_planarconfig = itd->td_planarconfig;
+			break;
+		case FIELD_RESOLUTIONUNIT:
+			otd->td_resolutionunit = itd->td_resolutionunit;
+			break;
+		case FIELD_PAGENUMBER:
+			otd->td_pagenumber[0] = itd->td_pagenumber[0];
+			otd->td_pagenumber[1] = itd->td_pagenumber[1];
+			break;
+		case FIELD_COLORMAP:
+			if (otd->td_bitspersample != itd->td_bitspersample)
+				goto mismatch;
+			for (i = 0; i < 3; i++)
+				_TIFFsetShortArray(&otd->td_colormap[i],
+				    itd->td_colormap[i],
+				    1U << itd->td_bitspersample);
+			break;
+		case FIELD_EXTRASAMPLES:
+			if (itd->td_extrasamples > otd->td_samplesperpixel)
+				goto mismatch;
+			otd->td_extrasamples = itd->td_extrasamples;
+			_TIFFsetShortArray(&otd->td_sampleinfo,
+			    itd->td_sampleinfo, itd->td_extrasamples);
+			break;
+		case FIELD_SAMPLEFORMAT:
+			if (!TIFFSetField(out, TIFFTAG_SAMPLEFORMAT,
+			    itd->td_sampleformat))
+				status = 0;
+			continue;
+		case FIELD_SMINSAMPLEVALUE:
+			if (otd->td_samplesperpixel != itd->td_samplesperpixel)
+				goto mismatch;
+			_TIFFsetDoubleArray(&otd->td_sminsamplevalue,
+			    itd->td_sminsamplevalue, itd->td_samplesperpixel);
+			break;
+		case FIELD_SMAXSAMPLEVALUE:
+			if (otd->td_samplesperpixel != itd->td_samplesperpixel)
+				goto mismatch;
+			_TIFFsetDoubleArray(&otd->td_smaxsamplevalue,
+			    itd->td_smaxsamplevalue, itd->td_samplesperpixel);
+			break;
+		case FIELD_IMAGEDEPTH:
+			otd->td_imagedepth = itd->td_imagedepth;
+			break;
+		case FIELD_TILEDEPTH:
+			otd->td_tiledepth = itd->td_tiledepth;
+			break;
+		case FIELD_HALFTONEHINTS:
+			otd->td_halftonehints[0] = itd->td_halftonehints[0];
+			otd->td_halftonehints[1] = itd->td_halftonehints[1];
+			break;
+		case FIELD_YCBCRSUBSAMPLING:
+			otd->td_ycbcrsubsampling[0] = itd->td_ycbcrsubsampling[0];
+			otd->td_ycbcrsubsampling[1] = itd->td_ycbcrsubsampling[1];
+			break;
+		case FIELD_YCBCRPOSITIONING:
+			otd->td_ycbcrpositioning = itd->td_ycbcrpositioning;
+			break;
+		case FIELD_REFBLACKWHITE:
+			_TIFFsetFloatArray(&otd->td_refblackwhite,
+			    itd->td_refblackwhite, 6);
+			break;
+		case FIELD_TRANSFERFUNCTION:
+			if (otd->td_bitspersample != itd->td_bitspersample ||
+			    otd->td_samplesperpixel != itd->td_samplesperpixel ||
+			    otd->td_extrasamples != itd->td_extrasamples)
+				goto mismatch;
+			for (i = 0; i < 3; i++)
+				_TIFFsetShortArray(&otd->td_transferfunction[i],
+				    itd->td_transferfunction[i],
+				    1U << itd->td_bitspersample);
+			break;
+		case FIELD_INKNAMES:
+			_TIFFsetNString(&otd->td_inknames, itd->td_inknames,
+			    (uint32_t) itd->td_inknameslen);
+			otd->td_inknameslen = itd->td_inknameslen;
+			break;
+		case FIELD_NDPIMAGNIFICATION:
+			otd->td_ndpimagnification = itd->td_ndpimagnification;
+			break;
+		case FIELD_NDPIZOFFSET:
+			otd->td_ndpizoffset = itd->td_ndpizoffset;
+			break;
+		case FIELD_NDPIUSERGIVENSLIDELABEL:
+			setDirString(out, &otd->td_ndpiusergivenslidelabel,
+			    itd->td_ndpiusergivenslidelabel);
+			break;
+		case FIELD_NDPIBLANKLANES:
+			otd->td_ndpinblanklanes = itd->td_ndpinblanklanes;
+			setDirValue(out, (void**) &otd->td_ndpiblanklanes,
+			    itd->td_ndpiblanklanes,
+			    (tmsize_t) itd->td_ndpinblanklanes,
+			    sizeof (uint32_t));
+			break;
+		case FIELD_NDPICOMMENTS:
+			setDirString(out, &otd->td_ndpicomments,
+			    itd->td_ndpicomments);
+			break;
+		case FIELD_NDPIFLUORESCENCE:
+			setDirString(out, &otd->td_ndpifluorescence,
+			    itd->td_ndpifluorescence);
+			break;
+		default:
+			continue;
+		}
+		TIFFSetFieldBit(out, bit);
+		continue;
+	mismatch:
+		TIFFWarningExt(out->tif_clientdata, module,
+		    "%s: Field %d not copied, BitsPerSample or "
+		    "SamplesPerPixel differ", out->tif_name, bit);
+	}
+
+	/* Those of the codec of in, if out now has the same */
+	if (TIFFFieldSet(out, FIELD_COMPRESSION) &&
+	    otd->td_compression == itd->td_compression) {
+		for (i = 0; i < in->tif_nfields; i++) {
+			const TIFFField* fip = in->tif_fields[i];
+
+			if (fip->field_bit >= FIELD_CODEC &&
+			    FieldSet(fields, fip->field_bit) &&
+			    !isExcludedTag(fip->field_tag, exclude, nexclude) &&
+			    !copyCodecField(in, out, fip))
+				status = 0;
+		}
+	}
+
+	/* The custom values, with a single reallocation */
+	if (itd->td_customValueCount > 0) {
+		tvs = (TIFFTagValue*) _TIFFCheckRealloc(out,
+		    otd->td_customValues,
+		    otd->td_customValueCount + itd->td_customValueCount,
+		    sizeof(TIFFTagValue), "for list of custom values");
+		if (!tvs)
+			return (0);
+		otd->td_customValues = tvs;
+	}
+	ncustom = otd->td_customValueCount;
+	for (k = 0; k < itd->td_customValueCount; k++) {
+		const TIFFTagValue* itv = itd->td_customValues + k;
+		const TIFFField* fip = itv->info;
+		const TIFFField* ofip;
+		TIFFTagValue* otv = NULL;
+		int size, j;
+		void* value;
+
+		if (fip->field_type == TIFF_IFD ||
+		    fip->field_type == TIFF_IFD8 ||
+		    isExcludedTag(fip->field_tag, exclude, nexclude))
+			continue;
+		/*
+		 * Tags unknown to out (read from in as such) are registered.
+		 * The value is kept as in stores it, so a tag out already
+		 * knows must be defined the same way.
+		 */
+		ofip = TIFFFindField(out, fip->field_tag, TIFF_ANY);
+		if (ofip && (ofip->field_type != fip->field_type ||
+		    ofip->field_readcount != fip->field_readcount ||
+		    ofip->field_passcount != fip->field_passcount))
+			ofip = NULL;
+		else if (!ofip)
+			ofip = _TIFFFindOrRegisterField(out, fip->field_tag,
+			    fip->field_type);
+		size = customValueSize(fip);
+		if (!ofip || ofip->field_bit != FIELD_CUSTOM ||
+		    customValueSize(ofip) != size) {
+			TIFFWarningExt(out->tif_clientdata, module,
+			    "%s: Tag \"%s\" not copied", out->tif_name,
+			    fip->field_name);
+			continue;
+		}
+		value = _TIFFCheckMalloc(out, itv->count, size,
+		    "custom tag binary object");
+		if (!value) {
+			status = 0;
+			continue;
+		}
+		_TIFFmemcpy(value, itv->value, (tmsize_t) itv->count * size);
+
+		for (j = 0; j < ncustom; j++) {
+			if (otd->td_customValues[j].info->field_tag ==
+			    fip->field_tag) {
+				otv = otd->td_customValues + j;
+				dirValueFree(otd, otv->value);
+				break;
+			}
+		}
+		if (!otv)
+			otv = otd->td_customValues + otd->td_customValueCount++;
+		otv->info = ofip;
+		otv->count = itv->count;
+		otv->value = value;
+	}
+
+	out->tif_flags |= TIFF_DIRTYDIRECT;
+	return (status);
+}
+
 #define	CleanupField(member) {		\
     if (td->member) {			\
 	_TIFFfree(td->member);		\
@@ -1368,15 +1838,30 @@ TIFFFreeDirectory(TIFF* tif)
 	TIFFClrFieldBit(tif, FIELD_YCBCRSUBSAMPLING);
 	TIFFClrFieldBit(tif, FIELD_YCBCRPOSITIONING);
 
+	dirValueFree(td, td->td_ndpiusergivenslidelabel);
+	td->td_ndpiusergivenslidelabel = NULL;
+	dirValueFree(td, td->td_ndpiblanklanes);
+	td->td_ndpiblanklanes = NULL;
+	td->td_ndpinblanklanes = 0;
+	dirValueFree(td, td->td_ndpicomments);
+	td->td_ndpicomments = NULL;
+	dirValueFree(td, td->td_ndpifluorescence);
+	td->td_ndpifluorescence = NULL;
+
 	/* Cleanup custom tag values */
-	for( i = 0; i < td->td_customValueCount; i++ ) {
-		if (td->td_customValues[i].value)
-			_TIFFfree(td->td_customValues[i].value);
-	}
+	for( i = 0; i < td->td_customValueCount; i++ )
+		dirValueFree(td, td->td_customValues[i].value);
 
 	td->td_customValueCount = 0;
 	CleanupField(td_customValues);
 
+	while (td->td_arena) {
+		TIFFDirArenaBlock* next = td->td_arena->next;
+
+		_TIFFfree(td->td_arena);
+		td->td_arena = next;
+	}
+
         _TIFFmemset( &(td->td_stripoffset_entry), 0, sizeof(TIFFDirEntry));
         _TIFFmemset( &(td->td_stripbytecount_entry), 0, sizeof(TIFFDirEntry));
 }
@@ -1851,6 +2336,8 @@ TIFFUnlinkDirectory(TIFF* tif, uint16_t dirn)
 	 * means that the caller can only append to the directory
 	 * chain.
 	 */
+	tif->tif_lastdiroff = 0;
+	tif->tif_lastprevdiroff = 0;
 	(*tif->tif_cleanup)(tif);
 	if ((tif->tif_flags & TIFF_MYBUFFER) && tif->tif_rawdata) {
 		_TIFFfree(tif->tif_rawdata);
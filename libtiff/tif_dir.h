@@ -38,6 +38,8 @@ typedef struct {
 	void           *value;
 } TIFFTagValue;
 
+typedef struct TIFFDirArenaBlock TIFFDirArenaBlock;	/* see tif_dir.c */
+
 /*
  * TIFF Image File Directories are comprised of a table of field
  * descriptors of the form shown below.  The table is sorted in
@@ -128,6 +130,7 @@ typedef struct {
 
 	int     td_customValueCount;
         TIFFTagValue *td_customValues;
+	TIFFDirArenaBlock* td_arena;	/* values allocated while the directory was read */
 
         unsigned char td_deferstrilearraywriting; /* see TIFFDeferStrileArrayWriting() */
 } TIFFDirectory;
@@ -277,6 +280,7 @@ extern const TIFFFieldArray* _TIFFGetFields(void);
 extern const TIFFFieldArray* _TIFFGetExifFields(void);
 extern const TIFFFieldArray* _TIFFGetGpsFields(void);
 extern void _TIFFSetupFields(TIFF* tif, const TIFFFieldArray* infoarray);
+extern void _TIFFFreeFieldIndex(TIFF* tif);
 extern void _TIFFPrintFieldInfo(TIFF*, FILE*);
 
 extern int _TIFFFillStriles(TIFF*);        
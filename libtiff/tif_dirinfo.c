@@ -447,6 +447,58 @@ _TIFFGetGpsFields(void)
 	return(&gpsFieldArray);
 }
 
+/*
+ * Direct index of tif_fields by tag number, so that TIFFFindField() does
+ * not have to search for each tag: a table of pages of 256 tags, allocated
+ * on demand, pointing to the fields.  It is only kept while it holds all of
+ * tif_fields; tags beyond it, and all tags if it could not be allocated,
+ * are searched for in tif_fields.
+ */
+#define FIELDINDEX_PAGESHIFT	8
+#define FIELDINDEX_PAGESIZE	(1U << FIELDINDEX_PAGESHIFT)
+#define FIELDINDEX_NPAGES	512U
+#define FIELDINDEX_MAXTAG	(FIELDINDEX_NPAGES << FIELDINDEX_PAGESHIFT)
+
+void
+_TIFFFreeFieldIndex(TIFF* tif)
+{
+	uint32_t i;
+
+	if (!tif->tif_fieldindex)
+		return;
+	for (i = 0; i < FIELDINDEX_NPAGES; i++)
+		if (tif->tif_fieldindex[i])
+			_TIFFfree(tif->tif_fieldindex[i]);
+	_TIFFfree(tif->tif_fieldindex);
+	tif->tif_fieldindex = NULL;
+}
+
+/*
+ * Set (or clear, with a NULL fip) the index entry of tag.
+ */
+static void
+_TIFFIndexField(TIFF* tif, uint32_t tag, const TIFFField* fip)
+{
+	const TIFFField** page;
+
+	if (tag >= FIELDINDEX_MAXTAG || !tif->tif_fieldindex)
+		return;
+	page = tif->tif_fieldindex[tag >> FIELDINDEX_PAGESHIFT];
+	if (!page) {
+		if (!fip)
+			return;
+		page = (const TIFFField**) _TIFFCheckMalloc(tif,
+		    FIELDINDEX_PAGESIZE, sizeof(TIFFField*), "for field index");
+		if (!page) {
+			_TIFFFreeFieldIndex(tif);
+			return;
+		}
+		_TIFFmemset(page, 0, FIELDINDEX_PAGESIZE * sizeof(TIFFField*));
+		tif->tif_fieldindex[tag >> FIELDINDEX_PAGESHIFT] = page;
+	}
+	page[tag & (FIELDINDEX_PAGESIZE - 1)] = fip;
+}
+
 void
 _TIFFSetupFields(TIFF* tif, const TIFFFieldArray* fieldarray)
 {
@@ -455,6 +507,7 @@ _TIFFSetupFields(TIFF* tif, const TIFFFieldArray* fieldarray)
 
 		for (i = 0; i < tif->tif_nfields; i++) {
 			TIFFField *fld = tif->tif_fields[i];
+			_TIFFIndexField(tif, fld->field_tag, NULL);
 			if (fld->field_bit == FIELD_CUSTOM &&
 				strncmp("Tag ", fld->field_name, 4) == 0) {
 					_TIFFfree(fld->field_name);
@@ -499,13 +552,55 @@ tagNameCompare(const void* a, const void* b)
 			0 : ((int)tb->field_type - (int)ta->field_type);
 }
 
+/*
+ * Sort tif_fields once fields were added after the first nold ones, which
+ * are sorted.  The new fields usually come in order, and often all after
+ * the others, so they are merged in rather than all sorted again.
+ */
+static void
+_TIFFSortFields(TIFF* tif, uint32_t nold)
+{
+	TIFFField** fields = tif->tif_fields;
+	uint32_t nfields = tif->tif_nfields;
+	uint32_t nnew = nfields - nold;
+	TIFFField** tmp;
+	uint32_t i;
+
+	for (i = nold + 1; i < nfields; i++)
+		if (fields[i - 1]->field_tag > fields[i]->field_tag) {
+			qsort(fields + nold, nnew, sizeof(TIFFField *),
+			      tagCompare);
+			break;
+		}
+	if (nold == 0 || nnew == 0 ||
+	    fields[nold - 1]->field_tag < fields[nold]->field_tag)
+		return;
+
+	tmp = (TIFFField**) _TIFFCheckMalloc(tif, nnew, sizeof(TIFFField *),
+					     "for fields array");
+	if (!tmp) {
+		qsort(fields, nfields, sizeof(TIFFField *), tagCompare);
+		return;
+	}
+	_TIFFmemcpy(tmp, fields + nold, nnew * sizeof(TIFFField *));
+	/* Merge from the end, tags being unique */
+	i = nold;
+	while (nnew > 0) {
+		if (i > 0 && fields[i - 1]->field_tag > tmp[nnew - 1]->field_tag)
+			fields[--nfields] = fields[--i];
+		else
+			fields[--nfields] = tmp[--nnew];
+	}
+	_TIFFfree(tmp);
+}
+
 int
 _TIFFMergeFields(TIFF* tif, const TIFFField info[], uint32_t n)
 {
 	static const char module[] = "_TIFFMergeFields";
 	static const char reason[] = "for fields array";
 	/* TIFFField** tp; */
-	uint32_t i;
+	uint32_t i, nold = tif->tif_nfields;
 
         tif->tif_foundfield = NULL;
 
@@ -518,6 +613,16 @@ _TIFFMergeFields(TIFF* tif, const TIFFField info[], uint32_t n)
 		tif->tif_fields = (TIFFField **)
 			_TIFFCheckMalloc(tif, n, sizeof(TIFFField *),
 					 reason);
+		/* Start the index anew: nothing is left out of it */
+		if (!tif->tif_fieldindex) {
+			tif->tif_fieldindex = (const TIFFField***)
+				_TIFFCheckMalloc(tif, FIELDINDEX_NPAGES,
+						 sizeof(TIFFField**),
+						 "for field index");
+			if (tif->tif_fieldindex)
+				_TIFFmemset(tif->tif_fieldindex, 0,
+				    FIELDINDEX_NPAGES * sizeof(TIFFField**));
+		}
 	}
 	if (!tif->tif_fields) {
 		TIFFErrorExt(tif->tif_clientdata, module,
@@ -533,13 +638,13 @@ _TIFFMergeFields(TIFF* tif, const TIFFField info[], uint32_t n)
                 /* only add definitions that aren't already present */
 		if (!fip) {
                         tif->tif_fields[tif->tif_nfields] = (TIFFField *) (info+i);
+                        _TIFFIndexField(tif, info[i].field_tag, info+i);
                         tif->tif_nfields++;
                 }
 	}
 
         /* Sort the field info by tag number */
-	qsort(tif->tif_fields, tif->tif_nfields,
-	      sizeof(TIFFField *), tagCompare);
+	_TIFFSortFields(tif, nold);
 
 	return n;
 }
@@ -726,6 +831,17 @@ TIFFFindField(TIFF* tif, uint32_t tag, TIFFDataType dt)
 	if (!tif->tif_fields)
 		return NULL;
 
+	if (tag < FIELDINDEX_MAXTAG && tif->tif_fieldindex) {
+		const TIFFField** page =
+		    tif->tif_fieldindex[tag >> FIELDINDEX_PAGESHIFT];
+		const TIFFField* fip =
+		    page ? page[tag & (FIELDINDEX_PAGESIZE - 1)] : NULL;
+
+		if (fip && dt != TIFF_ANY && dt != fip->field_type)
+			fip = NULL;
+		return tif->tif_foundfield = fip;
+	}
+
 	/* NB: use sorted search (e.g. binary search) */
 
 	key.field_tag = tag;
@@ -41,6 +41,11 @@
 
 #define FAILED_FII    ((uint32_t) -1)
 
+/* Bytes read at once at the start of a directory, see TIFFFetchDirectory() */
+#ifndef TIFF_DIRWINDOW_SIZE
+#define TIFF_DIRWINDOW_SIZE 16384
+#endif
+
 #ifdef HAVE_IEEEFP
 # define TIFFCvtIEEEFloatToNative(tif, n, fp)
 # define TIFFCvtIEEEDoubleToNative(tif, n, dp)
@@ -159,6 +164,7 @@ static int CheckDirCount(TIFF*, TIFFDirEntry*, uint32_t);
 static uint64_t NDPIFixOffset(uint32_t dataoff32, uint64_t diroff, int swab);
 static void NDPIFixOffsets(uint64_t * p_dataoff, uint64_t diroff, uint32_t count);
 static uint16_t TIFFFetchDirectory(TIFF* tif, uint64_t diroff, TIFFDirEntry** pdir, uint64_t* nextdiroff);
+static void TIFFFreeDirWindow(TIFF* tif);
 static int TIFFFetchNormalTag(TIFF*, TIFFDirEntry*, int recover);
 static int TIFFFetchStripThing(TIFF* tif, TIFFDirEntry* dir, uint32_t nstrips, uint64_t** lpp);
 static int TIFFFetchSubjectDistance(TIFF*, TIFFDirEntry*);
@@ -773,6 +779,21 @@ static enum TIFFReadDirEntryErr TIFFReadDirEntryIfd8(TIFF* tif, TIFFDirEntry* di
 #define THRESHOLD_MULTIPLIER 10
 #define MAX_THRESHOLD (THRESHOLD_MULTIPLIER * THRESHOLD_MULTIPLIER * THRESHOLD_MULTIPLIER * INITIAL_THRESHOLD)
 
+/*
+ * Where size bytes at offset are among those read along with the directory
+ * (see TIFFFetchDirectory()), or NULL.
+ */
+static const uint8_t*
+TIFFReadDirEntryInWindow(TIFF* tif, uint64_t offset, tmsize_t size)
+{
+	if (!tif->tif_dirwindow || offset < tif->tif_dirwindowoff ||
+	    size > tif->tif_dirwindowsize ||
+	    offset - tif->tif_dirwindowoff >
+	    (uint64_t)(tif->tif_dirwindowsize - size))
+		return NULL;
+	return tif->tif_dirwindow + (offset - tif->tif_dirwindowoff);
+}
+
 static enum TIFFReadDirEntryErr TIFFReadDirEntryDataAndRealloc(
         TIFF* tif, uint64_t offset, tmsize_t size, void** pdest)
 {
@@ -780,9 +801,22 @@ static enum TIFFReadDirEntryErr TIFFReadDirEntryDataAndRealloc(
         tmsize_t threshold = INITIAL_THRESHOLD;
 #endif
         tmsize_t already_read = 0;
+        const uint8_t* src;
 
         assert( !isMapped(tif) );
 
+        src = TIFFReadDirEntryInWindow(tif, offset, size);
+        if (src)
+        {
+            void* new_dest = _TIFFCheckRealloc(tif, *pdest, 1, size,
+                                               "TIFFReadDirEntryArray");
+            if( new_dest == NULL )
+                return TIFFReadDirEntryErrAlloc;
+            *pdest = new_dest;
+            _TIFFmemcpy(*pdest, src, size);
+            return TIFFReadDirEntryErrOk;
+        }
+
         if (!SeekOK(tif,offset))
                 return(TIFFReadDirEntryErrIo);
 
@@ -3395,6 +3429,11 @@ TIFFReadDirEntryData(TIFF* tif, uint64_t offset, tmsize_t size, void* dest)
 {
 	assert(size>0);
 	if (!isMapped(tif)) {
+		const uint8_t* src = TIFFReadDirEntryInWindow(tif, offset, size);
+		if (src) {
+			_TIFFmemcpy(dest, src, size);
+			return(TIFFReadDirEntryErrOk);
+		}
 		if (!SeekOK(tif,offset))
 			return(TIFFReadDirEntryErrIo);
 		if (!ReadOK(tif,dest,size))
@@ -3640,6 +3679,7 @@ TIFFReadDirectory(TIFF* tif)
 	/* free any old stuff and reinit */
 	TIFFFreeDirectory(tif);
 	TIFFDefaultDirectory(tif);
+	tif->tif_flags |= TIFF_DIRARENA;
 	/*
 	 * Electronic Arts writes gray-scale TIFF files
 	 * without a PlanarConfiguration directory entry.
@@ -4273,6 +4313,8 @@ TIFFReadDirectory(TIFF* tif)
 		_TIFFfree(dir);
 		dir=NULL;
 	}
+	TIFFFreeDirWindow(tif);
+	tif->tif_flags &= ~TIFF_DIRARENA;
 	if (!TIFFFieldSet(tif, FIELD_MAXSAMPLEVALUE))
 	{
 		if (tif->tif_dir.td_bitspersample>=16)
@@ -4374,6 +4416,8 @@ TIFFReadDirectory(TIFF* tif)
 bad:
 	if (dir)
 		_TIFFfree(dir);
+	TIFFFreeDirWindow(tif);
+	tif->tif_flags &= ~TIFF_DIRARENA;
 	return (0);
 }
 
@@ -4469,6 +4513,7 @@ TIFFReadCustomDirectory(TIFF* tif, toff_t diroff,
 	}
 	TIFFFreeDirectory(tif);
 	_TIFFmemset(&tif->tif_dir, 0, sizeof(TIFFDirectory));
+	tif->tif_flags |= TIFF_DIRARENA;
 	TIFFReadDirectoryCheckOrder(tif,dir,dircount);
 	for (di=0, dp=dir; di<dircount; di++, dp++)
 	{
@@ -4548,6 +4593,8 @@ TIFFReadCustomDirectory(TIFF* tif, toff_t diroff,
 	}
 	if (dir)
 		_TIFFfree(dir);
+	TIFFFreeDirWindow(tif);
+	tif->tif_flags &= ~TIFF_DIRARENA;
 	return 1;
 }
 
@@ -4780,6 +4827,19 @@ NDPIFixOffset(uint32_t dataoff32, uint64_t diroff, int swab)
 	return(dataoff64);
 }
 
+/*
+ * Forget the bytes read along with a directory, once its entries are read.
+ */
+static void
+TIFFFreeDirWindow(TIFF* tif)
+{
+	if (tif->tif_dirwindow) {
+		_TIFFfree(tif->tif_dirwindow);
+		tif->tif_dirwindow = NULL;
+		tif->tif_dirwindowsize = 0;
+	}
+}
+
 /*
  * Read IFD structure from the specified offset. If the pointer to
  * nextdiroff variable has been specified, read it too. Function returns a
@@ -4804,60 +4864,115 @@ TIFFFetchDirectory(TIFF* tif, uint64_t diroff, TIFFDirEntry** pdir,
 	tif->tif_diroff = diroff;
 	if (nextdiroff)
 		*nextdiroff = 0;
+	TIFFFreeDirWindow(tif);
 	if (!isMapped(tif)) {
+		tmsize_t countsize, got, need, m;
+		uint8_t* w;
+
 		if (!SeekOK(tif, tif->tif_diroff)) {
 			TIFFErrorExt(tif->tif_clientdata, module,
 				"%s: Seek error accessing TIFF directory",
 				tif->tif_name);
 			return 0;
 		}
+		/*
+		 * Read the directory and what follows it in one go: the
+		 * values of its entries are usually there, and
+		 * TIFFReadDirEntryData() takes them from this window
+		 * until the directory is read.
+		 */
+		w = (uint8_t*) _TIFFCheckMalloc(tif, TIFF_DIRWINDOW_SIZE, 1,
+		    "to read TIFF directory");
+		if (w == NULL)
+			return 0;
+		got = TIFFReadFile(tif, w, TIFF_DIRWINDOW_SIZE);
+		if (got < 0)
+			got = 0;
+		tif->tif_dirwindow = w;
+		tif->tif_dirwindowoff = tif->tif_diroff;
+		tif->tif_dirwindowsize = got;
 		if (!(tif->tif_flags&TIFF_BIGTIFF))
 		{
-			if (!ReadOK(tif, &dircount16, sizeof (uint16_t))) {
+			countsize = sizeof (uint16_t);
+			if (got < countsize) {
 				TIFFErrorExt(tif->tif_clientdata, module,
 				    "%s: Can not read TIFF directory count",
 				    tif->tif_name);
+				TIFFFreeDirWindow(tif);
 				return 0;
 			}
+			_TIFFmemcpy(&dircount16, w, sizeof (uint16_t));
 			if (tif->tif_flags & TIFF_SWAB)
 				TIFFSwabShort(&dircount16);
 			if (dircount16>4096)
 			{
 				TIFFErrorExt(tif->tif_clientdata, module,
 				    "Sanity check on directory count failed, this is probably not a valid IFD offset");
+				TIFFFreeDirWindow(tif);
 				return 0;
 			}
 			dirsize = 12;
 		} else {
 			uint64_t dircount64;
-			if (!ReadOK(tif, &dircount64, sizeof (uint64_t))) {
+			countsize = sizeof (uint64_t);
+			if (got < countsize) {
 				TIFFErrorExt(tif->tif_clientdata, module,
 					"%s: Can not read TIFF directory count",
 					tif->tif_name);
+				TIFFFreeDirWindow(tif);
 				return 0;
 			}
+			_TIFFmemcpy(&dircount64, w, sizeof (uint64_t));
 			if (tif->tif_flags & TIFF_SWAB)
 				TIFFSwabLong8(&dircount64);
 			if (dircount64>4096)
 			{
 				TIFFErrorExt(tif->tif_clientdata, module,
 				    "Sanity check on directory count failed, this is probably not a valid IFD offset");
+				TIFFFreeDirWindow(tif);
 				return 0;
 			}
 			dircount16 = (uint16_t)dircount64;
 			dirsize = 20;
 		}
-		origdir = _TIFFCheckMalloc(tif, dircount16,
-		    dirsize, "to read TIFF directory");
-		if (origdir == NULL)
-			return 0;
-		if (!ReadOK(tif, origdir, (tmsize_t)(dircount16*dirsize))) {
+		m = countsize + (tmsize_t)dircount16 * dirsize;
+		need = m + (tif->tif_flags&TIFF_BIGTIFF ?
+		    sizeof (uint64_t) : sizeof (uint32_t));
+		if (need > got && got == TIFF_DIRWINDOW_SIZE) {
+			/*
+			 * A directory larger than the window: read the rest,
+			 * and as much again of what follows.
+			 */
+			tmsize_t rest;
+
+			w = (uint8_t*) _TIFFCheckRealloc(tif, w,
+			    need + TIFF_DIRWINDOW_SIZE, 1,
+			    "to read TIFF directory");
+			if (w == NULL) {
+				TIFFFreeDirWindow(tif);
+				return 0;
+			}
+			tif->tif_dirwindow = w;
+			rest = TIFFReadFile(tif, w + got,
+			    need + TIFF_DIRWINDOW_SIZE - got);
+			if (rest > 0)
+				got += rest;
+			tif->tif_dirwindowsize = got;
+		}
+		if (got < m) {
 			TIFFErrorExt(tif->tif_clientdata, module,
 				"%.100s: Can not read TIFF directory",
 				tif->tif_name);
-			_TIFFfree(origdir);
+			TIFFFreeDirWindow(tif);
+			return 0;
+		}
+		origdir = _TIFFCheckMalloc(tif, dircount16,
+		    dirsize, "to read TIFF directory");
+		if (origdir == NULL) {
+			TIFFFreeDirWindow(tif);
 			return 0;
 		}
+		_TIFFmemcpy(origdir, w + countsize, m - countsize);
 		/*
 		 * Read offset to next directory for sequential scans if
 		 * needed.
@@ -4866,15 +4981,17 @@ TIFFFetchDirectory(TIFF* tif, uint64_t diroff, TIFFDirEntry** pdir,
 		{
 			if (!(tif->tif_flags&TIFF_BIGTIFF))
 			{
-				uint32_t nextdiroff32;
-				if (!ReadOK(tif, &nextdiroff32, sizeof(uint32_t)))
-					nextdiroff32 = 0;
+				uint32_t nextdiroff32 = 0;
+				if (got >= need)
+					_TIFFmemcpy(&nextdiroff32, w + m,
+						    sizeof(uint32_t));
 				if (tif->tif_flags&TIFF_SWAB)
 					TIFFSwabLong(&nextdiroff32);
 				*nextdiroff=nextdiroff32;
 			} else {
-				if (!ReadOK(tif, nextdiroff, sizeof(uint64_t)))
-					*nextdiroff = 0;
+				if (got >= need)
+					_TIFFmemcpy(nextdiroff, w + m,
+						    sizeof(uint64_t));
 				if (tif->tif_flags&TIFF_SWAB)
 					TIFFSwabLong8(nextdiroff);
 			}
@@ -4999,6 +5116,7 @@ TIFFFetchDirectory(TIFF* tif, uint64_t diroff, TIFFDirEntry** pdir,
 	if (dir==0)
 	{
 		_TIFFfree(origdir);
+		TIFFFreeDirWindow(tif);
 		return 0;
 	}
 	ma=(uint8_t*)origdir;
@@ -5020,8 +5138,15 @@ TIFFFetchDirectory(TIFF* tif, uint64_t diroff, TIFFDirEntry** pdir,
 				TIFFSwabLong((uint32_t*)ma);
 			mb->tdir_count=(uint64_t)(*(uint32_t*)ma);
 			ma+=sizeof(uint32_t);
-			mb->tdir_offset.toff_long8=
-			    NDPIFixOffset(*(uint32_t*)ma, diroff, tif->tif_flags&TIFF_SWAB);
+			/* Values that fit in the entry keep their file byte order */
+			if (mb->tdir_count * TIFFDataWidth((TIFFDataType) mb->tdir_type) <= 4)
+			{
+				mb->tdir_offset.toff_long8=0;
+				_TIFFmemcpy(&mb->tdir_offset,ma,sizeof(uint32_t));
+			}
+			else
+				mb->tdir_offset.toff_long8=
+				    NDPIFixOffset(*(uint32_t*)ma, diroff, tif->tif_flags&TIFF_SWAB);
 			ma+=sizeof(uint32_t);
 		}
 		else
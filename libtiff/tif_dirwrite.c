@@ -30,6 +30,7 @@
 #include "tiffiop.h"
 #include <float.h>		/*--: for Rational2Double */
 #include <math.h>		/*--: for Rational2Double */
+#include <stdlib.h>
 
 #ifdef HAVE_IEEEFP
 #define TIFFCvtNativeToIEEEFloat(tif, n, fp)
@@ -183,6 +184,10 @@ static int TIFFWriteDirectoryTagCheckedIfd8Array(TIFF* tif, uint32_t* ndir, TIFF
 static int TIFFWriteDirectoryTagData(TIFF* tif, uint32_t* ndir, TIFFDirEntry* dir, uint16_t tag, uint16_t datatype, uint32_t count, uint32_t datalength, void* data);
 
 static int TIFFLinkDirectory(TIFF*);
+static int TIFFFetchDirectoryLink(TIFF*, uint64_t, uint64_t*, uint64_t*);
+static int TIFFWriteDirectoryLink(TIFF*, uint64_t, uint64_t);
+static int TIFFUnlinkDirectoryForRewrite(TIFF*);
+static uint64_t TIFFDirectoryFootprintEnd(TIFF*);
 
 /*
  * Write the contents of the current directory
@@ -267,23 +272,53 @@ TIFFWriteCustomDirectory(TIFF* tif, uint64_t* pdiroff)
 
 /*
  * Similar to TIFFWriteDirectory(), but if the directory has already
- * been written once, it is relocated to the end of the file, in case it
- * has changed in size.  Note that this will result in the loss of the
+ * been written once, it is rewritten where it is if it still fits in the
+ * room its old version and the tag data following it took up (or if
+ * nothing follows them in the file), and relocated to the end of the
+ * file otherwise.  Note that relocation will result in the loss of the
  * previously used directory space. 
  */ 
 int
 TIFFRewriteDirectory( TIFF *tif )
 {
-	static const char module[] = "TIFFRewriteDirectory";
+	int rc;
 
 	/* We don't need to do anything special if it hasn't been written. */
 	if( tif->tif_diroff == 0 )
 		return TIFFWriteDirectory( tif );
 
 	/*
-	 * Find and zero the pointer to this directory, so that TIFFLinkDirectory
-	 * will cause it to be added after this directories current pre-link.
+	 * Directories with SubIFDs are always relocated, as writing them
+	 * also sets up the writing of the SubIFDs.
+	 */
+	if( tif->tif_dir.td_nsubifd != 0 )
+	{
+		if( !TIFFUnlinkDirectoryForRewrite(tif) )
+			return (0);
+		return TIFFWriteDirectory( tif );
+	}
+
+	/*
+	 * TIFFWriteDirectorySec() decides between both once pending image
+	 * data has been written out, as that can change the end of the file.
 	 */
+	tif->tif_flags |= TIFF_REWRITEINPLACE;
+	rc = TIFFWriteDirectory( tif );
+	tif->tif_flags &= ~TIFF_REWRITEINPLACE;
+	tif->tif_rewritelimit = 0;
+	return rc;
+}
+
+/*
+ * Find and zero the pointer to the current directory, so that
+ * TIFFLinkDirectory will cause it to be added after this directories
+ * current pre-link.
+ */
+static int
+TIFFUnlinkDirectoryForRewrite(TIFF* tif)
+{
+	static const char module[] = "TIFFRewriteDirectory";
+	uint64_t nextdir = 0, nextnextdir, linkoff;
 
 	if (!(tif->tif_flags&TIFF_BIGTIFF))
 	{
@@ -301,47 +336,7 @@ TIFFRewriteDirectory( TIFF *tif )
 			}
 		}
 		else
-		{
-			uint32_t nextdir;
 			nextdir = tif->tif_header.classic.tiff_diroff;
-			while(1) {
-				uint16_t dircount;
-				uint32_t nextnextdir;
-
-				if (!SeekOK(tif, nextdir) ||
-				    !ReadOK(tif, &dircount, 2)) {
-					TIFFErrorExt(tif->tif_clientdata, module,
-					     "Error fetching directory count");
-					return (0);
-				}
-				if (tif->tif_flags & TIFF_SWAB)
-					TIFFSwabShort(&dircount);
-				(void) TIFFSeekFile(tif,
-				    nextdir+2+dircount*12, SEEK_SET);
-				if (!ReadOK(tif, &nextnextdir, 4)) {
-					TIFFErrorExt(tif->tif_clientdata, module,
-					     "Error fetching directory link");
-					return (0);
-				}
-				if (tif->tif_flags & TIFF_SWAB)
-					TIFFSwabLong(&nextnextdir);
-				if (nextnextdir==tif->tif_diroff)
-				{
-					uint32_t m;
-					m=0;
-					(void) TIFFSeekFile(tif,
-					    nextdir+2+dircount*12, SEEK_SET);
-					if (!WriteOK(tif, &m, 4)) {
-						TIFFErrorExt(tif->tif_clientdata, module,
-						     "Error writing directory link");
-						return (0);
-					}
-					tif->tif_diroff=0;
-					break;
-				}
-				nextdir=nextnextdir;
-			}
-		}
 	}
 	else
 	{
@@ -359,62 +354,393 @@ TIFFRewriteDirectory( TIFF *tif )
 			}
 		}
 		else
-		{
-			uint64_t nextdir;
 			nextdir = tif->tif_header.big.tiff_diroff;
-			while(1) {
-				uint64_t dircount64;
-				uint16_t dircount;
-				uint64_t nextnextdir;
-
-				if (!SeekOK(tif, nextdir) ||
-				    !ReadOK(tif, &dircount64, 8)) {
-					TIFFErrorExt(tif->tif_clientdata, module,
-					     "Error fetching directory count");
-					return (0);
-				}
-				if (tif->tif_flags & TIFF_SWAB)
-					TIFFSwabLong8(&dircount64);
-				if (dircount64>0xFFFF)
-				{
-					TIFFErrorExt(tif->tif_clientdata, module,
-					     "Sanity check on tag count failed, likely corrupt TIFF");
-					return (0);
-				}
-				dircount=(uint16_t)dircount64;
-				(void) TIFFSeekFile(tif,
-				    nextdir+8+dircount*20, SEEK_SET);
-				if (!ReadOK(tif, &nextnextdir, 8)) {
-					TIFFErrorExt(tif->tif_clientdata, module,
-					     "Error fetching directory link");
-					return (0);
-				}
-				if (tif->tif_flags & TIFF_SWAB)
-					TIFFSwabLong8(&nextnextdir);
-				if (nextnextdir==tif->tif_diroff)
-				{
-					uint64_t m;
-					m=0;
-					(void) TIFFSeekFile(tif,
-					    nextdir+8+dircount*20, SEEK_SET);
-					if (!WriteOK(tif, &m, 8)) {
-						TIFFErrorExt(tif->tif_clientdata, module,
-						     "Error writing directory link");
-						return (0);
-					}
-					tif->tif_diroff=0;
-					break;
-				}
-				nextdir=nextnextdir;
+	}
+
+	if (tif->tif_diroff == 0)
+	{
+		/* The chain is now empty */
+		tif->tif_lastdiroff = 0;
+		tif->tif_lastprevdiroff = 0;
+	}
+	else
+	{
+		/*
+		 * Rewriting the last directory linked through this handle,
+		 * the usual case, needs no search: the directory linked to
+		 * it is known.
+		 */
+		if (tif->tif_diroff == tif->tif_lastdiroff &&
+		    tif->tif_lastprevdiroff != 0 &&
+		    TIFFFetchDirectoryLink(tif, tif->tif_lastprevdiroff,
+					   &linkoff, &nextnextdir) &&
+		    nextnextdir == tif->tif_diroff)
+			nextdir = tif->tif_lastprevdiroff;
+		while (1) {
+			if (!TIFFFetchDirectoryLink(tif, nextdir, &linkoff,
+						    &nextnextdir))
+				return (0);
+			if (nextnextdir == tif->tif_diroff)
+				break;
+			if (nextnextdir == 0) {
+				TIFFErrorExt(tif->tif_clientdata, module,
+				    "Directory to rewrite not found in the chain");
+				return (0);
 			}
+			nextdir = nextnextdir;
 		}
+		if (!TIFFWriteDirectoryLink(tif, linkoff, 0))
+			return (0);
+		tif->tif_diroff = 0;
+		/* The directory it was linked to is now the last one */
+		tif->tif_lastdiroff = nextdir;
+		tif->tif_lastprevdiroff = 0;
 	}
+	return (1);
+}
 
-	/*
-	 * Now use TIFFWriteDirectory() normally.
-	 */
+typedef struct {
+	uint64_t offset;
+	uint64_t length;
+} TIFFDirDataRange;
+
+static int
+TIFFCompareDirDataRanges(const void* a, const void* b)
+{
+	const TIFFDirDataRange* ra = (const TIFFDirDataRange*) a;
+	const TIFFDirDataRange* rb = (const TIFFDirDataRange*) b;
+
+	if (ra->offset != rb->offset)
+		return ra->offset < rb->offset ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Read the directory at diroff.  Set *dirend to the end of the directory
+ * itself and *nextdiroff to the offset of the next one, append to *ranges
+ * the tag data stored out of its entries, and to *subdirs the offsets of
+ * the directories its entries point to (SubIFD, EXIF IFD...).  Return 0 if
+ * the directory can't be read, or if it points to directories through an
+ * array stored out of the entries, which is not followed.
+ */
+static int
+TIFFReadDirDataRanges(TIFF* tif, uint64_t diroff, uint64_t* dirend,
+    uint64_t* nextdiroff, TIFFDirDataRange** ranges, uint32_t* nranges,
+    uint64_t** subdirs, uint32_t* nsubdirs)
+{
+	int bigtiff = (tif->tif_flags & TIFF_BIGTIFF) != 0;
+	tmsize_t entrysize = bigtiff ? 20 : 12;
+	uint64_t inlinesize = bigtiff ? 8 : 4;
+	uint64_t dircount;
+	uint8_t* entries = NULL;
+	void* p;
+	uint32_t i;
+	int ok = 0;
+
+	if (!SeekOK(tif, diroff))
+		return (0);
+	if (!bigtiff) {
+		uint16_t dircount16;
+
+		if (!ReadOK(tif, &dircount16, 2))
+			return (0);
+		if (tif->tif_flags & TIFF_SWAB)
+			TIFFSwabShort(&dircount16);
+		dircount = dircount16;
+		*dirend = diroff + 2 + dircount * 12 + 4;
+	} else {
+		if (!ReadOK(tif, &dircount, 8))
+			return (0);
+		if (tif->tif_flags & TIFF_SWAB)
+			TIFFSwabLong8(&dircount);
+		if (dircount > 0xFFFF)
+			return (0);
+		*dirend = diroff + 8 + dircount * 20 + 8;
+	}
+	if (dircount == 0)
+		return (0);
+	entries = (uint8_t*) _TIFFCheckMalloc(tif, (tmsize_t) dircount + 1,
+	    entrysize, "for directory entries");
+	if (entries == NULL ||
+	    !ReadOK(tif, entries, (tmsize_t) dircount * entrysize +
+	    (tmsize_t) inlinesize))
+		goto done;
+	/* The next directory offset follows the entries */
+	if (!bigtiff) {
+		uint32_t next32;
+
+		_TIFFmemcpy(&next32, entries + dircount * entrysize, 4);
+		if (tif->tif_flags & TIFF_SWAB)
+			TIFFSwabLong(&next32);
+		*nextdiroff = next32;
+	} else {
+		_TIFFmemcpy(nextdiroff, entries + dircount * entrysize, 8);
+		if (tif->tif_flags & TIFF_SWAB)
+			TIFFSwabLong8(nextdiroff);
+	}
+	p = _TIFFCheckRealloc(tif, *ranges, (tmsize_t) (*nranges + dircount),
+	    sizeof(TIFFDirDataRange), "for directory data ranges");
+	if (p == NULL)
+		goto done;
+	*ranges = (TIFFDirDataRange*) p;
+	/* Up to two per entry, and room for the caller to add one */
+	p = _TIFFCheckRealloc(tif, *subdirs,
+	    (tmsize_t) (*nsubdirs + dircount * 2 + 1), sizeof(uint64_t),
+	    "for directory offsets");
+	if (p == NULL)
+		goto done;
+	*subdirs = (uint64_t*) p;
+	for (i = 0; i < dircount; i++) {
+		const uint8_t* entry = entries + i * entrysize;
+		uint16_t tag, type;
+		uint64_t count, offset;
+		int width;
+
+		_TIFFmemcpy(&tag, entry, 2);
+		_TIFFmemcpy(&type, entry + 2, 2);
+		if (tif->tif_flags & TIFF_SWAB) {
+			TIFFSwabShort(&tag);
+			TIFFSwabShort(&type);
+		}
+		if (!bigtiff) {
+			uint32_t count32, offset32;
+
+			_TIFFmemcpy(&count32, entry + 4, 4);
+			_TIFFmemcpy(&offset32, entry + 8, 4);
+			if (tif->tif_flags & TIFF_SWAB) {
+				TIFFSwabLong(&count32);
+				TIFFSwabLong(&offset32);
+			}
+			count = count32;
+			offset = offset32;
+		} else {
+			_TIFFmemcpy(&count, entry + 4, 8);
+			_TIFFmemcpy(&offset, entry + 12, 8);
+			if (tif->tif_flags & TIFF_SWAB) {
+				TIFFSwabLong8(&count);
+				TIFFSwabLong8(&offset);
+			}
+		}
+		width = TIFFDataWidth((TIFFDataType) type);
+		if (width == 0 || count > (~(uint64_t) 0) / (uint64_t) width)
+			continue;
+		if (type == TIFF_IFD || type == TIFF_IFD8 ||
+		    tag == TIFFTAG_SUBIFD || tag == TIFFTAG_EXIFIFD ||
+		    tag == TIFFTAG_GPSIFD ||
+		    tag == TIFFTAG_INTEROPERABILITYIFD) {
+			uint32_t v32;
+
+			if (count * width > inlinesize)
+				goto done;
+			/* One or two offsets, in the entry */
+			if (width == 8 && count == 1)
+				(*subdirs)[(*nsubdirs)++] = offset;
+			else if (width == 4)
+				for (v32 = 0; v32 < count; v32++) {
+					uint32_t o;
+
+					_TIFFmemcpy(&o, entry + (bigtiff ? 12 : 8) +
+					    v32 * 4, 4);
+					if (tif->tif_flags & TIFF_SWAB)
+						TIFFSwabLong(&o);
+					(*subdirs)[(*nsubdirs)++] = o;
+				}
+			continue;
+		}
+		if (count * width <= inlinesize)
+			continue;
+		(*ranges)[*nranges].offset = offset;
+		(*ranges)[*nranges].length = count * width;
+		(*nranges)++;
+	}
+	ok = 1;
+
+done:
+	_TIFFfree(entries);
+	return (ok);
+}
+
+#define TIFF_FOOTPRINT_MAXDIRS 65536
+
+static int
+TIFFCompareDirExtents(const void* a, const void* b)
+{
+	const TIFFDirExtent* ea = (const TIFFDirExtent*) a;
+	const TIFFDirExtent* eb = (const TIFFDirExtent*) b;
+
+	if (ea->offset != eb->offset)
+		return ea->offset < eb->offset ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Record in tif_dirextents the parts of the file that the directories take
+ * up: each directory and its tag data stored out of the entries.  The
+ * directories are found from the file header, along the chain and through
+ * the SubIFD, EXIF and similar entries.  A file that can't be walked this
+ * way is recorded as a single part, of no directory, covering it all.
+ *
+ * This is done once per open file.  Directories written afterwards go to
+ * the end of the file, or within a room no other directory uses, so the
+ * parts recorded still tell whether a room is shared.
+ */
+static int
+TIFFReadDirExtents(TIFF* tif)
+{
+	TIFFDirDataRange* ranges = NULL;
+	TIFFDirExtent* extents = NULL;
+	uint64_t* pending = NULL;
+	uint64_t* visited = NULL;
+	uint32_t npending = 0, nvisited = 0, nextents = 0, nranges, i;
+	int walked = 1, ok = 0;
+	void* p;
+
+	pending = (uint64_t*) _TIFFCheckMalloc(tif, 1, sizeof(uint64_t),
+	    "for directory offsets");
+	visited = (uint64_t*) _TIFFCheckMalloc(tif, TIFF_FOOTPRINT_MAXDIRS,
+	    sizeof(uint64_t), "for directory offsets");
+	if (pending == NULL || visited == NULL)
+		goto done;
+	pending[npending++] = (tif->tif_flags & TIFF_BIGTIFF) ?
+	    tif->tif_header.big.tiff_diroff :
+	    tif->tif_header.classic.tiff_diroff;
+	while (npending > 0) {
+		uint64_t diroff = pending[--npending], dirend, next = 0;
+
+		if (diroff == 0)
+			continue;
+		for (i = 0; i < nvisited && visited[i] != diroff; i++)
+			;
+		if (i < nvisited)
+			continue;
+		nranges = 0;
+		if (nvisited == TIFF_FOOTPRINT_MAXDIRS ||
+		    !TIFFReadDirDataRanges(tif, diroff, &dirend, &next,
+		    &ranges, &nranges, &pending, &npending)) {
+			walked = 0;
+			break;
+		}
+		visited[nvisited++] = diroff;
+		pending[npending++] = next;
+		p = _TIFFCheckRealloc(tif, extents,
+		    (tmsize_t) nextents + nranges + 1, sizeof(TIFFDirExtent),
+		    "for directory extents");
+		if (p == NULL)
+			goto done;
+		extents = (TIFFDirExtent*) p;
+		extents[nextents].offset = diroff;
+		extents[nextents].end = dirend;
+		extents[nextents++].diroff = diroff;
+		for (i = 0; i < nranges; i++) {
+			extents[nextents].offset = ranges[i].offset;
+			extents[nextents].end = ranges[i].offset + ranges[i].length;
+			extents[nextents++].diroff = diroff;
+		}
+	}
+	if (!walked || nextents == 0) {
+		p = _TIFFCheckRealloc(tif, extents, 1, sizeof(TIFFDirExtent),
+		    "for directory extents");
+		if (p == NULL)
+			goto done;
+		extents = (TIFFDirExtent*) p;
+		extents[0].offset = 0;
+		extents[0].end = ~(uint64_t) 0;
+		extents[0].diroff = 0;
+		nextents = 1;
+	}
+	qsort(extents, nextents, sizeof(TIFFDirExtent), TIFFCompareDirExtents);
+	for (i = 0; i < nextents; i++)
+		extents[i].maxend = (i > 0 && extents[i-1].maxend > extents[i].end) ?
+		    extents[i-1].maxend : extents[i].end;
+	tif->tif_dirextents = extents;
+	tif->tif_ndirextents = nextents;
+	extents = NULL;
+	ok = 1;
+
+done:
+	_TIFFfree(ranges);
+	_TIFFfree(extents);
+	_TIFFfree(pending);
+	_TIFFfree(visited);
+	return (ok);
+}
 
-	return TIFFWriteDirectory( tif );
+/*
+ * Tell whether a directory of the file other than the current one, or the
+ * tag data of one, lies in [start,end).
+ */
+static int
+TIFFDirectoryRoomShared(TIFF* tif, uint64_t start, uint64_t end)
+{
+	const TIFFDirExtent* extents;
+	uint32_t lo = 0, hi;
+
+	if (tif->tif_dirextents == NULL && !TIFFReadDirExtents(tif))
+		return (1);
+	extents = tif->tif_dirextents;
+	/* Past the parts that start before end... */
+	hi = tif->tif_ndirextents;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (extents[mid].offset < end)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	/* ...then back over those that may end after start */
+	while (lo > 0 && extents[lo-1].maxend > start) {
+		lo--;
+		if (extents[lo].end > start &&
+		    extents[lo].diroff != tif->tif_diroff)
+			return (1);
+	}
+	return (0);
+}
+
+/*
+ * Return the end of the room the current directory takes up in the file:
+ * the directory itself, then the tag data that follows it without a gap,
+ * as TIFFWriteDirectorySec() lays them out.  Return ~0 if nothing else
+ * follows in the file, so that the directory can grow where it is, and 0
+ * if the directory can't be read or if another directory of the file
+ * refers to part of that room, which then can't be reused.
+ */
+static uint64_t
+TIFFDirectoryFootprintEnd(TIFF* tif)
+{
+	TIFFDirDataRange* ranges = NULL;
+	uint64_t* subdirs = NULL;
+	uint64_t end, next, filesize;
+	uint32_t nranges = 0, nsubdirs = 0, i;
+
+	if (!TIFFReadDirDataRanges(tif, tif->tif_diroff, &end, &next,
+	    &ranges, &nranges, &subdirs, &nsubdirs)) {
+		end = 0;
+		goto done;
+	}
+	qsort(ranges, nranges, sizeof(TIFFDirDataRange),
+	    TIFFCompareDirDataRanges);
+	for (i = 0; i < nranges; i++) {
+		/* Data is written on word boundaries */
+		if (ranges[i].offset < tif->tif_diroff ||
+		    ranges[i].offset > end + (end & 1))
+			continue;
+		if (ranges[i].offset + ranges[i].length > end)
+			end = ranges[i].offset + ranges[i].length;
+	}
+	if (TIFFDirectoryRoomShared(tif, tif->tif_diroff, end)) {
+		end = 0;
+		goto done;
+	}
+	filesize = TIFFGetFileSize(tif);
+	if (end + (end & 1) >= filesize)
+		end = ~(uint64_t) 0;
+
+done:
+	_TIFFfree(ranges);
+	_TIFFfree(subdirs);
+	return (end);
 }
 
 static int
@@ -477,6 +803,16 @@ TIFFWriteDirectorySec(TIFF* tif, int isimage, int imagedone, uint64_t* pdiroff)
 		}
 		tif->tif_flags &= ~(TIFF_BEENWRITING|TIFF_BUFFERSETUP);
 	}
+	/*
+	 * Write out what the write-behind buffer holds, so that an error
+	 * doing so fails the directory write before any offset is taken.
+	 */
+	if (!_TIFFSyncWriteBuffer(tif))
+	{
+		TIFFErrorExt(tif->tif_clientdata, module,
+		    "Error flushing data before directory write");
+		return (0);
+	}
 	dir=NULL;
 	dirmem=NULL;
 	dirsize=0;
@@ -869,21 +1205,49 @@ TIFFWriteDirectorySec(TIFF* tif, int isimage, int imagedone, uint64_t* pdiroff)
 					break;
 			}
 		}
-		if (dir!=NULL)
-			break;
-		dir=_TIFFmalloc(ndir*sizeof(TIFFDirEntry));
-		if (dir==NULL)
+		if (dir!=NULL && tif->tif_rewritelimit!=0)
 		{
-			TIFFErrorExt(tif->tif_clientdata,module,"Out of memory");
-			goto bad;
+			/*
+			 * Sizing pass of a directory being rewritten done: keep
+			 * it where it is if it still fits there, and write it for
+			 * good after the end of the directory chain otherwise.
+			 */
+			if (!(tif->tif_flags&TIFF_REWRITEINPLACE)||
+			    (tif->tif_diroff+dirsize>tif->tif_rewritelimit))
+			{
+				if (!TIFFUnlinkDirectoryForRewrite(tif)||
+				    !TIFFLinkDirectory(tif))
+					goto bad;
+			}
+			tif->tif_rewritelimit=0;
 		}
-		if (isimage)
+		else if (dir!=NULL)
+			break;
+		else
 		{
-			if ((tif->tif_diroff==0)&&(!TIFFLinkDirectory(tif)))
+			dir=_TIFFmalloc(ndir*sizeof(TIFFDirEntry));
+			if (dir==NULL)
+			{
+				TIFFErrorExt(tif->tif_clientdata,module,"Out of memory");
 				goto bad;
+			}
+			if (isimage)
+			{
+				if ((tif->tif_diroff!=0)&&(tif->tif_flags&TIFF_REWRITEINPLACE))
+				{
+					/* Size it first if it has a room to fit in */
+					tif->tif_rewritelimit=TIFFDirectoryFootprintEnd(tif);
+					if ((tif->tif_rewritelimit==0)&&
+					    !TIFFUnlinkDirectoryForRewrite(tif))
+						goto bad;
+				}
+				if ((tif->tif_diroff==0)&&(!TIFFLinkDirectory(tif)))
+					goto bad;
+				tif->tif_curdir++;
+			}
+			else
+				tif->tif_diroff=(TIFFSeekFile(tif,0,SEEK_END)+1)&(~((toff_t)1));
 		}
-		else
-			tif->tif_diroff=(TIFFSeekFile(tif,0,SEEK_END)+1)&(~((toff_t)1));
 		if (pdiroff!=NULL)
 			*pdiroff=tif->tif_diroff;
 		if (!(tif->tif_flags&TIFF_BIGTIFF))
@@ -900,8 +1264,6 @@ TIFFWriteDirectorySec(TIFF* tif, int isimage, int imagedone, uint64_t* pdiroff)
 		}
 		if (tif->tif_dataoff&1)
 			tif->tif_dataoff++;
-		if (isimage)
-			tif->tif_curdir++;
 	}
 	if (isimage)
 	{
@@ -1028,6 +1390,7 @@ TIFFWriteDirectorySec(TIFF* tif, int isimage, int imagedone, uint64_t* pdiroff)
 	}
 	return(1);
 bad:
+	tif->tif_rewritelimit=0;
 	if (dir!=NULL)
 		_TIFFfree(dir);
 	if (dirmem!=NULL)
@@ -3053,16 +3416,25 @@ TIFFWriteDirectoryTagData(TIFF* tif, uint32_t* ndir, TIFFDirEntry* dir, uint16_t
 			TIFFErrorExt(tif->tif_clientdata,module,"Maximum TIFF file size exceeded");
 			return(0);
 		}
-		if (!SeekOK(tif,na))
+		if (tif->tif_rewritelimit!=0)
 		{
-			TIFFErrorExt(tif->tif_clientdata,module,"IO error writing tag data");
-			return(0);
+			/* Sizing a directory to rewrite: only check it fits */
+			if (nb>tif->tif_rewritelimit)
+				tif->tif_flags&=~TIFF_REWRITEINPLACE;
 		}
-		assert(datalength<0x80000000UL);
-		if (!WriteOK(tif,data,(tmsize_t)datalength))
+		else
 		{
-			TIFFErrorExt(tif->tif_clientdata,module,"IO error writing tag data");
-			return(0);
+			if (!SeekOK(tif,na))
+			{
+				TIFFErrorExt(tif->tif_clientdata,module,"IO error writing tag data");
+				return(0);
+			}
+			assert(datalength<0x80000000UL);
+			if (!WriteOK(tif,data,(tmsize_t)datalength))
+			{
+				TIFFErrorExt(tif->tif_clientdata,module,"IO error writing tag data");
+				return(0);
+			}
 		}
 		tif->tif_dataoff=nb;
 		if (tif->tif_dataoff&1)
@@ -3086,6 +3458,101 @@ TIFFWriteDirectoryTagData(TIFF* tif, uint32_t* ndir, TIFFDirEntry* dir, uint16_t
 	return(1);
 }
 
+/*
+ * Find where the link to the next directory of the directory at diroff is
+ * stored (*linkoff), and read it (*nextdiroff).
+ */
+static int
+TIFFFetchDirectoryLink(TIFF* tif, uint64_t diroff, uint64_t* linkoff,
+		       uint64_t* nextdiroff)
+{
+	static const char module[] = "TIFFFetchDirectoryLink";
+
+	if (!(tif->tif_flags&TIFF_BIGTIFF))
+	{
+		uint16_t dircount;
+		uint32_t nextdir;
+
+		if (!SeekOK(tif, diroff) ||
+		    !ReadOK(tif, &dircount, 2)) {
+			TIFFErrorExt(tif->tif_clientdata, module,
+				     "Error fetching directory count");
+			return (0);
+		}
+		if (tif->tif_flags & TIFF_SWAB)
+			TIFFSwabShort(&dircount);
+		*linkoff = diroff+2+dircount*12;
+		(void) TIFFSeekFile(tif, *linkoff, SEEK_SET);
+		if (!ReadOK(tif, &nextdir, 4)) {
+			TIFFErrorExt(tif->tif_clientdata, module,
+				     "Error fetching directory link");
+			return (0);
+		}
+		if (tif->tif_flags & TIFF_SWAB)
+			TIFFSwabLong(&nextdir);
+		*nextdiroff = nextdir;
+	}
+	else
+	{
+		uint64_t dircount64;
+
+		if (!SeekOK(tif, diroff) ||
+		    !ReadOK(tif, &dircount64, 8)) {
+			TIFFErrorExt(tif->tif_clientdata, module,
+				     "Error fetching directory count");
+			return (0);
+		}
+		if (tif->tif_flags & TIFF_SWAB)
+			TIFFSwabLong8(&dircount64);
+		if (dircount64>0xFFFF)
+		{
+			TIFFErrorExt(tif->tif_clientdata, module,
+				     "Sanity check on tag count failed, likely corrupt TIFF");
+			return (0);
+		}
+		*linkoff = diroff+8+dircount64*20;
+		(void) TIFFSeekFile(tif, *linkoff, SEEK_SET);
+		if (!ReadOK(tif, nextdiroff, 8)) {
+			TIFFErrorExt(tif->tif_clientdata, module,
+				     "Error fetching directory link");
+			return (0);
+		}
+		if (tif->tif_flags & TIFF_SWAB)
+			TIFFSwabLong8(nextdiroff);
+	}
+	return (1);
+}
+
+/*
+ * Store nextdiroff as the link to the next directory at linkoff.
+ */
+static int
+TIFFWriteDirectoryLink(TIFF* tif, uint64_t linkoff, uint64_t nextdiroff)
+{
+	static const char module[] = "TIFFWriteDirectoryLink";
+	int ok;
+
+	(void) TIFFSeekFile(tif, linkoff, SEEK_SET);
+	if (!(tif->tif_flags&TIFF_BIGTIFF))
+	{
+		uint32_t m = (uint32_t) nextdiroff;
+		if (tif->tif_flags & TIFF_SWAB)
+			TIFFSwabLong(&m);
+		ok = WriteOK(tif, &m, 4);
+	}
+	else
+	{
+		uint64_t m = nextdiroff;
+		if (tif->tif_flags & TIFF_SWAB)
+			TIFFSwabLong8(&m);
+		ok = WriteOK(tif, &m, 8);
+	}
+	if (!ok)
+		TIFFErrorExt(tif->tif_clientdata, module,
+			     "Error writing directory link");
+	return (ok);
+}
+
 /*
  * Link the current directory into the directory chain for the file.
  */
@@ -3093,6 +3560,7 @@ static int
 TIFFLinkDirectory(TIFF* tif)
 {
 	static const char module[] = "TIFFLinkDirectory";
+	uint64_t nextdir, nextnextdir, linkoff;
 
 	tif->tif_diroff = (TIFFSeekFile(tif,0,SEEK_END)+1) & (~((toff_t)1));
 
@@ -3151,12 +3619,11 @@ TIFFLinkDirectory(TIFF* tif)
 
 	if (!(tif->tif_flags&TIFF_BIGTIFF))
 	{
-		uint32_t m;
-		uint32_t nextdir;
-		m = (uint32_t)(tif->tif_diroff);
-		if (tif->tif_flags & TIFF_SWAB)
-			TIFFSwabLong(&m);
 		if (tif->tif_header.classic.tiff_diroff == 0) {
+			uint32_t m;
+			m = (uint32_t)(tif->tif_diroff);
+			if (tif->tif_flags & TIFF_SWAB)
+				TIFFSwabLong(&m);
 			/*
 			 * First directory, overwrite offset in header.
 			 */
@@ -3167,55 +3634,19 @@ TIFFLinkDirectory(TIFF* tif)
 					     "Error writing TIFF header");
 				return (0);
 			}
+			tif->tif_lastdiroff = tif->tif_diroff;
+			tif->tif_lastprevdiroff = 0;
 			return (1);
 		}
-		/*
-		 * Not the first directory, search to the last and append.
-		 */
 		nextdir = tif->tif_header.classic.tiff_diroff;
-		while(1) {
-			uint16_t dircount;
-			uint32_t nextnextdir;
-
-			if (!SeekOK(tif, nextdir) ||
-			    !ReadOK(tif, &dircount, 2)) {
-				TIFFErrorExt(tif->tif_clientdata, module,
-					     "Error fetching directory count");
-				return (0);
-			}
-			if (tif->tif_flags & TIFF_SWAB)
-				TIFFSwabShort(&dircount);
-			(void) TIFFSeekFile(tif,
-			    nextdir+2+dircount*12, SEEK_SET);
-			if (!ReadOK(tif, &nextnextdir, 4)) {
-				TIFFErrorExt(tif->tif_clientdata, module,
-					     "Error fetching directory link");
-				return (0);
-			}
-			if (tif->tif_flags & TIFF_SWAB)
-				TIFFSwabLong(&nextnextdir);
-			if (nextnextdir==0)
-			{
-				(void) TIFFSeekFile(tif,
-				    nextdir+2+dircount*12, SEEK_SET);
-				if (!WriteOK(tif, &m, 4)) {
-					TIFFErrorExt(tif->tif_clientdata, module,
-					     "Error writing directory link");
-					return (0);
-				}
-				break;
-			}
-			nextdir=nextnextdir;
-		}
 	}
 	else
 	{
-		uint64_t m;
-		uint64_t nextdir;
-		m = tif->tif_diroff;
-		if (tif->tif_flags & TIFF_SWAB)
-			TIFFSwabLong8(&m);
 		if (tif->tif_header.big.tiff_diroff == 0) {
+			uint64_t m;
+			m = tif->tif_diroff;
+			if (tif->tif_flags & TIFF_SWAB)
+				TIFFSwabLong8(&m);
 			/*
 			 * First directory, overwrite offset in header.
 			 */
@@ -3226,55 +3657,31 @@ TIFFLinkDirectory(TIFF* tif)
 					     "Error writing TIFF header");
 				return (0);
 			}
+			tif->tif_lastdiroff = tif->tif_diroff;
+			tif->tif_lastprevdiroff = 0;
 			return (1);
 		}
-		/*
-		 * Not the first directory, search to the last and append.
-		 */
 		nextdir = tif->tif_header.big.tiff_diroff;
-		while(1) {
-			uint64_t dircount64;
-			uint16_t dircount;
-			uint64_t nextnextdir;
+	}
 
-			if (!SeekOK(tif, nextdir) ||
-			    !ReadOK(tif, &dircount64, 8)) {
-				TIFFErrorExt(tif->tif_clientdata, module,
-					     "Error fetching directory count");
-				return (0);
-			}
-			if (tif->tif_flags & TIFF_SWAB)
-				TIFFSwabLong8(&dircount64);
-			if (dircount64>0xFFFF)
-			{
-				TIFFErrorExt(tif->tif_clientdata, module,
-					     "Sanity check on tag count failed, likely corrupt TIFF");
-				return (0);
-			}
-			dircount=(uint16_t)dircount64;
-			(void) TIFFSeekFile(tif,
-			    nextdir+8+dircount*20, SEEK_SET);
-			if (!ReadOK(tif, &nextnextdir, 8)) {
-				TIFFErrorExt(tif->tif_clientdata, module,
-					     "Error fetching directory link");
-				return (0);
-			}
-			if (tif->tif_flags & TIFF_SWAB)
-				TIFFSwabLong8(&nextnextdir);
-			if (nextnextdir==0)
-			{
-				(void) TIFFSeekFile(tif,
-				    nextdir+8+dircount*20, SEEK_SET);
-				if (!WriteOK(tif, &m, 8)) {
-					TIFFErrorExt(tif->tif_clientdata, module,
-					     "Error writing directory link");
-					return (0);
-				}
-				break;
-			}
-			nextdir=nextnextdir;
-		}
+	/*
+	 * Not the first directory, search to the last and append.  The
+	 * search starts at the last directory linked through this handle,
+	 * so that writing N directories does not read the chain N times.
+	 */
+	if (tif->tif_lastdiroff != 0)
+		nextdir = tif->tif_lastdiroff;
+	while (1) {
+		if (!TIFFFetchDirectoryLink(tif, nextdir, &linkoff, &nextnextdir))
+			return (0);
+		if (nextnextdir == 0)
+			break;
+		nextdir = nextnextdir;
 	}
+	if (!TIFFWriteDirectoryLink(tif, linkoff, tif->tif_diroff))
+		return (0);
+	tif->tif_lastprevdiroff = nextdir;
+	tif->tif_lastdiroff = tif->tif_diroff;
 	return (1);
 }
 
@@ -327,23 +327,15 @@ Fax3Decode2D(TIFF* tif, uint8_t* buf, tmsize_t occ, uint16_t s)
 }
 #undef SWAP
 
-# define FILL(n, cp)                              \
-    for (int32_t ifill = 0; ifill < (n); ++ifill) \
-    {                                             \
-        (cp)[ifill] = 0xff;                       \
-    }                                             \
-    (cp) += (n);
-
-# define ZERO(n, cp)                              \
-    for (int32_t izero = 0; izero < (n); ++izero) \
-    {                                             \
-        (cp)[izero] = 0;                          \
-    }                                             \
-    (cp) += (n);
-
 /*
  * Bit-fill a row according to the white/black
  * runs generated during G3/G4 decoding.
+ *
+ * Partial bytes at either end of a run are masked in; the whole
+ * bytes in between are set with _TIFFmemset, which the C library
+ * implements a machine word (or vector) at a time.  Runs of up to
+ * a few bytes are by far the most common in scanned documents, so
+ * those are stored directly rather than paying for the call.
  */
 void
 _TIFFFax3fillruns(unsigned char* buf, uint32_t* runs, uint32_t* erun, uint32_t lastx)
@@ -352,8 +344,7 @@ _TIFFFax3fillruns(unsigned char* buf, uint32_t* runs, uint32_t* erun, uint32_t l
 	    { 0x00, 0x80, 0xc0, 0xe0, 0xf0, 0xf8, 0xfc, 0xfe, 0xff };
 	unsigned char* cp;
 	uint32_t x, bx, run;
-	int32_t n, nw;
-	int64_t* lp;
+	int32_t n;
 
 	if ((erun-runs)&1)
 	    *erun++ = 0;
@@ -371,21 +362,16 @@ _TIFFFax3fillruns(unsigned char* buf, uint32_t* runs, uint32_t* erun, uint32_t l
 			run -= 8-bx;
 		    }
 		    if( (n = run >> 3) != 0 ) {	/* multiple bytes to fill */
-			if ((n/sizeof (int64_t)) > 1) {
-			    /*
-			     * Align to int64_tword boundary and fill.
-			     */
-			    for (; n && !isAligned(cp, int64_t); n--)
-				    *cp++ = 0x00;
-			    lp = (int64_t*) cp;
-			    nw = (int32_t)(n / sizeof (int64_t));
-			    n -= nw * sizeof (int64_t);
-			    do {
-				    *lp++ = 0L;
-			    } while (--nw);
-			    cp = (unsigned char*) lp;
-			}
-			ZERO(n, cp);
+			if (n > 4)
+			    _TIFFmemset(cp, 0x00, n);
+			else
+			    switch (n) {
+			    case 4: cp[3] = 0x00; /*-fallthrough*/
+			    case 3: cp[2] = 0x00; /*-fallthrough*/
+			    case 2: cp[1] = 0x00; /*-fallthrough*/
+			    case 1: cp[0] = 0x00;
+			    }
+			cp += n;
 			run &= 7;
 		    }
 		    if (run)
@@ -406,21 +392,16 @@ _TIFFFax3fillruns(unsigned char* buf, uint32_t* runs, uint32_t* erun, uint32_t l
 			run -= 8-bx;
 		    }
 		    if( (n = run>>3) != 0 ) {	/* multiple bytes to fill */
-			if ((n/sizeof (int64_t)) > 1) {
-			    /*
-			     * Align to int64_t boundary and fill.
-			     */
-			    for (; n && !isAligned(cp, int64_t); n--)
-				*cp++ = 0xff;
-			    lp = (int64_t*) cp;
-			    nw = (int32_t)(n / sizeof (int64_t));
-			    n -= nw * sizeof (int64_t);
-			    do {
-				*lp++ = -1L;
-			    } while (--nw);
-			    cp = (unsigned char*) lp;
-			}
-			FILL(n, cp);
+			if (n > 4)
+			    _TIFFmemset(cp, 0xff, n);
+			else
+			    switch (n) {
+			    case 4: cp[3] = 0xff; /*-fallthrough*/
+			    case 3: cp[2] = 0xff; /*-fallthrough*/
+			    case 2: cp[1] = 0xff; /*-fallthrough*/
+			    case 1: cp[0] = 0xff;
+			    }
+			cp += n;
 			run &= 7;
 		    }
                     /* Explicit 0xff masking to make icc -check=conversions happy */
@@ -433,8 +414,6 @@ _TIFFFax3fillruns(unsigned char* buf, uint32_t* runs, uint32_t* erun, uint32_t l
 	}
 	assert(x == lastx);
 }
-#undef	ZERO
-#undef	FILL
 
 static int
 Fax3FixupTags(TIFF* tif)
@@ -161,7 +161,9 @@ TIFFFlushData(TIFF* tif)
 		if (!(*tif->tif_postencode)(tif))
 			return (0);
 	}
-	return (TIFFFlushData1(tif));
+	if (!TIFFFlushData1(tif))
+		return (0);
+	return (_TIFFSyncWriteBuffer(tif));
 }
 
 /* vim: set ts=8 sts=8 sw=8 noet: */
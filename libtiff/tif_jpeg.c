@@ -179,6 +179,9 @@ typedef struct {
 
         int             ycbcrsampling_fetched;
         int             max_allowed_scan_number;
+					/* per-directory encoder setup */
+	int		tables_quality;	/* quality of the quant tables, -1 if unset */
+	int		colorspace_set;	/* contig colorspace/sampling already set */
 } JPEGState;
 
 #define	JState(tif)	((JPEGState*)(tif)->tif_data)
@@ -1717,6 +1720,7 @@ prepare_JPEGTables(TIFF* tif)
 	/* Initialize quant tables for current quality setting */
 	if (!TIFFjpeg_set_quality(sp, sp->jpegquality, FALSE))
 		return (0);
+	sp->tables_quality = sp->jpegquality;
 	/* Mark only the tables we want for output */
 	/* NB: chrominance tables are currently used only with YCbCr */
 	if (!TIFFjpeg_suppress_tables(sp, TRUE))
@@ -1789,6 +1793,9 @@ JPEGSetupEncode(TIFF* tif)
 	}
 	if (!TIFFjpeg_set_defaults(sp))
 		return (0);
+	/* jpeg_set_defaults() reset the tables and colorspace */
+	sp->tables_quality = -1;
+	sp->colorspace_set = FALSE;
 	/* Set per-file parameters */
 	switch (sp->photometric) {
 	case PHOTOMETRIC_YCBCR:
@@ -1967,18 +1974,27 @@ JPEGPreEncode(TIFF* tif, uint16_t s)
 				if (sp->h_sampling != 1 || sp->v_sampling != 1)
 					downsampled_input = TRUE;
 			}
-			if (!TIFFjpeg_set_colorspace(sp, JCS_YCbCr))
-				return (0);
-			/*
-			 * Set Y sampling factors;
-			 * we assume jpeg_set_colorspace() set the rest to 1
-			 */
-			sp->cinfo.c.comp_info[0].h_samp_factor = sp->h_sampling;
-			sp->cinfo.c.comp_info[0].v_samp_factor = sp->v_sampling;
-		} else {
-			if (!TIFFjpeg_set_colorspace(sp, sp->cinfo.c.in_color_space))
-				return (0);
-			/* jpeg_set_colorspace set all sampling factors to 1 */
+		}
+		/*
+		 * Colorspace and sampling factors are the same for all
+		 * strips/tiles of a contig image: set them up only once.
+		 */
+		if (!sp->colorspace_set) {
+			if (sp->photometric == PHOTOMETRIC_YCBCR) {
+				if (!TIFFjpeg_set_colorspace(sp, JCS_YCbCr))
+					return (0);
+				/*
+				 * Set Y sampling factors;
+				 * we assume jpeg_set_colorspace() set the rest to 1
+				 */
+				sp->cinfo.c.comp_info[0].h_samp_factor = sp->h_sampling;
+				sp->cinfo.c.comp_info[0].v_samp_factor = sp->v_sampling;
+			} else {
+				if (!TIFFjpeg_set_colorspace(sp, sp->cinfo.c.in_color_space))
+					return (0);
+				/* jpeg_set_colorspace set all sampling factors to 1 */
+			}
+			sp->colorspace_set = TRUE;
 		}
 	} else {
 		if (!TIFFjpeg_set_colorspace(sp, JCS_UNKNOWN))
@@ -2000,8 +2016,13 @@ JPEGPreEncode(TIFF* tif, uint16_t s)
 	/* mode, so we must manually suppress them. However TIFFjpeg_set_quality() */
 	/* should really be called when dealing with files with directories with */
 	/* mixed qualities. see http://trac.osgeo.org/gdal/ticket/3539 */
-	if (!TIFFjpeg_set_quality(sp, sp->jpegquality, FALSE))
-		return (0);
+	/* The tables are only recomputed when the quality changed since the */
+	/* previous strip/tile: the flags below are set explicitly anyway. */
+	if (sp->tables_quality != sp->jpegquality) {
+		if (!TIFFjpeg_set_quality(sp, sp->jpegquality, FALSE))
+			return (0);
+		sp->tables_quality = sp->jpegquality;
+	}
 	if (sp->jpegtablesmode & JPEGTABLESMODE_QUANT) {
 		suppress_quant_table(sp, 0);
 		suppress_quant_table(sp, 1);
@@ -2546,6 +2567,8 @@ TIFFInitJPEG(TIFF* tif, int scheme)
 	sp->jpegtables = NULL;
 	sp->jpegtables_length = 0;
 	sp->jpegquality = 75;			/* Default IJG quality */
+	sp->tables_quality = -1;
+	sp->colorspace_set = FALSE;
 	sp->jpegcolormode = JPEGCOLORMODE_RAW;
 	sp->jpegtablesmode = JPEGTABLESMODE_QUANT | JPEGTABLESMODE_HUFF;
         sp->ycbcrsampling_fetched = 0;
@@ -216,6 +216,12 @@ TIFFClientOpen(
 	 * application-transparent and as such can cause problems.  The 'c'
 	 * option permits applications that only want to look at the tags,
 	 * for example, to get the unadulterated TIFF tag information.
+	 *
+	 * The 'N' flag is for bulk conversions of files that are only
+	 * read or written once, so that they don't evict more useful data
+	 * from the system page cache.  It is honoured by the file access
+	 * routines of TIFFOpen() and TIFFFdOpen() where the system allows,
+	 * and turns memory-mapping off since mapped pages would be cached.
 	 */
 	for (cp = mode; *cp; cp++)
 		switch (*cp) {
@@ -273,6 +279,10 @@ TIFFClientOpen(
 				if( m == O_RDONLY )
 					tif->tif_flags |= (TIFF_LAZYSTRILELOAD | TIFF_DEFERSTRILELOAD);
 				break;
+			case 'N':
+				tif->tif_flags |= TIFF_NOCACHE;
+				tif->tif_flags &= ~TIFF_MAPPED;
+				break;
 		}
 
 #ifdef DEFER_STRILE_LOAD
@@ -535,6 +535,8 @@ TIFFReadEncodedStrip(TIFF* tif, uint32_t strip, void* buf, tmsize_t size)
 		return((tmsize_t)(-1));
 	if ((*tif->tif_decodestrip)(tif,buf,stripsize,plane)<=0)
 		return((tmsize_t)(-1));
+	/* The strip data is used up: scanline reads must load it again */
+	tif->tif_curstrip = NOSTRIP;
 	(*tif->tif_postdecode)(tif,buf,stripsize);
 	return(stripsize);
 }
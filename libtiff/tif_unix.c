@@ -27,6 +27,10 @@
  * Windows Common RunTime Library.
  */
 
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE	/* for sync_file_range(), where there is one */
+#endif
+
 #include "tif_config.h"
 
 #ifdef HAVE_SYS_TYPES_H
@@ -196,6 +200,88 @@ _tiffUnmapProc(thandle_t fd, void* base, toff_t size)
 }
 #endif /* !HAVE_MMAP */
 
+#ifdef HAVE_POSIX_FADVISE
+/*
+ * Variants used with the 'N' open flag, which tell the system to drop from
+ * its page cache what has been read as soon as it has been read, and what
+ * has been written once it is on the disk.  Pages only partly covered by a
+ * read or write stay cached, as the next one may need them.
+ */
+#define TIFF_NOCACHE_WRITEBEHIND (32 * 1024 * 1024)
+
+/*
+ * Dirty pages can't be dropped: write them out first, waiting for it if
+ * wait is set.  Without sync_file_range(), posix_fadvise() starts their
+ * writeback on some systems, and they get dropped by a later call.
+ */
+static void
+_tiffDropWritten(int fd, _TIFF_off_t off, _TIFF_off_t len, int wait)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+	(void) sync_file_range(fd, off, len, wait ?
+	    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+	    SYNC_FILE_RANGE_WAIT_AFTER : SYNC_FILE_RANGE_WRITE);
+	if (wait)
+#endif
+		(void) posix_fadvise(fd, off, len, POSIX_FADV_DONTNEED);
+}
+
+static tmsize_t
+_tiffReadProcNoCache(thandle_t fd, void* buf, tmsize_t size)
+{
+	fd_as_handle_union_t fdh;
+	tmsize_t count = _tiffReadProc(fd, buf, size);
+
+	if (count > 0) {
+		_TIFF_off_t end;
+
+		fdh.h = fd;
+		end = _TIFF_lseek_f(fdh.fd, 0, SEEK_CUR);
+		if (end >= (_TIFF_off_t) count)
+			(void) posix_fadvise(fdh.fd, end - count, count,
+			    POSIX_FADV_DONTNEED);
+	}
+	return (count);
+}
+
+static tmsize_t
+_tiffWriteProcNoCache(thandle_t fd, void* buf, tmsize_t size)
+{
+	fd_as_handle_union_t fdh;
+	tmsize_t count = _tiffWriteProc(fd, buf, size);
+
+	if (count > 0) {
+		_TIFF_off_t end;
+
+		fdh.h = fd;
+		end = _TIFF_lseek_f(fdh.fd, 0, SEEK_CUR);
+		if (end < (_TIFF_off_t) count)
+			return (count);
+		/*
+		 * Start writing out what was just written, and drop what
+		 * was written a while ago, which should be on the disk by
+		 * now, so that the writer seldom waits.
+		 */
+		_tiffDropWritten(fdh.fd, end - count, count, 0);
+		if (end - count > TIFF_NOCACHE_WRITEBEHIND)
+			_tiffDropWritten(fdh.fd,
+			    end - count - TIFF_NOCACHE_WRITEBEHIND, count, 1);
+	}
+	return (count);
+}
+
+static int
+_tiffCloseProcNoCache(thandle_t fd)
+{
+	fd_as_handle_union_t fdh;
+
+	fdh.h = fd;
+	/* Including the last pages written, once they are on the disk */
+	_tiffDropWritten(fdh.fd, 0, 0, 1);
+	return (_tiffCloseProc(fd));
+}
+#endif /* HAVE_POSIX_FADVISE */
+
 /*
  * Open a TIFF file descriptor for read/writing.
  */
@@ -213,6 +299,14 @@ TIFFFdOpen(int fd, const char* name, const char* mode)
 	    _tiffMapProc, _tiffUnmapProc);
 	if (tif)
 		tif->tif_fd = fd;
+#ifdef HAVE_POSIX_FADVISE
+	if (tif && (tif->tif_flags & TIFF_NOCACHE)) {
+		(void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		tif->tif_readproc = _tiffReadProcNoCache;
+		tif->tif_writeproc = _tiffWriteProcNoCache;
+		tif->tif_closeproc = _tiffCloseProcNoCache;
+	}
+#endif
 	return (tif);
 }
 
@@ -31,6 +31,7 @@
 #include <stdio.h>
 
 #define STRIPINCR	20		/* expansion factor on strip array */
+#define WRITEBUFFERALIGN	4096	/* file offset alignment of buffered writes */
 
 #define WRITECHECKSTRIPS(tif, module)				\
 	(((tif)->tif_flags&TIFF_BEENWRITING) || TIFFWriteCheck((tif),0,module))
@@ -42,6 +43,10 @@
 
 static int TIFFGrowStrips(TIFF* tif, uint32_t delta, const char* module);
 static int TIFFAppendToStrip(TIFF* tif, uint32_t strip, uint8_t* data, tmsize_t cc);
+static int TIFFAppendToWriteBuffer(TIFF* tif, const uint8_t* data, tmsize_t cc);
+static int TIFFWriteBehind(TIFF* tif, const uint8_t* data, tmsize_t cc);
+static int TIFFWriteAppended(TIFF* tif, const uint8_t* data, tmsize_t cc);
+static int TIFFWriteStrileLeader(TIFF* tif, uint32_t strip, uint64_t bytecount);
 
 int
 TIFFWriteScanline(TIFF* tif, void* buf, uint32_t row, uint16_t sample)
@@ -748,7 +753,8 @@ TIFFAppendToStrip(TIFF* tif, uint32_t strip, uint8_t* data, tmsize_t cc)
 
             if( td->td_stripbytecount_p[strip] != 0 
                 && td->td_stripoffset_p[strip] != 0 
-                && td->td_stripbytecount_p[strip] >= (uint64_t) cc )
+                && td->td_stripbytecount_p[strip] >= (uint64_t) cc
+                && !(tif->tif_flags & TIFF_STRILELEADER) )
             {
                 /* 
                  * There is already tile data on disk, and the new tile
@@ -768,9 +774,30 @@ TIFFAppendToStrip(TIFF* tif, uint32_t strip, uint8_t* data, tmsize_t cc)
             {
                 /* 
                  * Seek to end of file, and set that as our location to 
-                 * write this strip.
+                 * write this strip.  While appending to the write-behind
+                 * buffer, the end of the file is already known.
                  */
-                td->td_stripoffset_p[strip] = TIFFSeekFile(tif, 0, SEEK_END);
+                if (tif->tif_wbufoff != 0)
+                    td->td_stripoffset_p[strip] =
+                        tif->tif_wbufoff + tif->tif_wbufcc;
+                else
+                {
+                    td->td_stripoffset_p[strip] =
+                        TIFFSeekFile(tif, 0, SEEK_END);
+                    if (tif->tif_wbufsize != 0)
+                        tif->tif_wbufoff = td->td_stripoffset_p[strip];
+                }
+                if (tif->tif_flags & TIFF_STRILELEADER)
+                {
+                    /*
+                     * The leader goes first, and the strip after it.  It
+                     * is fixed up below if more data follows.
+                     */
+                    tif->tif_curoff = td->td_stripoffset_p[strip];
+                    td->td_stripoffset_p[strip] += 4;
+                    if (!TIFFWriteStrileLeader(tif, strip, (uint64_t) cc))
+                        return (0);
+                }
                 tif->tif_flags |= TIFF_DIRTYSTRIP;
             }
 
@@ -791,13 +818,17 @@ TIFFAppendToStrip(TIFF* tif, uint32_t strip, uint8_t* data, tmsize_t cc)
 		TIFFErrorExt(tif->tif_clientdata, module, "Maximum TIFF file size exceeded");
 		return (0);
 	}
-	if (!WriteOK(tif, data, cc)) {
+	if (!TIFFWriteAppended(tif, data, cc)) {
 		TIFFErrorExt(tif->tif_clientdata, module, "Write error at scanline %lu",
 		    (unsigned long) tif->tif_row);
 		    return (0);
 	}
 	tif->tif_curoff = m;
 	td->td_stripbytecount_p[strip] += cc;
+	if ((tif->tif_flags & TIFF_STRILELEADER) &&
+	    td->td_stripbytecount_p[strip] != (uint64_t) cc &&
+	    !TIFFWriteStrileLeader(tif, strip, td->td_stripbytecount_p[strip]))
+		return (0);
 
         if((int64_t) td->td_stripbytecount_p[strip] != old_byte_count )
             tif->tif_flags |= TIFF_DIRTYSTRIP;
@@ -805,6 +836,137 @@ TIFFAppendToStrip(TIFF* tif, uint32_t strip, uint8_t* data, tmsize_t cc)
 	return (1);
 }
 
+/*
+ * Write data at tif_curoff, through the write-behind buffer if it follows
+ * what the buffer holds.
+ */
+static int
+TIFFWriteAppended(TIFF* tif, const uint8_t* data, tmsize_t cc)
+{
+	if (tif->tif_wbufoff != 0 &&
+	    tif->tif_curoff == tif->tif_wbufoff + tif->tif_wbufcc)
+		return (TIFFAppendToWriteBuffer(tif, data, cc));
+	return (WriteOK(tif, (void*) data, cc));
+}
+
+/*
+ * Write the leader of a strip, its byte count as a 4-byte integer just
+ * before its data.  A new leader is appended at tif_curoff; one that must
+ * be fixed up is patched where it is, in the write-behind buffer if it
+ * is still there.
+ */
+static int
+TIFFWriteStrileLeader(TIFF* tif, uint32_t strip, uint64_t bytecount)
+{
+	static const char module[] = "TIFFWriteStrileLeader";
+	uint64_t off = tif->tif_dir.td_stripoffset_p[strip] - 4;
+	uint32_t leader;
+
+	if (bytecount > 0xFFFFFFFFU) {
+		TIFFErrorExt(tif->tif_clientdata, module,
+		    "Strip %"PRIu32" is too large for its leader", strip);
+		return (0);
+	}
+	leader = (uint32_t) bytecount;
+	if (tif->tif_flags & TIFF_SWAB)
+		TIFFSwabLong(&leader);
+	if (off == tif->tif_curoff) {
+		if (!TIFFWriteAppended(tif, (const uint8_t*) &leader, 4))
+			goto bad;
+		tif->tif_curoff += 4;
+	} else if (tif->tif_wbufcc != 0 && off >= tif->tif_wbufoff &&
+	    off + 4 <= tif->tif_wbufoff + tif->tif_wbufcc) {
+		_TIFFmemcpy(tif->tif_wbuf + (off - tif->tif_wbufoff), &leader, 4);
+	} else if (!SeekOK(tif, off) ||
+	    !WriteOK(tif, &leader, 4) ||
+	    !SeekOK(tif, tif->tif_curoff))
+		goto bad;
+	return (1);
+
+bad:
+	TIFFErrorExt(tif->tif_clientdata, module,
+	    "Write error at offset %"PRIu64, off);
+	return (0);
+}
+
+/*
+ * Append data to the write-behind buffer, which starts at the end of the
+ * file, and write the buffer out each time it fills up.  Buffer boundaries
+ * fall on file offsets multiple of WRITEBUFFERALIGN, so that all writes
+ * but the first and the last ones are full-sized and aligned.
+ */
+static int
+TIFFAppendToWriteBuffer(TIFF* tif, const uint8_t* data, tmsize_t cc)
+{
+	static const char module[] = "TIFFAppendToWriteBuffer";
+
+	if (tif->tif_wbuf == NULL) {
+		tif->tif_wbuf = (uint8_t*) _TIFFmalloc(tif->tif_wbufsize);
+		if (tif->tif_wbuf == NULL) {
+			TIFFErrorExt(tif->tif_clientdata, module,
+			    "No space for write buffer");
+			return (0);
+		}
+	}
+	while (cc > 0) {
+		tmsize_t limit = tif->tif_wbufsize -
+		    (tmsize_t) (tif->tif_wbufoff % WRITEBUFFERALIGN);
+		tmsize_t n = limit - tif->tif_wbufcc;
+
+		if (tif->tif_wbufcc == 0 && cc >= limit) {
+			/* Nothing to gather it with */
+			return (TIFFWriteBehind(tif, data, cc));
+		}
+		if (n > cc)
+			n = cc;
+		_TIFFmemcpy(tif->tif_wbuf + tif->tif_wbufcc, data, n);
+		tif->tif_wbufcc += n;
+		data += n;
+		cc -= n;
+		if (tif->tif_wbufcc == limit) {
+			tif->tif_wbufcc = 0;
+			if (!TIFFWriteBehind(tif, tif->tif_wbuf, limit))
+				return (0);
+		}
+	}
+	return (1);
+}
+
+/*
+ * Write data at tif_wbufoff, where the file is positioned whenever
+ * tif_wbufoff is not 0, and advance it.
+ */
+static int
+TIFFWriteBehind(TIFF* tif, const uint8_t* data, tmsize_t cc)
+{
+	static const char module[] = "TIFFWriteBehind";
+
+	if ((*tif->tif_writeproc)(tif->tif_clientdata, (void*) data, cc) != cc) {
+		TIFFErrorExt(tif->tif_clientdata, module,
+		    "Write error at offset %" PRIu64, tif->tif_wbufoff);
+		tif->tif_wbufoff = 0;
+		return (0);
+	}
+	tif->tif_wbufoff += cc;
+	return (1);
+}
+
+/*
+ * Write out the pending content of the write-behind buffer before other
+ * file accesses, after which the end of the file is no longer known.
+ */
+int
+_TIFFFlushWriteBuffer(TIFF* tif)
+{
+	tmsize_t cc = tif->tif_wbufcc;
+	int ok;
+
+	tif->tif_wbufcc = 0;
+	ok = cc == 0 || TIFFWriteBehind(tif, tif->tif_wbuf, cc);
+	tif->tif_wbufoff = 0;
+	return (ok);
+}
+
 /*
  * Internal version of TIFFFlushData that can be
  * called by ``encodestrip routines'' w/o concern
@@ -847,6 +1009,192 @@ TIFFSetWriteOffset(TIFF* tif, toff_t off)
 	tif->tif_curoff = off;
 }
 
+/*
+ * Set the size of the buffer gathering the strips and tiles appended to
+ * the end of the file, so that they are written out in large sequential
+ * writes; 0 (the default) writes each of them as it comes.  Pending data
+ * is written out first.
+ */
+int
+TIFFSetWriteBufferSize(TIFF* tif, tmsize_t size)
+{
+	static const char module[] = "TIFFSetWriteBufferSize";
+
+	if (size < 0) {
+		TIFFErrorExt(tif->tif_clientdata, module,
+		    "Invalid write buffer size %" TIFF_SSIZE_FORMAT, size);
+		return (0);
+	}
+	if (!_TIFFSyncWriteBuffer(tif))
+		return (0);
+	if (tif->tif_wbuf) {
+		_TIFFfree(tif->tif_wbuf);
+		tif->tif_wbuf = NULL;
+	}
+	if (size > TIFF_TMSIZE_T_MAX - WRITEBUFFERALIGN)
+		size = TIFF_TMSIZE_T_MAX - WRITEBUFFERALIGN;
+	tif->tif_wbufsize = (tmsize_t) TIFFroundup_64(size, WRITEBUFFERALIGN);
+	return (1);
+}
+
+/*
+ * Precede (or not) the data of each strip or tile appended to the file
+ * from now on with its byte count, as a 4-byte integer in the byte order
+ * of the file, so that a reader knowing where the data of a strip or tile
+ * starts can fetch it together with its size.
+ */
+int
+TIFFSetStrileLeaders(TIFF* tif, int enable)
+{
+	if (enable)
+		tif->tif_flags |= TIFF_STRILELEADER;
+	else
+		tif->tif_flags &= ~TIFF_STRILELEADER;
+	return (1);
+}
+
+/*
+ * Write size bytes of data (zeroes if data is NULL) just after the file
+ * header.  The first call, before anything else follows the header,
+ * reserves that room; later calls rewrite what it holds.
+ */
+int
+TIFFSetHeaderGap(TIFF* tif, const void* data, tmsize_t size)
+{
+	static const char module[] = "TIFFSetHeaderGap";
+	void* zeroes = NULL;
+	int ok;
+
+	if (tif->tif_mode == O_RDONLY) {
+		TIFFErrorExt(tif->tif_clientdata, module,
+		    "File opened in read-only mode");
+		return (0);
+	}
+	if (size < 0) {
+		TIFFErrorExt(tif->tif_clientdata, module,
+		    "Invalid header gap size %" TIFF_SSIZE_FORMAT, size);
+		return (0);
+	}
+	if (tif->tif_headergapsize == 0) {
+		if (TIFFGetFileSize(tif) != tif->tif_header_size) {
+			TIFFErrorExt(tif->tif_clientdata, module,
+			    "Data already follows the header");
+			return (0);
+		}
+	} else if (size > tif->tif_headergapsize) {
+		TIFFErrorExt(tif->tif_clientdata, module,
+		    "Header gap of %" TIFF_SSIZE_FORMAT " bytes can't hold %"
+		    TIFF_SSIZE_FORMAT " bytes", tif->tif_headergapsize, size);
+		return (0);
+	}
+	if (size == 0)
+		return (1);
+	if (data == NULL) {
+		zeroes = _TIFFcalloc(1, size);
+		if (zeroes == NULL) {
+			TIFFErrorExt(tif->tif_clientdata, module,
+			    "No space for header gap");
+			return (0);
+		}
+		data = zeroes;
+	}
+	ok = SeekOK(tif, tif->tif_header_size) &&
+	    WriteOK(tif, (void*) data, size) &&
+	    (tif->tif_curoff == 0 || SeekOK(tif, tif->tif_curoff));
+	_TIFFfree(zeroes);
+	if (!ok) {
+		TIFFErrorExt(tif->tif_clientdata, module,
+		    "Error writing header gap");
+		return (0);
+	}
+	if (tif->tif_headergapsize == 0)
+		tif->tif_headergapsize = size;
+	return (1);
+}
+
+/*
+ * Lay out the data of all the strips or tiles of the current image, which
+ * must be uncompressed so that their sizes are known in advance, one after
+ * the other at the end of the file, and extend the file over them without
+ * writing them: where the system supports it, the file stays sparse until
+ * they are written.  They can then be written in any order, with
+ * TIFFWriteEncodedStrip() or TIFFWriteEncodedTile(), or directly in the
+ * file (in a memory mapping of it, for instance) at the offsets given by
+ * TIFFGetStrileOffset().
+ */
+int
+TIFFReserveStrileData(TIFF* tif)
+{
+	static const char module[] = "TIFFReserveStrileData";
+	TIFFDirectory *td = &tif->tif_dir;
+	uint64_t off, m;
+	uint32_t strile;
+	uint8_t zero = 0;
+
+	if (isTiled(tif) ? !WRITECHECKTILES(tif, module) :
+	    !WRITECHECKSTRIPS(tif, module))
+		return (0);
+	if (td->td_compression != COMPRESSION_NONE) {
+		TIFFErrorExt(tif->tif_clientdata, module,
+		    "Can only reserve room for uncompressed data");
+		return (0);
+	}
+	if (tif->tif_flags & TIFF_STRILELEADER) {
+		TIFFErrorExt(tif->tif_clientdata, module,
+		    "Can't reserve room for data with strip/tile leaders");
+		return (0);
+	}
+	for (strile = 0; strile < td->td_nstrips; strile++) {
+		if (td->td_stripbytecount_p[strile] != 0) {
+			TIFFErrorExt(tif->tif_clientdata, module,
+			    "Data has already been written");
+			return (0);
+		}
+	}
+	if (!_TIFFSyncWriteBuffer(tif))
+		return (0);
+	off = m = TIFFSeekFile(tif, 0, SEEK_END);
+	for (strile = 0; strile < td->td_nstrips; strile++) {
+		uint64_t size;
+
+		if (isTiled(tif))
+			size = TIFFTileSize64(tif);
+		else {
+			uint32_t row = (strile % td->td_stripsperimage) *
+			    td->td_rowsperstrip;
+			uint32_t nrows = td->td_imagelength - row;
+
+			if (nrows > td->td_rowsperstrip)
+				nrows = td->td_rowsperstrip;
+			size = TIFFVStripSize64(tif, nrows);
+		}
+		td->td_stripoffset_p[strile] = m;
+		td->td_stripbytecount_p[strile] = size;
+		m += size;
+		if (m < size || (!(tif->tif_flags & TIFF_BIGTIFF) &&
+		    m > 0xFFFFFFFFU)) {
+			TIFFErrorExt(tif->tif_clientdata, module,
+			    "Maximum TIFF file size exceeded");
+			goto bad;
+		}
+	}
+	if (m > off && (!SeekOK(tif, m - 1) || !WriteOK(tif, &zero, 1))) {
+		TIFFErrorExt(tif->tif_clientdata, module,
+		    "Error extending file to %" PRIu64 " bytes", m);
+		goto bad;
+	}
+	tif->tif_curoff = 0;
+	tif->tif_flags |= TIFF_DIRTYSTRIP;
+	return (1);
+
+bad:
+	for (strile = 0; strile < td->td_nstrips; strile++) {
+		td->td_stripoffset_p[strile] = 0;
+		td->td_stripbytecount_p[strile] = 0;
+	}
+	return (0);
+}
+
 /* vim: set ts=8 sts=8 sw=8 noet: */
 /*
  * Local Variables:
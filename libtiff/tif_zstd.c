@@ -36,6 +36,15 @@
 
 #include <stdio.h>
 
+/*
+ * Private tag, in the reusable range, holding a dictionary shared by all
+ * the strips/tiles of an image.  Only this codec knows about it, and it
+ * refuses to start when an application has registered the same tag
+ * number for something else.
+ */
+#define TIFFTAG_ZSTD_DICTIONARY 65000
+#define FIELD_ZSTD_DICTIONARY   (FIELD_CODEC+0)
+
 /*
 * State block for each open TIFF file using ZSTD compression/decompression.
 */
@@ -43,6 +52,11 @@ typedef struct {
         TIFFPredictorState predict;
         ZSTD_DStream*   dstream;
         ZSTD_CStream*   cstream;
+        void*           dictionary;             /* TIFFTAG_ZSTD_DICTIONARY value */
+        uint32_t        dictionary_length;      /* number of bytes in same */
+        ZSTD_DDict*     ddict;                  /* digested dictionary */
+        ZSTD_CDict*     cdict;
+        int             cdict_level;            /* level cdict was built for */
         int             compression_level;      /* compression level */
         ZSTD_outBuffer  out_buffer;
         int             state;                  /* state flags */
@@ -51,6 +65,7 @@ typedef struct {
 
         TIFFVGetMethod  vgetparent;            /* super-class method */
         TIFFVSetMethod  vsetparent;            /* super-class method */
+        TIFFPrintMethod printdir;              /* super-class method */
 } ZSTDState;
 
 #define LState(tif)             ((ZSTDState*) (tif)->tif_data)
@@ -60,6 +75,35 @@ typedef struct {
 static int ZSTDEncode(TIFF* tif, uint8_t* bp, tmsize_t cc, uint16_t s);
 static int ZSTDDecode(TIFF* tif, uint8_t* op, tmsize_t occ, uint16_t s);
 
+/*
+* Return the dictionary stored in TIFFTAG_ZSTD_DICTIONARY, if any.
+*/
+static int
+ZSTDGetDictionary(TIFF* tif, const void** dict, size_t* size)
+{
+        ZSTDState* sp = LState(tif);
+
+        if( !TIFFFieldSet(tif, FIELD_ZSTD_DICTIONARY) ||
+            sp->dictionary_length == 0 || sp->dictionary == NULL )
+                return 0;
+        *dict = sp->dictionary;
+        *size = (size_t) sp->dictionary_length;
+        return 1;
+}
+
+static void
+ZSTDFreeDictionaries(ZSTDState* sp)
+{
+        if( sp->ddict ) {
+            ZSTD_freeDDict(sp->ddict);
+            sp->ddict = NULL;
+        }
+        if( sp->cdict ) {
+            ZSTD_freeCDict(sp->cdict);
+            sp->cdict = NULL;
+        }
+}
+
 static int
 ZSTDFixupTags(TIFF* tif)
 {
@@ -93,6 +137,8 @@ ZSTDPreDecode(TIFF* tif, uint16_t s)
 {
         static const char module[] = "ZSTDPreDecode";
         ZSTDState* sp = DecoderState(tif);
+        const void* dict;
+        size_t dictsize;
         size_t zstd_ret;
 
         (void) s;
@@ -101,19 +147,39 @@ ZSTDPreDecode(TIFF* tif, uint16_t s)
         if( (sp->state & LSTATE_INIT_DECODE) == 0 )
             tif->tif_setupdecode(tif);
 
-        if( sp->dstream )
-        {
-            ZSTD_freeDStream(sp->dstream);
-            sp->dstream = NULL;
-        }
-
-        sp->dstream = ZSTD_createDStream();
+        /*
+         * The stream is reused from one strip/tile to the next: with small
+         * tiles, reallocating it each time costs as much as decoding.
+         */
         if( sp->dstream == NULL ) {
+            sp->dstream = ZSTD_createDStream();
+            if( sp->dstream == NULL ) {
+                TIFFErrorExt(tif->tif_clientdata, module,
+                             "Cannot allocate decompression stream");
+                return 0;
+            }
+        }
+        if( ZSTDGetDictionary(tif, &dict, &dictsize) ) {
+#if ZSTD_VERSION_NUMBER >= 10400
+            /* Digested once, then shared by all strips/tiles */
+            if( sp->ddict == NULL ) {
+                sp->ddict = ZSTD_createDDict(dict, dictsize);
+                if( sp->ddict == NULL ) {
+                    TIFFErrorExt(tif->tif_clientdata, module,
+                                 "Cannot load ZSTD dictionary");
+                    return 0;
+                }
+            }
+            zstd_ret = ZSTD_DCtx_reset(sp->dstream, ZSTD_reset_session_only);
+            if( !ZSTD_isError(zstd_ret) )
+                zstd_ret = ZSTD_DCtx_refDDict(sp->dstream, sp->ddict);
+#else
             TIFFErrorExt(tif->tif_clientdata, module,
-                         "Cannot allocate decompression stream");
+                         "ZSTD dictionaries require libzstd 1.4 or later");
             return 0;
-        }
-        zstd_ret = ZSTD_initDStream(sp->dstream);
+#endif
+        } else
+            zstd_ret = ZSTD_initDStream(sp->dstream);
         if( ZSTD_isError(zstd_ret) ) {
             TIFFErrorExt(tif->tif_clientdata, module,
                          "Error in ZSTD_initDStream(): %s",
@@ -196,6 +262,8 @@ ZSTDPreEncode(TIFF* tif, uint16_t s)
 {
         static const char module[] = "ZSTDPreEncode";
         ZSTDState *sp = EncoderState(tif);
+        const void* dict;
+        size_t dictsize;
         size_t zstd_ret;
 
         (void) s;
@@ -203,18 +271,41 @@ ZSTDPreEncode(TIFF* tif, uint16_t s)
         if( sp->state != LSTATE_INIT_ENCODE )
             tif->tif_setupencode(tif);
 
-        if (sp->cstream) {
-            ZSTD_freeCStream(sp->cstream);
-            sp->cstream = NULL;
-        }
-        sp->cstream = ZSTD_createCStream();
         if( sp->cstream == NULL ) {
+            sp->cstream = ZSTD_createCStream();
+            if( sp->cstream == NULL ) {
+                TIFFErrorExt(tif->tif_clientdata, module,
+                             "Cannot allocate compression stream");
+                return 0;
+            }
+        }
+        if( ZSTDGetDictionary(tif, &dict, &dictsize) ) {
+#if ZSTD_VERSION_NUMBER >= 10400
+            if( sp->cdict != NULL &&
+                sp->cdict_level != sp->compression_level ) {
+                ZSTD_freeCDict(sp->cdict);
+                sp->cdict = NULL;
+            }
+            if( sp->cdict == NULL ) {
+                sp->cdict = ZSTD_createCDict(dict, dictsize,
+                                             sp->compression_level);
+                if( sp->cdict == NULL ) {
+                    TIFFErrorExt(tif->tif_clientdata, module,
+                                 "Cannot load ZSTD dictionary");
+                    return 0;
+                }
+                sp->cdict_level = sp->compression_level;
+            }
+            zstd_ret = ZSTD_CCtx_reset(sp->cstream, ZSTD_reset_session_only);
+            if( !ZSTD_isError(zstd_ret) )
+                zstd_ret = ZSTD_CCtx_refCDict(sp->cstream, sp->cdict);
+#else
             TIFFErrorExt(tif->tif_clientdata, module,
-                         "Cannot allocate compression stream");
+                         "ZSTD dictionaries require libzstd 1.4 or later");
             return 0;
-        }
-
-        zstd_ret = ZSTD_initCStream(sp->cstream, sp->compression_level);
+#endif
+        } else
+            zstd_ret = ZSTD_initCStream(sp->cstream, sp->compression_level);
         if( ZSTD_isError(zstd_ret) ) {
             TIFFErrorExt(tif->tif_clientdata, module,
                          "Error in ZSTD_initCStream(): %s",
@@ -310,6 +401,7 @@ ZSTDCleanup(TIFF* tif)
 
         tif->tif_tagmethods.vgetfield = sp->vgetparent;
         tif->tif_tagmethods.vsetfield = sp->vsetparent;
+        tif->tif_tagmethods.printdir = sp->printdir;
 
         if (sp->dstream) {
             ZSTD_freeDStream(sp->dstream);
@@ -319,6 +411,9 @@ ZSTDCleanup(TIFF* tif)
             ZSTD_freeCStream(sp->cstream);
             sp->cstream = NULL;
         }
+        ZSTDFreeDictionaries(sp);
+        if (sp->dictionary)
+            _TIFFfree(sp->dictionary);
         _TIFFfree(sp);
         tif->tif_data = NULL;
 
@@ -342,6 +437,27 @@ ZSTDVSetField(TIFF* tif, uint32_t tag, va_list ap)
                                    ZSTD_maxCLevel());
                 }
                 return 1;
+        case TIFFTAG_ZSTD_DICTIONARY:
+        {
+                uint32_t v32 = (uint32_t) va_arg(ap, uint32_t);
+                void* data = va_arg(ap, void*);
+
+                /* digested on next use */
+                ZSTDFreeDictionaries(sp);
+                if (v32 == 0) {
+                        TIFFClrFieldBit(tif, FIELD_ZSTD_DICTIONARY);
+                        return 1;
+                }
+                _TIFFsetByteArray(&sp->dictionary, data, v32);
+                if (sp->dictionary == NULL) {
+                        sp->dictionary_length = 0;
+                        return 0;
+                }
+                sp->dictionary_length = v32;
+                TIFFSetFieldBit(tif, FIELD_ZSTD_DICTIONARY);
+                tif->tif_flags |= TIFF_DIRTYDIRECT;
+                return 1;
+        }
         default:
                 return (*sp->vsetparent)(tif, tag, ap);
         }
@@ -357,16 +473,37 @@ ZSTDVGetField(TIFF* tif, uint32_t tag, va_list ap)
         case TIFFTAG_ZSTD_LEVEL:
                 *va_arg(ap, int*) = sp->compression_level;
                 break;
+        case TIFFTAG_ZSTD_DICTIONARY:
+                *va_arg(ap, uint32_t*) = sp->dictionary_length;
+                *va_arg(ap, const void**) = sp->dictionary;
+                break;
         default:
                 return (*sp->vgetparent)(tif, tag, ap);
         }
         return 1;
 }
 
+static void
+ZSTDPrintDir(TIFF* tif, FILE* fd, long flags)
+{
+        ZSTDState* sp = LState(tif);
+
+        assert(sp != NULL);
+
+        if (TIFFFieldSet(tif, FIELD_ZSTD_DICTIONARY))
+                fprintf(fd, "  ZSTD Dictionary: (%"PRIu32" bytes)\n",
+                        sp->dictionary_length);
+        if (sp->printdir)
+                (*sp->printdir)(tif, fd, flags);
+}
+
 static const TIFFField ZSTDFields[] = {
         { TIFFTAG_ZSTD_LEVEL, 0, 0, TIFF_ANY, 0, TIFF_SETGET_INT,
           TIFF_SETGET_UNDEFINED,
           FIELD_PSEUDO, TRUE, FALSE, "ZSTD compression_level", NULL },
+        { TIFFTAG_ZSTD_DICTIONARY, TIFF_VARIABLE2, TIFF_VARIABLE2,
+          TIFF_UNDEFINED, 0, TIFF_SETGET_C32_UINT8, TIFF_SETGET_C32_UINT8,
+          FIELD_ZSTD_DICTIONARY, FALSE, TRUE, "ZSTDDictionary", NULL },
 };
 
 int
@@ -374,10 +511,23 @@ TIFFInitZSTD(TIFF* tif, int scheme)
 {
         static const char module[] = "TIFFInitZSTD";
         ZSTDState* sp;
+        const TIFFField* fip;
 
         (void) scheme;
         assert( scheme == COMPRESSION_ZSTD );
 
+        /*
+        * The dictionary tag number is only ours by convention.
+        */
+        fip = TIFFFindField(tif, TIFFTAG_ZSTD_DICTIONARY, TIFF_ANY);
+        if (fip != NULL && fip != &ZSTDFields[1]) {
+                TIFFErrorExt(tif->tif_clientdata, module,
+                             "Tag %d is already registered as %s, "
+                             "can't use it for the ZSTD dictionary",
+                             TIFFTAG_ZSTD_DICTIONARY, fip->field_name);
+                return 0;
+        }
+
         /*
         * Merge codec-specific tag information.
         */
@@ -402,12 +552,19 @@ TIFFInitZSTD(TIFF* tif, int scheme)
         tif->tif_tagmethods.vgetfield = ZSTDVGetField;	/* hook for codec tags */
         sp->vsetparent = tif->tif_tagmethods.vsetfield;
         tif->tif_tagmethods.vsetfield = ZSTDVSetField;	/* hook for codec tags */
+        sp->printdir = tif->tif_tagmethods.printdir;
+        tif->tif_tagmethods.printdir = ZSTDPrintDir;	/* hook for codec tags */
 
         /* Default values for codec-specific fields */
         sp->compression_level = 9;		/* default comp. level */
         sp->state = 0;
         sp->dstream = 0;
         sp->cstream = 0;
+        sp->dictionary = NULL;
+        sp->dictionary_length = 0;
+        sp->ddict = NULL;
+        sp->cdict = NULL;
+        sp->cdict_level = 0;
         sp->out_buffer.dst = NULL;
         sp->out_buffer.size = 0;
         sp->out_buffer.pos = 0;
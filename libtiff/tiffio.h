@@ -413,6 +413,7 @@ extern int TIFFUnlinkDirectory(TIFF*, uint16_t);
 extern int TIFFSetField(TIFF*, uint32_t, ...);
 extern int TIFFVSetField(TIFF*, uint32_t, va_list);
 extern int TIFFUnsetField(TIFF*, uint32_t);
+extern int TIFFCopyDirectoryTags(TIFF*, TIFF*, const uint32_t*, uint32_t);
 extern int TIFFWriteDirectory(TIFF *);
 extern int TIFFWriteCustomDirectory(TIFF *, uint64_t *);
 extern int TIFFCheckpointDirectory(TIFF *);
@@ -485,6 +486,10 @@ extern tmsize_t TIFFWriteEncodedTile(TIFF* tif, uint32_t tile, void* data, tmsiz
 extern tmsize_t TIFFWriteRawTile(TIFF* tif, uint32_t tile, void* data, tmsize_t cc);
 extern int TIFFDataWidth(TIFFDataType);    /* table of tag datatype widths */
 extern void TIFFSetWriteOffset(TIFF* tif, toff_t off);
+extern int TIFFSetWriteBufferSize(TIFF* tif, tmsize_t size);
+extern int TIFFSetStrileLeaders(TIFF* tif, int enable);
+extern int TIFFSetHeaderGap(TIFF* tif, const void* data, tmsize_t size);
+extern int TIFFReserveStrileData(TIFF* tif);
 extern void TIFFSwabShort(uint16_t*);
 extern void TIFFSwabLong(uint32_t*);
 extern void TIFFSwabLong8(uint64_t*);
@@ -68,6 +68,18 @@ typedef struct client_info {
     char *name;
 } TIFFClientInfoLink;
 
+/*
+ * Part of the file taken up by a directory or its tag data, as sorted by
+ * offset for TIFFRewriteDirectory() to check that rewriting a directory
+ * where it is leaves the other directories alone.
+ */
+typedef struct {
+	uint64_t offset;	/* start of the part */
+	uint64_t end;		/* end of the part */
+	uint64_t maxend;	/* largest end of this part and those before it */
+	uint64_t diroff;	/* offset of the directory it belongs to */
+} TIFFDirExtent;
+
 /*
  * Typedefs for ``method pointers'' used internally.
  * these are deprecated and provided only for backwards compatibility.
@@ -115,11 +127,20 @@ struct tiff {
         #define TIFF_DEFERSTRILELOAD 0x1000000U /* defer strip/tile offset/bytecount array loading. */
         #define TIFF_LAZYSTRILELOAD  0x2000000U /* lazy/ondemand loading of strip/tile offset/bytecount values. Only used if TIFF_DEFERSTRILELOAD is set and in read-only mode */
         #define TIFF_CHOPPEDUPARRAYS 0x4000000U /* set when allocChoppedUpStripArrays() has modified strip array */
+        #define TIFF_STRILELEADER 0x8000000U /* precede appended strip/tile data with its byte count */
+        #define TIFF_REWRITEINPLACE 0x10000000U /* rewrite directory where it is if it still fits */
+        #define TIFF_NOCACHE 0x20000000U /* keep file contents out of the system page cache */
+        #define TIFF_DIRARENA 0x40000000U /* values of the directory being read go to its arena */
 	uint64_t               tif_diroff;       /* file offset of current directory */
 	uint64_t               tif_nextdiroff;   /* file offset of following directory */
+	uint64_t               tif_lastdiroff;   /* file offset of last directory linked into the chain, or 0 */
+	uint64_t               tif_lastprevdiroff; /* file offset of the directory linked to it, or 0 */
 	uint64_t*              tif_dirlist;      /* list of offsets to already seen directories to prevent IFD looping */
 	uint16_t               tif_dirlistsize;  /* number of entries in offset list */
 	uint16_t               tif_dirnumber;    /* number of already seen directories */
+	uint8_t*               tif_dirwindow;    /* bytes read along with the directory being read, or NULL */
+	uint64_t               tif_dirwindowoff; /* file offset of tif_dirwindow */
+	tmsize_t             tif_dirwindowsize; /* # of bytes in tif_dirwindow */
 	TIFFDirectory        tif_dir;          /* internal rep of current directory */
 	TIFFDirectory        tif_customdir;    /* custom IFDs are separated from the main ones */
 	union {
@@ -128,11 +149,15 @@ struct tiff {
 		TIFFHeaderBig big;
 	} tif_header;
 	uint16_t               tif_header_size;  /* file's header block and its length */
+	tmsize_t             tif_headergapsize; /* bytes reserved after the header by TIFFSetHeaderGap() */
 	uint32_t               tif_row;          /* current scanline */
 	uint16_t               tif_curdir;       /* current directory (index) */
 	uint32_t               tif_curstrip;     /* current strip for read/write */
 	uint64_t               tif_curoff;       /* current offset for read/write */
 	uint64_t               tif_dataoff;      /* current offset for writing dir */
+	uint64_t               tif_rewritelimit; /* end of the room of a directory being sized for rewriting in place, or 0 */
+	TIFFDirExtent*         tif_dirextents;   /* parts of the file taken up by the directories, or NULL until first rewrite */
+	uint32_t               tif_ndirextents;  /* # of entries in tif_dirextents */
 	/* SubIFD support */
 	uint16_t               tif_nsubifd;      /* remaining subifds to write */
 	uint64_t               tif_subifdoff;    /* offset for patching SubIFD link */
@@ -170,6 +195,10 @@ struct tiff {
         tmsize_t             tif_rawdataloaded;/* amount of data in rawdata */
 	uint8_t*               tif_rawcp;        /* current spot in raw buffer */
 	tmsize_t             tif_rawcc;        /* bytes unread from raw buffer */
+	uint8_t*               tif_wbuf;         /* strip/tile write-behind buffer */
+	tmsize_t             tif_wbufsize;     /* size of tif_wbuf, 0 if unbuffered */
+	tmsize_t             tif_wbufcc;       /* # of bytes pending in tif_wbuf */
+	uint64_t               tif_wbufoff;      /* file offset of tif_wbuf, or end of file if known and nothing pending, or 0 */
 	/* memory-mapped file support */
 	uint8_t*               tif_base;         /* base of mapped file */
 	tmsize_t             tif_size;         /* size of mapped file region (bytes, thus tmsize_t) */
@@ -188,6 +217,7 @@ struct tiff {
 	TIFFField**          tif_fields;       /* sorted table of registered tags */
 	size_t               tif_nfields;      /* # entries in registered tag table */
 	const TIFFField*     tif_foundfield;   /* cached pointer to already found tag */
+	const TIFFField***   tif_fieldindex;   /* tif_fields by tag, see tif_dirinfo.c */
 	TIFFTagMethods       tif_tagmethods;   /* tag get/set/print routines */
 	TIFFClientInfoLink*  tif_clientinfo;   /* extra client information. */
 	/* Backward compatibility stuff. We need these two fields for
@@ -202,16 +232,32 @@ struct tiff {
 #define isMapped(tif) (((tif)->tif_flags & TIFF_MAPPED) != 0)
 #define isFillOrder(tif, o) (((tif)->tif_flags & (o)) != 0)
 #define isUpSampled(tif) (((tif)->tif_flags & TIFF_UPSAMPLED) != 0)
+/*
+ * Any file access other than appending to the write-behind buffer first
+ * writes out what it holds, and forgets where the end of the file is.  If
+ * that fails, so does the access: a write error on data written behind
+ * is reported by the next read, write, seek or size query.
+ */
+#define _TIFFSyncWriteBuffer(tif) \
+	((tif)->tif_wbufcc != 0 ? _TIFFFlushWriteBuffer(tif) : \
+	    ((tif)->tif_wbufoff = 0, 1))
 #define TIFFReadFile(tif, buf, size) \
-	((*(tif)->tif_readproc)((tif)->tif_clientdata,(buf),(size)))
+	(_TIFFSyncWriteBuffer(tif) ? \
+	    (*(tif)->tif_readproc)((tif)->tif_clientdata,(buf),(size)) : \
+	    (tmsize_t) -1)
 #define TIFFWriteFile(tif, buf, size) \
-	((*(tif)->tif_writeproc)((tif)->tif_clientdata,(buf),(size)))
+	(_TIFFSyncWriteBuffer(tif) ? \
+	    (*(tif)->tif_writeproc)((tif)->tif_clientdata,(buf),(size)) : \
+	    (tmsize_t) -1)
 #define TIFFSeekFile(tif, off, whence) \
-	((*(tif)->tif_seekproc)((tif)->tif_clientdata,(off),(whence)))
+	(_TIFFSyncWriteBuffer(tif) ? \
+	    (*(tif)->tif_seekproc)((tif)->tif_clientdata,(off),(whence)) : \
+	    (toff_t) -1)
 #define TIFFCloseFile(tif) \
 	((*(tif)->tif_closeproc)((tif)->tif_clientdata))
 #define TIFFGetFileSize(tif) \
-	((*(tif)->tif_sizeproc)((tif)->tif_clientdata))
+	(_TIFFSyncWriteBuffer(tif) ? \
+	    (*(tif)->tif_sizeproc)((tif)->tif_clientdata) : (toff_t) 0)
 #define TIFFMapFileContents(tif, paddr, psize) \
 	((*(tif)->tif_mapproc)((tif)->tif_clientdata,(paddr),(psize)))
 #define TIFFUnmapFileContents(tif, addr, size) \
@@ -382,6 +428,7 @@ _TIFFReadTileAndAllocBuffer(TIFF* tif,
                             void **buf, tmsize_t bufsizetoalloc,
                             uint32_t x, uint32_t y, uint32_t z, uint16_t s);
 extern int _TIFFSeekOK(TIFF* tif, toff_t off);
+extern int _TIFFFlushWriteBuffer(TIFF* tif);
 
 extern int TIFFInitDumpMode(TIFF*, int);
 #ifdef PACKBITS_SUPPORT
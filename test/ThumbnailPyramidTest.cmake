@@ -0,0 +1,107 @@
+# CMake tests for libtiff
+#
+# Check that thumbnail -p makes the thumbnail from the smallest level of a
+# pyramid that is at least as large as the thumbnail.  When JPEGFILE is
+# set, also check thumbnails decoded from it at reduced DCT scales against
+# thumbnails of decoded copies, made through the RGBA interface.
+#
+# THUMBNAIL, TIFF2BW, TIFFCMP - executables
+# INFILE - 512x384 RGB image
+# JPEGFILE - optional 512x384 tiled YCbCr JPEG image
+# OUTDIR - directory of the pyramid and thumbnails
+
+include(${CMAKE_CURRENT_LIST_DIR}/TiffTestCommon.cmake)
+
+macro(run)
+  message(STATUS "Running ${MEMCHECK} ${ARGN}")
+  execute_process(COMMAND ${MEMCHECK} ${ARGN} RESULT_VARIABLE TEST_STATUS)
+  if(TEST_STATUS)
+    message(FATAL_ERROR "Returned failed status ${TEST_STATUS}!")
+  endif()
+endmacro()
+
+# thumbnail -p -w size -h size of infile must be width x length with
+# samples samples per pixel
+macro(check_level infile size width length samples)
+  run("${THUMBNAIL}" -p -w ${size} -h ${size} "${infile}" ${o}.tiff)
+  tiffinfo_validate(${o}.tiff)
+  execute_process(COMMAND "${TIFFINFO}" ${o}.tiff
+                  OUTPUT_VARIABLE INFO_OUTPUT
+                  RESULT_VARIABLE TEST_STATUS)
+  if(TEST_STATUS)
+    message(FATAL_ERROR "Returned failed status ${TEST_STATUS}!")
+  endif()
+  if(NOT INFO_OUTPUT MATCHES "Image Width: ${width} Image Length: ${length}\n" OR
+     NOT INFO_OUTPUT MATCHES "Samples/Pixel: ${samples}\n")
+    message(FATAL_ERROR "Expected a ${width}x${length} thumbnail with ${samples} samples per pixel: ${INFO_OUTPUT}")
+  endif()
+endmacro()
+
+# The last thumbnail, of a JPEG level decoded at reduced DCT scale, must
+# be within 16 of the thumbnail of decoded, the level decoded in full,
+# once that is area-averaged to scaled, the width of the scaled level.
+# RGB thumbnails are compared by their luma: the chroma of subsampled
+# YCbCr data is upsampled differently at reduced scale.
+macro(check_scaled decoded size scaled samples)
+  run("${THUMBNAIL}" -p -w ${scaled} -h ${scaled} "${decoded}" ${o}-scaled.tiff)
+  run("${THUMBNAIL}" -p -w ${size} -h ${size} ${o}-scaled.tiff ${o}-rgba.tiff)
+  if(${samples} EQUAL 3)
+    run("${TIFF2BW}" ${o}.tiff ${o}-luma.tiff)
+    run("${TIFF2BW}" ${o}-rgba.tiff ${o}-rgba-luma.tiff)
+    set(compared ${o}-luma.tiff ${o}-rgba-luma.tiff)
+  else()
+    set(compared ${o}.tiff ${o}-rgba.tiff)
+  endif()
+  execute_process(COMMAND "${TIFFCMP}" -s -t ${compared}
+                  OUTPUT_VARIABLE CMP_OUTPUT
+                  RESULT_VARIABLE TEST_STATUS)
+  if(TEST_STATUS EQUAL 1 AND CMP_OUTPUT MATCHES "max abs diff ([0-9]+),")
+    set(maxdiff ${CMAKE_MATCH_1})
+  elseif(TEST_STATUS EQUAL 0)
+    set(maxdiff 0)
+  else()
+    message(FATAL_ERROR "Can't compare ${compared}: ${CMP_OUTPUT}")
+  endif()
+  if(maxdiff GREATER 16)
+    message(FATAL_ERROR "The ${size} thumbnail of ${decoded} at reduced scale is up to ${maxdiff} away from the full decode")
+  endif()
+endmacro()
+
+file(MAKE_DIRECTORY "${OUTDIR}")
+set(o "${OUTDIR}/thumbnail-pyramid")
+
+# A 512x384 RGB image followed by a 32x24 RGB level and a 128x96 grayscale
+# level: the size and samples per pixel of the thumbnail tell which level
+# it was made from.
+run("${THUMBNAIL}" -p -w 128 -h 128 "${INFILE}" ${o}-rgb128.tiff)
+run("${TIFF2BW}" ${o}-rgb128.tiff ${o}-gray128.tiff)
+run("${THUMBNAIL}" -p -w 32 -h 32 "${INFILE}" ${o}-rgb32.tiff)
+run("${TIFFCP}" "${INFILE}" ${o}-rgb32.tiff ${o}-gray128.tiff ${o}-levels.tiff)
+check_level(${o}-levels.tiff 20 20 15 3)
+check_level(${o}-levels.tiff 32 32 24 3)
+check_level(${o}-levels.tiff 33 33 25 1)
+check_level(${o}-levels.tiff 100 100 75 1)
+check_level(${o}-levels.tiff 128 128 96 1)
+check_level(${o}-levels.tiff 200 200 150 3)
+check_level(${o}-levels.tiff 1000 512 384 3)
+
+if(JPEGFILE)
+  # Tiles of YCbCr and RGB JPEG at 1/8, 1/4 and 1/2 scale, and strips of
+  # grayscale JPEG with a shorter last strip
+  run("${TIFFCP}" -c jpeg:r -t -w 128 -l 128 "${INFILE}" ${o}-jpeg-rgb.tiff)
+  run("${TIFFCP}" -c jpeg -r 40 ${o}-gray128.tiff ${o}-jpeg-gray.tiff)
+  foreach(jpeg "${JPEGFILE}" ${o}-jpeg-rgb.tiff)
+    run("${TIFFCP}" -c none "${jpeg}" ${o}-decoded.tiff)
+    check_level(${jpeg} 64 64 48 3)
+    check_scaled(${o}-decoded.tiff 64 64 3)
+    check_level(${jpeg} 100 100 75 3)
+    check_scaled(${o}-decoded.tiff 100 128 3)
+    check_level(${jpeg} 200 200 150 3)
+    check_scaled(${o}-decoded.tiff 200 256 3)
+  endforeach()
+  run("${TIFFCP}" -c none ${o}-jpeg-gray.tiff ${o}-decoded.tiff)
+  check_level(${o}-jpeg-gray.tiff 20 20 15 1)
+  check_scaled(${o}-decoded.tiff 20 32 1)
+  check_level(${o}-jpeg-gray.tiff 50 50 38 1)
+  check_scaled(${o}-decoded.tiff 50 64 1)
+endif()
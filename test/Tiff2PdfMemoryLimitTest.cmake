@@ -0,0 +1,57 @@
+# CMake tests for libtiff
+#
+# Check that tiff2pdf -m bounds the memory used for a stripped image
+# rather than its size: a 1.5 MiB RGB image converts with -m 1, in 16-row
+# strips and in a single strip, to the same PDF as without a limit, while
+# a single strip of separate planes is refused.
+#
+# RAW2TIFF, TIFFCP, TIFF2PDF - executables
+# OUTDIR - directory of the test files
+
+include(${CMAKE_CURRENT_LIST_DIR}/TiffTestCommon.cmake)
+
+macro(run)
+  message(STATUS "Running ${MEMCHECK} ${ARGN}")
+  execute_process(COMMAND ${MEMCHECK} ${ARGN} RESULT_VARIABLE TEST_STATUS)
+  if(TEST_STATUS)
+    message(FATAL_ERROR "Returned failed status ${TEST_STATUS}!")
+  endif()
+endmacro()
+
+# The PDF of file as hex, without the creation and modification dates
+function(read_pdf var file)
+  file(READ "${file}" hex HEX)
+  string(REGEX REPLACE "28443a(3[0-9])+" "" hex "${hex}")
+  set(${var} "${hex}" PARENT_SCOPE)
+endfunction()
+
+file(MAKE_DIRECTORY "${OUTDIR}")
+set(o "${OUTDIR}/tiff2pdf-memlimit")
+
+# 1024x512 RGB samples: 48 bytes doubled 15 times
+set(data "The quick brown fox jumps over the lazy dog 0123")
+foreach(i RANGE 1 15)
+  set(data "${data}${data}")
+endforeach()
+file(WRITE "${o}.raw" "${data}")
+run("${RAW2TIFF}" -w 1024 -l 512 -b 3 -p rgb "${o}.raw" "${o}-raw.tiff")
+run("${TIFFCP}" -c lzw -r 16 "${o}-raw.tiff" "${o}-strips.tiff")
+run("${TIFFCP}" -c lzw -r 512 "${o}-raw.tiff" "${o}-strip.tiff")
+run("${TIFFCP}" -c lzw -p separate -r 512 "${o}-raw.tiff" "${o}-separate.tiff")
+
+foreach(layout strips strip)
+  run("${TIFF2PDF}" -z -o "${o}-${layout}.pdf" "${o}-${layout}.tiff")
+  run("${TIFF2PDF}" -m 1 -z -o "${o}-${layout}-m1.pdf" "${o}-${layout}.tiff")
+  read_pdf(unlimited "${o}-${layout}.pdf")
+  read_pdf(limited "${o}-${layout}-m1.pdf")
+  if(NOT unlimited STREQUAL limited)
+    message(FATAL_ERROR "${o}-${layout}-m1.pdf differs from ${o}-${layout}.pdf")
+  endif()
+endforeach()
+
+message(STATUS "Running ${MEMCHECK} ${TIFF2PDF} -m 1 -z -o ${o}-separate-m1.pdf ${o}-separate.tiff")
+execute_process(COMMAND ${MEMCHECK} "${TIFF2PDF}" -m 1 -z -o "${o}-separate-m1.pdf" "${o}-separate.tiff"
+                RESULT_VARIABLE TEST_STATUS)
+if(NOT TEST_STATUS)
+  message(FATAL_ERROR "A strip of separate planes larger than -m was accepted")
+endif()
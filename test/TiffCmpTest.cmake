@@ -0,0 +1,81 @@
+# CMake tests for libtiff
+#
+# Check tiffcmp -s on copies of one RGB image with strips, two tilings,
+# both byte orders and separate planes, and on 16-bit images whose strips
+# or tiles hold the same bytes in different byte orders.  Subsampled
+# YCbCr JPEG images of two qualities, tiled and stripped, compare as RGB,
+# while uncompressed subsampled YCbCr images are refused.
+#
+# RAW2TIFF, RGB2YCBCR, TIFFCP, TIFFCMP - executables
+# INFILE - raw data for the image
+# JPEGFILE - optional 512x384 JPEG YCbCr image
+# OUTDIR - directory of the images made from INFILE
+
+include(${CMAKE_CURRENT_LIST_DIR}/TiffTestCommon.cmake)
+
+macro(run)
+  message(STATUS "Running ${MEMCHECK} ${ARGN}")
+  execute_process(COMMAND ${MEMCHECK} ${ARGN} RESULT_VARIABLE TEST_STATUS)
+  if(TEST_STATUS)
+    message(FATAL_ERROR "Returned failed status ${TEST_STATUS}!")
+  endif()
+endmacro()
+
+# tiffcmp -s -t file1 file2 must exit with status and print the
+# optional expected statistics
+macro(compare status file1 file2)
+  message(STATUS "Running ${MEMCHECK} ${TIFFCMP} -s -t ${file1} ${file2}")
+  execute_process(COMMAND ${MEMCHECK} "${TIFFCMP}" -s -t "${file1}" "${file2}"
+                  OUTPUT_VARIABLE CMP_OUTPUT
+                  RESULT_VARIABLE TEST_STATUS)
+  if(NOT TEST_STATUS EQUAL ${status})
+    message(FATAL_ERROR "Returned status ${TEST_STATUS} instead of ${status}!")
+  endif()
+  if(NOT "${ARGN}" STREQUAL "" AND NOT CMP_OUTPUT MATCHES "${ARGN}")
+    message(FATAL_ERROR "Expected \"${ARGN}\" in: ${CMP_OUTPUT}")
+  endif()
+endmacro()
+
+file(MAKE_DIRECTORY "${OUTDIR}")
+set(o "${OUTDIR}/tiffcmp")
+set(raw2tiff_args -H 512 -w 100 -l 70 -d short)
+run("${RAW2TIFF}" ${raw2tiff_args} -b 3 -p rgb "${INFILE}" ${o}-raw.tiff)
+run("${TIFFCP}" -L -r 8 ${o}-raw.tiff ${o}-strip-le.tiff)
+run("${TIFFCP}" -B -r 8 ${o}-raw.tiff ${o}-strip-be.tiff)
+run("${TIFFCP}" -L -t -w 32 -l 16 ${o}-raw.tiff ${o}-tile32x16.tiff)
+run("${TIFFCP}" -B -c lzw -t -w 16 -l 48 ${o}-raw.tiff ${o}-tile16x48.tiff)
+# tiffcp only separates the planes of 8-bit images
+run("${RAW2TIFF}" -H 512 -w 100 -l 70 -b 3 -p rgb "${INFILE}" ${o}-raw8.tiff)
+run("${TIFFCP}" -L -p separate -r 8 ${o}-raw8.tiff ${o}-sep-strip.tiff)
+run("${TIFFCP}" -B -p separate -t -w 32 -l 32 ${o}-raw8.tiff ${o}-sep-tile.tiff)
+# The same bytes, as little-endian and as big-endian samples
+run("${RAW2TIFF}" ${raw2tiff_args} "${INFILE}" ${o}-gray.tiff)
+run("${RAW2TIFF}" ${raw2tiff_args} -s "${INFILE}" ${o}-swapped.tiff)
+run("${TIFFCP}" -L -c none -r 8 ${o}-gray.tiff ${o}-gray-le.tiff)
+run("${TIFFCP}" -B -c none -r 8 ${o}-swapped.tiff ${o}-swapped-be.tiff)
+run("${TIFFCP}" -L -c none -t -w 16 -l 16 ${o}-gray.tiff ${o}-gray-tile-le.tiff)
+run("${TIFFCP}" -B -c none -t -w 16 -l 16 ${o}-swapped.tiff ${o}-swapped-tile-be.tiff)
+
+compare(0 ${o}-strip-le.tiff ${o}-tile32x16.tiff)
+compare(0 ${o}-tile32x16.tiff ${o}-strip-le.tiff)
+compare(0 ${o}-tile32x16.tiff ${o}-tile16x48.tiff)
+compare(0 ${o}-strip-le.tiff ${o}-strip-be.tiff)
+compare(0 ${o}-sep-strip.tiff ${o}-sep-tile.tiff)
+compare(1 ${o}-gray-le.tiff ${o}-swapped-be.tiff " of 7000 samples differ")
+compare(1 ${o}-gray-tile-le.tiff ${o}-swapped-tile-be.tiff " of 7000 samples differ")
+compare(1 ${o}-gray-le.tiff ${o}-swapped-tile-be.tiff " of 7000 samples differ")
+
+run("${RGB2YCBCR}" -c none -h 2 -v 2 ${o}-raw8.tiff ${o}-ycbcr.tiff)
+compare(2 ${o}-ycbcr.tiff ${o}-ycbcr.tiff)
+
+if(JPEGFILE)
+  run("${TIFFCP}" -c jpeg:50 "${JPEGFILE}" ${o}-jpeg50-tile.tiff)
+  run("${TIFFCP}" -c jpeg:90 "${JPEGFILE}" ${o}-jpeg90-tile.tiff)
+  run("${TIFFCP}" -s -r 16 -c jpeg:50 "${JPEGFILE}" ${o}-jpeg50-strip.tiff)
+  run("${TIFFCP}" -s -r 16 -c jpeg:90 "${JPEGFILE}" ${o}-jpeg90-strip.tiff)
+  set(jpeg_stats " of 589824 samples differ, max abs diff [0-9]+, RMSE [0-9.]+, PSNR 3[0-9]\\.")
+  compare(0 ${o}-jpeg90-tile.tiff ${o}-jpeg90-tile.tiff)
+  compare(1 ${o}-jpeg50-tile.tiff ${o}-jpeg90-tile.tiff "${jpeg_stats}")
+  compare(1 ${o}-jpeg50-strip.tiff ${o}-jpeg90-strip.tiff "${jpeg_stats}")
+  compare(1 ${o}-jpeg50-tile.tiff ${o}-jpeg90-strip.tiff "${jpeg_stats}")
+endif()
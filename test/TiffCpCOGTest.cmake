@@ -0,0 +1,146 @@
+# CMake tests for libtiff
+#
+# Check that tiffcp -G writes every IFD and every strip/tile offset and
+# byte count array before the first strip or tile of image data.
+#
+# TIFFCP - tiffcp executable
+# ARGS - tiffcp arguments, separated by ^
+# INFILES - input files, separated by ^
+# OUTFILE - output file
+
+include(${CMAKE_CURRENT_LIST_DIR}/TiffTestCommon.cmake)
+
+string(REPLACE "^" ";" ARGS "${ARGS}")
+string(REPLACE "^" ";" INFILES "${INFILES}")
+test_convert_multi("${TIFFCP};${ARGS}" "${INFILES}" "${OUTFILE}")
+tiffinfo_validate("${OUTFILE}")
+
+# Read an unsigned integer of SIZE bytes at OFFSET in OUTFILE
+function(read_uint var offset size)
+  file(READ "${OUTFILE}" hex OFFSET ${offset} LIMIT ${size} HEX)
+  hex_to_uint(value "${hex}")
+  set(${var} ${value} PARENT_SCOPE)
+endfunction()
+
+# Convert the HEX bytes of one integer, in file byte order, to a number
+function(hex_to_uint var hex)
+  if(little_endian)
+    string(LENGTH "${hex}" len)
+    set(swapped "")
+    set(i 0)
+    while(i LESS len)
+      string(SUBSTRING "${hex}" ${i} 2 byte)
+      set(swapped "${byte}${swapped}")
+      math(EXPR i "${i} + 2")
+    endwhile()
+    set(hex "${swapped}")
+  endif()
+  math(EXPR value "0x${hex}")
+  set(${var} ${value} PARENT_SCOPE)
+endfunction()
+
+file(READ "${OUTFILE}" magic LIMIT 2 HEX)
+if(magic STREQUAL "4949")
+  set(little_endian TRUE)
+elseif(magic STREQUAL "4d4d")
+  set(little_endian FALSE)
+else()
+  message(FATAL_ERROR "${OUTFILE}: not a TIFF file")
+endif()
+read_uint(version 2 2)
+if(version EQUAL 42)
+  set(countsize 2)
+  set(entrysize 12)
+  set(offsetsize 4)
+  read_uint(diroff 4 4)
+elseif(version EQUAL 43)
+  set(countsize 8)
+  set(entrysize 20)
+  set(offsetsize 8)
+  read_uint(diroff 8 8)
+else()
+  message(FATAL_ERROR "${OUTFILE}: unknown TIFF version ${version}")
+endif()
+
+set(indexend 0)      # end of the IFDs and strile arrays seen so far
+set(datastart -1)    # first byte of strip or tile data
+set(ndirs 0)
+while(diroff GREATER 0)
+  read_uint(dircount ${diroff} ${countsize})
+  math(EXPR entry "${diroff} + ${countsize}")
+  math(EXPR nextoff "${entry} + ${dircount} * ${entrysize}")
+  math(EXPR dirend "${nextoff} + ${offsetsize}")
+  if(dirend GREATER indexend)
+    set(indexend ${dirend})
+  endif()
+  unset(offsets_hex)
+  unset(counts_hex)
+  foreach(i RANGE 1 ${dircount})
+    read_uint(tag ${entry} 2)
+    if(tag EQUAL 273 OR tag EQUAL 279 OR tag EQUAL 324 OR tag EQUAL 325)
+      math(EXPR typeoff "${entry} + 2")
+      math(EXPR countoff "${entry} + 4")
+      math(EXPR valueoff "${entry} + 4 + ${offsetsize}")
+      read_uint(type ${typeoff} 2)
+      read_uint(count ${countoff} ${offsetsize})
+      if(type EQUAL 3)
+        set(typesize 2)
+      elseif(type EQUAL 4)
+        set(typesize 4)
+      elseif(type EQUAL 16)
+        set(typesize 8)
+      else()
+        message(FATAL_ERROR "${OUTFILE}: tag ${tag} has type ${type}")
+      endif()
+      math(EXPR arraysize "${count} * ${typesize}")
+      if(arraysize GREATER offsetsize)
+        read_uint(arrayoff ${valueoff} ${offsetsize})
+        math(EXPR arrayend "${arrayoff} + ${arraysize}")
+        if(arrayend GREATER indexend)
+          set(indexend ${arrayend})
+        endif()
+      else()
+        set(arrayoff ${valueoff})
+      endif()
+      file(READ "${OUTFILE}" hex OFFSET ${arrayoff} LIMIT ${arraysize} HEX)
+      if(tag EQUAL 273 OR tag EQUAL 324)
+        set(offsets_hex "${hex}")
+        set(offsets_size ${typesize})
+      else()
+        set(counts_hex "${hex}")
+        set(counts_size ${typesize})
+      endif()
+    endif()
+    math(EXPR entry "${entry} + ${entrysize}")
+  endforeach()
+  if(NOT DEFINED offsets_hex OR NOT DEFINED counts_hex)
+    message(FATAL_ERROR "${OUTFILE}: IFD at ${diroff} has no strile arrays")
+  endif()
+  # The first byte of data of every non-empty strip or tile
+  string(LENGTH "${offsets_hex}" len)
+  math(EXPR nstriles "${len} / (2 * ${offsets_size})")
+  math(EXPR last "${nstriles} - 1")
+  foreach(i RANGE ${last})
+    math(EXPR pos "${i} * 2 * ${offsets_size}")
+    math(EXPR width "2 * ${offsets_size}")
+    string(SUBSTRING "${offsets_hex}" ${pos} ${width} hex)
+    hex_to_uint(stripoff "${hex}")
+    math(EXPR pos "${i} * 2 * ${counts_size}")
+    math(EXPR width "2 * ${counts_size}")
+    string(SUBSTRING "${counts_hex}" ${pos} ${width} hex)
+    hex_to_uint(stripsize "${hex}")
+    if(stripsize GREATER 0 AND (datastart LESS 0 OR stripoff LESS datastart))
+      set(datastart ${stripoff})
+    endif()
+  endforeach()
+  math(EXPR ndirs "${ndirs} + 1")
+  read_uint(diroff ${nextoff} ${offsetsize})
+endwhile()
+
+if(datastart LESS 0)
+  message(FATAL_ERROR "${OUTFILE}: no image data")
+endif()
+if(indexend GREATER datastart)
+  message(FATAL_ERROR "${OUTFILE}: IFDs and strile arrays end at ${indexend}, after the image data at ${datastart}")
+endif()
+message(STATUS "${ndirs} IFDs and their strile arrays end at ${indexend}, image data starts at ${datastart}")
@@ -0,0 +1,35 @@
+# CMake tests for libtiff
+#
+# Check that tiffcp -c jpeg:t copies DCT coefficients without loss: the
+# input re-tiled or stripped, then transcoded back to its own tiling,
+# decodes to exactly the samples of the input.
+#
+# TIFFCP, TIFFINFO, TIFFCMP - executables
+# INFILE - JPEG image with 128x128 tiles
+# OUTDIR - directory of the test files
+
+include(${CMAKE_CURRENT_LIST_DIR}/TiffTestCommon.cmake)
+
+macro(run)
+  message(STATUS "Running ${MEMCHECK} ${ARGN}")
+  execute_process(COMMAND ${MEMCHECK} ${ARGN} RESULT_VARIABLE TEST_STATUS)
+  if(TEST_STATUS)
+    message(FATAL_ERROR "Returned failed status ${TEST_STATUS}!")
+  endif()
+endmacro()
+
+# Transcode INFILE with the layout options in ARGN, and back
+macro(round_trip name)
+  run("${TIFFCP}" -c jpeg:t ${ARGN} "${INFILE}" "${o}-${name}.tiff")
+  run("${TIFFINFO}" -D "${o}-${name}.tiff")
+  run("${TIFFCP}" -c jpeg:t -t -w 128 -l 128 "${o}-${name}.tiff" "${o}-${name}-back.tiff")
+  run("${TIFFCMP}" -s -t "${INFILE}" "${o}-${name}-back.tiff")
+endmacro()
+
+file(MAKE_DIRECTORY "${OUTDIR}")
+set(o "${OUTDIR}/tiffcp-jpegtranscode")
+
+round_trip(tiles -t -w 256 -l 256)
+# Input tiles spanning several output strips or tiles
+round_trip(strips -s -r 48)
+round_trip(retile -t -w 192 -l 80)
@@ -0,0 +1,46 @@
+# CMake tests for libtiff
+#
+# Check that tiffcp recompresses JPEG YCbCr images, tiled and stripped,
+# to images that decode close to the input: the largest difference
+# between the RGB samples of input and output stays within MAXDIFF.
+#
+# TIFFCP, TIFF2RGBA, TIFFCMP - executables
+# INFILE - tiled JPEG YCbCr image
+# OUTDIR - directory of the test files
+# MAXDIFF - largest accepted sample difference
+
+include(${CMAKE_CURRENT_LIST_DIR}/TiffTestCommon.cmake)
+
+macro(run)
+  message(STATUS "Running ${MEMCHECK} ${ARGN}")
+  execute_process(COMMAND ${MEMCHECK} ${ARGN} RESULT_VARIABLE TEST_STATUS)
+  if(TEST_STATUS)
+    message(FATAL_ERROR "Returned failed status ${TEST_STATUS}!")
+  endif()
+endmacro()
+
+# Decode file1 and file2 to RGB and check their largest sample difference
+macro(compare_decoded file1 file2)
+  run("${TIFF2RGBA}" -n "${file1}" "${o}-rgb1.tiff")
+  run("${TIFF2RGBA}" -n "${file2}" "${o}-rgb2.tiff")
+  message(STATUS "Running ${MEMCHECK} ${TIFFCMP} -s -t ${o}-rgb1.tiff ${o}-rgb2.tiff")
+  execute_process(COMMAND ${MEMCHECK} "${TIFFCMP}" -s -t "${o}-rgb1.tiff" "${o}-rgb2.tiff"
+                  OUTPUT_VARIABLE CMP_OUTPUT)
+  if(CMP_OUTPUT MATCHES "max abs diff ([0-9]+)")
+    if(CMAKE_MATCH_1 GREATER ${MAXDIFF})
+      message(FATAL_ERROR "${file2} decodes up to ${CMAKE_MATCH_1} away from ${file1}")
+    endif()
+  elseif(NOT CMP_OUTPUT STREQUAL "")
+    message(FATAL_ERROR "Unexpected tiffcmp output: ${CMP_OUTPUT}")
+  endif()
+endmacro()
+
+file(MAKE_DIRECTORY "${OUTDIR}")
+set(o "${OUTDIR}/tiffcp-jpeg-ycbcr")
+
+run("${TIFFCP}" -c jpeg:90 "${INFILE}" "${o}-tiles.tiff")
+compare_decoded("${INFILE}" "${o}-tiles.tiff")
+
+run("${TIFFCP}" -s -r 16 -c jpeg:90 "${INFILE}" "${o}-strips-in.tiff")
+run("${TIFFCP}" -c jpeg:90 "${o}-strips-in.tiff" "${o}-strips.tiff")
+compare_decoded("${o}-strips-in.tiff" "${o}-strips.tiff")
@@ -0,0 +1,68 @@
+# CMake tests for libtiff
+#
+# Check that tiffcp copies the compressed strips or tiles of INFILE as
+# they are: each one in OUTFILE holds the same bytes, and the images
+# decode the same, so any codec tags needed came along.
+#
+# TIFFCP, TIFFINFO, TIFFCMP - executables
+# ARGS - tiffcp arguments, separated by ^
+# INFILE, OUTFILE - input and output images
+
+include(${CMAKE_CURRENT_LIST_DIR}/TiffTestCommon.cmake)
+
+macro(run)
+  message(STATUS "Running ${MEMCHECK} ${ARGN}")
+  execute_process(COMMAND ${MEMCHECK} ${ARGN} RESULT_VARIABLE TEST_STATUS)
+  if(TEST_STATUS)
+    message(FATAL_ERROR "Returned failed status ${TEST_STATUS}!")
+  endif()
+endmacro()
+
+# The "offset,bytecount" pairs of the strips or tiles of file
+function(read_striles var file)
+  message(STATUS "Running ${MEMCHECK} ${TIFFINFO} -s ${file}")
+  execute_process(COMMAND ${MEMCHECK} "${TIFFINFO}" -s "${file}"
+                  OUTPUT_VARIABLE INFO_OUTPUT
+                  RESULT_VARIABLE TEST_STATUS)
+  if(TEST_STATUS)
+    message(FATAL_ERROR "Returned failed status ${TEST_STATUS}!")
+  endif()
+  string(REGEX MATCHALL "[0-9]+: \\[ *[0-9]+, *[0-9]+\\]" entries "${INFO_OUTPUT}")
+  set(striles)
+  foreach(entry ${entries})
+    string(REGEX REPLACE "[0-9]+: \\[ *([0-9]+), *([0-9]+)\\]" "\\1,\\2" entry "${entry}")
+    list(APPEND striles "${entry}")
+  endforeach()
+  set(${var} "${striles}" PARENT_SCOPE)
+endfunction()
+
+string(REPLACE "^" ";" ARGS "${ARGS}")
+run("${TIFFCP}" ${ARGS} "${INFILE}" "${OUTFILE}")
+run("${TIFFCMP}" -s -t "${INFILE}" "${OUTFILE}")
+
+read_striles(in_striles "${INFILE}")
+read_striles(out_striles "${OUTFILE}")
+list(LENGTH in_striles n)
+list(LENGTH out_striles n_out)
+if(n EQUAL 0 OR NOT n EQUAL n_out)
+  message(FATAL_ERROR "${n_out} strips or tiles in ${OUTFILE} for ${n} in ${INFILE}")
+endif()
+math(EXPR last "${n} - 1")
+foreach(i RANGE ${last})
+  list(GET in_striles ${i} in_strile)
+  list(GET out_striles ${i} out_strile)
+  string(REPLACE "," ";" in_strile "${in_strile}")
+  string(REPLACE "," ";" out_strile "${out_strile}")
+  list(GET in_strile 0 in_offset)
+  list(GET in_strile 1 in_count)
+  list(GET out_strile 0 out_offset)
+  list(GET out_strile 1 out_count)
+  if(NOT in_count EQUAL out_count)
+    message(FATAL_ERROR "Strip or tile ${i}: ${out_count} bytes for ${in_count}")
+  endif()
+  file(READ "${INFILE}" in_bytes OFFSET ${in_offset} LIMIT ${in_count} HEX)
+  file(READ "${OUTFILE}" out_bytes OFFSET ${out_offset} LIMIT ${out_count} HEX)
+  if(NOT in_bytes STREQUAL out_bytes)
+    message(FATAL_ERROR "Strip or tile ${i} differs")
+  endif()
+endforeach()
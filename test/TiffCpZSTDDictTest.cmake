@@ -0,0 +1,62 @@
+# CMake tests for libtiff
+#
+# Check that tiffcp -c zstd:d trains a ZSTD dictionary for tiles and
+# strips, with and without predictor, in either byte order, for 1-bit
+# samples, for separate planes and for tiles larger than the training
+# data, and that the output decodes to the input.
+#
+# RAW2TIFF, TIFFCP, TIFFINFO, TIFFCMP - executables
+# IMAGES - directory of the test images
+# OUTDIR - directory of the test files
+
+include(${CMAKE_CURRENT_LIST_DIR}/TiffTestCommon.cmake)
+
+macro(run)
+  message(STATUS "Running ${MEMCHECK} ${ARGN}")
+  execute_process(COMMAND ${MEMCHECK} ${ARGN} RESULT_VARIABLE TEST_STATUS)
+  if(TEST_STATUS)
+    message(FATAL_ERROR "Returned failed status ${TEST_STATUS}!")
+  endif()
+endmacro()
+
+# tiffcp ARGN infile to outfile, which must hold a dictionary and decode
+# to the samples of infile.  compared is outfile, or else the contig copy
+# of outfile to compare with infile.
+macro(check_dict infile outfile compared)
+  run("${TIFFCP}" ${ARGN} "${infile}" "${outfile}")
+  message(STATUS "Running ${MEMCHECK} ${TIFFINFO} ${outfile}")
+  execute_process(COMMAND ${MEMCHECK} "${TIFFINFO}" "${outfile}"
+                  OUTPUT_VARIABLE INFO_OUTPUT
+                  RESULT_VARIABLE TEST_STATUS)
+  if(TEST_STATUS OR NOT INFO_OUTPUT MATCHES "ZSTD Dictionary: \\([1-9][0-9]* bytes\\)")
+    message(FATAL_ERROR "No ZSTD dictionary in ${outfile}: ${INFO_OUTPUT}")
+  endif()
+  if(NOT "${compared}" STREQUAL "${outfile}")
+    run("${TIFFCP}" -p contig "${outfile}" "${compared}")
+  endif()
+  run("${TIFFCMP}" -s -t "${infile}" "${compared}")
+endmacro()
+
+file(MAKE_DIRECTORY "${OUTDIR}")
+set(o "${OUTDIR}/tiffcp-zstddict")
+
+check_dict("${IMAGES}/rgb-3c-8b.tiff" ${o}-tiles.tiff ${o}-tiles.tiff
+           -c zstd:d4 -t -w 16 -l 16)
+check_dict("${IMAGES}/rgb-3c-8b.tiff" ${o}-pred.tiff ${o}-pred.tiff
+           -c zstd:2:d4 -t -w 16 -l 16)
+check_dict("${IMAGES}/rgb-3c-16b.tiff" ${o}-be.tiff ${o}-be.tiff
+           -B -c zstd:2:d4 -r 4)
+check_dict("${IMAGES}/miniswhite-1c-1b.tiff" ${o}-1b.tiff ${o}-1b.tiff
+           -c zstd:d4 -t -w 16 -l 16)
+check_dict("${IMAGES}/rgb-3c-8b.tiff" ${o}-sep.tiff ${o}-sep-contig.tiff
+           -p separate -c zstd:2:d4 -t -w 16 -l 16)
+
+# Two 512x512 RGB tiles, each larger than the training data for 4 KiB
+set(data "The quick brown fox jumps over the lazy dog 0123")
+foreach(i RANGE 1 15)
+  set(data "${data}${data}")
+endforeach()
+file(WRITE "${o}.raw" "${data}")
+run("${RAW2TIFF}" -w 1024 -l 512 -b 3 -p rgb "${o}.raw" "${o}-raw.tiff")
+check_dict("${o}-raw.tiff" ${o}-large.tiff ${o}-large.tiff
+           -c zstd:d4 -t -w 512 -l 512)
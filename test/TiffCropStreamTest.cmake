@@ -0,0 +1,25 @@
+# CMake tests for libtiff
+#
+# Check that tiffcrop -T, which crops and rotates an image one output
+# strip or tile at a time, writes the same pixels as the whole image path.
+#
+# TIFFCROP, TIFFINFO, TIFFCMP - executables
+# ARGS - tiffcrop arguments, separated by ^
+# INFILE, OUTFILE - input and output images
+
+include(${CMAKE_CURRENT_LIST_DIR}/TiffTestCommon.cmake)
+
+macro(run)
+  message(STATUS "Running ${MEMCHECK} ${ARGN}")
+  execute_process(COMMAND ${MEMCHECK} ${ARGN} RESULT_VARIABLE TEST_STATUS)
+  if(TEST_STATUS)
+    message(FATAL_ERROR "Returned failed status ${TEST_STATUS}!")
+  endif()
+endmacro()
+
+string(REPLACE "^" ";" ARGS "${ARGS}")
+string(REGEX REPLACE "\\.tiff$" "-whole.tiff" WHOLEFILE "${OUTFILE}")
+run("${TIFFCROP}" -T 1 ${ARGS} "${INFILE}" "${OUTFILE}")
+run("${TIFFINFO}" -D "${OUTFILE}")
+run("${TIFFCROP}" ${ARGS} "${INFILE}" "${WHOLEFILE}")
+run("${TIFFCMP}" -s -t "${WHOLEFILE}" "${OUTFILE}")
@@ -0,0 +1,38 @@
+# CMake tests for libtiff
+#
+# Check that tiffinfo -J prints one well-formed JSON object for INFILE,
+# holding the keys every directory must have.  When EXPECT is set, the
+# output must also contain it.
+
+include(${CMAKE_CURRENT_LIST_DIR}/TiffTestCommon.cmake)
+
+file(TO_NATIVE_PATH "${INFILE}" native_infile)
+message(STATUS "Running ${MEMCHECK} ${TIFFINFO} -J ${native_infile}")
+execute_process(COMMAND ${MEMCHECK} "${TIFFINFO}" -J "${native_infile}"
+                OUTPUT_VARIABLE JSON_OUTPUT
+                RESULT_VARIABLE TEST_STATUS)
+if(TEST_STATUS)
+  message(FATAL_ERROR "Returned failed status ${TEST_STATUS}!")
+endif()
+
+# The subset of JSON tiffinfo -J uses: flat objects in one array.  Reduce
+# strings to S and numbers to N, then check the structure.
+string(REGEX REPLACE "\"([^\"\\]|\\.)*\"" "S" json "${JSON_OUTPUT}")
+string(REGEX REPLACE "-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?" "N" json "${json}")
+set(json_value "(N|S|true|false|null)")
+set(json_object "{S:${json_value}(,S:${json_value})*}")
+if(NOT json MATCHES "^{S:S,S:(true|false),S:\\[${json_object}(,${json_object})*\\]}\n$")
+  message(FATAL_ERROR "Not a valid tiffinfo -J line: ${JSON_OUTPUT}")
+endif()
+foreach(key index offset width length subfiletype bitspersample
+            samplesperpixel planarconfig compression)
+  if(NOT JSON_OUTPUT MATCHES "\"${key}\":")
+    message(FATAL_ERROR "Key \"${key}\" missing in: ${JSON_OUTPUT}")
+  endif()
+endforeach()
+if(EXPECT)
+  string(FIND "${JSON_OUTPUT}" "${EXPECT}" found)
+  if(found EQUAL -1)
+    message(FATAL_ERROR "${EXPECT} missing in: ${JSON_OUTPUT}")
+  endif()
+endif()
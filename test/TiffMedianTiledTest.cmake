@@ -0,0 +1,32 @@
+# CMake tests for libtiff
+#
+# Check that tiffmedian writes the same file from a tiled copy of INFILE
+# as from a stripped one: the histogram, colormap and quantized (or
+# dithered) pixels do not depend on the input layout.
+#
+# TIFFCP, TIFFINFO, TIFFMEDIAN - executables
+# ARGS - tiffmedian arguments, separated by ^
+# INFILE, OUTFILE - input and output images
+
+include(${CMAKE_CURRENT_LIST_DIR}/TiffTestCommon.cmake)
+
+macro(run)
+  message(STATUS "Running ${MEMCHECK} ${ARGN}")
+  execute_process(COMMAND ${MEMCHECK} ${ARGN} RESULT_VARIABLE TEST_STATUS)
+  if(TEST_STATUS)
+    message(FATAL_ERROR "Returned failed status ${TEST_STATUS}!")
+  endif()
+endmacro()
+
+string(REPLACE "^" ";" ARGS "${ARGS}")
+string(REGEX REPLACE "\\.tiff$" "" o "${OUTFILE}")
+run("${TIFFCP}" -c none "${INFILE}" "${o}-strips-in.tiff")
+run("${TIFFCP}" -c none -t -w 32 -l 16 "${INFILE}" "${o}-tiles-in.tiff")
+run("${TIFFMEDIAN}" ${ARGS} "${o}-strips-in.tiff" "${o}-strips.tiff")
+run("${TIFFMEDIAN}" ${ARGS} "${o}-tiles-in.tiff" "${OUTFILE}")
+run("${TIFFINFO}" -D "${OUTFILE}")
+file(READ "${o}-strips.tiff" strips HEX)
+file(READ "${OUTFILE}" tiles HEX)
+if(NOT strips STREQUAL tiles)
+  message(FATAL_ERROR "${OUTFILE} differs from ${o}-strips.tiff")
+endif()
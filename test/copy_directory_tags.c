@@ -0,0 +1,223 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that (i) the above copyright notices and this permission notice appear in
+ * all copies of the software and related documentation, and (ii) the names of
+ * Sam Leffler and Silicon Graphics may not be used in any advertising or
+ * publicity relating to the software without the specific, prior written
+ * permission of Sam Leffler and Silicon Graphics.
+ *
+ * THE SOFTWARE IS PROVIDED "AS-IS" AND WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS, IMPLIED OR OTHERWISE, INCLUDING WITHOUT LIMITATION, ANY
+ * WARRANTY OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * IN NO EVENT SHALL SAM LEFFLER OR SILICON GRAPHICS BE LIABLE FOR
+ * ANY SPECIAL, INCIDENTAL, INDIRECT OR CONSEQUENTIAL DAMAGES OF ANY KIND,
+ * OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+ * WHETHER OR NOT ADVISED OF THE POSSIBILITY OF DAMAGE, AND ON ANY THEORY OF
+ * LIABILITY, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * TIFF Library
+ *
+ * Module to test TIFFCopyDirectoryTags(): the tags of a directory read from
+ * a file are copied to a new one, but for those excluded, and the new file
+ * is read back.  Excluding a codec tag of another codec must not drop the
+ * Predictor, which shares its field bit, and a private tag that the new
+ * file defines with another type must be left out.
+ */
+
+#include "tif_config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "tiffio.h"
+
+#define WIDTH		64
+#define LENGTH		32
+#define SOFTWARE	"copy_directory_tags"
+#define DESCRIPTION	"not copied"
+#define TAG_COPIED	65200		/* private tags */
+#define TAG_RETYPED	65201
+
+static const TIFFFieldInfo infieldinfo[] = {
+	{ TAG_COPIED, 1, 1, TIFF_LONG, FIELD_CUSTOM, 1, 0, "Copied" },
+	{ TAG_RETYPED, 1, 1, TIFF_LONG, FIELD_CUSTOM, 1, 0, "Retyped" },
+};
+
+/* out knows TAG_RETYPED as a string */
+static const TIFFFieldInfo outfieldinfo[] = {
+	{ TAG_RETYPED, -1, -1, TIFF_ASCII, FIELD_CUSTOM, 1, 0, "Retyped" },
+};
+
+static uint16_t red[256], green[256], blue[256];
+
+static int
+write_strip(TIFF* tif, uint32_t width, uint32_t length)
+{
+	unsigned char buf[WIDTH * LENGTH];
+	uint32_t i;
+
+	for (i = 0; i < width * length; i++)
+		buf[i] = (unsigned char) i;
+	if (TIFFWriteEncodedStrip(tif, 0, buf, width * length) < 0 ||
+	    !TIFFWriteDirectory(tif)) {
+		fprintf(stderr, "Can't write %s\n", TIFFFileName(tif));
+		return 0;
+	}
+	return 1;
+}
+
+static int
+write_source(const char* filename)
+{
+	TIFF* tif = TIFFOpen(filename, "w");
+	uint32_t copied = 42, retyped = 43;
+	int i;
+
+	if (!tif) {
+		fprintf(stderr, "Can't create %s\n", filename);
+		return 0;
+	}
+	for (i = 0; i < 256; i++) {
+		red[i] = (uint16_t) (i * 257);
+		green[i] = (uint16_t) (65535 - i * 257);
+		blue[i] = (uint16_t) (i * 100);
+	}
+	if (TIFFMergeFieldInfo(tif, infieldinfo, 2) != 0 ||
+	    !TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, WIDTH) ||
+	    !TIFFSetField(tif, TIFFTAG_IMAGELENGTH, LENGTH) ||
+	    !TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8) ||
+	    !TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1) ||
+	    !TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_PALETTE) ||
+	    !TIFFSetField(tif, TIFFTAG_COLORMAP, red, green, blue) ||
+	    !TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_LZW) ||
+	    !TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL) ||
+	    !TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, LENGTH) ||
+	    !TIFFSetField(tif, TIFFTAG_XRESOLUTION, 300.0) ||
+	    !TIFFSetField(tif, TIFFTAG_YRESOLUTION, 150.0) ||
+	    !TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH) ||
+	    !TIFFSetField(tif, TIFFTAG_PAGENUMBER, 2, 5) ||
+	    !TIFFSetField(tif, TIFFTAG_SOFTWARE, SOFTWARE) ||
+	    !TIFFSetField(tif, TIFFTAG_IMAGEDESCRIPTION, DESCRIPTION) ||
+	    !TIFFSetField(tif, TAG_COPIED, copied) ||
+	    !TIFFSetField(tif, TAG_RETYPED, retyped) ||
+	    !write_strip(tif, WIDTH, LENGTH)) {
+		TIFFClose(tif);
+		return 0;
+	}
+	TIFFClose(tif);
+	return 1;
+}
+
+static int
+check_copy(const char* filename, uint32_t width)
+{
+	TIFF* tif = TIFFOpen(filename, "r");
+	uint16_t *r, *g, *b, v16, page, npages;
+	uint32_t v32, count, *p;
+	float xres, yres;
+	char* s;
+
+	if (!tif) {
+		fprintf(stderr, "Can't open %s\n", filename);
+		return 0;
+	}
+	if (!TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &v32) || v32 != width ||
+	    !TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &v16) ||
+	    v16 != PHOTOMETRIC_PALETTE ||
+	    !TIFFGetField(tif, TIFFTAG_COLORMAP, &r, &g, &b) ||
+	    memcmp(r, red, sizeof(red)) != 0 ||
+	    memcmp(g, green, sizeof(green)) != 0 ||
+	    memcmp(b, blue, sizeof(blue)) != 0 ||
+	    !TIFFGetField(tif, TIFFTAG_COMPRESSION, &v16) ||
+	    v16 != COMPRESSION_LZW ||
+	    !TIFFGetField(tif, TIFFTAG_PREDICTOR, &v16) ||
+	    v16 != PREDICTOR_HORIZONTAL ||
+	    !TIFFGetField(tif, TIFFTAG_XRESOLUTION, &xres) || xres != 300 ||
+	    !TIFFGetField(tif, TIFFTAG_YRESOLUTION, &yres) || yres != 150 ||
+	    !TIFFGetField(tif, TIFFTAG_PAGENUMBER, &page, &npages) ||
+	    page != 2 || npages != 5 ||
+	    !TIFFGetField(tif, TIFFTAG_SOFTWARE, &s) ||
+	    strcmp(s, SOFTWARE) != 0 ||
+	    TIFFGetField(tif, TIFFTAG_IMAGEDESCRIPTION, &s) ||
+	    !TIFFGetField(tif, TAG_COPIED, &count, &p) ||
+	    count != 1 || p[0] != 42 ||
+	    TIFFFindField(tif, TAG_RETYPED, TIFF_ANY)) {
+		fprintf(stderr, "%s: wrong tags\n", filename);
+		TIFFClose(tif);
+		return 0;
+	}
+	TIFFClose(tif);
+	return 1;
+}
+
+static int
+test(uint32_t width)
+{
+	const char* source = "copy_directory_tags_in.tif";
+	const char* filename = "copy_directory_tags.tif";
+	/* JPEGTables has the field bit of Predictor */
+	uint32_t exclude[3] = { TIFFTAG_IMAGEDESCRIPTION, TIFFTAG_JPEGTABLES,
+				TIFFTAG_IMAGEWIDTH };
+	TIFF *in, *out;
+
+	if (!write_source(source))
+		return 1;
+	in = TIFFOpen(source, "r");
+	if (!in) {
+		fprintf(stderr, "Can't open %s\n", source);
+		return 1;
+	}
+	out = TIFFOpen(filename, "w");
+	if (!out) {
+		fprintf(stderr, "Can't create %s\n", filename);
+		TIFFClose(in);
+		return 1;
+	}
+	/* Excluding ImageWidth also excludes ImageLength */
+	if (TIFFMergeFieldInfo(out, outfieldinfo, 1) != 0 ||
+	    !TIFFCopyDirectoryTags(in, out, exclude, width == WIDTH ? 2 : 3) ||
+	    (width != WIDTH &&
+	     (!TIFFSetField(out, TIFFTAG_IMAGEWIDTH, width) ||
+	      !TIFFSetField(out, TIFFTAG_IMAGELENGTH, LENGTH))) ||
+	    !write_strip(out, width, LENGTH)) {
+		fprintf(stderr, "Can't copy the tags of %s\n", source);
+		TIFFClose(out);
+		TIFFClose(in);
+		return 1;
+	}
+	TIFFClose(out);
+	TIFFClose(in);
+	if (!check_copy(filename, width))
+		return 1;
+	unlink(source);
+	unlink(filename);
+	return 0;
+}
+
+int
+main(void)
+{
+	int ret = 0;
+
+	ret += test(WIDTH);
+	ret += test(WIDTH / 2);
+	return ret;
+}
+
+/* vim: set ts=8 sts=8 sw=8 noet: */
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 8
+ * fill-column: 78
+ * End:
+ */
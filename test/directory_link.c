@@ -0,0 +1,180 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that (i) the above copyright notices and this permission notice appear in
+ * all copies of the software and related documentation, and (ii) the names of
+ * Sam Leffler and Silicon Graphics may not be used in any advertising or
+ * publicity relating to the software without the specific, prior written
+ * permission of Sam Leffler and Silicon Graphics.
+ *
+ * THE SOFTWARE IS PROVIDED "AS-IS" AND WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS, IMPLIED OR OTHERWISE, INCLUDING WITHOUT LIMITATION, ANY
+ * WARRANTY OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * IN NO EVENT SHALL SAM LEFFLER OR SILICON GRAPHICS BE LIABLE FOR
+ * ANY SPECIAL, INCIDENTAL, INDIRECT OR CONSEQUENTIAL DAMAGES OF ANY KIND,
+ * OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+ * WHETHER OR NOT ADVISED OF THE POSSIBILITY OF DAMAGE, AND ON ANY THEORY OF
+ * LIABILITY, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * TIFF Library
+ *
+ * Module to test the linking of directories into the chain: many
+ * directories written in a row, rewrites of the last one, and appending
+ * to an existing file.
+ */
+
+#include "tif_config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "tiffio.h"
+
+#define NDIRS 300
+
+static int
+write_directory(TIFF* tif, uint32_t width, int rewrite)
+{
+	unsigned char buf[NDIRS];
+
+	memset(buf, (int) (width & 0xff), sizeof(buf));
+	if (!TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width) ||
+	    !TIFFSetField(tif, TIFFTAG_IMAGELENGTH, 1) ||
+	    !TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8) ||
+	    !TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1) ||
+	    !TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK) ||
+	    !TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, 1)) {
+		fprintf(stderr, "Can't set fields of directory %u\n",
+			(unsigned) width);
+		return 0;
+	}
+	if (TIFFWriteEncodedStrip(tif, 0, buf, width) < 0) {
+		fprintf(stderr, "Can't write strip of directory %u\n",
+			(unsigned) width);
+		return 0;
+	}
+	if (rewrite) {
+		/*
+		 * Flush the directory, then change it so that it moves to
+		 * the end of the file.
+		 */
+		if (!TIFFCheckpointDirectory(tif) ||
+		    !TIFFSetField(tif, TIFFTAG_IMAGEDESCRIPTION,
+				  "rewritten directory") ||
+		    !TIFFRewriteDirectory(tif)) {
+			fprintf(stderr, "Can't rewrite directory %u\n",
+				(unsigned) width);
+			return 0;
+		}
+	} else if (!TIFFWriteDirectory(tif)) {
+		fprintf(stderr, "Can't write directory %u\n", (unsigned) width);
+		return 0;
+	}
+	return 1;
+}
+
+static int
+check_file(const char* filename, int ndirs)
+{
+	TIFF* tif = TIFFOpen(filename, "r");
+	int i;
+
+	if (!tif) {
+		fprintf(stderr, "Can't open %s\n", filename);
+		return 0;
+	}
+	if (TIFFNumberOfDirectories(tif) != ndirs) {
+		fprintf(stderr, "%s: %u directories instead of %d\n", filename,
+			(unsigned) TIFFNumberOfDirectories(tif), ndirs);
+		TIFFClose(tif);
+		return 0;
+	}
+	for (i = 0; i < ndirs; i++) {
+		uint32_t width = 0;
+		unsigned char buf[NDIRS];
+
+		if (!TIFFSetDirectory(tif, (uint16_t) i) ||
+		    !TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width) ||
+		    width != (uint32_t) (i + 1) ||
+		    TIFFReadEncodedStrip(tif, 0, buf, width) != (tmsize_t) width ||
+		    buf[0] != (unsigned char) (width & 0xff) ||
+		    buf[width - 1] != (unsigned char) (width & 0xff)) {
+			fprintf(stderr, "%s: directory %d is wrong\n",
+				filename, i);
+			TIFFClose(tif);
+			return 0;
+		}
+	}
+	TIFFClose(tif);
+	return 1;
+}
+
+static int
+test(const char* mode)
+{
+	const char* filename = "directory_link.tif";
+	TIFF* tif;
+	uint32_t i;
+
+	tif = TIFFOpen(filename, mode);
+	if (!tif) {
+		fprintf(stderr, "Can't create %s\n", filename);
+		return 1;
+	}
+	for (i = 1; i <= NDIRS / 2; i++) {
+		/* Now and then, rewrite the last directory before the next */
+		if (!write_directory(tif, i, i % 7 == 0)) {
+			TIFFClose(tif);
+			return 1;
+		}
+	}
+	TIFFClose(tif);
+	if (!check_file(filename, NDIRS / 2))
+		return 1;
+
+	/* Append the other half to the existing chain */
+	tif = TIFFOpen(filename, "a");
+	if (!tif) {
+		fprintf(stderr, "Can't open %s for appending\n", filename);
+		return 1;
+	}
+	for (; i <= NDIRS; i++) {
+		if (!write_directory(tif, i, i % 5 == 0)) {
+			TIFFClose(tif);
+			return 1;
+		}
+	}
+	TIFFClose(tif);
+	if (!check_file(filename, NDIRS))
+		return 1;
+
+	unlink(filename);
+	return 0;
+}
+
+int
+main(void)
+{
+	int ret = 0;
+
+	ret += test("w");
+	ret += test("w8");
+	return ret;
+}
+
+/* vim: set ts=8 sts=8 sw=8 noet: */
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 8
+ * fill-column: 78
+ * End:
+ */
@@ -0,0 +1,221 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that (i) the above copyright notices and this permission notice appear in
+ * all copies of the software and related documentation, and (ii) the names of
+ * Sam Leffler and Silicon Graphics may not be used in any advertising or
+ * publicity relating to the software without the specific, prior written
+ * permission of Sam Leffler and Silicon Graphics.
+ *
+ * THE SOFTWARE IS PROVIDED "AS-IS" AND WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS, IMPLIED OR OTHERWISE, INCLUDING WITHOUT LIMITATION, ANY
+ * WARRANTY OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * IN NO EVENT SHALL SAM LEFFLER OR SILICON GRAPHICS BE LIABLE FOR
+ * ANY SPECIAL, INCIDENTAL, INDIRECT OR CONSEQUENTIAL DAMAGES OF ANY KIND,
+ * OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+ * WHETHER OR NOT ADVISED OF THE POSSIBILITY OF DAMAGE, AND ON ANY THEORY OF
+ * LIABILITY, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+
+/*
+ * TIFF Library
+ *
+ * Module to test the reading of directories with many custom tags, whose
+ * values come from the bytes read along with the directory and are kept in
+ * its arena: with and without memory mapping, for a directory larger than
+ * what is read at once, and for values beyond it.
+ */
+
+#include "tif_config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "tiffio.h"
+
+#define NSMALL		1400	/* more entries than read at once */
+#define TAG_SMALL	60000	/* NSMALL ASCII tags from there */
+#define TAG_LONGS	62000
+#define NLONGS		300
+#define TAG_BIG		62001
+#define BIGSIZE		20000
+
+static TIFFFieldInfo fieldinfo[NSMALL + 2];
+static char names[NSMALL][16];
+static char big[BIGSIZE];
+static TIFFExtendProc parent;
+
+static void
+extender(TIFF* tif)
+{
+	TIFFMergeFieldInfo(tif, fieldinfo, NSMALL + 2);
+	if (parent)
+		(*parent)(tif);
+}
+
+static void
+setup_fields(void)
+{
+	int i;
+
+	for (i = 0; i < NSMALL + 2; i++) {
+		TIFFFieldInfo* fi = fieldinfo + i;
+
+		fi->field_tag = i < NSMALL ? TAG_SMALL + i :
+		    i == NSMALL ? TAG_LONGS : TAG_BIG;
+		fi->field_readcount = TIFF_VARIABLE;
+		fi->field_writecount = TIFF_VARIABLE;
+		fi->field_type = i == NSMALL ? TIFF_LONG : TIFF_ASCII;
+		fi->field_bit = FIELD_CUSTOM;
+		fi->field_oktochange = 1;
+		fi->field_passcount = i == NSMALL;
+		if (i < NSMALL) {
+			sprintf(names[i], "Small%d", i);
+			fi->field_name = names[i];
+		} else
+			fi->field_name = i == NSMALL ? "Longs" : "Big";
+	}
+	parent = TIFFSetTagExtender(extender);
+}
+
+static void
+small_value(char* buf, int dir, int i)
+{
+	sprintf(buf, "%d value %d", dir, i);
+}
+
+static int
+write_file(const char* filename)
+{
+	unsigned char pixel = 0;
+	uint32_t longs[NLONGS];
+	char buf[32];
+	TIFF* tif;
+	int dir, i;
+
+	tif = TIFFOpen(filename, "w");
+	if (!tif) {
+		fprintf(stderr, "Can't create %s\n", filename);
+		return 0;
+	}
+	for (dir = 0; dir < 2; dir++) {
+		for (i = 0; i < NLONGS; i++)
+			longs[i] = (uint32_t) (dir * 1000 + i);
+		memset(big, 'a' + dir, BIGSIZE - 1);
+		if (!TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, 1) ||
+		    !TIFFSetField(tif, TIFFTAG_IMAGELENGTH, 1) ||
+		    !TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8) ||
+		    !TIFFSetField(tif, TIFFTAG_PHOTOMETRIC,
+				  PHOTOMETRIC_MINISBLACK) ||
+		    !TIFFSetField(tif, TAG_LONGS, NLONGS, longs))
+			goto bad;
+		for (i = 0; i < NSMALL; i++) {
+			small_value(buf, dir, i);
+			if (!TIFFSetField(tif, TAG_SMALL + i, buf))
+				goto bad;
+		}
+		/* Written last, out of what is read with the directory */
+		if (!TIFFSetField(tif, TAG_BIG, big))
+			goto bad;
+		if (TIFFWriteEncodedStrip(tif, 0, &pixel, 1) != 1 ||
+		    !TIFFWriteDirectory(tif))
+			goto bad;
+	}
+	TIFFClose(tif);
+	return 1;
+
+bad:
+	fprintf(stderr, "Can't write %s\n", filename);
+	TIFFClose(tif);
+	return 0;
+}
+
+static int
+check_directory(TIFF* tif, int dir)
+{
+	uint32_t* longs;
+	uint16_t count;
+	char buf[32];
+	char* s;
+	int i;
+
+	if (!TIFFGetField(tif, TAG_LONGS, &count, &longs) ||
+	    count != NLONGS)
+		return 0;
+	for (i = 0; i < NLONGS; i++)
+		if (longs[i] != (uint32_t) (dir * 1000 + i))
+			return 0;
+	if (!TIFFGetField(tif, TAG_BIG, &s) || strlen(s) != BIGSIZE - 1 ||
+	    s[0] != 'a' + dir || s[BIGSIZE - 2] != 'a' + dir)
+		return 0;
+	for (i = 0; i < NSMALL; i++) {
+		small_value(buf, dir, i);
+		if (!TIFFGetField(tif, TAG_SMALL + i, &s) || strcmp(s, buf) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+static int
+test(const char* filename, const char* mode)
+{
+	TIFF* tif = TIFFOpen(filename, mode);
+	char* s;
+
+	if (!tif) {
+		fprintf(stderr, "Can't open %s\n", filename);
+		return 1;
+	}
+	if (!check_directory(tif, 0) || !TIFFReadDirectory(tif) ||
+	    !check_directory(tif, 1) || !TIFFSetDirectory(tif, 0) ||
+	    !check_directory(tif, 0)) {
+		fprintf(stderr, "%s (mode %s): wrong values\n", filename, mode);
+		TIFFClose(tif);
+		return 1;
+	}
+	/* Values read can be replaced and removed */
+	if (!TIFFSetField(tif, TAG_BIG, "replaced") ||
+	    !TIFFGetField(tif, TAG_BIG, &s) || strcmp(s, "replaced") != 0 ||
+	    !TIFFUnsetField(tif, TAG_SMALL) ||
+	    TIFFGetField(tif, TAG_SMALL, &s) ||
+	    !TIFFSetField(tif, TAG_SMALL + 1, "replaced") ||
+	    !TIFFReadDirectory(tif) || !check_directory(tif, 1)) {
+		fprintf(stderr, "%s (mode %s): values not replaced\n",
+			filename, mode);
+		TIFFClose(tif);
+		return 1;
+	}
+	TIFFClose(tif);
+	return 0;
+}
+
+int
+main(void)
+{
+	const char* filename = "directory_values.tif";
+	int ret = 0;
+
+	setup_fields();
+	if (!write_file(filename))
+		return 1;
+	ret += test(filename, "r");
+	ret += test(filename, "rm");
+	if (ret == 0)
+		unlink(filename);
+	return ret;
+}
+/* vim: set ts=8 sts=8 sw=8 noet: */
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 8
+ * fill-column: 78
+ * End:
+ */
@@ -0,0 +1,225 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that (i) the above copyright notices and this permission notice appear in
+ * all copies of the software and related documentation, and (ii) the names of
+ * Sam Leffler and Silicon Graphics may not be used in any advertising or
+ * publicity relating to the software without the specific, prior written
+ * permission of Sam Leffler and Silicon Graphics.
+ *
+ * THE SOFTWARE IS PROVIDED "AS-IS" AND WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS, IMPLIED OR OTHERWISE, INCLUDING WITHOUT LIMITATION, ANY
+ * WARRANTY OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * IN NO EVENT SHALL SAM LEFFLER OR SILICON GRAPHICS BE LIABLE FOR
+ * ANY SPECIAL, INCIDENTAL, INDIRECT OR CONSEQUENTIAL DAMAGES OF ANY KIND,
+ * OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+ * WHETHER OR NOT ADVISED OF THE POSSIBILITY OF DAMAGE, AND ON ANY THEORY OF
+ * LIABILITY, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+
+/*
+ * TIFF Library
+ *
+ * Module to test TIFFFindField() on standard and registered tags.  Given a
+ * number of iterations, it also times the lookups and the reading of a
+ * directory with many tags:
+ *
+ *	find_field [iterations]
+ */
+
+#include "tif_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "tiffio.h"
+
+#define TAG_PRIVATE	65100		/* private tags */
+#define TAG_LONG	65101
+#define TAG_HIGH	300000		/* beyond 16 bits */
+
+static const TIFFFieldInfo fieldinfo[] = {
+	{ TAG_PRIVATE, -1, -1, TIFF_ASCII, FIELD_CUSTOM, 1, 0, "Private" },
+	{ TAG_LONG, 1, 1, TIFF_LONG, FIELD_CUSTOM, 1, 0, "PrivateLong" },
+	{ TAG_HIGH, 1, 1, TIFF_LONG, FIELD_CUSTOM, 1, 0, "High" },
+};
+
+static TIFFExtendProc parent;
+
+static void
+extender(TIFF* tif)
+{
+	TIFFMergeFieldInfo(tif, fieldinfo, 3);
+	if (parent)
+		(*parent)(tif);
+}
+
+static const uint32_t tags[] = {
+	TIFFTAG_SUBFILETYPE, TIFFTAG_IMAGEWIDTH, TIFFTAG_IMAGELENGTH,
+	TIFFTAG_BITSPERSAMPLE, TIFFTAG_COMPRESSION, TIFFTAG_PHOTOMETRIC,
+	TIFFTAG_IMAGEDESCRIPTION, TIFFTAG_MAKE, TIFFTAG_MODEL,
+	TIFFTAG_STRIPOFFSETS, TIFFTAG_SAMPLESPERPIXEL, TIFFTAG_ROWSPERSTRIP,
+	TIFFTAG_STRIPBYTECOUNTS, TIFFTAG_XRESOLUTION, TIFFTAG_YRESOLUTION,
+	TIFFTAG_PLANARCONFIG, TIFFTAG_RESOLUTIONUNIT, TIFFTAG_SOFTWARE,
+	TIFFTAG_DATETIME, TIFFTAG_ARTIST, TIFFTAG_COPYRIGHT,
+	TAG_PRIVATE, TAG_LONG
+};
+#define NTAGS	(sizeof(tags) / sizeof(tags[0]))
+
+static int
+check_lookups(TIFF* tif)
+{
+	const TIFFField* fip;
+	size_t i;
+
+	for (i = 0; i < NTAGS; i++) {
+		fip = TIFFFindField(tif, tags[i], TIFF_ANY);
+		if (!fip || TIFFFieldTag(fip) != tags[i]) {
+			fprintf(stderr, "Tag %u not found\n", (unsigned) tags[i]);
+			return 0;
+		}
+	}
+	fip = TIFFFindField(tif, TAG_HIGH, TIFF_ANY);
+	if (!fip || TIFFFieldTag(fip) != TAG_HIGH) {
+		fprintf(stderr, "Tag %u not found\n", (unsigned) TAG_HIGH);
+		return 0;
+	}
+	/* The type must match, but for TIFF_ANY */
+	if (!TIFFFindField(tif, TIFFTAG_IMAGEWIDTH, TIFF_LONG) ||
+	    TIFFFindField(tif, TIFFTAG_IMAGEWIDTH, TIFF_DOUBLE) ||
+	    !TIFFFindField(tif, TAG_LONG, TIFF_LONG) ||
+	    TIFFFindField(tif, TAG_LONG, TIFF_SHORT)) {
+		fprintf(stderr, "Field type not taken into account\n");
+		return 0;
+	}
+	/* Unknown tags, in and out of the range of known ones */
+	if (TIFFFindField(tif, 1, TIFF_ANY) ||
+	    TIFFFindField(tif, 65102, TIFF_ANY) ||
+	    TIFFFindField(tif, TAG_HIGH + 1, TIFF_ANY) ||
+	    TIFFFindField(tif, 0xFFFFFFFFU, TIFF_ANY)) {
+		fprintf(stderr, "Unknown tag found\n");
+		return 0;
+	}
+	return 1;
+}
+
+static int
+write_file(const char* filename)
+{
+	unsigned char buf[16];
+	TIFF* tif = TIFFOpen(filename, "w");
+
+	if (!tif) {
+		fprintf(stderr, "Can't create %s\n", filename);
+		return 0;
+	}
+	memset(buf, 0, sizeof(buf));
+	if (!TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, 4) ||
+	    !TIFFSetField(tif, TIFFTAG_IMAGELENGTH, 4) ||
+	    !TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8) ||
+	    !TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1) ||
+	    !TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK) ||
+	    !TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, 4) ||
+	    !TIFFSetField(tif, TIFFTAG_IMAGEDESCRIPTION, "find_field") ||
+	    !TIFFSetField(tif, TIFFTAG_MAKE, "make") ||
+	    !TIFFSetField(tif, TIFFTAG_MODEL, "model") ||
+	    !TIFFSetField(tif, TIFFTAG_XRESOLUTION, 72.0) ||
+	    !TIFFSetField(tif, TIFFTAG_YRESOLUTION, 72.0) ||
+	    !TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH) ||
+	    !TIFFSetField(tif, TIFFTAG_SOFTWARE, "libtiff") ||
+	    !TIFFSetField(tif, TIFFTAG_DATETIME, "2021:01:01 00:00:00") ||
+	    !TIFFSetField(tif, TIFFTAG_ARTIST, "artist") ||
+	    !TIFFSetField(tif, TIFFTAG_COPYRIGHT, "copyright") ||
+	    !TIFFSetField(tif, TAG_PRIVATE, "private") ||
+	    !TIFFSetField(tif, TAG_LONG, 42) ||
+	    TIFFWriteEncodedStrip(tif, 0, buf, sizeof(buf)) < 0 ||
+	    !TIFFWriteDirectory(tif)) {
+		fprintf(stderr, "Can't write %s\n", filename);
+		TIFFClose(tif);
+		return 0;
+	}
+	TIFFClose(tif);
+	return 1;
+}
+
+static double
+elapsed(clock_t start)
+{
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static int
+benchmark(TIFF* tif, long n)
+{
+	uint32_t sum = 0;
+	clock_t start;
+	long i;
+	size_t t;
+
+	start = clock();
+	for (i = 0; i < n; i++)
+		for (t = 0; t < NTAGS; t++) {
+			const TIFFField* fip = TIFFFindField(tif, tags[t],
+			    TIFF_ANY);
+			sum += TIFFFieldTag(fip);
+		}
+	printf("%ld x %u lookups: %.3f s\n", n, (unsigned) NTAGS,
+	    elapsed(start));
+
+	start = clock();
+	for (i = 0; i < n; i++)
+		if (!TIFFReadDirectory(tif) && !TIFFSetDirectory(tif, 0)) {
+			fprintf(stderr, "Can't read directory\n");
+			return 0;
+		}
+	printf("%ld directory reads: %.3f s\n", n, elapsed(start));
+	return sum != 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	const char* filename = "find_field.tif";
+	char* description;
+	uint32_t value;
+	TIFF* tif;
+	int ret = 0;
+
+	parent = TIFFSetTagExtender(extender);
+	if (!write_file(filename))
+		return 1;
+	tif = TIFFOpen(filename, "r");
+	if (!tif) {
+		fprintf(stderr, "Can't open %s\n", filename);
+		return 1;
+	}
+	if (!check_lookups(tif) ||
+	    !TIFFGetField(tif, TAG_PRIVATE, &description) ||
+	    strcmp(description, "private") != 0 ||
+	    !TIFFGetField(tif, TAG_LONG, &value) || value != 42) {
+		fprintf(stderr, "Registered tags not read back\n");
+		ret = 1;
+	} else if (argc > 1 && !benchmark(tif, atol(argv[1])))
+		ret = 1;
+	TIFFClose(tif);
+	if (ret == 0)
+		unlink(filename);
+	return ret;
+}
+/* vim: set ts=8 sts=8 sw=8 noet: */
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 8
+ * fill-column: 78
+ * End:
+ */
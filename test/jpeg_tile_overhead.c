@@ -0,0 +1,185 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that (i) the above copyright notices and this permission notice appear in
+ * all copies of the software and related documentation, and (ii) the names of
+ * Sam Leffler and Silicon Graphics may not be used in any advertising or
+ * publicity relating to the software without the specific, prior written
+ * permission of Sam Leffler and Silicon Graphics.
+ *
+ * THE SOFTWARE IS PROVIDED "AS-IS" AND WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS, IMPLIED OR OTHERWISE, INCLUDING WITHOUT LIMITATION, ANY
+ * WARRANTY OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * IN NO EVENT SHALL SAM LEFFLER OR SILICON GRAPHICS BE LIABLE FOR
+ * ANY SPECIAL, INCIDENTAL, INDIRECT OR CONSEQUENTIAL DAMAGES OF ANY KIND,
+ * OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+ * WHETHER OR NOT ADVISED OF THE POSSIBILITY OF DAMAGE, AND ON ANY THEORY OF
+ * LIABILITY, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * TIFF Library
+ *
+ * Check that the per-tile state kept by the JPEG codec does not change
+ * its output, and measure the fixed per-tile cost of encoding/decoding.
+ *
+ *   jpeg_tile_overhead [tilesize [ntiles]]
+ *
+ * Without arguments a quick check with 16x16 tiles is run; e.g.
+ * "jpeg_tile_overhead 256 4096" gives figures for typical tile sizes.
+ */
+
+#include "tif_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_UNISTD_H 
+# include <unistd.h> 
+#endif 
+
+#include "tiffio.h"
+
+static const char filename[] = "jpeg_tile_overhead.tif";
+
+static void
+fill_tile(unsigned char* buf, uint32_t size, uint32_t t)
+{
+	uint32_t x, y;
+
+	for (y = 0; y < size; y++)
+		for (x = 0; x < size; x++) {
+			unsigned char* p = buf + 3 * (y * size + x);
+			p[0] = (unsigned char) (x * 255 / size);
+			p[1] = (unsigned char) (y * 255 / size);
+			p[2] = (unsigned char) ((t % 2) ? 200 : 40);
+		}
+}
+
+int
+main(int argc, char** argv)
+{
+	uint32_t size = 16, ntiles = 256, t, across;
+	tmsize_t tilesize;
+	unsigned char *buf = NULL, *ref = NULL;
+	uint64_t bytes[2] = { 0, 0 };
+	TIFF* tif;
+	clock_t start;
+	double enc, dec;
+	int ret = 1;
+
+	if (argc > 1)
+		size = (uint32_t) atoi(argv[1]);
+	if (argc > 2)
+		ntiles = (uint32_t) atoi(argv[2]);
+	if (size == 0 || size % 16 != 0 || ntiles < 4) {
+		fprintf(stderr, "usage: %s [tilesize (multiple of 16) [ntiles (>= 4)]]\n",
+			argv[0]);
+		return 1;
+	}
+	across = 16;
+	ntiles = (ntiles + across - 1) / across * across;
+
+	tif = TIFFOpen(filename, "w");
+	if (!tif) {
+		fprintf(stderr, "Can't create %s\n", filename);
+		return 1;
+	}
+	TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, size * across);
+	TIFFSetField(tif, TIFFTAG_IMAGELENGTH, size * (ntiles / across));
+	TIFFSetField(tif, TIFFTAG_TILEWIDTH, size);
+	TIFFSetField(tif, TIFFTAG_TILELENGTH, size);
+	TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
+	TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 3);
+	TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_JPEG);
+	TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_YCBCR);
+	TIFFSetField(tif, TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB);
+	TIFFSetField(tif, TIFFTAG_JPEGQUALITY, 90);
+
+	tilesize = TIFFTileSize(tif);
+	buf = (unsigned char*) _TIFFmalloc(tilesize);
+	ref = (unsigned char*) _TIFFmalloc(tilesize);
+	if (!buf || !ref) {
+		fprintf(stderr, "Out of memory\n");
+		goto done;
+	}
+
+	start = clock();
+	for (t = 0; t < ntiles; t++) {
+		/* the last tile is written at another quality */
+		if (t == ntiles - 1)
+			TIFFSetField(tif, TIFFTAG_JPEGQUALITY, 30);
+		fill_tile(buf, size, t);
+		if (TIFFWriteEncodedTile(tif, t, buf, tilesize) != tilesize) {
+			fprintf(stderr, "Can't write tile %u\n", t);
+			TIFFClose(tif);
+			goto done;
+		}
+	}
+	enc = (double) (clock() - start) / CLOCKS_PER_SEC;
+	TIFFClose(tif);
+
+	tif = TIFFOpen(filename, "r");
+	if (!tif) {
+		fprintf(stderr, "Can't open %s\n", filename);
+		goto done;
+	}
+	TIFFSetField(tif, TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB);
+	/* identical tiles must have been compressed identically */
+	for (t = 0; t < ntiles - 1; t++) {
+		uint64_t n = TIFFGetStrileByteCount(tif, t);
+		if (t < 2)
+			bytes[t] = n;
+		else if (n != bytes[t % 2]) {
+			fprintf(stderr, "Tile %u: %u bytes, expected %u\n",
+				t, (unsigned) n, (unsigned) bytes[t % 2]);
+			goto done_read;
+		}
+	}
+	if (TIFFGetStrileByteCount(tif, ntiles - 1) >= bytes[(ntiles - 1) % 2]) {
+		fprintf(stderr, "Quality change ignored for the last tile\n");
+		goto done_read;
+	}
+
+	start = clock();
+	for (t = 0; t < ntiles; t++) {
+		if (TIFFReadEncodedTile(tif, t, buf, tilesize) != tilesize) {
+			fprintf(stderr, "Can't read tile %u\n", t);
+			goto done_read;
+		}
+		if (t == 0)
+			memcpy(ref, buf, tilesize);
+		else if (t % 2 == 0 && memcmp(ref, buf, tilesize) != 0) {
+			fprintf(stderr, "Tile %u decodes differently from tile 0\n", t);
+			goto done_read;
+		}
+	}
+	dec = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	printf("%u tiles of %ux%u: encode %.2f us/tile, decode %.2f us/tile\n",
+	       ntiles, size, size, enc * 1e6 / ntiles, dec * 1e6 / ntiles);
+	ret = 0;
+
+done_read:
+	TIFFClose(tif);
+done:
+	_TIFFfree(buf);
+	_TIFFfree(ref);
+	if (ret == 0)
+		unlink(filename);
+	return ret;
+}
+
+/* vim: set ts=8 sts=8 sw=8 noet: */
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 8
+ * fill-column: 78
+ * End:
+ */
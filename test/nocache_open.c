@@ -0,0 +1,190 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that (i) the above copyright notices and this permission notice appear in
+ * all copies of the software and related documentation, and (ii) the names of
+ * Sam Leffler and Silicon Graphics may not be used in any advertising or
+ * publicity relating to the software without the specific, prior written
+ * permission of Sam Leffler and Silicon Graphics.
+ *
+ * THE SOFTWARE IS PROVIDED "AS-IS" AND WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS, IMPLIED OR OTHERWISE, INCLUDING WITHOUT LIMITATION, ANY
+ * WARRANTY OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * IN NO EVENT SHALL SAM LEFFLER OR SILICON GRAPHICS BE LIABLE FOR
+ * ANY SPECIAL, INCIDENTAL, INDIRECT OR CONSEQUENTIAL DAMAGES OF ANY KIND,
+ * OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+ * WHETHER OR NOT ADVISED OF THE POSSIBILITY OF DAMAGE, AND ON ANY THEORY OF
+ * LIABILITY, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+
+/*
+ * TIFF Library
+ *
+ * Module to test the 'N' open flag: a file written with "wN" and read back
+ * with "rN" must hold the same data as without it.  The first image is
+ * larger than the write-behind distance of the file routines, so that
+ * ranges written a while ago get waited for and dropped too.
+ */
+
+#include "tif_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "tiffiop.h"
+
+#define WIDTH		4096
+#define LENGTH		2400	/* 37.5 MiB of RGBA */
+#define ROWSPERSTRIP	64	/* the last strip is shorter */
+#define SPP		4
+#define SMALLSIZE	100
+
+static const char* filename = "nocache_open.tif";
+
+static void
+fill_strip(unsigned char* buf, tmsize_t size, uint32_t dir, uint32_t s)
+{
+	tmsize_t i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = (unsigned char) ((i * 7 + s * 13 + dir) >> 2);
+}
+
+static int
+setup_image(TIFF* tif, uint32_t width, uint32_t length, uint16_t compression)
+{
+	static const uint16_t extra[] = { EXTRASAMPLE_ASSOCALPHA };
+
+	return TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width) &&
+	    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, length) &&
+	    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8) &&
+	    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, SPP) &&
+	    TIFFSetField(tif, TIFFTAG_EXTRASAMPLES, 1, extra) &&
+	    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB) &&
+	    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG) &&
+	    TIFFSetField(tif, TIFFTAG_COMPRESSION, compression) &&
+	    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, ROWSPERSTRIP);
+}
+
+static int
+write_image(TIFF* tif, uint32_t dir, unsigned char* buf)
+{
+	uint32_t nstrips = TIFFNumberOfStrips(tif), length, s;
+
+	TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &length);
+	for (s = 0; s < nstrips; s++) {
+		tmsize_t size = TIFFVStripSize(tif, ROWSPERSTRIP);
+
+		if (s == nstrips - 1 && length % ROWSPERSTRIP)
+			size = TIFFVStripSize(tif, length % ROWSPERSTRIP);
+		fill_strip(buf, size, dir, s);
+		if (TIFFWriteEncodedStrip(tif, s, buf, size) != size) {
+			fprintf(stderr, "Can't write strip %u of image %u\n",
+				(unsigned) s, (unsigned) dir);
+			return 0;
+		}
+	}
+	return TIFFWriteDirectory(tif);
+}
+
+static int
+check_image(TIFF* tif, uint32_t dir, unsigned char* buf, unsigned char* ref)
+{
+	uint32_t nstrips = TIFFNumberOfStrips(tif), s;
+
+	for (s = 0; s < nstrips; s++) {
+		tmsize_t size = TIFFReadEncodedStrip(tif, s, buf, (tmsize_t) -1);
+
+		fill_strip(ref, size, dir, s);
+		if (size <= 0 || memcmp(buf, ref, (size_t) size) != 0) {
+			fprintf(stderr, "Strip %u of image %u is wrong\n",
+				(unsigned) s, (unsigned) dir);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int
+test(const char* wmode, const char* rmode)
+{
+	tmsize_t bufsize = (tmsize_t) WIDTH * ROWSPERSTRIP * SPP;
+	unsigned char* buf = (unsigned char*) malloc((size_t) bufsize);
+	unsigned char* ref = (unsigned char*) malloc((size_t) bufsize);
+	TIFF* tif = NULL;
+	int ret = 1;
+
+	if (!buf || !ref) {
+		fprintf(stderr, "Out of memory\n");
+		goto end;
+	}
+	tif = TIFFOpen(filename, wmode);
+	if (!tif) {
+		fprintf(stderr, "Can't create %s\n", filename);
+		goto end;
+	}
+	if (!setup_image(tif, WIDTH, LENGTH, COMPRESSION_NONE) ||
+	    !write_image(tif, 0, buf) ||
+	    !setup_image(tif, SMALLSIZE, SMALLSIZE, COMPRESSION_LZW) ||
+	    !write_image(tif, 1, buf)) {
+		fprintf(stderr, "Can't write %s with \"%s\"\n",
+			filename, wmode);
+		goto end;
+	}
+	TIFFClose(tif);
+
+	tif = TIFFOpen(filename, rmode);
+	if (!tif) {
+		fprintf(stderr, "Can't open %s\n", filename);
+		goto end;
+	}
+	if (strchr(rmode, 'N') && isMapped(tif)) {
+		fprintf(stderr, "\"%s\" left the file mapped\n", rmode);
+		goto end;
+	}
+	/* Forwards, then back to the first image */
+	if (!check_image(tif, 0, buf, ref) ||
+	    !TIFFReadDirectory(tif) || !check_image(tif, 1, buf, ref) ||
+	    !TIFFSetDirectory(tif, 0) || !check_image(tif, 0, buf, ref)) {
+		fprintf(stderr, "Wrong data written with \"%s\", read with \"%s\"\n",
+			wmode, rmode);
+		goto end;
+	}
+	ret = 0;
+
+end:
+	if (tif)
+		TIFFClose(tif);
+	free(buf);
+	free(ref);
+	unlink(filename);
+	return ret;
+}
+
+int
+main(void)
+{
+	int ret = 0;
+
+	ret += test("wN", "rN");
+	ret += test("w", "rN");
+	ret += test("wN", "r");
+	ret += test("w8N", "rN");
+	return ret;
+}
+/* vim: set ts=8 sts=8 sw=8 noet: */
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 8
+ * fill-column: 78
+ * End:
+ */
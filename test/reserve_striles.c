@@ -0,0 +1,222 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that (i) the above copyright notices and this permission notice appear in
+ * all copies of the software and related documentation, and (ii) the names of
+ * Sam Leffler and Silicon Graphics may not be used in any advertising or
+ * publicity relating to the software without the specific, prior written
+ * permission of Sam Leffler and Silicon Graphics.
+ *
+ * THE SOFTWARE IS PROVIDED "AS-IS" AND WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS, IMPLIED OR OTHERWISE, INCLUDING WITHOUT LIMITATION, ANY
+ * WARRANTY OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * IN NO EVENT SHALL SAM LEFFLER OR SILICON GRAPHICS BE LIABLE FOR
+ * ANY SPECIAL, INCIDENTAL, INDIRECT OR CONSEQUENTIAL DAMAGES OF ANY KIND,
+ * OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+ * WHETHER OR NOT ADVISED OF THE POSSIBILITY OF DAMAGE, AND ON ANY THEORY OF
+ * LIABILITY, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * TIFF Library
+ *
+ * Module to test TIFFReserveStrileData(): the strips or tiles are laid out
+ * first, then written out of order, through libtiff or directly in the
+ * file.
+ */
+
+#include "tif_config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "tiffio.h"
+
+#define WIDTH		100
+#define LENGTH		45
+#define ROWSPERSTRIP	10	/* the last strip is shorter */
+#define TILESIZE	16
+
+static int
+check_file(const char* filename, uint32_t nstriles, tmsize_t stripsize)
+{
+	unsigned char buf[WIDTH * LENGTH];
+	TIFF* tif = TIFFOpen(filename, "r");
+	uint32_t s;
+
+	if (!tif) {
+		fprintf(stderr, "Can't open %s\n", filename);
+		return 0;
+	}
+	for (s = 0; s < nstriles; s++) {
+		tmsize_t size = TIFFIsTiled(tif) ?
+		    TIFFReadEncodedTile(tif, s, buf, sizeof(buf)) :
+		    TIFFReadEncodedStrip(tif, s, buf, sizeof(buf));
+
+		if (size <= 0 || size > stripsize ||
+		    buf[0] != (unsigned char) (s + 1) ||
+		    buf[size - 1] != (unsigned char) (s + 1) ||
+		    (s > 0 && TIFFGetStrileOffset(tif, s) !=
+		     TIFFGetStrileOffset(tif, s - 1) +
+		     TIFFGetStrileByteCount(tif, s - 1))) {
+			fprintf(stderr, "%s: strip/tile %u is wrong\n",
+				filename, (unsigned) s);
+			TIFFClose(tif);
+			return 0;
+		}
+	}
+	TIFFClose(tif);
+	return 1;
+}
+
+static int
+test(const char* mode, int tiled)
+{
+	const char* filename = "reserve_striles.tif";
+	unsigned char buf[WIDTH * LENGTH];
+	TIFF* tif;
+	FILE* f;
+	uint32_t nstriles, s;
+	uint64_t offset, bytecount;
+	tmsize_t stripsize;
+	toff_t size;
+
+	tif = TIFFOpen(filename, mode);
+	if (!tif) {
+		fprintf(stderr, "Can't create %s\n", filename);
+		return 1;
+	}
+	if (!TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, WIDTH) ||
+	    !TIFFSetField(tif, TIFFTAG_IMAGELENGTH, LENGTH) ||
+	    !TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8) ||
+	    !TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1) ||
+	    !TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK) ||
+	    (tiled ? !TIFFSetField(tif, TIFFTAG_TILEWIDTH, TILESIZE) ||
+		     !TIFFSetField(tif, TIFFTAG_TILELENGTH, TILESIZE) :
+		     !TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, ROWSPERSTRIP))) {
+		fprintf(stderr, "Can't set up %s\n", filename);
+		goto bad;
+	}
+	if (!TIFFReserveStrileData(tif)) {
+		fprintf(stderr, "Can't reserve room for the data\n");
+		goto bad;
+	}
+	nstriles = tiled ? TIFFNumberOfTiles(tif) : TIFFNumberOfStrips(tif);
+	stripsize = tiled ? TIFFTileSize(tif) : TIFFStripSize(tif);
+	size = TIFFGetStrileOffset(tif, nstriles - 1) +
+	    TIFFGetStrileByteCount(tif, nstriles - 1);
+	if (!tiled && TIFFGetStrileByteCount(tif, nstriles - 1) !=
+	    (uint64_t) (WIDTH * (LENGTH % ROWSPERSTRIP))) {
+		fprintf(stderr, "Wrong size of the last strip\n");
+		goto bad;
+	}
+	/* A second reservation is refused */
+	if (TIFFReserveStrileData(tif)) {
+		fprintf(stderr, "Room reserved twice\n");
+		goto bad;
+	}
+
+	/* Backwards, but for strip/tile 0 */
+	for (s = nstriles - 1; s > 0; s--) {
+		tmsize_t cc = (tmsize_t) TIFFGetStrileByteCount(tif, s);
+
+		memset(buf, (int) (s + 1), (size_t) cc);
+		if ((tiled ? TIFFWriteEncodedTile(tif, s, buf, cc) :
+		     TIFFWriteEncodedStrip(tif, s, buf, cc)) != cc) {
+			fprintf(stderr, "Can't write strip/tile %u\n",
+				(unsigned) s);
+			goto bad;
+		}
+	}
+	offset = TIFFGetStrileOffset(tif, 0);
+	bytecount = TIFFGetStrileByteCount(tif, 0);
+	if (!TIFFWriteDirectory(tif)) {
+		fprintf(stderr, "Can't write directory\n");
+		goto bad;
+	}
+	TIFFClose(tif);
+
+	/* Strip/tile 0 goes directly in the file */
+	memset(buf, 1, (size_t) bytecount);
+	f = fopen(filename, "r+b");
+	if (!f || fseek(f, (long) offset, SEEK_SET) != 0 ||
+	    fwrite(buf, (size_t) bytecount, 1, f) != 1) {
+		fprintf(stderr, "Can't write in %s\n", filename);
+		if (f)
+			fclose(f);
+		return 1;
+	}
+	fclose(f);
+
+	if (!check_file(filename, nstriles, stripsize))
+		return 1;
+	tif = TIFFOpen(filename, "r");
+	if (!tif)
+		return 1;
+	/* Nothing was moved to the end of the file */
+	if (TIFFCurrentDirOffset(tif) < size) {
+		fprintf(stderr, "Data was written outside of the reserved room\n");
+		goto bad;
+	}
+	TIFFClose(tif);
+	unlink(filename);
+	return 0;
+
+bad:
+	TIFFClose(tif);
+	return 1;
+}
+
+/* Room can only be reserved for data of a known size */
+static int
+test_compressed(void)
+{
+	const char* filename = "reserve_striles.tif";
+	TIFF* tif = TIFFOpen(filename, "wl");
+	int ret = 0;
+
+	if (!tif) {
+		fprintf(stderr, "Can't create %s\n", filename);
+		return 1;
+	}
+	if (!TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, WIDTH) ||
+	    !TIFFSetField(tif, TIFFTAG_IMAGELENGTH, LENGTH) ||
+	    !TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8) ||
+	    !TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, ROWSPERSTRIP) ||
+	    !TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_PACKBITS) ||
+	    TIFFReserveStrileData(tif)) {
+		fprintf(stderr, "Room reserved for compressed data\n");
+		ret = 1;
+	}
+	TIFFClose(tif);
+	unlink(filename);
+	return ret;
+}
+
+int
+main(void)
+{
+	int ret = 0;
+
+	ret += test("wl", 0);
+	ret += test("wl", 1);
+	ret += test("w8l", 0);
+	ret += test("w8l", 1);
+	ret += test_compressed();
+	return ret;
+}
+
+/* vim: set ts=8 sts=8 sw=8 noet: */
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 8
+ * fill-column: 78
+ * End:
+ */
@@ -0,0 +1,377 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that (i) the above copyright notices and this permission notice appear in
+ * all copies of the software and related documentation, and (ii) the names of
+ * Sam Leffler and Silicon Graphics may not be used in any advertising or
+ * publicity relating to the software without the specific, prior written
+ * permission of Sam Leffler and Silicon Graphics.
+ *
+ * THE SOFTWARE IS PROVIDED "AS-IS" AND WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS, IMPLIED OR OTHERWISE, INCLUDING WITHOUT LIMITATION, ANY
+ * WARRANTY OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * IN NO EVENT SHALL SAM LEFFLER OR SILICON GRAPHICS BE LIABLE FOR
+ * ANY SPECIAL, INCIDENTAL, INDIRECT OR CONSEQUENTIAL DAMAGES OF ANY KIND,
+ * OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+ * WHETHER OR NOT ADVISED OF THE POSSIBILITY OF DAMAGE, AND ON ANY THEORY OF
+ * LIABILITY, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * TIFF Library
+ *
+ * Module to test TIFFRewriteDirectory() on an existing file: directories
+ * whose new version fits in the room of the old one stay where they are,
+ * the others move to the end of the file.  So does a directory whose tag
+ * data another directory refers to as well.
+ */
+
+#include "tif_config.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "tiffio.h"
+
+#define NDIRS	3
+#define WIDTH	16
+
+static const char* descriptions[NDIRS] = {
+	"first directory", "second directory", "third directory"
+};
+static char upper[NDIRS][64];
+
+static int
+write_file(const char* filename, const char* mode)
+{
+	unsigned char buf[WIDTH];
+	TIFF* tif = TIFFOpen(filename, mode);
+	int i;
+
+	if (!tif) {
+		fprintf(stderr, "Can't create %s\n", filename);
+		return 0;
+	}
+	for (i = 0; i < NDIRS; i++) {
+		memset(buf, i + 1, sizeof(buf));
+		if (!TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, WIDTH) ||
+		    !TIFFSetField(tif, TIFFTAG_IMAGELENGTH, 1) ||
+		    !TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8) ||
+		    !TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1) ||
+		    !TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK) ||
+		    /* Set by TIFFReadDirectory() anyway, so keep the size */
+		    !TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG) ||
+		    !TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, 1) ||
+		    !TIFFSetField(tif, TIFFTAG_IMAGEDESCRIPTION, descriptions[i]) ||
+		    TIFFWriteEncodedStrip(tif, 0, buf, sizeof(buf)) < 0 ||
+		    !TIFFWriteDirectory(tif)) {
+			fprintf(stderr, "Can't write directory %d\n", i);
+			TIFFClose(tif);
+			return 0;
+		}
+	}
+	TIFFClose(tif);
+	return 1;
+}
+
+static uint64_t
+file_size(const char* filename)
+{
+	FILE* f = fopen(filename, "rb");
+	long size = -1;
+
+	if (f) {
+		if (fseek(f, 0, SEEK_END) == 0)
+			size = ftell(f);
+		fclose(f);
+	}
+	return size < 0 ? 0 : (uint64_t) size;
+}
+
+/*
+ * Set the description of directory dir and rewrite it, then check that
+ * it moved or not, as expected.
+ */
+static int
+rewrite(const char* filename, int dir, const char* description, int moves)
+{
+	TIFF* tif = TIFFOpen(filename, "r+");
+	uint64_t diroff, size = file_size(filename);
+	int moved;
+
+	if (!tif) {
+		fprintf(stderr, "Can't open %s for update\n", filename);
+		return 0;
+	}
+	if (!TIFFSetDirectory(tif, (uint16_t) dir)) {
+		fprintf(stderr, "Can't read directory %d\n", dir);
+		TIFFClose(tif);
+		return 0;
+	}
+	diroff = TIFFCurrentDirOffset(tif);
+	if (!TIFFSetField(tif, TIFFTAG_IMAGEDESCRIPTION, description) ||
+	    !TIFFRewriteDirectory(tif)) {
+		fprintf(stderr, "Can't rewrite directory %d\n", dir);
+		TIFFClose(tif);
+		return 0;
+	}
+	TIFFClose(tif);
+	descriptions[dir] = description;
+
+	/* In place, the file can only grow if the directory was the last */
+	moved = file_size(filename) > size && dir != NDIRS - 1;
+	tif = TIFFOpen(filename, "r");
+	if (!tif || !TIFFSetDirectory(tif, (uint16_t) dir)) {
+		fprintf(stderr, "Can't read back directory %d\n", dir);
+		if (tif)
+			TIFFClose(tif);
+		return 0;
+	}
+	if ((TIFFCurrentDirOffset(tif) != diroff) != moves || moved != moves) {
+		fprintf(stderr, "Directory %d was %s\n", dir,
+			moves ? "not moved" : "moved");
+		TIFFClose(tif);
+		return 0;
+	}
+	TIFFClose(tif);
+	return 1;
+}
+
+/*
+ * Upper-case the descriptions of the directories from the last one down to
+ * first and rewrite them through a single handle, then check that only
+ * directory moves (or none if -1) moved.
+ */
+static int
+rewrite_each(const char* filename, int first, int moves)
+{
+	uint64_t diroffs[NDIRS];
+	TIFF* tif = TIFFOpen(filename, "r");
+	int dir;
+
+	for (dir = 0; tif && dir < NDIRS; dir++) {
+		if (!TIFFSetDirectory(tif, (uint16_t) dir))
+			break;
+		diroffs[dir] = TIFFCurrentDirOffset(tif);
+	}
+	if (tif)
+		TIFFClose(tif);
+	if (dir < NDIRS) {
+		fprintf(stderr, "Can't read the directories of %s\n", filename);
+		return 0;
+	}
+
+	tif = TIFFOpen(filename, "r+");
+	if (!tif) {
+		fprintf(stderr, "Can't open %s for update\n", filename);
+		return 0;
+	}
+	for (dir = NDIRS - 1; dir >= first; dir--) {
+		size_t i;
+
+		for (i = 0; descriptions[dir][i] != '\0' &&
+		     i < sizeof(upper[dir]) - 1; i++)
+			upper[dir][i] = (char) toupper(
+			    (unsigned char) descriptions[dir][i]);
+		upper[dir][i] = '\0';
+		if (!TIFFSetDirectory(tif, (uint16_t) dir) ||
+		    !TIFFSetField(tif, TIFFTAG_IMAGEDESCRIPTION, upper[dir]) ||
+		    !TIFFRewriteDirectory(tif)) {
+			fprintf(stderr, "Can't rewrite directory %d\n", dir);
+			TIFFClose(tif);
+			return 0;
+		}
+		descriptions[dir] = upper[dir];
+	}
+	TIFFClose(tif);
+
+	tif = TIFFOpen(filename, "r");
+	for (dir = 0; tif && dir < NDIRS; dir++) {
+		if (!TIFFSetDirectory(tif, (uint16_t) dir))
+			break;
+		if ((TIFFCurrentDirOffset(tif) != diroffs[dir]) !=
+		    (dir == moves)) {
+			fprintf(stderr, "Directory %d was %s\n", dir,
+				dir == moves ? "not moved" : "moved");
+			break;
+		}
+	}
+	if (tif)
+		TIFFClose(tif);
+	return dir == NDIRS;
+}
+
+static uint64_t
+get_le(const unsigned char* p, int size)
+{
+	uint64_t v = 0;
+
+	while (size-- > 0)
+		v = (v << 8) | p[size];
+	return v;
+}
+
+/*
+ * Make the ImageDescription entry of directory 0 refer to the value of
+ * that of directory 1, as some writers share identical tag data.  The
+ * file is little-endian.
+ */
+static int
+share_description(const char* filename, int bigtiff)
+{
+	unsigned char entry[20];
+	long entrypos[2] = { 0, 0 };
+	uint64_t diroff[2], n, i;
+	int entrysize = bigtiff ? 20 : 12, countsize = bigtiff ? 8 : 2;
+	TIFF* tif = TIFFOpen(filename, "r");
+	FILE* f;
+	int dir;
+
+	if (!tif)
+		return 0;
+	diroff[0] = TIFFCurrentDirOffset(tif);
+	if (!TIFFReadDirectory(tif)) {
+		TIFFClose(tif);
+		return 0;
+	}
+	diroff[1] = TIFFCurrentDirOffset(tif);
+	TIFFClose(tif);
+
+	f = fopen(filename, "r+b");
+	if (!f)
+		return 0;
+	for (dir = 0; dir < 2; dir++) {
+		if (fseek(f, (long) diroff[dir], SEEK_SET) != 0 ||
+		    fread(entry, countsize, 1, f) != 1)
+			break;
+		n = get_le(entry, countsize);
+		for (i = 0; i < n; i++) {
+			if (fread(entry, entrysize, 1, f) != 1)
+				break;
+			if (get_le(entry, 2) == TIFFTAG_IMAGEDESCRIPTION)
+				entrypos[dir] = ftell(f) - entrysize;
+		}
+	}
+	/* Copy the count and offset of directory 1 into directory 0 */
+	if (entrypos[0] == 0 || entrypos[1] == 0 ||
+	    fseek(f, entrypos[1] + 4, SEEK_SET) != 0 ||
+	    fread(entry, entrysize - 4, 1, f) != 1 ||
+	    fseek(f, entrypos[0] + 4, SEEK_SET) != 0 ||
+	    fwrite(entry, entrysize - 4, 1, f) != 1) {
+		fclose(f);
+		return 0;
+	}
+	fclose(f);
+	descriptions[0] = descriptions[1];
+	return 1;
+}
+
+static int
+check_file(const char* filename)
+{
+	TIFF* tif = TIFFOpen(filename, "r");
+	int i;
+
+	if (!tif) {
+		fprintf(stderr, "Can't open %s\n", filename);
+		return 0;
+	}
+	if (TIFFNumberOfDirectories(tif) != NDIRS) {
+		fprintf(stderr, "%s: %u directories instead of %d\n", filename,
+			(unsigned) TIFFNumberOfDirectories(tif), NDIRS);
+		TIFFClose(tif);
+		return 0;
+	}
+	for (i = 0; i < NDIRS; i++) {
+		unsigned char buf[WIDTH];
+		char* description = NULL;
+
+		if (!TIFFSetDirectory(tif, (uint16_t) i) ||
+		    !TIFFGetField(tif, TIFFTAG_IMAGEDESCRIPTION, &description) ||
+		    strcmp(description, descriptions[i]) != 0 ||
+		    TIFFReadEncodedStrip(tif, 0, buf, sizeof(buf)) !=
+		    (tmsize_t) sizeof(buf) ||
+		    buf[0] != (unsigned char) (i + 1) ||
+		    buf[WIDTH - 1] != (unsigned char) (i + 1)) {
+			fprintf(stderr, "%s: directory %d is wrong\n", filename, i);
+			TIFFClose(tif);
+			return 0;
+		}
+	}
+	TIFFClose(tif);
+	return 1;
+}
+
+static int
+test(const char* mode)
+{
+	const char* filename = "rewrite_directory.tif";
+
+	descriptions[0] = "first directory";
+	descriptions[1] = "second directory";
+	descriptions[2] = "third directory";
+	if (!write_file(filename, mode))
+		return 1;
+	/* Same size, then smaller: in place */
+	if (!rewrite(filename, 1, "SECOND DIRECTORY", 0) ||
+	    !rewrite(filename, 0, "first", 0) ||
+	    !check_file(filename))
+		return 1;
+	/* Nothing follows the last directory: it grows in place */
+	if (!rewrite(filename, 2,
+		     "a third directory with a much longer description",
+		     0) ||
+	    !check_file(filename))
+		return 1;
+	/* Larger than the room it has: relocated */
+	if (!rewrite(filename, 1,
+		     "a second directory with a much longer description",
+		     1) ||
+	    !check_file(filename))
+		return 1;
+	/* Several through one handle, which walks the file once: in place */
+	if (!rewrite_each(filename, 0, -1) ||
+	    !check_file(filename))
+		return 1;
+	/* Room shared with another directory: relocated, even if it fits */
+	if (!write_file(filename, mode) ||
+	    !share_description(filename, strchr(mode, '8') != NULL) ||
+	    !check_file(filename) ||
+	    !rewrite(filename, 1, "SECOND DIRECTORY", 1) ||
+	    !check_file(filename))
+		return 1;
+	/* The same, after the walk for rewriting another directory */
+	if (!write_file(filename, mode) ||
+	    !share_description(filename, strchr(mode, '8') != NULL) ||
+	    !rewrite_each(filename, 1, 1) ||
+	    !check_file(filename))
+		return 1;
+	unlink(filename);
+	return 0;
+}
+
+int
+main(void)
+{
+	int ret = 0;
+
+	ret += test("wl");
+	ret += test("w8l");
+	return ret;
+}
+
+/* vim: set ts=8 sts=8 sw=8 noet: */
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 8
+ * fill-column: 78
+ * End:
+ */
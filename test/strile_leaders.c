@@ -0,0 +1,192 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that (i) the above copyright notices and this permission notice appear in
+ * all copies of the software and related documentation, and (ii) the names of
+ * Sam Leffler and Silicon Graphics may not be used in any advertising or
+ * publicity relating to the software without the specific, prior written
+ * permission of Sam Leffler and Silicon Graphics.
+ *
+ * THE SOFTWARE IS PROVIDED "AS-IS" AND WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS, IMPLIED OR OTHERWISE, INCLUDING WITHOUT LIMITATION, ANY
+ * WARRANTY OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * IN NO EVENT SHALL SAM LEFFLER OR SILICON GRAPHICS BE LIABLE FOR
+ * ANY SPECIAL, INCIDENTAL, INDIRECT OR CONSEQUENTIAL DAMAGES OF ANY KIND,
+ * OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+ * WHETHER OR NOT ADVISED OF THE POSSIBILITY OF DAMAGE, AND ON ANY THEORY OF
+ * LIABILITY, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * TIFF Library
+ *
+ * Module to test the header gap and the leaders written before the data
+ * of each strip: strips appended in several pieces, rewritten strips, and
+ * both with and without the write-behind buffer.
+ */
+
+#include "tif_config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "tiffio.h"
+
+#define WIDTH		1000
+#define ROWSPERSTRIP	10
+#define NSTRIPS		5
+#define GAP		"some index"
+#define GAPSIZE		64
+
+static int
+check_file(const char* filename, int bigtiff, int bigendian)
+{
+	unsigned char buf[WIDTH * ROWSPERSTRIP];
+	unsigned char header[16 + GAPSIZE];
+	FILE* f;
+	TIFF* tif;
+	uint32_t s;
+	long headersize = bigtiff ? 16 : 8;
+
+	tif = TIFFOpen(filename, "r");
+	if (!tif) {
+		fprintf(stderr, "Can't open %s\n", filename);
+		return 0;
+	}
+	f = fopen(filename, "rb");
+	if (!f || fread(header, headersize + GAPSIZE, 1, f) != 1 ||
+	    memcmp(header + headersize, GAP, sizeof(GAP)) != 0) {
+		fprintf(stderr, "%s: wrong header gap\n", filename);
+		goto bad;
+	}
+	for (s = 0; s < NSTRIPS; s++) {
+		uint64_t offset = TIFFGetStrileOffset(tif, s);
+		uint64_t bytecount = TIFFGetStrileByteCount(tif, s);
+		unsigned char leader[4];
+		uint32_t size;
+		int i;
+
+		if (fseek(f, (long) offset - 4, SEEK_SET) != 0 ||
+		    fread(leader, 4, 1, f) != 1) {
+			fprintf(stderr, "%s: can't read leader of strip %u\n",
+				filename, (unsigned) s);
+			goto bad;
+		}
+		size = 0;
+		for (i = 0; i < 4; i++)
+			size |= (uint32_t) leader[bigendian ? i : 3 - i] <<
+			    (8 * (3 - i));
+		if (size != bytecount) {
+			fprintf(stderr, "%s: leader of strip %u is %u instead of %u\n",
+				filename, (unsigned) s, (unsigned) size,
+				(unsigned) bytecount);
+			goto bad;
+		}
+		if (TIFFReadEncodedStrip(tif, s, buf, sizeof(buf)) !=
+		    (tmsize_t) sizeof(buf) ||
+		    buf[0] != (unsigned char) (s + 1) ||
+		    buf[sizeof(buf) - 1] != (unsigned char) (s + 1)) {
+			fprintf(stderr, "%s: strip %u is wrong\n", filename,
+				(unsigned) s);
+			goto bad;
+		}
+	}
+	fclose(f);
+	TIFFClose(tif);
+	return 1;
+
+bad:
+	if (f)
+		fclose(f);
+	TIFFClose(tif);
+	return 0;
+}
+
+static int
+test(const char* mode, tmsize_t writebuffersize)
+{
+	const char* filename = "strile_leaders.tif";
+	unsigned char buf[WIDTH * ROWSPERSTRIP];
+	TIFF* tif;
+	uint32_t s;
+
+	tif = TIFFOpen(filename, mode);
+	if (!tif) {
+		fprintf(stderr, "Can't create %s\n", filename);
+		return 1;
+	}
+	if (!TIFFSetHeaderGap(tif, NULL, GAPSIZE) ||
+	    !TIFFSetWriteBufferSize(tif, writebuffersize) ||
+	    !TIFFSetStrileLeaders(tif, 1) ||
+	    !TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, WIDTH) ||
+	    !TIFFSetField(tif, TIFFTAG_IMAGELENGTH, ROWSPERSTRIP * NSTRIPS) ||
+	    !TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8) ||
+	    !TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1) ||
+	    !TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK) ||
+	    !TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, ROWSPERSTRIP) ||
+	    /* Each strip gets appended in several pieces */
+	    !TIFFWriteBufferSetup(tif, NULL, 3000)) {
+		fprintf(stderr, "Can't set up %s\n", filename);
+		goto bad;
+	}
+	for (s = 0; s < NSTRIPS; s++) {
+		/* Strip 2 is written twice: the second time, it moves */
+		memset(buf, s == 2 ? 0xff : (int) (s + 1), sizeof(buf));
+		if (TIFFWriteEncodedStrip(tif, s, buf, sizeof(buf)) < 0) {
+			fprintf(stderr, "Can't write strip %u\n", (unsigned) s);
+			goto bad;
+		}
+	}
+	memset(buf, 3, sizeof(buf));
+	if (TIFFWriteEncodedStrip(tif, 2, buf, sizeof(buf)) < 0) {
+		fprintf(stderr, "Can't rewrite strip 2\n");
+		goto bad;
+	}
+	if (!TIFFWriteDirectory(tif)) {
+		fprintf(stderr, "Can't write directory\n");
+		goto bad;
+	}
+	/* The gap can be rewritten, but not grown */
+	if (TIFFSetHeaderGap(tif, NULL, GAPSIZE + 1) ||
+	    !TIFFSetHeaderGap(tif, GAP, sizeof(GAP))) {
+		fprintf(stderr, "Wrong outcome of header gap rewrites\n");
+		goto bad;
+	}
+	TIFFClose(tif);
+	if (!check_file(filename, strchr(mode, '8') != NULL,
+			strchr(mode, 'b') != NULL))
+		return 1;
+	unlink(filename);
+	return 0;
+
+bad:
+	TIFFClose(tif);
+	return 1;
+}
+
+int
+main(void)
+{
+	int ret = 0;
+
+	ret += test("wl", 0);
+	ret += test("wl", 4096);
+	ret += test("w8b", 0);
+	ret += test("w8b", 4096);
+	return ret;
+}
+
+/* vim: set ts=8 sts=8 sw=8 noet: */
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 8
+ * fill-column: 78
+ * End:
+ */
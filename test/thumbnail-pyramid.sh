@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# Check that thumbnail -p makes the thumbnail from the smallest level of a
+# pyramid that is at least as large as the thumbnail
+#
+. ${srcdir:-.}/common.sh
+infile="${IMG_LZW_SINGLE_STROP}"
+outfile="o-thumbnail-pyramid.tiff"
+f_test_convert "${THUMBNAIL} -p -w 64 -h 64" $infile $outfile
+f_tiffinfo_validate $outfile
+
+# A 512x384 RGB image followed by a 32x24 RGB level and a 128x96 grayscale
+# level: the size and samples per pixel of the thumbnail tell which level
+# it was made from.
+rgb128="o-thumbnail-pyramid-rgb128.tiff"
+gray128="o-thumbnail-pyramid-gray128.tiff"
+rgb32="o-thumbnail-pyramid-rgb32.tiff"
+pyramid="o-thumbnail-pyramid-levels.tiff"
+f_test_convert "${THUMBNAIL} -p -w 128 -h 128" "${IMG_QUAD_LZW_COMPAT}" $rgb128
+f_test_convert "${TIFF2BW}" $rgb128 $gray128
+f_test_convert "${THUMBNAIL} -p -w 32 -h 32" "${IMG_QUAD_LZW_COMPAT}" $rgb32
+f_test_convert "${TIFFCP}" "${IMG_QUAD_LZW_COMPAT} $rgb32 $gray128" $pyramid
+
+# f_check_level size width length samples
+f_check_level ()
+{
+  f_test_convert "${THUMBNAIL} -p -w $1 -h $1" $pyramid $outfile
+  f_tiffinfo_validate $outfile
+  info=`${TIFFINFO} $outfile`
+  if echo "$info" | grep "Image Width: $2 Image Length: $3" >/dev/null &&
+     echo "$info" | grep "Samples/Pixel: $4" >/dev/null
+  then
+    :
+  else
+    echo "Expected a $2x$3 thumbnail with $4 samples per pixel:"
+    echo "$info"
+    exit 1
+  fi
+}
+
+f_check_level 20 20 15 3
+f_check_level 32 32 24 3
+f_check_level 33 33 25 1
+f_check_level 100 100 75 1
+f_check_level 128 128 96 1
+f_check_level 200 200 150 3
+f_check_level 1000 512 384 3
@@ -0,0 +1,6 @@
+#!/bin/sh
+#
+# Check that tiff2pdf re-encodes a stripped image band by band
+#
+. ${srcdir:-.}/common.sh
+f_test_stdout "${TIFF2PDF} -z" "${IMG_LZW_SINGLE_STROP}" "o-tiff2pdf-lzw-single-strip.pdf"
@@ -0,0 +1,42 @@
+#!/bin/sh
+#
+# Check tiffcmp -s on one image with strips, two tilings and both byte
+# orders, and on images holding the same bytes in different byte orders
+#
+. ${srcdir:-.}/common.sh
+raw="${IMG_LZW_SINGLE_STROP}"
+o=o-tiffcmp-layouts
+
+f_run ()
+{
+  echo "$MEMCHECK $*"
+  eval "$MEMCHECK $*" || exit 1
+}
+
+# tiffcmp -s -t file1 file2 must exit with the given status
+f_compare ()
+{
+  echo "$MEMCHECK ${TIFFCMP} -s -t $2 $3"
+  eval "$MEMCHECK ${TIFFCMP} -s -t $2 $3"
+  status=$?
+  if test $status != $1
+  then
+    echo "Returned status $status instead of $1"
+    exit 1
+  fi
+}
+
+f_run ${RAW2TIFF} -H 512 -w 100 -l 70 -b 3 -d short -p rgb $raw $o-raw.tiff
+f_run ${TIFFCP} -L -r 8 $o-raw.tiff $o-strip-le.tiff
+f_run ${TIFFCP} -B -r 8 $o-raw.tiff $o-strip-be.tiff
+f_run ${TIFFCP} -L -t -w 32 -l 16 $o-raw.tiff $o-tile32x16.tiff
+f_run ${TIFFCP} -B -c lzw -t -w 16 -l 48 $o-raw.tiff $o-tile16x48.tiff
+f_run ${RAW2TIFF} -H 512 -w 100 -l 70 -d short $raw $o-gray.tiff
+f_run ${RAW2TIFF} -H 512 -w 100 -l 70 -d short -s $raw $o-swapped.tiff
+f_run ${TIFFCP} -L -c none -t -w 16 -l 16 $o-gray.tiff $o-gray-le.tiff
+f_run ${TIFFCP} -B -c none -t -w 16 -l 16 $o-swapped.tiff $o-swapped-be.tiff
+
+f_compare 0 $o-strip-le.tiff $o-tile32x16.tiff
+f_compare 0 $o-tile32x16.tiff $o-tile16x48.tiff
+f_compare 0 $o-strip-le.tiff $o-strip-be.tiff
+f_compare 1 $o-gray-le.tiff $o-swapped-be.tiff
@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# Check that tiffcp -G writes a readable file with the IFDs and tile arrays first
+#
+. ${srcdir:-.}/common.sh
+infile="$srcdir/images/quad-tile.jpg.tiff"
+outfile="o-tiffcp-cog.tiff"
+f_test_convert "${TIFFCP} -G" $infile $outfile
+f_tiffinfo_validate $outfile
+
+# Walk the IFDs and check that they and their StripOffsets/StripByteCounts
+# or TileOffsets/TileByteCounts arrays all end before the first strile.
+layout=`od -v -An -tu1 $outfile | awk '
+function uint(off, size,   v, i) {
+	v = 0
+	for (i = 0; i < size; i++)
+		v = v * 256 + (le ? b[off + size - 1 - i] : b[off + i])
+	return v
+}
+{ for (i = 1; i <= NF; i++) b[n++] = $i }
+END {
+	le = (b[0] == 73)
+	big = (uint(2, 2) == 43)
+	cs = big ? 8 : 2; es = big ? 20 : 12; os = big ? 8 : 4
+	dir = uint(big ? 8 : 4, os)
+	indexend = 0; datastart = -1
+	while (dir > 0) {
+		cnt = uint(dir, cs)
+		next_ = dir + cs + cnt * es
+		if (next_ + os > indexend) indexend = next_ + os
+		for (e = dir + cs; e < next_; e += es) {
+			tag = uint(e, 2); type = uint(e + 2, 2); count = uint(e + 4, os)
+			if (tag != 273 && tag != 279 && tag != 324 && tag != 325)
+				continue
+			ts = (type == 3) ? 2 : (type == 16) ? 8 : 4
+			at = e + 4 + os
+			if (count * ts > os) {
+				at = uint(at, os)
+				if (at + count * ts > indexend) indexend = at + count * ts
+			}
+			for (i = 0; i < count; i++) {
+				if (tag == 273 || tag == 324) off[i] = uint(at + i * ts, ts)
+				else size[i] = uint(at + i * ts, ts)
+			}
+			nstriles = count
+		}
+		for (i = 0; i < nstriles; i++)
+			if (size[i] > 0 && (datastart < 0 || off[i] < datastart))
+				datastart = off[i]
+		dir = uint(next_, os)
+	}
+	print indexend, datastart
+}'`
+set -- $layout
+if test -z "$2" || test "$2" -lt 0 || test "$1" -gt "$2"
+then
+  echo "IFDs and strile arrays end at $1, after the image data at $2"
+  exit 1
+fi
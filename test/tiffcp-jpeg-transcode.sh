@@ -0,0 +1,14 @@
+#!/bin/sh
+#
+# Check that tiffcp re-tiles JPEG data by copying DCT coefficients without
+# loss: transcoded back to its own tiling, the image decodes as the input
+#
+. ${srcdir:-.}/common.sh
+# not infile, which the f_* functions set
+jpegfile="$srcdir/images/quad-tile.jpg.tiff"
+outfile="o-tiffcp-jpeg-transcode.tiff"
+backfile="o-tiffcp-jpeg-transcode-back.tiff"
+f_test_convert "${TIFFCP} -c jpeg:t -t -w 256 -l 256" $jpegfile $outfile
+f_tiffinfo_validate $outfile
+f_test_convert "${TIFFCP} -c jpeg:t -t -w 128 -l 128" $outfile $backfile
+f_test_reader "${TIFFCMP} -s -t $jpegfile" $backfile
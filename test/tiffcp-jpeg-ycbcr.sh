@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Check that tiffcp recompresses JPEG YCbCr tiles and strips to images
+# that decode close to the input
+#
+. ${srcdir:-.}/common.sh
+# not infile, which the f_* functions set
+jpegfile="$srcdir/images/quad-tile.jpg.tiff"
+outfile="o-tiffcp-jpeg-ycbcr.tiff"
+stripfile="o-tiffcp-jpeg-ycbcr-strips-in.tiff"
+stripoutfile="o-tiffcp-jpeg-ycbcr-strips.tiff"
+
+# f_compare_decoded file1 file2
+f_compare_decoded ()
+{
+  f_test_convert "${TIFF2RGBA} -n" $1 o-tiffcp-jpeg-ycbcr-rgb1.tiff
+  f_test_convert "${TIFF2RGBA} -n" $2 o-tiffcp-jpeg-ycbcr-rgb2.tiff
+  diff=`${TIFFCMP} -s -t o-tiffcp-jpeg-ycbcr-rgb1.tiff o-tiffcp-jpeg-ycbcr-rgb2.tiff | \
+    sed -n 's/.*max abs diff \([0-9]*\),.*/\1/p'`
+  if [ "${diff:-0}" -gt 40 ] ; then
+    echo "$2 decodes up to $diff away from $1"
+    exit 1
+  fi
+}
+
+f_test_convert "${TIFFCP} -c jpeg:90" $jpegfile $outfile
+f_tiffinfo_validate $outfile
+f_compare_decoded $jpegfile $outfile
+
+f_test_convert "${TIFFCP} -s -r 16 -c jpeg:90" $jpegfile $stripfile
+f_test_convert "${TIFFCP} -c jpeg:90" $stripfile $stripoutfile
+f_tiffinfo_validate $stripoutfile
+f_compare_decoded $stripfile $stripoutfile
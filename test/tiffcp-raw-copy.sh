@@ -0,0 +1,24 @@
+#!/bin/sh
+#
+# Check that tiffcp copies compressed tiles (and JPEGTABLES) as they are:
+# the tiles keep their byte counts and the images decode the same
+#
+. ${srcdir:-.}/common.sh
+# not infile, which the f_* functions set
+jpegfile="$srcdir/images/quad-tile.jpg.tiff"
+outfile="o-tiffcp-raw-copy.tiff"
+
+# f_byte_counts file: the byte count of each strip or tile of file
+f_byte_counts ()
+{
+  ${TIFFINFO} -s $1 | sed -n 's/^ *[0-9]*: \[ *[0-9]*, *\([0-9]*\)\]$/\1/p'
+}
+
+f_test_convert "${TIFFCP} -8" $jpegfile $outfile
+f_tiffinfo_validate $outfile
+f_test_reader "${TIFFCMP} -s -t $jpegfile" $outfile
+if [ "`f_byte_counts $jpegfile`" != "`f_byte_counts $outfile`" -o \
+     -z "`f_byte_counts $outfile`" ] ; then
+  echo "Tiles of $outfile differ in size from those of $jpegfile"
+  exit 1
+fi
@@ -0,0 +1,14 @@
+#!/bin/sh
+#
+# Check that tiffcrop crops and rotates tiled data through its tile cache
+# to the same pixels as through the whole image
+#
+. ${srcdir:-.}/common.sh
+# not infile and outfile, which the f_* functions set
+jpegfile="$srcdir/images/quad-tile.jpg.tiff"
+streamfile="o-tiffcrop-R90-stream.tiff"
+wholefile="o-tiffcrop-R90-stream-whole.tiff"
+f_test_convert "$TIFFCROP -T 1 -R90 -U px -m 100,100,0,0 -X 60 -Y 40" $jpegfile $streamfile
+f_tiffinfo_validate $streamfile
+f_test_convert "$TIFFCROP -R90 -U px -m 100,100,0,0 -X 60 -Y 40" $jpegfile $wholefile
+f_test_reader "${TIFFCMP} -s -t $wholefile" $streamfile
@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# Check that tiffinfo -J prints valid JSON, with null for a non-finite
+# NDPI magnification.
+#
+. ${srcdir:-.}/common.sh
+outfile="o-tiffinfo-json.json"
+f_test_json ()
+{
+  f_test_stdout "${TIFFINFO} -J" "$1" $outfile
+  for key in file bigtiff directories index offset width length \
+             bitspersample samplesperpixel compression; do
+    if ! grep "\"$key\":" $outfile > /dev/null; then
+      echo "Key \"$key\" missing in $outfile"
+      exit 1
+    fi
+  done
+  if command -v python3 > /dev/null 2>&1; then
+    python3 -m json.tool < $outfile > /dev/null || exit 1
+  fi
+}
+f_test_json "${IMG_LZW_SINGLE_STROP}"
+f_test_json "${IMAGES}/ndpi-magnification-nan.tiff"
+if ! grep '"magnification":null' $outfile > /dev/null; then
+  echo "Non-finite magnification not written as null in $outfile"
+  exit 1
+fi
@@ -0,0 +1,19 @@
+#!/bin/sh
+#
+# Check that tiffmedian writes the same file, with and without dithering,
+# from tiled and stripped copies of an image
+#
+. ${srcdir:-.}/common.sh
+stripfile="o-tiffmedian-tiled-strips-in.tiff"
+tilefile="o-tiffmedian-tiled-tiles-in.tiff"
+f_test_convert "${TIFFCP} -c none" "${IMG_RGB_3C_8B}" $stripfile
+f_test_convert "${TIFFCP} -c none -t -w 32 -l 16" "${IMG_RGB_3C_8B}" $tilefile
+for opts in "" "-f" ; do
+  f_test_convert "${TIFFMEDIAN} $opts" $stripfile o-tiffmedian-tiled-strips.tiff
+  f_test_convert "${TIFFMEDIAN} $opts" $tilefile o-tiffmedian-tiled.tiff
+  f_tiffinfo_validate o-tiffmedian-tiled.tiff
+  if ! cmp o-tiffmedian-tiled-strips.tiff o-tiffmedian-tiled.tiff ; then
+    echo "tiffmedian $opts output differs for tiled and stripped input"
+    exit 1
+  fi
+done
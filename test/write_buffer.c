@@ -0,0 +1,210 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that (i) the above copyright notices and this permission notice appear in
+ * all copies of the software and related documentation, and (ii) the names of
+ * Sam Leffler and Silicon Graphics may not be used in any advertising or
+ * publicity relating to the software without the specific, prior written
+ * permission of Sam Leffler and Silicon Graphics.
+ *
+ * THE SOFTWARE IS PROVIDED "AS-IS" AND WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS, IMPLIED OR OTHERWISE, INCLUDING WITHOUT LIMITATION, ANY
+ * WARRANTY OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * IN NO EVENT SHALL SAM LEFFLER OR SILICON GRAPHICS BE LIABLE FOR
+ * ANY SPECIAL, INCIDENTAL, INDIRECT OR CONSEQUENTIAL DAMAGES OF ANY KIND,
+ * OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+ * WHETHER OR NOT ADVISED OF THE POSSIBILITY OF DAMAGE, AND ON ANY THEORY OF
+ * LIABILITY, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+
+/*
+ * TIFF Library
+ *
+ * Module to test TIFFSetWriteBufferSize(): a file written through the
+ * write-behind buffer must be the same as one written without it, and a
+ * write error on the buffered data must fail the directory write or flush
+ * that writes it out.
+ */
+
+#include "tif_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tiffio.h"
+
+#define WIDTH		256
+#define LENGTH		256
+#define ROWSPERSTRIP	8
+#define BUFFERSIZE	(1024 * 1024)	/* holds the whole image */
+
+/* A file in memory, on a device that is full beyond limit bytes */
+typedef struct {
+	unsigned char* data;
+	toff_t size;
+	toff_t pos;
+	toff_t limit;
+} MemFile;
+
+static tmsize_t
+memRead(thandle_t h, void* buf, tmsize_t size)
+{
+	MemFile* f = (MemFile*) h;
+
+	if (f->pos >= f->size)
+		return 0;
+	if ((toff_t) size > f->size - f->pos)
+		size = (tmsize_t) (f->size - f->pos);
+	memcpy(buf, f->data + f->pos, (size_t) size);
+	f->pos += size;
+	return size;
+}
+
+static tmsize_t
+memWrite(thandle_t h, void* buf, tmsize_t size)
+{
+	MemFile* f = (MemFile*) h;
+	unsigned char* data;
+
+	if (f->pos + size > f->limit)
+		return -1;
+	if (f->pos + size > f->size) {
+		data = (unsigned char*) realloc(f->data,
+		    (size_t) (f->pos + size));
+		if (!data)
+			return -1;
+		memset(data + f->size, 0, (size_t) (f->pos - f->size));
+		f->data = data;
+		f->size = f->pos + size;
+	}
+	memcpy(f->data + f->pos, buf, (size_t) size);
+	f->pos += size;
+	return size;
+}
+
+static toff_t
+memSeek(thandle_t h, toff_t off, int whence)
+{
+	MemFile* f = (MemFile*) h;
+
+	if (whence == SEEK_CUR)
+		off += f->pos;
+	else if (whence == SEEK_END)
+		off += f->size;
+	f->pos = off;
+	return off;
+}
+
+static int
+memClose(thandle_t h)
+{
+	(void) h;
+	return 0;
+}
+
+static toff_t
+memSize(thandle_t h)
+{
+	return ((MemFile*) h)->size;
+}
+
+static int
+memMap(thandle_t h, void** base, toff_t* size)
+{
+	(void) h; (void) base; (void) size;
+	return 0;
+}
+
+static void
+memUnmap(thandle_t h, void* base, toff_t size)
+{
+	(void) h; (void) base; (void) size;
+}
+
+/*
+ * Write an image with the given write-behind buffer size, then write its
+ * directory with TIFFWriteDirectory() or TIFFFlush().  Returns what that
+ * returned.
+ */
+static int
+write_image(MemFile* f, tmsize_t buffersize, int flush)
+{
+	unsigned char buf[WIDTH * ROWSPERSTRIP];
+	TIFF* tif;
+	uint32_t s;
+	int ret;
+
+	tif = TIFFClientOpen("write_buffer", "w", (thandle_t) f, memRead,
+	    memWrite, memSeek, memClose, memSize, memMap, memUnmap);
+	if (!tif) {
+		fprintf(stderr, "Can't create the file\n");
+		return -1;
+	}
+	if (!TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, WIDTH) ||
+	    !TIFFSetField(tif, TIFFTAG_IMAGELENGTH, LENGTH) ||
+	    !TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8) ||
+	    !TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1) ||
+	    !TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK) ||
+	    !TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, ROWSPERSTRIP) ||
+	    !TIFFSetWriteBufferSize(tif, buffersize)) {
+		fprintf(stderr, "Can't set up the file\n");
+		TIFFClose(tif);
+		return -1;
+	}
+	for (s = 0; s < LENGTH / ROWSPERSTRIP; s++) {
+		memset(buf, (int) s, sizeof(buf));
+		if (TIFFWriteEncodedStrip(tif, s, buf, sizeof(buf)) < 0) {
+			fprintf(stderr, "Can't write strip %u\n", (unsigned) s);
+			TIFFClose(tif);
+			return -1;
+		}
+	}
+	ret = flush ? TIFFFlush(tif) : TIFFWriteDirectory(tif);
+	TIFFClose(tif);
+	return ret;
+}
+
+int
+main(void)
+{
+	MemFile plain = { NULL, 0, 0, (toff_t) -1 };
+	MemFile buffered = { NULL, 0, 0, (toff_t) -1 };
+	MemFile full = { NULL, 0, 0, WIDTH * LENGTH / 2 };
+	int ret = 0;
+
+	if (write_image(&plain, 0, 0) != 1 ||
+	    write_image(&buffered, BUFFERSIZE, 0) != 1 ||
+	    plain.size != buffered.size ||
+	    memcmp(plain.data, buffered.data, (size_t) plain.size) != 0) {
+		fprintf(stderr, "Buffered and plain writes differ\n");
+		ret = 1;
+	}
+	/* All strips are written out at once, when the directory is */
+	if (write_image(&full, BUFFERSIZE, 0) != 0) {
+		fprintf(stderr, "Write error missed by TIFFWriteDirectory()\n");
+		ret = 1;
+	}
+	free(full.data);
+	full.data = NULL;
+	full.size = full.pos = 0;
+	if (write_image(&full, BUFFERSIZE, 1) != 0) {
+		fprintf(stderr, "Write error missed by TIFFFlush()\n");
+		ret = 1;
+	}
+	free(plain.data);
+	free(buffered.data);
+	free(full.data);
+	return ret;
+}
+/* vim: set ts=8 sts=8 sw=8 noet: */
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 8
+ * fill-column: 78
+ * End:
+ */
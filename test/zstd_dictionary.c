@@ -0,0 +1,229 @@
+/*
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that (i) the above copyright notices and this permission notice appear in
+ * all copies of the software and related documentation, and (ii) the names of
+ * Sam Leffler and Silicon Graphics may not be used in any advertising or
+ * publicity relating to the software without the specific, prior written
+ * permission of Sam Leffler and Silicon Graphics.
+ *
+ * THE SOFTWARE IS PROVIDED "AS-IS" AND WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS, IMPLIED OR OTHERWISE, INCLUDING WITHOUT LIMITATION, ANY
+ * WARRANTY OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * IN NO EVENT SHALL SAM LEFFLER OR SILICON GRAPHICS BE LIABLE FOR
+ * ANY SPECIAL, INCIDENTAL, INDIRECT OR CONSEQUENTIAL DAMAGES OF ANY KIND,
+ * OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+ * WHETHER OR NOT ADVISED OF THE POSSIBILITY OF DAMAGE, AND ON ANY THEORY OF
+ * LIABILITY, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+
+/*
+ * TIFF Library
+ *
+ * Check that a ZSTD dictionary set on a directory is used by the encoder,
+ * written and read back, and that it does not leak into the following
+ * directory.  Also check that the codec refuses to start when the
+ * application uses the dictionary tag number for its own tag.
+ */
+
+#include "tif_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "tiffio.h"
+
+#define	TILESIZE	32
+#define	ACROSS		8
+#define	NTILES		(ACROSS * ACROSS)
+#define	DICTSIZE	(2 * TILESIZE * TILESIZE)
+
+static const char filename[] = "zstd_dictionary.tif";
+
+/* Tiles of two kinds of noise, which only compress with the dictionary */
+static void
+fill_tile(unsigned char* buf, uint32_t kind)
+{
+	uint32_t seed = 12345 + kind, i;
+
+	for (i = 0; i < TILESIZE * TILESIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (unsigned char) (seed >> 16);
+	}
+}
+
+static ttag_t
+dictionary_tag(TIFF* tif)
+{
+	const TIFFField* fip = TIFFFieldWithName(tif, "ZSTDDictionary");
+
+	return fip ? TIFFFieldTag(fip) : 0;
+}
+
+static int
+write_directory(TIFF* tif, const unsigned char* dict)
+{
+	unsigned char buf[TILESIZE * TILESIZE];
+	uint32_t t;
+
+	TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, TILESIZE * ACROSS);
+	TIFFSetField(tif, TIFFTAG_IMAGELENGTH, TILESIZE * ACROSS);
+	TIFFSetField(tif, TIFFTAG_TILEWIDTH, TILESIZE);
+	TIFFSetField(tif, TIFFTAG_TILELENGTH, TILESIZE);
+	TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
+	TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+	TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+	TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ZSTD);
+	if (dict) {
+		ttag_t tag = dictionary_tag(tif);
+
+		if (tag == 0 ||
+		    !TIFFSetField(tif, tag, (uint32_t) DICTSIZE, dict)) {
+			fprintf(stderr, "Can't set the ZSTD dictionary\n");
+			return 0;
+		}
+	}
+	for (t = 0; t < NTILES; t++) {
+		fill_tile(buf, t % 2);
+		if (TIFFWriteEncodedTile(tif, t, buf, sizeof(buf)) !=
+		    (tmsize_t) sizeof(buf)) {
+			fprintf(stderr, "Can't write tile %u\n", t);
+			return 0;
+		}
+	}
+	return TIFFWriteDirectory(tif);
+}
+
+static int
+check_directory(TIFF* tif, tdir_t dirn, const unsigned char* dict,
+		uint64_t* bytes)
+{
+	unsigned char buf[TILESIZE * TILESIZE], ref[TILESIZE * TILESIZE];
+	uint32_t count = 0, t;
+	void* data = NULL;
+	ttag_t tag;
+
+	if (!TIFFSetDirectory(tif, dirn)) {
+		fprintf(stderr, "Can't read directory %u\n", dirn);
+		return 0;
+	}
+	tag = dictionary_tag(tif);
+	if (tag == 0) {
+		fprintf(stderr, "Directory %u: no ZSTDDictionary field\n", dirn);
+		return 0;
+	}
+	if (TIFFGetField(tif, tag, &count, &data) != (dict != NULL)) {
+		fprintf(stderr, "Directory %u: dictionary %s\n", dirn,
+			dict ? "missing" : "unexpected");
+		return 0;
+	}
+	if (dict && (count != DICTSIZE || memcmp(data, dict, DICTSIZE) != 0)) {
+		fprintf(stderr, "Directory %u: dictionary of %u bytes differs\n",
+			dirn, count);
+		return 0;
+	}
+	*bytes = 0;
+	for (t = 0; t < NTILES; t++) {
+		*bytes += TIFFGetStrileByteCount(tif, t);
+		fill_tile(ref, t % 2);
+		if (TIFFReadEncodedTile(tif, t, buf, sizeof(buf)) !=
+		    (tmsize_t) sizeof(buf) ||
+		    memcmp(buf, ref, sizeof(buf)) != 0) {
+			fprintf(stderr, "Directory %u: tile %u differs\n",
+				dirn, t);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int
+check_conflict(void)
+{
+	static const TIFFFieldInfo info[] = {
+		{ 65000, 1, 1, TIFF_LONG, FIELD_CUSTOM, 1, 0, "OtherPrivateTag" },
+	};
+	TIFF* tif;
+	int ok;
+
+	tif = TIFFOpen(filename, "w");
+	if (!tif) {
+		fprintf(stderr, "Can't create %s\n", filename);
+		return 0;
+	}
+	TIFFMergeFieldInfo(tif, info, 1);
+	ok = !TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ZSTD);
+	TIFFClose(tif);
+	if (!ok)
+		fprintf(stderr, "ZSTD accepted tag 65000 registered by the application\n");
+	return ok;
+}
+
+int
+main()
+{
+	unsigned char dict[DICTSIZE];
+	uint64_t withdict, without, again;
+	TIFF* tif;
+	int ret = 1;
+
+	fill_tile(dict, 0);
+	fill_tile(dict + TILESIZE * TILESIZE, 1);
+
+	if (!check_conflict())
+		goto done;
+
+	tif = TIFFOpen(filename, "w");
+	if (!tif) {
+		fprintf(stderr, "Can't create %s\n", filename);
+		return 1;
+	}
+	if (!write_directory(tif, dict) || !write_directory(tif, NULL)) {
+		TIFFClose(tif);
+		goto done;
+	}
+	TIFFClose(tif);
+
+	tif = TIFFOpen(filename, "r");
+	if (!tif) {
+		fprintf(stderr, "Can't open %s\n", filename);
+		goto done;
+	}
+	/* Back to the first directory: the dictionary must be reloaded */
+	if (!check_directory(tif, 0, dict, &withdict) ||
+	    !check_directory(tif, 1, NULL, &without) ||
+	    !check_directory(tif, 0, dict, &again)) {
+		TIFFClose(tif);
+		goto done;
+	}
+	TIFFClose(tif);
+	if (withdict * 4 > without) {
+		fprintf(stderr,
+			"Dictionary unused: %u bytes with it, %u without\n",
+			(unsigned) withdict, (unsigned) without);
+		goto done;
+	}
+	ret = 0;
+done:
+	if (ret == 0)
+		unlink(filename);
+	return ret;
+}
+
+/* vim: set ts=8 sts=8 sw=8 noet: */
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 8
+ * fill-column: 78
+ * End:
+ */
@@ -59,6 +59,8 @@
 
 #include "tiffio.h"
 
+#include "ndpibatch.h"
+
 #ifndef HAVE_GETOPT
 extern int getopt(int, char**, char*);
 #endif
@@ -96,8 +98,18 @@ static int jpegcolormode = JPEGCOLORMODE_RGB;
 static uint16_t defcompression = (uint16_t) -1;
 static uint16_t defpredictor = (uint16_t) -1;
 static int defpreset =  -1;
+static uint16_t defconfig = (uint16_t) -1;
+static uint16_t deffillorder = 0;
+static uint32_t deftilewidth = (uint32_t) -1;
+static uint32_t deftilelength = (uint32_t) -1;
+static uint32_t defrowsperstrip = (uint32_t) 0;
+static uint64_t diroff = 0;
+static char mode[10];
+static const char* inmode = "r";	/* mode the input files are opened in */
 
 static int tiffcp(TIFF*, TIFF*);
+static int convertNDPIFile(char*, void*);
+static uint64_t estimateNDPIFileMemory(const char*, void*);
 static int processCompressOptions(char*);
 static void usage(void);
 
@@ -147,8 +159,8 @@ static char* build_outfilename(const char* infilename)
 		perror("Insufficient memory for a character string ");
 		exit(EXIT_FAILURE);
 	}
-	strncpy(outfilename, infilename, l);
-	strcat(outfilename, TIFF_SUFFIX);
+	memcpy(outfilename, infilename, l);
+	strcpy(outfilename + l, TIFF_SUFFIX);
 	return outfilename;
 }
 
@@ -195,7 +207,7 @@ static TIFF* openSrcImage (char **imageSpec)
 	*imageSpec = strchr (fn, comma);
 	if (*imageSpec) {  /* there is at least one image number specifier */
 		**imageSpec = '\0';
-		tif = TIFFOpen (fn, "r");
+		tif = TIFFOpen (fn, inmode);
 		/* but, ignore any single trailing comma */
 		if (!(*imageSpec)[1]) {*imageSpec = NULL; return tif;}
 		if (tif) {
@@ -206,25 +218,18 @@ static TIFF* openSrcImage (char **imageSpec)
 			}
 		}
 	}else
-		tif = TIFFOpen (fn, "r");
+		tif = TIFFOpen (fn, inmode);
 	return tif;
 }
 
 int
 main(int argc, char* argv[])
 {
-	uint16_t defconfig = (uint16_t) -1;
-	uint16_t deffillorder = 0;
-	uint32_t deftilewidth = (uint32_t) -1;
-	uint32_t deftilelength = (uint32_t) -1;
-	uint32_t defrowsperstrip = (uint32_t) 0;
-	uint64_t diroff = 0;
-	TIFF* in;
-	TIFF* out;
-	char mode[10];
 	char* mp = mode;
-	char* outfilename;
 	int c;
+	int errorcode = 0;
+	int nworkers = 1;
+	uint64_t batchbudget = ndpiBatchDefaultBudget();
 	extern int optind;
 	extern char* optarg;
 	TIFFErrorHandler oerror;
@@ -235,7 +240,7 @@ main(int argc, char* argv[])
 
 	*mp++ = 'w';
 	*mp = '\0';
-	while ((c = getopt(argc, argv, ",:b:c:f:l:o:z:p:r:w:T:aistBLMC8x")) != -1)
+	while ((c = getopt(argc, argv, ",:b:c:f:l:o:z:p:r:w:P:T:aistBLMNC8x")) != -1)
 		switch (c) {
 		case ',':
 			if (optarg[0] != '=') usage();
@@ -317,6 +322,10 @@ main(int argc, char* argv[])
 		case 'M':
 			*mp++ = 'm'; *mp = '\0';
 			break;
+		case 'N':   /* keep input and output out of the page cache */
+			*mp++ = 'N'; *mp = '\0';
+			inmode = "rN";
+			break;
 		case 'C':
 			*mp++ = 'c'; *mp = '\0';
 			break;
@@ -326,6 +335,11 @@ main(int argc, char* argv[])
 		case 'x':
 			pageInSeq = 1;
 			break;
+		case 'P':   /* parallel batch processing */
+			if (!ndpiBatchParseWorkers(optarg, &nworkers,
+			    &batchbudget))
+				usage();
+			break;
 		case 'T':
 			switch (optarg[0]) {
 			case 'W':
@@ -342,55 +356,97 @@ main(int argc, char* argv[])
 			usage();
 			/*NOTREACHED*/
 		}
-	if (argc - optind != 1)
+	if (argc - optind < 1)
 		usage();
-	outfilename= build_outfilename(argv[optind]);
+	if (nworkers > 1 && argc - optind > 1)
+		return ndpiBatchRun("ndpi2tiff", argc - optind, argv + optind,
+		    nworkers, batchbudget, estimateNDPIFileMemory,
+		    convertNDPIFile, NULL);
+	for (; optind <= argc-1 ; optind++) {
+		int r = convertNDPIFile(argv[optind], NULL);
+		if (r)
+			errorcode = r;
+	}
+	return (errorcode);
+}
+
+/*
+ * Converts one NDPI file (possibly followed by ,image#'s) into a TIFF file
+ * of the same name with the .tif suffix.
+ */
+static int
+convertNDPIFile(char* infilename, void* clientdata)
+{
+	TIFF* in;
+	TIFF* out;
+	char* outfilename;
+	char *imageCursor = infilename;
+
+	(void) clientdata;
+	outfilename= build_outfilename(infilename);
 	out = TIFFOpen(outfilename, mode);
+	_TIFFfree(outfilename);
 	if (out == NULL)
 		return (-2);
-	_TIFFfree(outfilename);
 	pageNum = -1;
-	for (; optind <= argc-1 ; optind++) {
-		char *imageCursor = argv[optind];
-		in = openSrcImage (&imageCursor);
-		if (in == NULL) {
-			(void) TIFFClose(out);
-			return (-3);
-		}
-		if (diroff != 0 && !TIFFSetSubDirectory(in, diroff)) {
-			TIFFError(TIFFFileName(in),
-			    "Error, setting subdirectory at " TIFF_UINT64_FORMAT, diroff);
+	in = openSrcImage (&imageCursor);
+	if (in == NULL) {
+		(void) TIFFClose(out);
+		return (-3);
+	}
+	if (diroff != 0 && !TIFFSetSubDirectory(in, diroff)) {
+		TIFFError(TIFFFileName(in),
+		    "Error, setting subdirectory at " TIFF_UINT64_FORMAT, diroff);
+		(void) TIFFClose(in);
+		(void) TIFFClose(out);
+		return (1);
+	}
+	for (;;) {
+		config = defconfig;
+		compression = defcompression;
+		predictor = defpredictor;
+		preset = defpreset;
+		fillorder = deffillorder;
+		rowsperstrip = defrowsperstrip;
+		tilewidth = deftilewidth;
+		tilelength = deftilelength;
+		g3opts = defg3opts;
+		if (!tiffcp(in, out) || !TIFFWriteDirectory(out)) {
 			(void) TIFFClose(in);
 			(void) TIFFClose(out);
 			return (1);
 		}
-		for (;;) {
-			config = defconfig;
-			compression = defcompression;
-			predictor = defpredictor;
-                        preset = defpreset;
-			fillorder = deffillorder;
-			rowsperstrip = defrowsperstrip;
-			tilewidth = deftilewidth;
-			tilelength = deftilelength;
-			g3opts = defg3opts;
-			if (!tiffcp(in, out) || !TIFFWriteDirectory(out)) {
-				(void) TIFFClose(in);
-				(void) TIFFClose(out);
-				return (1);
-			}
-			if (imageCursor) { /* seek next image directory */
-				if (!nextSrcImage(in, &imageCursor)) break;
-			}else
-				if (!TIFFReadDirectory(in)) break;
-		}
-		(void) TIFFClose(in);
+		if (imageCursor) { /* seek next image directory */
+			if (!nextSrcImage(in, &imageCursor)) break;
+		}else
+			if (!TIFFReadDirectory(in)) break;
 	}
-
+	(void) TIFFClose(in);
 	(void) TIFFClose(out);
 	return (0);
 }
 
+/* Rough peak memory of convertNDPIFile() on a file, used to schedule workers
+   of the batch mode: images are copied one decoded strip or tile at a time */
+static uint64_t
+estimateNDPIFileMemory(const char* infilename, void* clientdata)
+{
+	char* filename;
+	char* p;
+	uint64_t need;
+
+	(void) clientdata;
+	filename = _TIFFmalloc(strlen(infilename)+1);
+	if (filename == NULL)
+		return 0;
+	strcpy(filename, infilename);
+	if ((p = strchr(filename, comma)) != NULL)
+		*p = '\0';
+	need = ndpiBatchLargestImageSize(filename, 1);
+	_TIFFfree(filename);
+	return need;
+}
+
 static void
 processZIPOptions(char* cp)
 {
@@ -475,7 +531,7 @@ processCompressOptions(char* opt)
 }
 
 char* stuff[] = {
-"usage: ndpi2tiff [options] ndpi_input_file",
+"usage: ndpi2tiff [options] ndpi_input_file [ndpi_input_file...]",
 "where options are:",
 " -a              append to output instead of overwriting",
 " -o offset       set initial directory offset",
@@ -508,6 +564,10 @@ char* stuff[] = {
 " -c sgilog       compress output with SGILOG encoding",
 " -c none         use no compression algorithm on output",
 " -x              force the merged tiff pages in sequence",
+" -N              keep the input and output files out of the system page cache",
+" -P #[,#]        convert the input files in # parallel worker processes,",
+"                 largest files first, sharing a global memory budget in MiB",
+"                 (default half of the physical memory; 0 for no limit)",
 "",
 "Group 3 options:",
 " 1d              use default CCITT Group 3 1D-encoding",
@@ -658,6 +718,7 @@ static struct cpTag {
 typedef int (*copyFunc)
     (TIFF* in, TIFF* out, uint32_t l, uint32_t w, uint16_t samplesperpixel);
 static	copyFunc pickCopyFunc(TIFF*, TIFF*, uint16_t, uint16_t);
+static	int canKeepJPEGYCbCr(TIFF*, TIFF*, uint16_t, uint16_t, uint16_t, uint16_t);
 
 /* PODD */
 
@@ -823,7 +884,20 @@ tiffcp(TIFF* in, TIFF* out)
 	switch (compression) {
 		case COMPRESSION_JPEG:
 			TIFFSetField(out, TIFFTAG_JPEGQUALITY, quality);
-			TIFFSetField(out, TIFFTAG_JPEGCOLORMODE, jpegcolormode);
+			if (canKeepJPEGYCbCr(in, out, input_compression,
+			    input_photometric, bitspersample, samplesperpixel)) {
+				/*
+				 * Hand the subsampled YCbCr data straight
+				 * from the decoder to the encoder instead of
+				 * going through RGB.
+				 */
+				TIFFSetField(in, TIFFTAG_JPEGCOLORMODE,
+				    JPEGCOLORMODE_RAW);
+				TIFFSetField(out, TIFFTAG_JPEGCOLORMODE,
+				    JPEGCOLORMODE_RAW);
+			} else
+				TIFFSetField(out, TIFFTAG_JPEGCOLORMODE,
+				    jpegcolormode);
 			break;
 		case COMPRESSION_JBIG:
 			CopyTag(TIFFTAG_FAXRECVPARAMS, 1, TIFF_LONG);
@@ -1126,6 +1200,50 @@ bad:
 	return 0;
 }
 
+/*
+ * Contig tiles -> contig tiles of the same size.
+ */
+DECLAREcpFunc(cpDecodedTiles)
+{
+	tsize_t tilesize = TIFFTileSize(in);
+	tdata_t buf = _TIFFmalloc(tilesize);
+
+	(void) imagewidth; (void) imagelength; (void) spp;
+	if (buf) {
+		ttile_t t, nt = TIFFNumberOfTiles(in);
+		_TIFFmemset(buf, 0, tilesize);
+		for (t = 0; t < nt; t++) {
+			if (TIFFReadEncodedTile(in, t, buf, tilesize) < 0
+			    && !ignore) {
+				TIFFError(TIFFFileName(in),
+				    "Error, can't read tile "
+				    TIFF_UINT32_FORMAT,
+				    t);
+				goto bad;
+			}
+			if (TIFFWriteEncodedTile(out, t, buf, tilesize) < 0) {
+				TIFFError(TIFFFileName(out),
+				    "Error, can't write tile "
+				    TIFF_UINT32_FORMAT,
+				    t);
+				goto bad;
+			}
+		}
+		_TIFFfree(buf);
+		return 1;
+	} else {
+		TIFFError(TIFFFileName(in),
+		    "Error, can't allocate memory buffer of size "
+		    "%"TIFF_SSIZE_FORMAT " to read tiles",
+		    tilesize);
+		return 0;
+	}
+
+bad:
+	_TIFFfree(buf);
+	return 0;
+}
+
 /*
  * Separate -> separate by row for rows/strip change.
  */
@@ -1958,8 +2076,9 @@ pickCopyFunc(TIFF* in, TIFF* out, uint16_t bitspersample, uint16_t samplesperpix
 			return cpSeparateStrips2SeparateTiles;
 		/* Tiles -> Tiles */
 		case pack(PLANARCONFIG_CONTIG,   PLANARCONFIG_CONTIG,   T,T,F):
-		case pack(PLANARCONFIG_CONTIG,   PLANARCONFIG_CONTIG,   T,T,T):
 			return cpContigTiles2ContigTiles;
+		case pack(PLANARCONFIG_CONTIG,   PLANARCONFIG_CONTIG,   T,T,T):
+			return cpDecodedTiles;
 		case pack(PLANARCONFIG_CONTIG,   PLANARCONFIG_SEPARATE, T,T,F):
 		case pack(PLANARCONFIG_CONTIG,   PLANARCONFIG_SEPARATE, T,T,T):
 			return cpContigTiles2SeparateTiles;
@@ -2005,6 +2124,40 @@ pickCopyFunc(TIFF* in, TIFF* out, uint16_t bitspersample, uint16_t samplesperpix
 	return (NULL);
 }
 
+/*
+ * JPEG-compressed YCbCr input that is written out as JPEG with the same
+ * strip or tile layout can be copied in the codec's raw, subsampled YCbCr
+ * form: this skips the YCbCr->RGB conversion and chroma upsampling done by
+ * the decoder and the RGB->YCbCr conversion and downsampling done by the
+ * encoder.  The output keeps the input's YCbCrSubsampling.  Only tiles
+ * are copied this way: libtiff does not give scanline access to
+ * subsampled data, and raw strips do not survive cpDecodedStrips intact.
+ */
+static int
+canKeepJPEGYCbCr(TIFF* in, TIFF* out, uint16_t input_compression,
+    uint16_t input_photometric, uint16_t bitspersample,
+    uint16_t samplesperpixel)
+{
+	uint16_t input_config;
+	uint32_t tw, tl;
+
+	if (input_compression != COMPRESSION_JPEG ||
+	    input_photometric != PHOTOMETRIC_YCBCR ||
+	    jpegcolormode != JPEGCOLORMODE_RGB ||
+	    bitspersample != 8 || samplesperpixel != 3 || bias)
+		return FALSE;
+	TIFFGetFieldDefaulted(in, TIFFTAG_PLANARCONFIG, &input_config);
+	if (input_config != PLANARCONFIG_CONTIG ||
+	    config != PLANARCONFIG_CONTIG)
+		return FALSE;
+	if (!TIFFIsTiled(in) || !TIFFIsTiled(out))
+		return FALSE;
+	if (!TIFFGetField(in, TIFFTAG_TILEWIDTH, &tw) ||
+	    !TIFFGetField(in, TIFFTAG_TILELENGTH, &tl))
+		return FALSE;
+	return (tw == tilewidth && tl == tilelength);
+}
+
 /* vim: set ts=8 sts=8 sw=8 noet: */
 /*
  * Local Variables:
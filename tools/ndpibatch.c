@@ -0,0 +1,260 @@
+/* ndpibatch
+ Batch mode shared by ndpisplit and ndpi2tiff: processes several input
+ files in parallel worker processes under one memory budget.
+ Distributed under the GNU General Public License v3, like ndpisplit
+ and ndpi2tiff */
+
+#include "tif_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifndef _WIN32
+# include <sys/time.h>
+# include <sys/wait.h>
+#endif
+
+#include "ndpibatch.h"
+
+enum { PENDING, RUNNING, DONE };
+
+typedef struct {
+	char * filename;
+	int index;
+	uint64_t filesize;
+	uint64_t need;
+	long pid;
+	int state;
+} NDPIBatchEntry;
+
+int
+ndpiBatchParseWorkers(const char* arg, int* nworkers, uint64_t* budget)
+{
+	char * p;
+	unsigned long n;
+
+	errno = 0;
+	n = strtoul(arg, &p, 10);
+	if (errno || p == arg || n == 0 || n > 1024)
+		return 0;
+	*nworkers = (int) n;
+	if (*p == ',') {
+		double budget_in_MiB = strtod(p+1, &p);
+
+		if (errno || budget_in_MiB < 0 || !isfinite(budget_in_MiB))
+			return 0;
+		*budget = (uint64_t) (budget_in_MiB * 1048576.);
+	}
+	return *p == 0;
+}
+
+/*
+ * Half of the physical memory, or 0 (no limit) if it cannot be found out.
+ */
+uint64_t
+ndpiBatchDefaultBudget(void)
+{
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long pagesize = sysconf(_SC_PAGESIZE);
+
+	if (pages > 0 && pagesize > 0)
+		return (uint64_t) pages * (uint64_t) pagesize / 2;
+#endif
+	return 0;
+}
+
+/*
+ * Size of the largest decoded image of the file (or of its largest decoded
+ * strip or tile if decodedstripsonly is set); 0 if the file can't be read.
+ */
+uint64_t
+ndpiBatchLargestImageSize(const char* filename, int decodedstripsonly)
+{
+	TIFF * tif = TIFFOpen(filename, "r");
+	uint64_t largest = 0;
+
+	if (tif == NULL)
+		return 0;
+	do {
+		uint64_t size;
+
+		if (decodedstripsonly)
+			size = TIFFIsTiled(tif) ? TIFFTileSize64(tif) :
+			    TIFFStripSize64(tif);
+		else {
+			uint32_t length = 0;
+
+			TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &length);
+			size = TIFFScanlineSize64(tif) * length;
+		}
+		if (size > largest)
+			largest = size;
+	} while (TIFFReadDirectory(tif));
+	TIFFClose(tif);
+	return largest;
+}
+
+static int
+compareEntriesLargestFirst(const void* a, const void* b)
+{
+	const NDPIBatchEntry * ea = (const NDPIBatchEntry *) a;
+	const NDPIBatchEntry * eb = (const NDPIBatchEntry *) b;
+
+	if (ea->filesize != eb->filesize)
+		return ea->filesize < eb->filesize ? 1 : -1;
+	return ea->index - eb->index;
+}
+
+static double
+currentTime(void)
+{
+#ifndef _WIN32
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+#else
+	return (double) time(NULL);
+#endif
+}
+
+/*
+ * Runs job on each file, in at most nworkers child processes at a time,
+ * largest files first. A job is only started while the memory estimates of
+ * the running jobs plus its own fit in budget (0: no limit), except when
+ * nothing else runs. Returns the last non-zero code returned by a job, as
+ * the sequential loops of ndpisplit and ndpi2tiff do, and reports the
+ * aggregate throughput on stderr.
+ */
+int
+ndpiBatchRun(const char* progname, int nfiles, char** filenames,
+	int nworkers, uint64_t budget, NDPIBatchEstimate estimate,
+	NDPIBatchJob job, void* clientdata)
+{
+	NDPIBatchEntry * entries;
+	uint64_t reserved = 0, totalsize = 0;
+	int running = 0, done = 0, errorcode = 0;
+	double start = currentTime(), elapsed;
+	int i;
+
+	entries = (NDPIBatchEntry *) _TIFFmalloc(nfiles * sizeof(NDPIBatchEntry));
+	if (entries == NULL) {
+		fprintf(stderr, "Insufficient memory for the list of files to process.\n");
+		return -3;
+	}
+	for (i = 0; i < nfiles; i++) {
+		struct stat st;
+
+		entries[i].filename = filenames[i];
+		entries[i].index = i;
+		entries[i].filesize = stat(filenames[i], &st) == 0 ?
+		    (uint64_t) st.st_size : 0;
+		entries[i].need = estimate ? estimate(filenames[i], clientdata) : 0;
+		entries[i].pid = 0;
+		entries[i].state = PENDING;
+	}
+	qsort(entries, nfiles, sizeof(NDPIBatchEntry),
+	    compareEntriesLargestFirst);
+
+	while (done < nfiles) {
+#ifndef _WIN32
+		pid_t pid;
+		int status;
+
+		for (i = 0; i < nfiles && running < nworkers; i++) {
+			if (entries[i].state != PENDING ||
+			    (running > 0 && budget != 0 &&
+			     reserved + entries[i].need > budget))
+				continue;
+			fflush(NULL);
+			pid = fork();
+			if (pid == 0) {
+				int r = job(entries[i].filename, clientdata);
+
+				/* Keep the sign of small negative codes */
+				exit(r == 0 ? 0 : (r & 0xff) ? (r & 0xff) : 1);
+			}
+			if (pid < 0) {
+				if (running > 0)
+					break;
+				perror("fork");
+				/* Nothing in flight: do it ourselves */
+				if ((status = job(entries[i].filename,
+				    clientdata)) != 0)
+					errorcode = status;
+				entries[i].state = DONE;
+				totalsize += entries[i].filesize;
+				done++;
+				continue;
+			}
+			entries[i].pid = (long) pid;
+			entries[i].state = RUNNING;
+			reserved += entries[i].need;
+			running++;
+		}
+		if (running == 0)
+			continue;
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("waitpid");
+			errorcode = -1;
+			break;
+		}
+		for (i = 0; i < nfiles; i++)
+			if (entries[i].state == RUNNING &&
+			    entries[i].pid == (long) pid)
+				break;
+		if (i == nfiles)
+			continue;
+		entries[i].state = DONE;
+		reserved -= entries[i].need;
+		totalsize += entries[i].filesize;
+		running--;
+		done++;
+		if (WIFEXITED(status)) {
+			if (WEXITSTATUS(status) != 0)
+				errorcode = (signed char) WEXITSTATUS(status);
+		} else {
+			fprintf(stderr, "%s: processing of \"%s\" was interrupted by signal %d.\n",
+			    progname, entries[i].filename,
+			    WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+			errorcode = -1;
+		}
+#else
+		int r = job(entries[done].filename, clientdata);
+
+		if (r)
+			errorcode = r;
+		totalsize += entries[done].filesize;
+		done++;
+#endif
+	}
+
+	elapsed = currentTime() - start;
+	fprintf(stderr, "%s: %d file(s), %.1f MiB in %.2f s with %d worker(s): %.2f MiB/s, %.2f files/s\n",
+	    progname, done, totalsize / 1048576., elapsed, nworkers,
+	    elapsed > 0 ? totalsize / 1048576. / elapsed : 0.,
+	    elapsed > 0 ? done / elapsed : 0.);
+	_TIFFfree(entries);
+	return errorcode;
+}
+
+/* vim: set ts=8 sts=8 sw=8 noet: */
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 8
+ * fill-column: 78
+ * End:
+ */
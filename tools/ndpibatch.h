@@ -0,0 +1,24 @@
+/* ndpibatch
+ Batch mode shared by ndpisplit and ndpi2tiff: processes several input
+ files in parallel worker processes under one memory budget.
+ Distributed under the GNU General Public License v3, like ndpisplit
+ and ndpi2tiff */
+
+#ifndef _NDPIBATCH_
+#define _NDPIBATCH_
+
+#include "tiffio.h"
+
+/* Processes one input file; returns 0 on success or an error code */
+typedef int (*NDPIBatchJob)(char* filename, void* clientdata);
+/* Returns the number of bytes a job on this file is expected to need */
+typedef uint64_t (*NDPIBatchEstimate)(const char* filename, void* clientdata);
+
+extern	int ndpiBatchParseWorkers(const char* arg, int* nworkers, uint64_t* budget);
+extern	uint64_t ndpiBatchDefaultBudget(void);
+extern	uint64_t ndpiBatchLargestImageSize(const char* filename, int decodedstripsonly);
+extern	int ndpiBatchRun(const char* progname, int nfiles, char** filenames,
+	    int nworkers, uint64_t budget, NDPIBatchEstimate estimate,
+	    NDPIBatchJob job, void* clientdata);
+
+#endif /* _NDPIBATCH_ */
@@ -44,11 +44,16 @@
 #include <sys/stat.h>
 #include <ctype.h>
 #include <stdarg.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 #include "tiffio.h"
 
 #include "jpeglib.h"
 
+#include "ndpibatch.h"
+
 #define COMPRESSION_JPEG_IN_JPEG_FILE ((uint16_t) -2)
 #define ORDINARY_JPEG_MAX_DIMENSION  65500L
 
@@ -77,6 +82,16 @@ typedef struct {
 	char * label;
 } BoxToExtract;
 
+typedef struct {
+	int shouldmakepreviewonly;
+	int shouldsubdivideintoscannedzones;
+	unsigned numberofboxestoextract;
+	BoxToExtract * boxestoextract;
+	int shouldmakemosaicoffiles;
+	uint16_t mosaiccompressionformat;
+	uint16_t splitimagecompressionformat;
+} BatchOptions;
+
 #ifndef HAVE_GETOPT
 extern int getopt(int, char**, char*);
 #endif
@@ -117,6 +132,8 @@ static	int printcontroldata = 0;
 
 static	int parseBoxLabel(const char *, const char *, BoxToExtract *);
 static	int processNDPIFile(char*, int, int, unsigned, BoxToExtract*, int, uint16_t, uint16_t);
+static	int processNDPIFileInBatch(char*, void*);
+static	uint64_t estimateNDPIFileMemory(const char*, void*);
 static	int magnificationShouldNotBeExtracted(float, unsigned, const float *);
 static	int zoffsetShouldNotBeExtracted(int32_t, unsigned, const int32_t *);
 static	int rewindToBeginningOfTIFF(TIFF*);
@@ -130,6 +147,8 @@ static	int cpTiles(TIFF*, TIFF*, uint32_t, uint32_t, uint32_t, uint32_t, uint16_
 static	int cpStrips2Tiles(TIFF*, TIFF*, uint32_t, uint32_t, uint32_t, uint32_t, uint16_t);
 static	int cpTiles2Strip(TIFF*, void*, int, uint32_t, uint32_t, uint32_t, uint32_t, unsigned char*, uint16_t);
 static	int cpStrips2Strip(TIFF*, void*, int, uint32_t, uint32_t, uint32_t, uint32_t, unsigned char*, uint16_t, uint32_t*, uint32_t);
+static	unsigned char* mapStripData(TIFF*, void**, size_t*);
+static	void unmapStripData(void*, size_t);
 static	int getNumberOfBlankLanes(TIFF*);
 static	float getNDPIMagnification(TIFF*);
 static	int getWidthAndLength(TIFF*, uint32_t*, uint32_t*, float);
@@ -179,6 +198,8 @@ main(int argc, char* argv[])
 	uint16_t splitimagecompressionformat = -1;
 	uint16_t mosaiccompressionformat = NDPISPLIT_MOSAICCOMPRESSIONFORMAT;
 	int errorcode = 0;
+	int nworkers = 1;
+	uint64_t batchbudget = ndpiBatchDefaultBudget();
 
 	oerror = TIFFSetErrorHandler(NULL);
 	/*owarning =*/ TIFFSetWarningHandler(NULL);
@@ -598,6 +619,12 @@ read_mosaic_JPEG_quality:
 				default: usage("Unsupported compression format in argument to option '-c'.\n");
 					return (-3);
 			}
+		} else if (argv[arg][1] == 'P') {
+			if (!ndpiBatchParseWorkers(argv[arg]+2, &nworkers,
+			    &batchbudget)) {
+				usage("Syntax error in argument to option '-P'.\n");
+				return (-3);
+			}
 		} else {
 			usage("%s: option not recognized.\n", argv[arg]);
 			return(-3);
@@ -623,6 +650,23 @@ read_mosaic_JPEG_quality:
 		TIFFSetWarningHandler(stderrWarningHandler);
 	}
 
+	if (nworkers > 1 && argc - arg > 1) {
+		BatchOptions options;
+
+		options.shouldmakepreviewonly = shouldmakepreviewonly;
+		options.shouldsubdivideintoscannedzones =
+		    shouldsubdivideintoscannedzones;
+		options.numberofboxestoextract = numberofboxestoextract;
+		options.boxestoextract = boxestoextract;
+		options.shouldmakemosaicoffiles = shouldmakemosaicoffiles;
+		options.mosaiccompressionformat = mosaiccompressionformat;
+		options.splitimagecompressionformat =
+		    splitimagecompressionformat;
+		return ndpiBatchRun("ndpisplit", argc - arg, argv + arg,
+		    nworkers, batchbudget, estimateNDPIFileMemory,
+		    processNDPIFileInBatch, &options);
+	}
+
 	for (; arg < argc ; arg++) {
 		int r = processNDPIFile(argv[arg],
 		    shouldmakepreviewonly,
@@ -661,6 +705,38 @@ static int parseBoxLabel(const char * r, const char * p, BoxToExtract * box)
 	return 0;
 }
 
+static int
+processNDPIFileInBatch(char * NDPIfilename, void * clientdata)
+{
+	BatchOptions * options = (BatchOptions *) clientdata;
+
+	return processNDPIFile(NDPIfilename,
+	    options->shouldmakepreviewonly,
+	    options->shouldsubdivideintoscannedzones,
+	    options->numberofboxestoextract, options->boxestoextract,
+	    options->shouldmakemosaicoffiles,
+	    options->mosaiccompressionformat,
+	    options->splitimagecompressionformat);
+}
+
+/* Rough peak memory of processNDPIFile() on a file, used to schedule workers
+   of the batch mode: the largest decoded image, or what the preview size or
+   the mosaic piece size limits allow to be held at once */
+static uint64_t
+estimateNDPIFileMemory(const char * NDPIfilename, void * clientdata)
+{
+	BatchOptions * options = (BatchOptions *) clientdata;
+	uint64_t need = ndpiBatchLargestImageSize(NDPIfilename, 0);
+
+	if (options->shouldmakepreviewonly && previewimagesizelimit &&
+	    need > 3 * (uint64_t) previewimagesizelimit)
+		need = 3 * (uint64_t) previewimagesizelimit;
+	else if (options->shouldmakemosaicoffiles && mosaicpiecesizelimit &&
+	    need > (uint64_t) mosaicpiecesizelimit)
+		need = (uint64_t) mosaicpiecesizelimit;
+	return need;
+}
+
 static int
 processNDPIFile(char * NDPIfilename, int shouldmakepreviewonly,
 	int shouldsubdivideintoscannedzones,
@@ -834,6 +910,8 @@ processNDPIFile(char * NDPIfilename, int shouldmakepreviewonly,
 				maxndpimagnification= ndpimagnification;
 			} else if (ndpimagnification == -2) {
 				unsigned int n, first_non_empty;
+				if (scannedzoneboxes != NULL)
+					_TIFFfree(scannedzoneboxes);
 				nscannedzones= getScannedZonesFromMap(in,
 				    &scannedzoneboxes);
 				if (verbose >= 2)
@@ -1189,6 +1267,8 @@ processNDPIFile(char * NDPIfilename, int shouldmakepreviewonly,
 		}
 	} while (TIFFReadDirectory(in));
 	(void) TIFFClose(in);
+	if (scannedzoneboxes != NULL)
+		_TIFFfree(scannedzoneboxes);
 	return (0);
 }
 
@@ -1689,56 +1769,20 @@ computeMaxPieceMemorySize(uint32_t inimagewidth, uint32_t inimagelength,
 static void
 tiffCopyFieldsButDimensions(TIFF* in, TIFF* out)
 {
-	uint16_t bitspersample, samplesperpixel, compression, shortv, *shortav;
-	float floatv;
-	char *stringv;
-	uint32_t longv;
-
-	CopyField(TIFFTAG_SUBFILETYPE, longv);
-	CopyField(TIFFTAG_BITSPERSAMPLE, bitspersample);
-	CopyField(TIFFTAG_SAMPLESPERPIXEL, samplesperpixel);
-	CopyField(TIFFTAG_COMPRESSION, compression);
-	CopyField(TIFFTAG_PHOTOMETRIC, shortv);
-	CopyField(TIFFTAG_PREDICTOR, shortv);
-	CopyField(TIFFTAG_THRESHHOLDING, shortv);
-	CopyField(TIFFTAG_FILLORDER, shortv);
-	CopyField(TIFFTAG_ORIENTATION, shortv);
-	CopyField(TIFFTAG_MINSAMPLEVALUE, shortv);
-	CopyField(TIFFTAG_MAXSAMPLEVALUE, shortv);
-	CopyField(TIFFTAG_XRESOLUTION, floatv);
-	CopyField(TIFFTAG_YRESOLUTION, floatv);
-	CopyField(TIFFTAG_GROUP3OPTIONS, longv);
-	CopyField(TIFFTAG_GROUP4OPTIONS, longv);
-	CopyField(TIFFTAG_RESOLUTIONUNIT, shortv);
-	CopyField(TIFFTAG_PLANARCONFIG, shortv);
-	CopyField(TIFFTAG_XPOSITION, floatv);
-	CopyField(TIFFTAG_YPOSITION, floatv);
-	CopyField(TIFFTAG_IMAGEDEPTH, longv);
-	CopyField(TIFFTAG_TILEDEPTH, longv);
-	CopyField(TIFFTAG_SAMPLEFORMAT, shortv);
-	CopyField2(TIFFTAG_EXTRASAMPLES, shortv, shortav);
-	{ uint16_t *red, *green, *blue;
-	  CopyField3(TIFFTAG_COLORMAP, red, green, blue);
-	}
-	{ uint16_t shortv2;
-	  CopyField2(TIFFTAG_PAGENUMBER, shortv, shortv2);
-	}
-	CopyField(TIFFTAG_ARTIST, stringv);
-	CopyField(TIFFTAG_IMAGEDESCRIPTION, stringv);
-	CopyField(TIFFTAG_MAKE, stringv);
-	CopyField(TIFFTAG_MODEL, stringv);
-	CopyField(TIFFTAG_SOFTWARE, stringv);
-	CopyField(TIFFTAG_DATETIME, stringv);
-	CopyField(TIFFTAG_HOSTCOMPUTER, stringv);
-	CopyField(TIFFTAG_PAGENAME, stringv);
-	CopyField(TIFFTAG_DOCUMENTNAME, stringv);
-	CopyField(TIFFTAG_BADFAXLINES, longv);
-	CopyField(TIFFTAG_CLEANFAXDATA, longv);
-	CopyField(TIFFTAG_CONSECUTIVEBADFAXLINES, longv);
-	CopyField(TIFFTAG_FAXRECVPARAMS, longv);
-	CopyField(TIFFTAG_FAXRECVTIME, longv);
-	CopyField(TIFFTAG_FAXSUBADDRESS, stringv);
-	CopyField(TIFFTAG_FAXDCS, stringv);
+	/* Besides the layout of the image, leave out the JPEG tables,
+	 * since the compression is often changed afterwards, and the NDPI
+	 * private tags, which would make the output be taken for an NDPI
+	 * file */
+	uint32_t exclude[4 + NDPITAG_65458 - NDPITAG_65420 + 1];
+	uint32_t nexclude = 0, tag;
+
+	exclude[nexclude++] = TIFFTAG_IMAGEWIDTH;
+	exclude[nexclude++] = TIFFTAG_TILEWIDTH;
+	exclude[nexclude++] = TIFFTAG_ROWSPERSTRIP;
+	exclude[nexclude++] = TIFFTAG_JPEGTABLES;
+	for (tag = NDPITAG_65420; tag <= NDPITAG_65458; tag++)
+		exclude[nexclude++] = tag;
+	TIFFCopyDirectoryTags(in, out, exclude, nexclude);
 }
 
  /* Much faster than cpStrips, but defaults to cpStrips if there's not 
@@ -1935,6 +1979,51 @@ static void cpBufToBuf(uint8_t* out, uint8_t* in, uint32_t rows,
 	}
 }
 
+/*
+ * Reserve room in out for its single uncompressed strip and map it, so
+ * that the pixels are copied straight into the file instead of into a
+ * buffer written afterwards. Returns NULL when this can't be done: the
+ * strip must then be written as usual.
+ */
+static unsigned char*
+mapStripData(TIFF* out, void** map, size_t* maplen)
+{
+#ifdef HAVE_MMAP
+	uint64_t offset, pageoffset;
+	long pagesize = sysconf(_SC_PAGESIZE);
+	void* p;
+
+	if (TIFFIsByteSwapped(out) || pagesize <= 0 ||
+	    TIFFNumberOfStrips(out) != 1 || !TIFFReserveStrileData(out))
+		return NULL;
+	offset = TIFFGetStrileOffset(out, 0);
+	pageoffset = offset % (uint64_t) pagesize;
+	*maplen = (size_t) (pageoffset + TIFFGetStrileByteCount(out, 0));
+	p = mmap(NULL, *maplen, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    TIFFFileno(out), (off_t) (offset - pageoffset));
+	if (p == MAP_FAILED)
+		return NULL;
+	*map = p;
+	return (unsigned char*) p + pageoffset;
+#else
+	(void) out;
+	(void) map;
+	(void) maplen;
+	return NULL;
+#endif
+}
+
+static void
+unmapStripData(void* map, size_t maplen)
+{
+#ifdef HAVE_MMAP
+	munmap(map, maplen);
+#else
+	(void) map;
+	(void) maplen;
+#endif
+}
+
 static int
 writeBufferToContigTiles(TIFF* out, uint8_t* buf,
 	uint32_t inimagerowsizeinbytes, uint32_t firstrow,
@@ -2129,6 +2218,8 @@ cpTiles2Strip(TIFF* in, void * ambiguous_out,
 	uint32_t y;
 	tmsize_t outscanlinesizeinbytes;
 	unsigned char * inbuf, * bufp= outbuf;
+	void * map = NULL;
+	size_t maplen = 0;
 	int success = 1;
 
 	if (output_to_jpeg_rather_than_tiff) {
@@ -2205,6 +2296,10 @@ cpTiles2Strip(TIFF* in, void * ambiguous_out,
 		/* To be done *after* setting compression -- otherwise,
 		 * ScanlineSize may be wrong */
 		outscanlinesizeinbytes= TIFFRasterScanlineSize(TIFFout);
+		/* Uncompressed pixels go straight into the file */
+		if (compressionformat == COMPRESSION_NONE &&
+		    (bufp = mapStripData(TIFFout, &map, &maplen)) == NULL)
+			bufp = outbuf;
 
 /*{
 uint16_t out_compression= -1, out_photometric= -1;
@@ -2296,7 +2391,7 @@ TIFFFileName(TIFFout), outscanlinesizeinbytes, TIFFScanlineSize(TIFFout));*/
 			row_pointers[y]= row_pointer;
 
 		jpeg_write_scanlines(p_cinfo, row_pointers, length);
-	} else {
+	} else if (map == NULL) {
 		if (TIFFWriteEncodedStrip(TIFFout,
 			TIFFComputeStrip(TIFFout, 0, 0),
 		    outbuf, TIFFStripSize(TIFFout)) < 0) {
@@ -2307,6 +2402,8 @@ TIFFFileName(TIFFout), outscanlinesizeinbytes, TIFFScanlineSize(TIFFout));*/
 	}
 
 	done:
+	if (map != NULL)
+		unmapStripData(map, maplen);
 	_TIFFfree(inbuf);
 	return success;
 }
@@ -2327,6 +2424,8 @@ cpStrips2Strip(TIFF* in, void * ambiguous_out,
 	uint32_t y;
 	tmsize_t outscanlinesizeinbytes;
 	unsigned char * inbuf, * bufp= outbuf;
+	void * map = NULL;
+	size_t maplen = 0;
 	int success = 1;
 
 	if (output_to_jpeg_rather_than_tiff) {
@@ -2395,6 +2494,10 @@ cpStrips2Strip(TIFF* in, void * ambiguous_out,
 		/* To be done *after* setting compression -- otherwise,
 		 * ScanlineSize may be wrong */
 		outscanlinesizeinbytes= TIFFRasterScanlineSize(TIFFout);
+		/* Uncompressed pixels go straight into the file */
+		if (compressionformat == COMPRESSION_NONE &&
+		    (bufp = mapStripData(TIFFout, &map, &maplen)) == NULL)
+			bufp = outbuf;
 /*{
 uint16_t out_compression= -1, out_photometric= -1;
 
@@ -2491,7 +2594,7 @@ fprintf(stderr, "Outfile \"%s\": compression set scanlinesize="
 			row_pointers[y]= row_pointer;
 
 		jpeg_write_scanlines(p_cinfo, row_pointers, length);
-	} else {
+	} else if (map == NULL) {
 		if (TIFFWriteEncodedStrip(TIFFout,
 			TIFFComputeStrip(TIFFout, 0, 0),
 		    outbuf, TIFFStripSize(TIFFout)) < 0) {
@@ -2502,6 +2605,8 @@ fprintf(stderr, "Outfile \"%s\": compression set scanlinesize="
 	}
 
 	done:
+	if (map != NULL)
+		unmapStripData(map, maplen);
 	_TIFFfree(inbuf);
 	return success;
 }
@@ -2554,14 +2659,36 @@ getWidthAndLength(TIFF* in, uint32_t * width, uint32_t * length,
 	return 0;
 }
 
+/* Returns the index of the first non-zero byte of buf[x..width-1], or width.
+   Blank filling is skipped a machine word at a time. */
+static uint32_t
+skipZeroBytes(const uint8_t * buf, uint32_t x, uint32_t width)
+{
+	while (x < width && ((uintptr_t) (buf + x) & (sizeof(uint64_t)-1)))
+		if (buf[x])
+			return x;
+		else
+			x++;
+	while (width - x >= sizeof(uint64_t) &&
+	    *(const uint64_t *) (buf + x) == 0)
+		x += sizeof(uint64_t);
+	while (x < width && buf[x] == 0)
+		x++;
+	return x;
+}
+
+/* Reads the map of scanned zones one scanline at a time and returns the
+   number of zone labels (the largest label found), filling *ppboxes with
+   the bounding box in the map of each label. Returns 0 (and *ppboxes NULL)
+   if there is no zone or on error. */
 static unsigned int
 getScannedZonesFromMap(TIFF* in, ScannedZoneBox ** ppboxes)
 {
 	uint16_t planarconfig, spp, bitspersample;
 	uint32_t imagelength, imagewidth, x, y;
 	tmsize_t bufsize;
-	uint8_t * buf, * p;
-	unsigned int numberscannedzones, n;
+	uint8_t * buf;
+	unsigned int numberscannedzones, numberallocated, n;
 
 	assert(! TIFFIsTiled(in));
 
@@ -2575,7 +2702,8 @@ getScannedZonesFromMap(TIFF* in, ScannedZoneBox ** ppboxes)
 	(void) TIFFGetField(in, TIFFTAG_IMAGEWIDTH, &imagewidth);
 	(void) TIFFGetField(in, TIFFTAG_SAMPLESPERPIXEL, &spp);
 
-	bufsize = TIFFRasterScanlineSize(in) * (tmsize_t) imagelength;
+	*ppboxes= NULL;
+	bufsize = TIFFRasterScanlineSize(in);
 	buf  = (unsigned char *)_TIFFmalloc(bufsize);
 
 	if (!buf) {
@@ -2586,51 +2714,78 @@ getScannedZonesFromMap(TIFF* in, ScannedZoneBox ** ppboxes)
 			bufsize);
 		return 0;
 	}
+	if ((tmsize_t) imagewidth > bufsize)
+		imagewidth= (uint32_t) bufsize;
 
-	if (! readContigStripsIntoBuffer(in, buf, 0, imagelength, bufsize) )
-		return 0;
-
-		/* First pass on the map to count the scanned zones. */
 	numberscannedzones= 0;
-	for (y = 0, p = buf ; y < imagelength ; y++)
-		for (x = 0 ; x < imagewidth ; x++, p++) {
-			if (*p > numberscannedzones)
-				numberscannedzones= *p;
+	numberallocated= 0;
+	for (y = 0 ; y < imagelength ; y++) {
+		if (TIFFReadScanline(in, (tdata_t) buf, y, 0) < 0) {
+			TIFFError(TIFFFileName(in),
+			    "Error, can't read scanline " TIFF_UINT32_FORMAT,
+			    y);
+			goto bad;
 		}
-
-	*ppboxes= _TIFFmalloc(numberscannedzones * sizeof(ScannedZoneBox));
-	if (*ppboxes == NULL) {
-		TIFFError(TIFFFileName(in),
-			"Error, can't allocate memory buffer to store "
-			"the limits of scanned zones");
-		return 0;
-	}
-
-	for (n = 0 ; n < numberscannedzones ; n++)
-		(*ppboxes)[n].isempty= 1;
-
-		/* Second pass on the map to find the boxes. */
-	for (y = 0, p = buf ; y < imagelength ; y++)
-		for (x = 0 ; x < imagewidth ; x++, p++) {
-			if (*p) {
-				uint32_t n= (*p)-1;
-				ScannedZoneBox * p= &((*ppboxes)[n]);
-				if (p->isempty) {
-					p->isempty= 0;
-					p->map_xmin= x;
-					p->map_ymin= y;
-					p->map_xmax= x;
-					p->map_ymax= y;
-				} else {
-					MIN(p->map_xmin, x);
-					MIN(p->map_ymin, y);
-					MAX(p->map_xmax, x);
-					MAX(p->map_ymax, y);
+		for (x = skipZeroBytes(buf, 0, imagewidth) ; x < imagewidth ;
+		    x = skipZeroBytes(buf, x, imagewidth)) {
+			uint8_t label= buf[x];
+			uint32_t runstart= x;
+			ScannedZoneBox * p;
+
+				/* A zone crosses a scanline as one run */
+			while (x < imagewidth && buf[x] == label)
+				x++;
+
+			if (label > numberallocated) {
+				unsigned int newnumber= 2 * numberallocated;
+				ScannedZoneBox * newboxes;
+
+				if (newnumber < label)
+					newnumber= label;
+				newboxes= _TIFFrealloc(*ppboxes,
+				    newnumber * sizeof(ScannedZoneBox));
+				if (newboxes == NULL) {
+					TIFFError(TIFFFileName(in),
+						"Error, can't allocate memory buffer to store "
+						"the limits of scanned zones");
+					goto bad;
 				}
+				*ppboxes= newboxes;
+				for (n = numberallocated ; n < newnumber ; n++)
+					(*ppboxes)[n].isempty= 1;
+				numberallocated= newnumber;
+			}
+			MAX(numberscannedzones, label);
+
+			p= &((*ppboxes)[label-1]);
+			if (p->isempty) {
+				p->isempty= 0;
+				p->map_xmin= runstart;
+				p->map_ymin= y;
+				p->map_xmax= x-1;
+				p->map_ymax= y;
+			} else {
+				MIN(p->map_xmin, runstart);
+				MAX(p->map_xmax, x-1);
+				p->map_ymax= y;
 			}
 		}
+	}
 
+	_TIFFfree(buf);
+	if (numberscannedzones == 0 && *ppboxes != NULL) {
+		_TIFFfree(*ppboxes);
+		*ppboxes= NULL;
+	}
 	return numberscannedzones;
+
+bad:
+	_TIFFfree(buf);
+	if (*ppboxes != NULL) {
+		_TIFFfree(*ppboxes);
+		*ppboxes= NULL;
+	}
+	return 0;
 }
 
 static void
@@ -2808,6 +2963,7 @@ usage(const char* errorMessage, ...)
 	fprintf(stderr, " -M[#][c]  same as -m but a mosaic is always made (even for small images)\n");
 	fprintf(stderr, " -cC  specify the compression format of split images\n");
 	fprintf(stderr, "  C: compression format (as for mosaic pieces except that J isn't supported)\n");
+	fprintf(stderr, " -P#[,#]   process the files in # parallel worker processes, largest files first, sharing a global memory budget in MiB (default half of the physical memory; 0 for no limit)\n");
 	fprintf(stderr, " -p[s[,WxL]]     extract preview image(s) only (image(s) at lowest available magnification, or macroscopic image of the slide), of maximum size / width / length s / W / L pixels (default 1 Mpx for s and no limits on W and L; 0 for any dimension means no limit) and print a few parameters (useful to prepare selection of zones to extract at large magnification)\n\n");
 
 	fprintf(stderr, "Examples: ndpisplit -e0,0.75,0.25,0.25 -m500J60 -o30 to split the lower left quarter of the images inside the NDPI file into separate TIFF files (one for each magnification and each z level), then produce a mosaic from each TIFF file that would require more than 500 MiB of memory to open. Mosaic pieces will require less than 500 MiB to open and be stored into JPEG files with quality level 60. There will be an overlap of 30 pixels between adjacent mosaic pieces.\n");
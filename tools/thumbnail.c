@@ -36,6 +36,11 @@
 
 #include "tiffio.h"
 
+#ifdef JPEG_SUPPORT
+# include <setjmp.h>
+# include "jpeglib.h"
+#endif
+
 #ifndef EXIT_SUCCESS
 #define EXIT_SUCCESS 0
 #endif
@@ -63,9 +68,11 @@ static	uint32_t tnw = 216;		/* thumbnail width */
 static	uint32_t tnh = 274;		/* thumbnail height */
 static	Contrast contrast = LINEAR;	/* current contrast */
 static	uint8_t* thumbnail;
+static	int pyramid = 0;		/* thumbnail from a resolution level */
 
 static	int cpIFD(TIFF*, TIFF*);
 static	int generateThumbnail(TIFF*, TIFF*);
+static	int generateLevelThumbnail(TIFF*, TIFF*);
 static	void initScale();
 static	void usage(int code);
 
@@ -81,7 +88,7 @@ main(int argc, char* argv[])
     TIFF* out;
     int c;
 
-    while ((c = getopt(argc, argv, "w:h:c:")) != -1) {
+    while ((c = getopt(argc, argv, "w:h:c:p")) != -1) {
 	switch (c) {
 	case 'w':	tnw = strtoul(optarg, NULL, 0); break;
 	case 'h':	tnh = strtoul(optarg, NULL, 0); break;
@@ -94,6 +101,7 @@ main(int argc, char* argv[])
 				   streq(optarg, "linear")? LINEAR :
 							    EXP;
 			break;
+	case 'p':	pyramid = 1; break;
 	default:	usage(EXIT_FAILURE);
 	}
     }
@@ -107,6 +115,13 @@ main(int argc, char* argv[])
     if( in == NULL )
         return 2;
 
+    if (pyramid) {
+	int ok = generateLevelThumbnail(in, out);
+	(void) TIFFClose(in);
+	(void) TIFFClose(out);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     thumbnail = (uint8_t*) _TIFFmalloc(tnw * tnh);
     if (!thumbnail) {
 	    TIFFError(TIFFFileName(in),
@@ -650,12 +665,595 @@ generateThumbnail(TIFF* in, TIFF* out)
             TIFFWriteDirectory(out) != -1);
 }
 
+/*
+ * Pyramid mode: the thumbnail is made from the smallest resolution level
+ * of the image that is still at least as large as the thumbnail, instead
+ * of from the full resolution image.  The levels are the images of the
+ * main directory chain (NDPI magnifications, reduced-resolution images)
+ * and the SubIFDs of the first image that have its aspect ratio.
+ */
+
+/*
+ * Record a candidate level if it has the aspect ratio of the full resolution
+ * image and can be read through the RGBA interface.
+ */
+static void
+considerLevel(TIFF* in, uint32_t fw, uint32_t fh, uint32_t tw, uint32_t th,
+	      uint64_t* bestoff, uint32_t* bestw, uint32_t* besth)
+{
+    uint32_t w, h;
+    char emsg[1024];
+    double ratio;
+    int fits, bestfits;
+
+    if (!TIFFGetField(in, TIFFTAG_IMAGEWIDTH, &w) ||
+	!TIFFGetField(in, TIFFTAG_IMAGELENGTH, &h) || w == 0 || h == 0)
+	return;
+    ratio = ((double) w * fh) / ((double) h * fw);
+    if (ratio < 0.95 || ratio > 1.05 || !TIFFRGBAImageOK(in, emsg))
+	return;
+    fits = (w >= tw && h >= th);
+    bestfits = (*bestw >= tw && *besth >= th);
+    if (*bestw == 0 ||
+	(fits && (!bestfits || (uint64_t) w * h < (uint64_t) *bestw * *besth)) ||
+	(!fits && !bestfits && (uint64_t) w * h > (uint64_t) *bestw * *besth)) {
+	*bestoff = TIFFCurrentDirOffset(in);
+	*bestw = w;
+	*besth = h;
+    }
+}
+
+/*
+ * Select the level to make a thumbnail of size *tw x *th from, and make it
+ * the current directory.  The thumbnail size fits the -w and -h values and
+ * keeps the aspect ratio of the image, but is never larger than the level.
+ */
+static int
+selectLevel(TIFF* in, uint32_t* tw, uint32_t* th)
+{
+    uint32_t fw, fh, bestw = 0, besth = 0;
+    uint64_t bestoff = 0;
+    uint64_t* subifd;
+    uint64_t* suboffsets = NULL;
+    uint16_t nsubifd = 0, i;
+
+    TIFFGetField(in, TIFFTAG_IMAGEWIDTH, &fw);
+    TIFFGetField(in, TIFFTAG_IMAGELENGTH, &fh);
+    if (fw == 0 || fh == 0)
+	return 0;
+    *tw = tnw;
+    *th = (uint32_t) (((uint64_t) fh * tnw + fw / 2) / fw);
+    if (*th > tnh) {
+	*th = tnh;
+	*tw = (uint32_t) (((uint64_t) fw * tnh + fh / 2) / fh);
+    }
+    if (*tw == 0)
+	*tw = 1;
+    if (*th == 0)
+	*th = 1;
+
+    if (TIFFGetField(in, TIFFTAG_SUBIFD, &nsubifd, &subifd) && nsubifd > 0) {
+	suboffsets = (uint64_t*) _TIFFmalloc(nsubifd * sizeof(uint64_t));
+	if (suboffsets == NULL)
+	    nsubifd = 0;
+	else
+	    _TIFFmemcpy(suboffsets, subifd, nsubifd * sizeof(uint64_t));
+    }
+    do {
+	considerLevel(in, fw, fh, *tw, *th, &bestoff, &bestw, &besth);
+    } while (TIFFReadDirectory(in));
+    for (i = 0; i < nsubifd; i++)
+	if (TIFFSetSubDirectory(in, suboffsets[i]))
+	    considerLevel(in, fw, fh, *tw, *th, &bestoff, &bestw, &besth);
+    if (suboffsets)
+	_TIFFfree(suboffsets);
+
+    if (bestw == 0 || !TIFFSetSubDirectory(in, bestoff)) {
+	TIFFError(TIFFFileName(in), "No readable image to make a thumbnail of");
+	return 0;
+    }
+    if (*tw > bestw)
+	*tw = bestw;
+    if (*th > besth)
+	*th = besth;
+    return 1;
+}
+
+/*
+ * Sums of the thumbnail pixels, and the thumbnail column and row that each
+ * column and row of the (scaled) level falls in.
+ */
+typedef struct {
+    uint64_t* acc;		/* tw x th x nsamples sums */
+    uint32_t* xstart;		/* first level column of thumbnail column */
+    uint32_t* dxof;		/* thumbnail column of level column */
+    uint32_t* dyof;		/* thumbnail row of level row */
+    uint32_t tw;
+    uint16_t nsamples;
+} LevelSums;
+
+/*
+ * Add the pixels of a row segment, starting at column x0 of the level, to
+ * the sums of a row of the thumbnail.  xstart[dx] is the first column of
+ * the level that falls in column dx of the thumbnail.
+ */
+static void
+accumulateRow(uint64_t* acc, const uint32_t* src, uint32_t x0, uint32_t n,
+	      const uint32_t* xstart, uint32_t dx, uint16_t nsamples)
+{
+    uint32_t x = x0, xend = x0 + n;
+
+    while (x < xend) {
+	uint32_t xe = xstart[dx+1] < xend ? xstart[dx+1] : xend;
+	uint64_t r = 0, g = 0, b = 0;
+	uint32_t i;
+
+	/* Plain reductions over contiguous pixels, which vectorize */
+	for (i = x - x0; i < xe - x0; i++) {
+	    r += TIFFGetR(src[i]);
+	    g += TIFFGetG(src[i]);
+	    b += TIFFGetB(src[i]);
+	}
+	if (nsamples == 1)
+	    acc[dx] += r;
+	else {
+	    acc[3*dx] += r;
+	    acc[3*dx+1] += g;
+	    acc[3*dx+2] += b;
+	}
+	x = xe;
+	dx++;
+    }
+}
+
+/*
+ * Add n pixels of row y of the level, starting at column x, to the sums.
+ */
+static void
+addLevelRow(LevelSums* sums, const uint32_t* src, uint32_t x, uint32_t y,
+	    uint32_t n)
+{
+    accumulateRow(sums->acc + (size_t) sums->dyof[y] * sums->tw * sums->nsamples,
+		  src, x, n, sums->xstart, sums->dxof[x], sums->nsamples);
+}
+
+/*
+ * Add the level to the sums through the RGBA interface, one strip or tile
+ * at a time.
+ */
+static int
+rgbaLevelSums(TIFF* in, uint32_t lw, uint32_t lh, uint32_t bw, uint32_t bh,
+	      LevelSums* sums)
+{
+    uint32_t* raster;
+    uint32_t x, y, r;
+    int ok = 0;
+
+    raster = (uint32_t*) _TIFFmalloc((tmsize_t) bw * bh * sizeof(uint32_t));
+    if (!raster) {
+	TIFFError(TIFFFileName(in), "Can't allocate space for thumbnail buffers.");
+	return 0;
+    }
+    for (y = 0; y < lh; y += bh) {
+	uint32_t nrows = lh - y < bh ? lh - y : bh;
+
+	for (x = 0; x < lw; x += bw) {
+	    uint32_t ncols = lw - x < bw ? lw - x : bw;
+
+	    if (TIFFIsTiled(in) ? !TIFFReadRGBATile(in, x, y, raster) :
+				  !TIFFReadRGBAStrip(in, y, raster)) {
+		TIFFError(TIFFFileName(in), "Can't read image at row %"PRIu32
+			  ", column %"PRIu32, y, x);
+		goto done;
+	    }
+	    /* The RGBA interface returns the rows bottom-up */
+	    for (r = 0; r < nrows; r++) {
+		const uint32_t* src = TIFFIsTiled(in) ?
+		    raster + (size_t) (bh - 1 - r) * bw :
+		    raster + (size_t) (nrows - 1 - r) * bw;
+
+		addLevelRow(sums, src, x, y + r, ncols);
+	    }
+	}
+    }
+    ok = 1;
+done:
+    _TIFFfree(raster);
+    return ok;
+}
+
+#ifdef JPEG_SUPPORT
+/*
+ * JPEG levels are decoded by libjpeg straight from the raw tiles or
+ * strips with DCT scaling: each 8x8 block is inverse transformed to only
+ * 4x4, 2x2 or 1x1 pixels, which skips most of the IDCT, upsampling and
+ * color conversion work of a full decode.
+ */
+typedef struct {
+    struct jpeg_error_mgr err;	/* must be first */
+    jmp_buf jmpbuf;
+    const char* filename;
+    J_COLOR_SPACE colorspace;	/* of the JPEG data */
+    struct jpeg_decompress_struct d;
+    struct jpeg_source_mgr src;
+} JPEGLevelState;
+
+#define	CALLJPEG(st, fail, op)	(setjmp((st)->jmpbuf) ? (fail) : (op))
+#define	CALLVJPEG(st, op)	CALLJPEG(st, 0, ((op),1))
+
+/* Pack a pixel the way the RGBA interface does */
+#define	PACKRGB(r, g, b) \
+    ((uint32_t)(r) | ((uint32_t)(g) << 8) | ((uint32_t)(b) << 16) | \
+     ((uint32_t)0xff << 24))
+
+static void
+jlErrorExit(j_common_ptr cinfo)
+{
+    JPEGLevelState* st = (JPEGLevelState*) cinfo->err;
+    char buffer[JMSG_LENGTH_MAX];
+
+    (*cinfo->err->format_message) (cinfo, buffer);
+    TIFFError(st->filename, "%s", buffer);
+    longjmp(st->jmpbuf, 1);
+}
+
+static void
+jlOutputMessage(j_common_ptr cinfo)
+{
+    JPEGLevelState* st = (JPEGLevelState*) cinfo->err;
+    char buffer[JMSG_LENGTH_MAX];
+
+    (*cinfo->err->format_message) (cinfo, buffer);
+    TIFFWarning(st->filename, "%s", buffer);
+}
+
+static void
+jlInitSource(j_decompress_ptr cinfo)
+{
+    (void) cinfo;
+}
+
+static boolean
+jlFillInputBuffer(j_decompress_ptr cinfo)
+{
+    static const JOCTET dummy_EOI[2] = { 0xFF, JPEG_EOI };
+
+    /* Premature end of data: let libjpeg see an EOI marker */
+    cinfo->src->next_input_byte = dummy_EOI;
+    cinfo->src->bytes_in_buffer = 2;
+    return (TRUE);
+}
+
+static void
+jlSkipInputData(j_decompress_ptr cinfo, long num_bytes)
+{
+    struct jpeg_source_mgr* src = cinfo->src;
+
+    if (num_bytes > 0) {
+	if ((size_t) num_bytes > src->bytes_in_buffer) {
+	    (void) jlFillInputBuffer(cinfo);
+	} else {
+	    src->next_input_byte += (size_t) num_bytes;
+	    src->bytes_in_buffer -= (size_t) num_bytes;
+	}
+    }
+}
+
+static void
+jlTermSource(j_decompress_ptr cinfo)
+{
+    (void) cinfo;
+}
+
+static void
+jlSetSource(JPEGLevelState* st, const void* data, tmsize_t size)
+{
+    st->src.init_source = jlInitSource;
+    st->src.fill_input_buffer = jlFillInputBuffer;
+    st->src.skip_input_data = jlSkipInputData;
+    st->src.resync_to_restart = jpeg_resync_to_restart;
+    st->src.term_source = jlTermSource;
+    st->src.next_input_byte = (const JOCTET*) data;
+    st->src.bytes_in_buffer = (size_t) size;
+    st->d.src = &st->src;
+}
+
+/*
+ * Return the DCT scaling denominator (1, 2, 4 or 8) to decode the current
+ * directory with: the largest one that keeps the level at least tw x th
+ * pixels large and the tiles or strips on whole pixels of the scaled
+ * level.  1 means that the level is read through the RGBA interface.
+ */
+static int
+jpegLevelScale(TIFF* in, uint32_t lw, uint32_t lh, uint32_t bw, uint32_t bh,
+	       uint32_t tw, uint32_t th)
+{
+    uint16_t compression, bps, spp, planar, photometric;
+    int s;
+
+    TIFFGetFieldDefaulted(in, TIFFTAG_COMPRESSION, &compression);
+    TIFFGetFieldDefaulted(in, TIFFTAG_BITSPERSAMPLE, &bps);
+    TIFFGetFieldDefaulted(in, TIFFTAG_SAMPLESPERPIXEL, &spp);
+    TIFFGetFieldDefaulted(in, TIFFTAG_PLANARCONFIG, &planar);
+    if (compression != COMPRESSION_JPEG || bps != 8 ||
+	!TIFFGetField(in, TIFFTAG_PHOTOMETRIC, &photometric))
+	return 1;
+    if (!(spp == 1 && photometric == PHOTOMETRIC_MINISBLACK) &&
+	!(spp == 3 && planar == PLANARCONFIG_CONTIG &&
+	  (photometric == PHOTOMETRIC_YCBCR || photometric == PHOTOMETRIC_RGB)))
+	return 1;
+    for (s = 8; s > 1; s /= 2)
+	if ((lw + s - 1) / s >= tw && (lh + s - 1) / s >= th &&
+	    (bw % s == 0 || bw >= lw) && (bh % s == 0 || bh >= lh))
+	    break;
+    return s;
+}
+
+/*
+ * Decode one raw tile or strip at 1/s scale and add its first nrows rows
+ * of ncols pixels to the sums, at column sx and row sy of the scaled level.
+ */
+static int
+jpegLevelChunk(JPEGLevelState* st, const uint8_t* data, tmsize_t size, int s,
+	       uint32_t sx, uint32_t sy, uint32_t cw, uint32_t ncols,
+	       uint32_t nrows, JSAMPLE* line, uint32_t* row, LevelSums* sums)
+{
+    uint32_t r, i;
+
+    jlSetSource(st, data, size);
+    if (CALLJPEG(st, -1, jpeg_read_header(&st->d, TRUE)) != JPEG_HEADER_OK)
+	goto bad;
+    if (st->d.num_components != (sums->nsamples == 1 ? 1 : 3)) {
+	TIFFError(st->filename, "JPEG data does not match the image");
+	goto bad;
+    }
+    st->d.jpeg_color_space = st->colorspace;
+    st->d.out_color_space = sums->nsamples == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    st->d.scale_num = 1;
+    st->d.scale_denom = s;
+    if (!CALLVJPEG(st, jpeg_start_decompress(&st->d)))
+	goto bad;
+    if (st->d.output_width != cw || st->d.output_height < nrows) {
+	TIFFError(st->filename, "JPEG data does not match the image");
+	goto bad;
+    }
+    for (r = 0; r < nrows; r++) {
+	JSAMPROW lines[1];
+
+	lines[0] = line;
+	if (CALLJPEG(st, 0, jpeg_read_scanlines(&st->d, lines, 1)) != 1)
+	    goto bad;
+	if (sums->nsamples == 1)
+	    for (i = 0; i < ncols; i++)
+		row[i] = PACKRGB(line[i], line[i], line[i]);
+	else
+	    for (i = 0; i < ncols; i++)
+		row[i] = PACKRGB(line[3*i], line[3*i+1], line[3*i+2]);
+	addLevelRow(sums, row, sx, sy + r, ncols);
+    }
+    jpeg_abort_decompress(&st->d);
+    return 1;
+bad:
+    jpeg_abort_decompress(&st->d);
+    return 0;
+}
+
+/*
+ * Add the level, decoded at 1/s scale, to the sums one raw strip or tile
+ * at a time.  slw x slh is the size of the scaled level.
+ */
+static int
+jpegLevelSums(TIFF* in, int s, uint32_t lw, uint32_t lh, uint32_t bw,
+	      uint32_t bh, uint32_t slw, uint32_t slh, LevelSums* sums)
+{
+    JPEGLevelState st;
+    uint32_t cw = (bw + s - 1) / s, x, y, count;
+    uint8_t* data = NULL;
+    tmsize_t datasize = 0;
+    JSAMPLE* line = NULL;
+    uint32_t* row = NULL;
+    void* tables;
+    uint16_t photometric;
+    int ok = 0;
+
+    memset(&st, 0, sizeof (st));
+    st.filename = TIFFFileName(in);
+    TIFFGetField(in, TIFFTAG_PHOTOMETRIC, &photometric);
+    /* libtiff writes RGB data without a marker telling libjpeg so */
+    st.colorspace = photometric == PHOTOMETRIC_YCBCR ? JCS_YCbCr :
+		    photometric == PHOTOMETRIC_RGB ? JCS_RGB : JCS_GRAYSCALE;
+    line = (JSAMPLE*) _TIFFmalloc((tmsize_t) cw * sums->nsamples);
+    row = (uint32_t*) _TIFFmalloc((tmsize_t) cw * sizeof(uint32_t));
+    if (!line || !row) {
+	TIFFError(st.filename, "Can't allocate space for thumbnail buffers.");
+	goto done;
+    }
+    st.d.err = jpeg_std_error(&st.err);
+    st.err.error_exit = jlErrorExit;
+    st.err.output_message = jlOutputMessage;
+    if (!CALLVJPEG(&st, jpeg_create_decompress(&st.d)))
+	goto done;
+    /* Tables shared by all strips or tiles of the level */
+    if (TIFFGetField(in, TIFFTAG_JPEGTABLES, &count, &tables) && count > 2) {
+	jlSetSource(&st, tables, (tmsize_t) count);
+	if (CALLJPEG(&st, -1, jpeg_read_header(&st.d, FALSE)) !=
+	    JPEG_HEADER_TABLES_ONLY)
+	    goto destroy;
+    }
+
+    for (y = 0; y < lh; y += bh) {
+	for (x = 0; x < lw; x += bw) {
+	    uint32_t chunk = TIFFIsTiled(in) ? TIFFComputeTile(in, x, y, 0, 0) :
+					       TIFFComputeStrip(in, y, 0);
+	    uint64_t bytes = TIFFGetStrileByteCount(in, chunk);
+	    uint32_t sx = x / s, sy = y / s;
+	    tmsize_t n;
+
+	    if (bytes == 0 || bytes > (uint64_t) TIFF_TMSIZE_T_MAX) {
+		TIFFError(st.filename, "Can't read image at row %"PRIu32
+			  ", column %"PRIu32, y, x);
+		goto destroy;
+	    }
+	    if ((tmsize_t) bytes > datasize) {
+		uint8_t* newdata = (uint8_t*) _TIFFrealloc(data, (tmsize_t) bytes);
+
+		if (!newdata) {
+		    TIFFError(st.filename,
+			      "Can't allocate space for thumbnail buffers.");
+		    goto destroy;
+		}
+		data = newdata;
+		datasize = (tmsize_t) bytes;
+	    }
+	    n = TIFFIsTiled(in) ?
+		TIFFReadRawTile(in, chunk, data, (tmsize_t) bytes) :
+		TIFFReadRawStrip(in, chunk, data, (tmsize_t) bytes);
+	    if (n <= 0 ||
+		!jpegLevelChunk(&st, data, n, s, sx, sy, cw,
+				slw - sx < cw ? slw - sx : cw,
+				slh - sy < (bh + s - 1) / s ?
+				    slh - sy : (bh + s - 1) / s,
+				line, row, sums)) {
+		TIFFError(st.filename, "Can't read image at row %"PRIu32
+			  ", column %"PRIu32, y, x);
+		goto destroy;
+	    }
+	}
+    }
+    ok = 1;
+destroy:
+    jpeg_destroy_decompress(&st.d);
+done:
+    if (data) _TIFFfree(data);
+    if (line) _TIFFfree(line);
+    if (row) _TIFFfree(row);
+    return ok;
+}
+#endif /* JPEG_SUPPORT */
+
+/*
+ * Area-average the current directory into a tw x th thumbnail, one strip
+ * or tile at a time.  Only the sums of the thumbnail are kept in memory.
+ * JPEG levels much larger than the thumbnail are decoded at a reduced
+ * scale first.
+ */
+static int
+generateLevelThumbnail(TIFF* in, TIFF* out)
+{
+    uint32_t tw, th, lw, lh, slw, slh, bw, bh, x, y, dx, dy;
+    uint32_t *ystart = NULL;
+    uint8_t* tn = NULL;
+    uint16_t photometric, spp;
+    LevelSums sums;
+    int s = 1, ok = 0;
+
+    memset(&sums, 0, sizeof (sums));
+    if (!selectLevel(in, &tw, &th))
+	return 0;
+    TIFFGetField(in, TIFFTAG_IMAGEWIDTH, &lw);
+    TIFFGetField(in, TIFFTAG_IMAGELENGTH, &lh);
+    TIFFGetFieldDefaulted(in, TIFFTAG_SAMPLESPERPIXEL, &spp);
+    if (!TIFFGetField(in, TIFFTAG_PHOTOMETRIC, &photometric))
+	photometric = PHOTOMETRIC_MINISWHITE;
+    sums.tw = tw;
+    sums.nsamples = (spp == 1 && (photometric == PHOTOMETRIC_MINISBLACK ||
+				  photometric == PHOTOMETRIC_MINISWHITE)) ? 1 : 3;
+    if (TIFFIsTiled(in)) {
+	TIFFGetField(in, TIFFTAG_TILEWIDTH, &bw);
+	TIFFGetField(in, TIFFTAG_TILELENGTH, &bh);
+    } else {
+	bw = lw;
+	TIFFGetFieldDefaulted(in, TIFFTAG_ROWSPERSTRIP, &bh);
+	if (bh > lh)
+	    bh = lh;
+    }
+#ifdef JPEG_SUPPORT
+    s = jpegLevelScale(in, lw, lh, bw, bh, tw, th);
+#endif
+    slw = (lw + s - 1) / s;
+    slh = (lh + s - 1) / s;
+
+    sums.xstart = (uint32_t*) _TIFFmalloc((tw + 1) * sizeof(uint32_t));
+    ystart = (uint32_t*) _TIFFmalloc((th + 1) * sizeof(uint32_t));
+    sums.dxof = (uint32_t*) _TIFFmalloc((tmsize_t) slw * sizeof(uint32_t));
+    sums.dyof = (uint32_t*) _TIFFmalloc((tmsize_t) slh * sizeof(uint32_t));
+    sums.acc = (uint64_t*) _TIFFmalloc((tmsize_t) tw * th * sums.nsamples *
+				       sizeof(uint64_t));
+    tn = (uint8_t*) _TIFFmalloc((tmsize_t) tw * th * sums.nsamples);
+    if (!sums.xstart || !ystart || !sums.dxof || !sums.dyof || !sums.acc ||
+	!tn) {
+	TIFFError(TIFFFileName(in), "Can't allocate space for thumbnail buffers.");
+	goto done;
+    }
+    _TIFFmemset(sums.acc, 0, (tmsize_t) tw * th * sums.nsamples *
+		sizeof(uint64_t));
+    /* Column x of the level falls in column x*tw/slw of the thumbnail */
+    for (dx = 0; dx <= tw; dx++)
+	sums.xstart[dx] = (uint32_t) (((uint64_t) dx * slw + tw - 1) / tw);
+    for (dy = 0; dy <= th; dy++)
+	ystart[dy] = (uint32_t) (((uint64_t) dy * slh + th - 1) / th);
+    for (dx = 0; dx < tw; dx++)
+	for (x = sums.xstart[dx]; x < sums.xstart[dx+1]; x++)
+	    sums.dxof[x] = dx;
+    for (dy = 0; dy < th; dy++)
+	for (y = ystart[dy]; y < ystart[dy+1]; y++)
+	    sums.dyof[y] = dy;
+
+#ifdef JPEG_SUPPORT
+    if (s > 1) {
+	if (!jpegLevelSums(in, s, lw, lh, bw, bh, slw, slh, &sums))
+	    goto done;
+    } else
+#endif
+    if (!rgbaLevelSums(in, lw, lh, bw, bh, &sums))
+	goto done;
+
+    for (dy = 0; dy < th; dy++)
+	for (dx = 0; dx < tw; dx++) {
+	    uint64_t area = (uint64_t) (sums.xstart[dx+1] - sums.xstart[dx]) *
+			    (ystart[dy+1] - ystart[dy]);
+	    size_t i = ((size_t) dy * tw + dx) * sums.nsamples;
+	    uint16_t n;
+
+	    for (n = 0; n < sums.nsamples; n++)
+		tn[i+n] = (uint8_t) ((sums.acc[i+n] + area / 2) / area);
+	}
+
+    TIFFSetField(out, TIFFTAG_IMAGEWIDTH, tw);
+    TIFFSetField(out, TIFFTAG_IMAGELENGTH, th);
+    TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, (uint16_t) 8);
+    TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL, sums.nsamples);
+    TIFFSetField(out, TIFFTAG_COMPRESSION, COMPRESSION_PACKBITS);
+    TIFFSetField(out, TIFFTAG_PHOTOMETRIC, sums.nsamples == 1 ?
+		 PHOTOMETRIC_MINISBLACK : PHOTOMETRIC_RGB);
+    TIFFSetField(out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(out, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+    TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, th);
+    cpTag(in, out, TIFFTAG_SOFTWARE, (uint16_t) -1, TIFF_ASCII);
+    cpTag(in, out, TIFFTAG_IMAGEDESCRIPTION, (uint16_t) -1, TIFF_ASCII);
+    cpTag(in, out, TIFFTAG_DATETIME, (uint16_t) -1, TIFF_ASCII);
+    cpTag(in, out, TIFFTAG_HOSTCOMPUTER, (uint16_t) -1, TIFF_ASCII);
+    ok = TIFFWriteEncodedStrip(out, 0, tn,
+			       (tmsize_t) tw * th * sums.nsamples) != -1 &&
+	 TIFFWriteDirectory(out);
+done:
+    if (sums.xstart) _TIFFfree(sums.xstart);
+    if (ystart) _TIFFfree(ystart);
+    if (sums.dxof) _TIFFfree(sums.dxof);
+    if (sums.dyof) _TIFFfree(sums.dyof);
+    if (sums.acc) _TIFFfree(sums.acc);
+    if (tn) _TIFFfree(tn);
+    return ok;
+}
+
 const char* usage_info[] = {
 "Create a TIFF file with thumbnail images\n\n"
 "usage: thumbnail [options] input.tif output.tif",
 "where options are:",
 " -h #		specify thumbnail image height (default is 274)",
 " -w #		specify thumbnail image width (default is 216)",
+" -p		make one thumbnail, which fits in the -w x -h box, from the",
+"		smallest large enough resolution level of a pyramidal image",
 "",
 " -c linear	use linear contrast curve",
 " -c exp50	use 50% exponential contrast curve",
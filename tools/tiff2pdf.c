@@ -283,6 +283,9 @@ int t2p_tile_is_bottom_edge(T2P_TILES, ttile_t);
 int t2p_tile_is_edge(T2P_TILES, ttile_t);
 int t2p_tile_is_corner_edge(T2P_TILES, ttile_t);
 tsize_t t2p_readwrite_pdf_image(T2P*, TIFF*, TIFF*);
+int t2p_can_stream_image(T2P*, TIFF*);
+uint32_t t2p_stream_band_rows(T2P*, TIFF*, tsize_t*);
+int t2p_readwrite_pdf_image_bands(T2P*, TIFF*, TIFF*);
 tsize_t t2p_readwrite_pdf_image_tile(T2P*, TIFF*, TIFF*, ttile_t);
 #ifdef OJPEG_SUPPORT
 int t2p_process_ojpeg_tables(T2P*, TIFF*);
@@ -293,7 +296,7 @@ int t2p_process_jpeg_strip(unsigned char*, tsize_t*, unsigned char*, tsize_t, ts
 void t2p_tile_collapse_left(tdata_t, tsize_t, uint32_t, uint32_t, uint32_t);
 void t2p_write_advance_directory(T2P*, TIFF*);
 tsize_t t2p_sample_planar_separate_to_contig(T2P*, unsigned char*, unsigned char*, tsize_t);
-tsize_t t2p_sample_realize_palette(T2P*, unsigned char*);
+tsize_t t2p_sample_realize_palette(T2P*, unsigned char*, uint32_t, tsize_t);
 tsize_t t2p_sample_abgr_to_rgb(tdata_t, uint32_t);
 tsize_t t2p_sample_rgba_to_rgb(tdata_t, uint32_t);
 tsize_t t2p_sample_rgbaa_to_rgb(tdata_t, uint32_t);
@@ -2250,6 +2253,7 @@ tsize_t t2p_readwrite_pdf_image(T2P* t2p, TIFF* input, TIFF* output){
 	tsize_t striplength=0;
 	uint32_t max_striplength=0;
 #endif /* ifdef JPEG_SUPPORT */
+	int streamed=0;
 
 	/* Fail if prior error (in particular, can't trust tiff_datasize) */
 	if (t2p->t2p_error != T2P_ERR_OK)
@@ -2527,6 +2531,11 @@ tsize_t t2p_readwrite_pdf_image(T2P* t2p, TIFF* input, TIFF* output){
 		(void)0;
 	}
 
+	if(t2p_can_stream_image(t2p, input)){
+		streamed=1;
+		goto dataready;
+	}
+
 	if(t2p->pdf_sample==T2P_SAMPLE_NOTHING){
 		buffer = (unsigned char*) _TIFFmalloc(t2p->tiff_datasize);
 		if(buffer==NULL){
@@ -2664,7 +2673,9 @@ tsize_t t2p_readwrite_pdf_image(T2P* t2p, TIFF* input, TIFF* output){
 				buffer=samplebuffer;
 				t2p->tiff_datasize *= t2p->tiff_samplesperpixel;
 			}
-			t2p_sample_realize_palette(t2p, buffer);
+			t2p_sample_realize_palette(t2p, buffer,
+				t2p->tiff_width*t2p->tiff_length,
+				t2p->tiff_datasize);
 		}
 
 		if(t2p->pdf_sample & T2P_SAMPLE_RGBA_TO_RGB){
@@ -2726,6 +2737,11 @@ dataready:
 	TIFFSetField(output, TIFFTAG_PHOTOMETRIC, t2p->tiff_photometric);
 	TIFFSetField(output, TIFFTAG_BITSPERSAMPLE, t2p->tiff_bitspersample);
 	TIFFSetField(output, TIFFTAG_SAMPLESPERPIXEL, t2p->tiff_samplesperpixel);
+	if(streamed
+	   && (t2p->pdf_sample & (T2P_SAMPLE_RGBA_TO_RGB | T2P_SAMPLE_RGBAA_TO_RGB))){
+		/* Scanlines are fed after the alpha channel has been dropped */
+		TIFFSetField(output, TIFFTAG_SAMPLESPERPIXEL, 3);
+	}
 	TIFFSetField(output, TIFFTAG_IMAGEWIDTH, t2p->tiff_width);
 	TIFFSetField(output, TIFFTAG_IMAGELENGTH, t2p->tiff_length);
 	TIFFSetField(output, TIFFTAG_ROWSPERSTRIP, t2p->tiff_length);
@@ -2808,6 +2824,13 @@ dataready:
 
 	t2p_enable(output);
 	t2p->outputwritten = 0;
+	if(streamed){
+		if(!t2p_readwrite_pdf_image_bands(t2p, input, output)){
+			t2p->t2p_error = T2P_ERR_ERROR;
+			return(0);
+		}
+		return(t2p->outputwritten);
+	}
 #ifdef JPEG_SUPPORT
 	if(t2p->pdf_compression == T2P_COMPRESS_JPEG
 	   && t2p->tiff_photometric == PHOTOMETRIC_YCBCR){
@@ -2838,6 +2861,238 @@ dataready:
 	return(written);
 }
 
+/*
+ * This function returns a non-zero value when t2p_readwrite_pdf_image can
+ * decode, convert and encode the image one strip at a time instead of
+ * holding the whole decoded image in memory.
+ */
+
+int t2p_can_stream_image(T2P* t2p, TIFF* input){
+
+	if(t2p->pdf_transcode != T2P_TRANSCODE_ENCODE || TIFFIsTiled(input)){
+		return(0);
+	}
+	if(t2p->pdf_sample & T2P_SAMPLE_YCBCR_TO_RGB){
+		return(0);
+	}
+#ifdef JPEG_SUPPORT
+	if(t2p->pdf_compression == T2P_COMPRESS_JPEG
+	   && t2p->tiff_photometric == PHOTOMETRIC_YCBCR){
+		return(0);
+	}
+#endif /* ifdef JPEG_SUPPORT */
+	/* The sample converters work on whole bytes */
+	if((t2p->pdf_sample & ~T2P_SAMPLE_PLANAR_SEPARATE_TO_CONTIG) != 0
+	   && t2p->tiff_bitspersample != 8){
+		return(0);
+	}
+	if(t2p_stream_band_rows(t2p, input, NULL) == 0){
+		return(0);
+	}
+	return(1);
+}
+
+/*
+ * This function returns the number of rows t2p_readwrite_pdf_image_bands
+ * decodes at a time: a whole strip when it fits in the -m limit, otherwise
+ * as many scanlines as fit.  Separate planes and YCbCr data are only read
+ * by whole strips.  It returns zero when no band fits in the limit, and
+ * sets *rowbytes to the buffer size needed per row.
+ */
+
+uint32_t t2p_stream_band_rows(T2P* t2p, TIFF* input, tsize_t* rowbytes){
+
+	uint64_t inrow=0;
+	uint64_t outrow=0;
+	uint64_t bytes=0;
+	uint32_t rowsperstrip=0;
+	uint16_t planes=1;
+
+	if(t2p->pdf_sample & T2P_SAMPLE_PLANAR_SEPARATE_TO_CONTIG){
+		planes=t2p->tiff_samplesperpixel;
+	}
+	inrow=(uint64_t)TIFFScanlineSize(input) * planes;
+	outrow=((uint64_t)t2p->tiff_width * t2p->tiff_samplesperpixel
+		* t2p->tiff_bitspersample + 7) / 8;
+	bytes=TIFFmax(inrow, outrow);
+	if(bytes==0 || bytes > (uint64_t)TIFF_TMSIZE_T_MAX){
+		return(0);
+	}
+	if(rowbytes != NULL){
+		*rowbytes=(tsize_t)bytes;
+	}
+	TIFFGetFieldDefaulted(input, TIFFTAG_ROWSPERSTRIP, &rowsperstrip);
+	if(rowsperstrip > t2p->tiff_length){
+		rowsperstrip=t2p->tiff_length;
+	}
+	/* separate planes are converted in a second buffer */
+	if(t2p->tiff_maxdatasize == 0
+	   || bytes * rowsperstrip * (planes > 1 ? 2 : 1)
+	      <= (uint64_t)t2p->tiff_maxdatasize){
+		return(rowsperstrip);
+	}
+	if(planes > 1 || t2p->tiff_photometric == PHOTOMETRIC_YCBCR){
+		return(0);
+	}
+	return((uint32_t)((uint64_t)t2p->tiff_maxdatasize / bytes));
+}
+
+/*
+ * This function reads the strips of a stripped image one at a time, converts
+ * each to the output sample layout and feeds it as scanlines to the encoder
+ * of the output, which must already be set up.  Strips larger than the -m
+ * limit are read a band of scanlines at a time instead.  Peak memory is a
+ * couple of bands regardless of the image size.  It returns zero on error.
+ */
+
+int t2p_readwrite_pdf_image_bands(T2P* t2p, TIFF* input, TIFF* output){
+
+	unsigned char* buffer=NULL;
+	unsigned char* samplebuffer=NULL;
+	tsize_t stripsize=0;
+	tsize_t scanlinesize=0;
+	tsize_t inscanlinesize=0;
+	tsize_t rowbytes=0;
+	tsize_t buffersize=0;
+	tsize_t bufferoffset=0;
+	tsize_t read=0;
+	tstrip_t stripcount=0;
+	tstrip_t i=0;
+	uint16_t planes=1;
+	uint16_t j=0;
+	uint32_t rowsperstrip=0;
+	uint32_t bandrows=0;
+	uint32_t rows=0;
+	uint32_t row=0;
+	uint32_t k=0;
+	int ok=0;
+
+	stripsize=TIFFStripSize(input);
+	stripcount=TIFFNumberOfStrips(input);
+	scanlinesize=TIFFScanlineSize(output);
+	inscanlinesize=TIFFScanlineSize(input);
+	TIFFGetFieldDefaulted(input, TIFFTAG_ROWSPERSTRIP, &rowsperstrip);
+	if(rowsperstrip > t2p->tiff_length){
+		rowsperstrip=t2p->tiff_length;
+	}
+	if(t2p->pdf_sample & T2P_SAMPLE_PLANAR_SEPARATE_TO_CONTIG){
+		planes=t2p->tiff_samplesperpixel;
+		stripcount/=planes;
+	}
+	bandrows=t2p_stream_band_rows(t2p, input, &rowbytes);
+	if(bandrows==0){
+		TIFFError(TIFF2PDF_MODULE,
+			"Can't fit a band of %s in the memory limit, use -m option to change limit",
+			TIFFFileName(input));
+		return(0);
+	}
+	buffersize=TIFFSafeMultiply(tsize_t, rowbytes, bandrows);
+	if(bandrows == rowsperstrip
+	   && buffersize < TIFFSafeMultiply(tsize_t, stripsize, planes)){
+		buffersize=TIFFSafeMultiply(tsize_t, stripsize, planes);
+	}
+	if(stripsize==0 || scanlinesize==0 || buffersize==0){
+		TIFFError(TIFF2PDF_MODULE,
+			"Invalid strip layout in input file %s",
+			TIFFFileName(input));
+		return(0);
+	}
+	buffer = (unsigned char*) _TIFFmalloc(buffersize);
+	if(planes > 1){
+		samplebuffer = (unsigned char*) _TIFFmalloc(buffersize);
+	}
+	if(buffer==NULL || (planes > 1 && samplebuffer==NULL)){
+		TIFFError(TIFF2PDF_MODULE,
+			"Can't allocate %"TIFF_SSIZE_FORMAT" bytes of memory for t2p_readwrite_pdf_image_bands, %s",
+			buffersize,
+			TIFFFileName(input));
+		goto done;
+	}
+	/* Flush the encoded data to the PDF every band rather than once */
+	if(!TIFFWriteBufferSetup(output, NULL, TIFFmax(buffersize, 8*1024))){
+		goto done;
+	}
+
+	for(i=0;(bandrows < rowsperstrip || i<stripcount)
+		&& row < t2p->tiff_length;i++){
+		rows=TIFFmin(bandrows, t2p->tiff_length - row);
+		memset(buffer, 0, buffersize);
+		bufferoffset=0;
+		if(bandrows < rowsperstrip){
+			/* the strip does not fit in the limit, read part of it */
+			for(k=0;k<rows;k++){
+				if(TIFFReadScanline(input,
+					(tdata_t) &buffer[k*inscanlinesize],
+					row + k, 0) < 0){
+					TIFFError(TIFF2PDF_MODULE,
+						"Error on decoding scanline %"PRIu32" of %s",
+						row + k,
+						TIFFFileName(input));
+					goto done;
+				}
+			}
+		} else {
+			for(j=0;j<planes;j++){
+				read = TIFFReadEncodedStrip(input,
+					i + j*stripcount,
+					(tdata_t) &((planes > 1 ? samplebuffer : buffer)[bufferoffset]),
+					stripsize);
+				if(read==-1){
+					TIFFError(TIFF2PDF_MODULE,
+						"Error on decoding strip %"PRIu32" of %s",
+						i + j*stripcount,
+						TIFFFileName(input));
+					goto done;
+				}
+				bufferoffset+=read;
+			}
+		}
+		if(planes > 1){
+			t2p_sample_planar_separate_to_contig(
+				t2p, buffer, samplebuffer, bufferoffset);
+		} else {
+			if(t2p->pdf_sample & T2P_SAMPLE_REALIZE_PALETTE){
+				if(t2p_sample_realize_palette(t2p, buffer,
+					t2p->tiff_width*rows, buffersize) != 0){
+					goto done;
+				}
+			}
+			if(t2p->pdf_sample & T2P_SAMPLE_RGBA_TO_RGB){
+				t2p_sample_rgba_to_rgb(
+					(tdata_t)buffer, t2p->tiff_width*rows);
+			}
+			if(t2p->pdf_sample & T2P_SAMPLE_RGBAA_TO_RGB){
+				t2p_sample_rgbaa_to_rgb(
+					(tdata_t)buffer, t2p->tiff_width*rows);
+			}
+			if(t2p->pdf_sample & T2P_SAMPLE_LAB_SIGNED_TO_UNSIGNED){
+				t2p_sample_lab_signed_to_unsigned(
+					(tdata_t)buffer, t2p->tiff_width*rows);
+			}
+		}
+		for(k=0;k<rows;k++){
+			if(TIFFWriteScanline(output,
+				(tdata_t) &buffer[k*scanlinesize], row + k, 0) < 0){
+				TIFFError(TIFF2PDF_MODULE,
+					"Error writing encoded strip to output PDF %s",
+					TIFFFileName(output));
+				goto done;
+			}
+		}
+		row+=rows;
+	}
+	ok=TIFFFlushData(output);
+
+done:
+	if(buffer != NULL){
+		_TIFFfree(buffer);
+	}
+	if(samplebuffer != NULL){
+		_TIFFfree(samplebuffer);
+	}
+	return(ok);
+}
+
 /*
  * This function reads the raster image data from the input TIFF for an image
  * tile and writes the data to the output PDF XObject image dictionary stream
@@ -3776,20 +4031,19 @@ tsize_t t2p_sample_planar_separate_to_contig(
 	return(samplebuffersize);
 }
 
-tsize_t t2p_sample_realize_palette(T2P* t2p, unsigned char* buffer){
+tsize_t t2p_sample_realize_palette(T2P* t2p, unsigned char* buffer,
+				   uint32_t sample_count, tsize_t buffersize){
 
-	uint32_t sample_count=0;
 	uint16_t component_count=0;
 	uint32_t palette_offset=0;
 	uint32_t sample_offset=0;
 	uint32_t i=0;
 	uint32_t j=0;
         size_t data_size;
-	sample_count=t2p->tiff_width*t2p->tiff_length;
 	component_count=t2p->tiff_samplesperpixel;
         data_size=TIFFSafeMultiply(size_t,sample_count,component_count);
-        if( (data_size == 0U) || (t2p->tiff_datasize < 0) ||
-            (data_size > (size_t) t2p->tiff_datasize) )
+        if( (data_size == 0U) || (buffersize < 0) ||
+            (data_size > (size_t) buffersize) )
         {
             TIFFError(TIFF2PDF_MODULE,
                       "Error: sample_count * component_count > t2p->tiff_datasize");
@@ -5696,7 +5950,8 @@ tsize_t t2p_write_pdf(T2P* t2p, TIFF* input, TIFF* output){
 			written += t2p_write_pdf_stream_start(output);
 			streamlen=written;
 			t2p_read_tiff_size(t2p, input);
-			if (t2p->tiff_maxdatasize && (t2p->tiff_datasize > t2p->tiff_maxdatasize)) {
+			if (t2p->tiff_maxdatasize && (t2p->tiff_datasize > t2p->tiff_maxdatasize)
+			    && !t2p_can_stream_image(t2p, input)) {
 				TIFFError(TIFF2PDF_MODULE,
 					"Allocation of %" PRIu64 " bytes is forbidden. Limit is %" PRIu64 ". Use -m option to change limit",
                           (uint64_t)t2p->tiff_datasize, (uint64_t)t2p->tiff_maxdatasize);
@@ -45,6 +45,8 @@
 
 static	int stopondiff = 1;
 static	int stoponfirsttag = 1;
+static	int blockcompare = 0;
+static	int datadiffers = 0;
 static	uint16_t bitspersample = 1;
 static	uint16_t samplesperpixel = 1;
 static	uint16_t sampleformat = SAMPLEFORMAT_UINT;
@@ -56,6 +58,7 @@ static	int tiffcmp(TIFF*, TIFF*);
 static	int cmptags(TIFF*, TIFF*);
 static	int ContigCompare(int, uint32_t, unsigned char*, unsigned char*, tsize_t);
 static	int SeparateCompare(int, int, uint32_t, unsigned char*, unsigned char*);
+static	int BlockCompare(TIFF*, TIFF*);
 static	void PrintIntDiff(uint32_t, int, uint32_t, uint32_t, uint32_t);
 static	void PrintFloatDiff(uint32_t, int, uint32_t, double, double);
 
@@ -77,7 +80,7 @@ main(int argc, char* argv[])
 	extern char* optarg;
 #endif
 
-	while ((c = getopt(argc, argv, "ltz:h")) != -1)
+	while ((c = getopt(argc, argv, "lstz:h")) != -1)
 		switch (c) {
 		case 'l':
 			stopondiff = 0;
@@ -85,6 +88,9 @@ main(int argc, char* argv[])
 		case 'z':
 			stopondiff = atoi(optarg);
 			break;
+		case 's':
+			blockcompare = 1;
+			break;
 		case 't':
 			stoponfirsttag = 0;
 			break;
@@ -122,7 +128,7 @@ main(int argc, char* argv[])
 
 	TIFFClose(tif1);
 	TIFFClose(tif2);
-	return (0);
+	return (datadiffers ? 1 : 0);
 }
 
 static const char usage_info[] =
@@ -132,6 +138,8 @@ static const char usage_info[] =
 " -l		list each byte of image data that differs between the files\n"
 " -z #		list specified number of bytes that differs between the files\n"
 " -t		ignore any differences in directory tags\n"
+" -s		compare image data strip by strip or tile by tile and report\n"
+"		statistics on the differences instead of listing them\n"
 ;
 
 static void
@@ -180,6 +188,8 @@ tiffcmp(TIFF* tif1, TIFF* tif2)
 	(void) TIFFGetField(tif1, TIFFTAG_IMAGELENGTH, &imagelength);
 	(void) TIFFGetField(tif1, TIFFTAG_PLANARCONFIG, &config1);
 	(void) TIFFGetField(tif2, TIFFTAG_PLANARCONFIG, &config2);
+	if (blockcompare && config1 == config2)
+		return (BlockCompare(tif1, tif2));
 	buf1 = (unsigned char *)_TIFFmalloc(size1 = TIFFScanlineSize(tif1));
 	buf2 = (unsigned char *)_TIFFmalloc(TIFFScanlineSize(tif2));
 	if (buf1 == NULL || buf2 == NULL) {
@@ -433,6 +443,440 @@ ContigCompare(int sample, uint32_t row,
     return 0;
 }
 
+/*
+ * Statistics on the differences between the samples of two images.
+ */
+typedef struct {
+	uint64_t nsamples;
+	uint64_t ndiffs;
+	double maxdiff;
+	double sumsq;
+} DiffStats;
+
+#define	DiffSamples(type) {						\
+	const type *s1 = (const type *) p1, *s2 = (const type *) p2;	\
+	for (i = 0; i < n; i++) {					\
+		double d = (double) s1[i] - (double) s2[i];		\
+		if (d != 0) {						\
+			if (d < 0)					\
+				d = -d;					\
+			st->ndiffs++;					\
+			st->sumsq += d * d;				\
+			if (d > st->maxdiff)				\
+				st->maxdiff = d;			\
+		}							\
+	}								\
+}
+
+/*
+ * Add the differences between n samples of a row to st.
+ */
+static void
+AccumulateDiff(DiffStats* st, const unsigned char* p1,
+	       const unsigned char* p2, uint32_t n)
+{
+	uint32_t i;
+
+	st->nsamples += n;
+	if (memcmp(p1, p2, ((uint64_t) n * bitspersample + 7) / 8) == 0)
+		return;
+	switch (bitspersample) {
+	case 1: case 2: case 4:
+	{
+		unsigned mask = (1U << bitspersample) - 1;
+
+		for (i = 0; i < n; i++) {
+			uint32_t bit = i * bitspersample;
+			unsigned shift = 8 - bitspersample - (bit & 7);
+			int d = (int) ((p1[bit >> 3] >> shift) & mask) -
+				(int) ((p2[bit >> 3] >> shift) & mask);
+
+			if (d != 0) {
+				if (d < 0)
+					d = -d;
+				st->ndiffs++;
+				st->sumsq += (double) d * d;
+				if (d > st->maxdiff)
+					st->maxdiff = d;
+			}
+		}
+		break;
+	}
+	case 8:
+		if (sampleformat == SAMPLEFORMAT_INT)
+			DiffSamples(int8_t)
+		else
+			DiffSamples(uint8_t)
+		break;
+	case 16:
+		if (sampleformat == SAMPLEFORMAT_INT)
+			DiffSamples(int16_t)
+		else
+			DiffSamples(uint16_t)
+		break;
+	case 32:
+		if (sampleformat == SAMPLEFORMAT_INT)
+			DiffSamples(int32_t)
+		else if (sampleformat == SAMPLEFORMAT_IEEEFP)
+			DiffSamples(float)
+		else
+			DiffSamples(uint32_t)
+		break;
+	case 64:
+		if (sampleformat == SAMPLEFORMAT_IEEEFP)
+			DiffSamples(double)
+		else if (sampleformat == SAMPLEFORMAT_INT)
+			DiffSamples(int64_t)
+		else
+			DiffSamples(uint64_t)
+		break;
+	default:
+		/* Only report that bytes differ */
+		st->ndiffs++;
+		break;
+	}
+}
+
+#undef DiffSamples
+
+/*
+ * Tell if the compressed strips or tiles of both images decode the same
+ * way when their bytes are equal: same byte order and coding.
+ */
+static int
+SameCoding(TIFF* tif1, TIFF* tif2)
+{
+	uint16_t v1, v2;
+	uint32_t count1, count2;
+	void *tables1, *tables2;
+
+	/* Equal bytes are different samples in the other byte order */
+	if (TIFFIsByteSwapped(tif1) != TIFFIsByteSwapped(tif2))
+		return 0;
+	TIFFGetFieldDefaulted(tif1, TIFFTAG_COMPRESSION, &v1);
+	TIFFGetFieldDefaulted(tif2, TIFFTAG_COMPRESSION, &v2);
+	if (v1 != v2)
+		return 0;
+	TIFFGetFieldDefaulted(tif1, TIFFTAG_FILLORDER, &v1);
+	TIFFGetFieldDefaulted(tif2, TIFFTAG_FILLORDER, &v2);
+	if (v1 != v2)
+		return 0;
+	if (TIFFGetField(tif1, TIFFTAG_PREDICTOR, &v1) !=
+	    TIFFGetField(tif2, TIFFTAG_PREDICTOR, &v2) ||
+	    (TIFFGetField(tif1, TIFFTAG_PREDICTOR, &v1) && v1 != v2))
+		return 0;
+	TIFFGetFieldDefaulted(tif1, TIFFTAG_PHOTOMETRIC, &v1);
+	TIFFGetFieldDefaulted(tif2, TIFFTAG_PHOTOMETRIC, &v2);
+	if (v1 != v2)
+		return 0;
+	TIFFGetFieldDefaulted(tif1, TIFFTAG_COMPRESSION, &v1);
+	if (v1 == COMPRESSION_JPEG) {
+		if (TIFFGetField(tif1, TIFFTAG_JPEGTABLES, &count1, &tables1) !=
+		    TIFFGetField(tif2, TIFFTAG_JPEGTABLES, &count2, &tables2))
+			return 0;
+		if (TIFFGetField(tif1, TIFFTAG_JPEGTABLES, &count1, &tables1) &&
+		    (count1 != count2 || memcmp(tables1, tables2, count1) != 0))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Sequential access to the rows of one plane of a stripped or tiled
+ * image.  Tiled images are decoded one row of tiles at a time into a
+ * band of full scanlines.
+ */
+typedef struct {
+	TIFF* tif;
+	uint32_t tw, th;	/* tile size, 0 for strips */
+	tsample_t sample;	/* plane held in band */
+	uint32_t first;		/* first row held in band */
+	tmsize_t rowsize;	/* bytes in a scanline */
+	unsigned char* band;
+	unsigned char* tile;
+} RowReader;
+
+static void
+InitRowReader(RowReader* rr, TIFF* tif)
+{
+	tmsize_t bandsize;
+
+	memset(rr, 0, sizeof(*rr));
+	rr->tif = tif;
+	rr->rowsize = TIFFScanlineSize(tif);
+	rr->first = (uint32_t) -1;
+	bandsize = rr->rowsize;
+	if (TIFFIsTiled(tif)) {
+		TIFFGetField(tif, TIFFTAG_TILEWIDTH, &rr->tw);
+		TIFFGetField(tif, TIFFTAG_TILELENGTH, &rr->th);
+		if (rr->tw == 0 || rr->th == 0) {
+			fprintf(stderr, "Invalid tile size\n");
+			exit(2);
+		}
+		if ((uint64_t) rr->rowsize * rr->th > (uint64_t) TIFF_TMSIZE_T_MAX) {
+			fprintf(stderr, "Too large row of tiles\n");
+			exit(2);
+		}
+		bandsize = rr->rowsize * (tmsize_t) rr->th;
+		rr->tile = (unsigned char *)_TIFFmalloc(TIFFTileSize(tif));
+		if (rr->tile == NULL) {
+			fprintf(stderr, "No space for tile buffer\n");
+			exit(2);
+		}
+	}
+	rr->band = bandsize ? (unsigned char *)_TIFFmalloc(bandsize) : NULL;
+	if (rr->band == NULL) {
+		fprintf(stderr, "No space for scanline buffers\n");
+		exit(2);
+	}
+}
+
+/*
+ * Return scanline row of plane s, or NULL on a read error.
+ */
+static unsigned char*
+ReadRow(RowReader* rr, uint32_t row, tsample_t s)
+{
+	tmsize_t tilerowsize, offset, n;
+	uint32_t x, r, nrows;
+
+	if (rr->th == 0)
+		return TIFFReadScanline(rr->tif, rr->band, row, s) < 0 ?
+		    NULL : rr->band;
+	if (rr->first == (uint32_t) -1 || s != rr->sample ||
+	    row < rr->first || row - rr->first >= rr->th) {
+		rr->first = row - row % rr->th;
+		rr->sample = s;
+		nrows = imagelength - rr->first < rr->th ?
+		    imagelength - rr->first : rr->th;
+		tilerowsize = TIFFTileRowSize(rr->tif);
+		for (x = 0, offset = 0; x < imagewidth;
+		     x += rr->tw, offset += tilerowsize) {
+			if (TIFFReadTile(rr->tif, rr->tile, x, rr->first,
+			    0, s) < 0) {
+				rr->first = (uint32_t) -1;
+				return NULL;
+			}
+			/* Copy the rows of the tile, less any padding */
+			n = rr->rowsize - offset < tilerowsize ?
+			    rr->rowsize - offset : tilerowsize;
+			for (r = 0; r < nrows; r++)
+				_TIFFmemcpy(rr->band + r * rr->rowsize + offset,
+				    rr->tile + r * tilerowsize, n);
+		}
+	}
+	return rr->band + (row - rr->first) * rr->rowsize;
+}
+
+static void
+FreeRowReader(RowReader* rr)
+{
+	if (rr->band) _TIFFfree(rr->band);
+	if (rr->tile) _TIFFfree(rr->tile);
+}
+
+static int
+SameLayout(TIFF* tif1, TIFF* tif2)
+{
+	uint32_t v1, v2;
+
+	if (TIFFIsTiled(tif1) != TIFFIsTiled(tif2))
+		return 0;
+	if (TIFFIsTiled(tif1)) {
+		TIFFGetField(tif1, TIFFTAG_TILEWIDTH, &v1);
+		TIFFGetField(tif2, TIFFTAG_TILEWIDTH, &v2);
+		if (v1 != v2)
+			return 0;
+		TIFFGetField(tif1, TIFFTAG_TILELENGTH, &v1);
+		TIFFGetField(tif2, TIFFTAG_TILELENGTH, &v2);
+	} else {
+		TIFFGetFieldDefaulted(tif1, TIFFTAG_ROWSPERSTRIP, &v1);
+		TIFFGetFieldDefaulted(tif2, TIFFTAG_ROWSPERSTRIP, &v2);
+	}
+	return v1 == v2;
+}
+
+/*
+ * Have the blocks of a subsampled YCbCr image decode to one sample per
+ * pixel and plane, as JPEG can by upsampling to RGB.  Return 0 for other
+ * subsampled images, whose blocks hold packed YCbCr data units.
+ */
+static int
+UpsampleYCbCr(TIFF* tif)
+{
+	uint16_t photometric, config, compression, subh, subv;
+
+	if (!TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric) ||
+	    photometric != PHOTOMETRIC_YCBCR)
+		return 1;
+	TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &config);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_YCBCRSUBSAMPLING, &subh, &subv);
+	if (config != PLANARCONFIG_CONTIG || (subh == 1 && subv == 1))
+		return 1;
+	TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+	if (compression == COMPRESSION_JPEG &&
+	    TIFFSetField(tif, TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB))
+		return 1;
+	fprintf(stderr, "%s: Can't compare subsampled YCbCr data with -s\n",
+	    TIFFFileName(tif));
+	return 0;
+}
+
+/*
+ * Compare the image data of two images with the same planar configuration.
+ * When both have the same strip or tile layout, blocks whose compressed
+ * bytes are equal are not decoded, and decoded blocks are first compared
+ * as a whole.  Otherwise scanlines are compared, tiled images being read
+ * one row of tiles at a time.  Subsampled JPEG YCbCr images are compared
+ * as RGB.  The differences are not
+ * listed: their count, largest absolute value, RMSE and PSNR are reported.
+ */
+static int
+BlockCompare(TIFF* tif1, TIFF* tif2)
+{
+	DiffStats st;
+	uint16_t config;
+	int separate;
+	uint32_t spb;
+	unsigned char *buf1 = NULL, *buf2 = NULL, *raw1 = NULL, *raw2 = NULL;
+	tmsize_t bufsize, rawsize = 0;
+
+	memset(&st, 0, sizeof(st));
+	if (!UpsampleYCbCr(tif1) || !UpsampleYCbCr(tif2))
+		exit(2);
+	(void) TIFFGetField(tif1, TIFFTAG_PLANARCONFIG, &config);
+	separate = (config == PLANARCONFIG_SEPARATE);
+	spb = separate ? 1 : samplesperpixel;
+
+	if (SameLayout(tif1, tif2)) {
+		int tiled = TIFFIsTiled(tif1);
+		int samecoding = SameCoding(tif1, tif2);
+		uint32_t nblocks = tiled ? TIFFNumberOfTiles(tif1) :
+		    TIFFNumberOfStrips(tif1);
+		uint32_t bw, bh, across, perplane, b;
+		tmsize_t rowsize;
+
+		if (tiled) {
+			TIFFGetField(tif1, TIFFTAG_TILEWIDTH, &bw);
+			TIFFGetField(tif1, TIFFTAG_TILELENGTH, &bh);
+			bufsize = TIFFTileSize(tif1);
+			rowsize = TIFFTileRowSize(tif1);
+		} else {
+			bw = imagewidth;
+			TIFFGetFieldDefaulted(tif1, TIFFTAG_ROWSPERSTRIP, &bh);
+			if (bh > imagelength)
+				bh = imagelength;
+			bufsize = TIFFStripSize(tif1);
+			rowsize = TIFFScanlineSize(tif1);
+		}
+		if (bw == 0 || bh == 0) {
+			fprintf(stderr, "Invalid strip or tile size\n");
+			exit(2);
+		}
+		across = (imagewidth + bw - 1) / bw;
+		perplane = separate ? nblocks / samplesperpixel : nblocks;
+		buf1 = (unsigned char *)_TIFFmalloc(bufsize);
+		buf2 = (unsigned char *)_TIFFmalloc(bufsize);
+		if (buf1 == NULL || buf2 == NULL) {
+			fprintf(stderr, "No space for strip or tile buffers\n");
+			exit(2);
+		}
+		for (b = 0; b < nblocks; b++) {
+			uint32_t inplane = perplane ? b % perplane : b;
+			uint32_t x = (inplane % across) * bw;
+			uint32_t y = (inplane / across) * bh;
+			uint32_t ncols, nrows, r;
+			uint64_t size1, size2;
+
+			if (y >= imagelength)
+				continue;
+			ncols = imagewidth - x < bw ? imagewidth - x : bw;
+			nrows = imagelength - y < bh ? imagelength - y : bh;
+
+			size1 = TIFFGetStrileByteCount(tif1, b);
+			size2 = TIFFGetStrileByteCount(tif2, b);
+			if (samecoding && size1 == size2 && size1 > 0) {
+				if ((tmsize_t) size1 > rawsize) {
+					_TIFFfree(raw1);
+					_TIFFfree(raw2);
+					rawsize = (tmsize_t) size1;
+					raw1 = (unsigned char *)_TIFFmalloc(rawsize);
+					raw2 = (unsigned char *)_TIFFmalloc(rawsize);
+					if (raw1 == NULL || raw2 == NULL) {
+						fprintf(stderr, "No space for raw data buffers\n");
+						exit(2);
+					}
+				}
+				if ((tiled ? TIFFReadRawTile(tif1, b, raw1, rawsize) :
+					     TIFFReadRawStrip(tif1, b, raw1, rawsize)) == (tmsize_t) size1 &&
+				    (tiled ? TIFFReadRawTile(tif2, b, raw2, rawsize) :
+					     TIFFReadRawStrip(tif2, b, raw2, rawsize)) == (tmsize_t) size2 &&
+				    memcmp(raw1, raw2, (size_t) size1) == 0) {
+					st.nsamples += (uint64_t) ncols * nrows * spb;
+					continue;
+				}
+			}
+			if ((tiled ? TIFFReadEncodedTile(tif1, b, buf1, bufsize) :
+				     TIFFReadEncodedStrip(tif1, b, buf1, bufsize)) < 0) {
+				leof(TIFFFileName(tif1), y, separate ? (int) (b / perplane) : -1);
+				exit(2);
+			}
+			if ((tiled ? TIFFReadEncodedTile(tif2, b, buf2, bufsize) :
+				     TIFFReadEncodedStrip(tif2, b, buf2, bufsize)) < 0) {
+				leof(TIFFFileName(tif2), y, separate ? (int) (b / perplane) : -1);
+				exit(2);
+			}
+			/* Padding of edge tiles is not image data */
+			for (r = 0; r < nrows; r++)
+				AccumulateDiff(&st, buf1 + r * rowsize,
+					       buf2 + r * rowsize, ncols * spb);
+		}
+	} else {
+		RowReader rr1, rr2;
+		uint32_t row;
+		tsample_t s, nplanes = separate ? samplesperpixel : 1;
+
+		InitRowReader(&rr1, tif1);
+		InitRowReader(&rr2, tif2);
+		for (s = 0; s < nplanes; s++)
+			for (row = 0; row < imagelength; row++) {
+				unsigned char *row1, *row2;
+
+				if ((row1 = ReadRow(&rr1, row, s)) == NULL) {
+					leof(TIFFFileName(tif1), row, separate ? s : -1);
+					exit(2);
+				}
+				if ((row2 = ReadRow(&rr2, row, s)) == NULL) {
+					leof(TIFFFileName(tif2), row, separate ? s : -1);
+					exit(2);
+				}
+				AccumulateDiff(&st, row1, row2, imagewidth * spb);
+			}
+		FreeRowReader(&rr1);
+		FreeRowReader(&rr2);
+	}
+
+	if (st.ndiffs) {
+		double rmse = sqrt(st.sumsq / (double) st.nsamples);
+
+		datadiffers = 1;
+		printf("%"PRIu64" of %"PRIu64" samples differ, max abs diff %g, RMSE %g",
+		    st.ndiffs, st.nsamples, st.maxdiff, rmse);
+		if (sampleformat != SAMPLEFORMAT_IEEEFP && bitspersample <= 32 &&
+		    rmse > 0) {
+			double peak = (double) ((((uint64_t) 1) << bitspersample) - 1);
+
+			printf(", PSNR %.2f dB", 20. * log10(peak / rmse));
+		}
+		printf("\n");
+	}
+	if (buf1) _TIFFfree(buf1);
+	if (buf2) _TIFFfree(buf2);
+	if (raw1) _TIFFfree(raw1);
+	if (raw2) _TIFFfree(raw2);
+	return (1);
+}
+
 static void
 PrintIntDiff(uint32_t row, int sample, uint32_t pix, uint32_t w1, uint32_t w2)
 {
@@ -43,6 +43,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <errno.h>
 
 #include <ctype.h>
 
@@ -50,8 +51,24 @@
 # include <unistd.h>
 #endif
 
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#ifdef HAVE_IO_H
+# include <io.h>
+#endif
+
 #include "tiffio.h"
 
+#ifdef JPEG_SUPPORT
+# include <setjmp.h>
+# include "jpeglib.h"
+#endif
+#ifdef ZSTD_SUPPORT
+# include "zdict.h"
+#endif
+
 #ifndef EXIT_SUCCESS
 #define EXIT_SUCCESS 0
 #endif
@@ -71,6 +88,12 @@
  * disabled when set to 0 */
 static tmsize_t maxMalloc = DEFAULT_MAX_MALLOC;
 
+#define DEFAULT_WRITE_BUFFER_SIZE (8 * 1024 * 1024)
+
+/* size of the buffer gathering output strips and tiles (in bytes)
+ * disabled when set to 0 */
+static tmsize_t writeBufferSize = DEFAULT_WRITE_BUFFER_SIZE;
+
 static int outtiled = -1;
 static uint32_t tilewidth;
 static uint32_t tilelength;
@@ -88,12 +111,16 @@ static int ignore = FALSE;		/* if true, ignore read errors */
 static uint32_t defg3opts = (uint32_t) -1;
 static int quality = 75;		/* JPEG quality */
 static int jpegcolormode = JPEGCOLORMODE_RGB;
+static int jpegtranscode = FALSE;	/* copy JPEG data by DCT coefficients */
 static uint16_t defcompression = (uint16_t) -1;
 static uint16_t defpredictor = (uint16_t) -1;
 static int defpreset =  -1;
 static int subcodec = -1;
+static int zstddict = 0;		/* ZSTD dictionary size (KiB), 0 = none */
+static int compressopts = FALSE;	/* codec options given with -c */
 
 static int tiffcp(TIFF*, TIFF*);
+static int cpCloudOptimized(const char*, const char*, const char*);
 static int processCompressOptions(char*);
 static void usage(int code);
 
@@ -101,6 +128,9 @@ static char comma = ',';  /* (default) comma separator character */
 static TIFF* bias = NULL;
 static int pageNum = 0;
 static int pageInSeq = 0;
+static int cloudoptimized = FALSE;	/* IFDs and strile arrays first */
+static int strileindex = FALSE;		/* strile index and leaders for -G */
+static char* tmpfilename = NULL;	/* intermediate output of -G */
 
 /**
  * This custom malloc function enforce a maximum allocation size
@@ -176,6 +206,46 @@ static TIFF* openSrcImage (char **imageSpec)
 	return tif;
 }
 
+/*
+ * Create a new, empty temporary file next to the output file, so that
+ * the final layout pass does not copy across file systems.  The file is
+ * created exclusively, so that an existing file is never overwritten.
+ */
+static char*
+createTempFile(const char* outname)
+{
+	size_t len = strlen(outname) + 16;
+	char* name = (char*) _TIFFmalloc((tmsize_t) len);
+	unsigned int n;
+
+	if (name == NULL)
+		return NULL;
+	for (n = 0; n < 10000; n++) {
+		int fd;
+
+		snprintf(name, len, "%s.%u.tmp", outname, n);
+		fd = open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+		if (fd >= 0) {
+			close(fd);
+			return name;
+		}
+		if (errno != EEXIST)
+			break;
+	}
+	_TIFFfree(name);
+	return NULL;
+}
+
+static void
+removeTempFile(void)
+{
+	if (tmpfilename) {
+		(void) remove(tmpfilename);
+		_TIFFfree(tmpfilename);
+		tmpfilename = NULL;
+	}
+}
+
 int
 main(int argc, char* argv[])
 {
@@ -197,11 +267,14 @@ main(int argc, char* argv[])
 
 	*mp++ = 'w';
 	*mp = '\0';
-	while ((c = getopt(argc, argv, "m:,:b:c:f:l:o:p:r:w:aistBLMC8xh")) != -1)
+	while ((c = getopt(argc, argv, "m:W:,:b:c:f:l:o:p:r:w:aistBLMC8xGHh")) != -1)
 		switch (c) {
 		case 'm':
 			maxMalloc = (tmsize_t)strtoul(optarg, NULL, 0) << 20;
 			break;
+		case 'W':
+			writeBufferSize = (tmsize_t)strtoul(optarg, NULL, 0) << 20;
+			break;
 		case ',':
 			if (optarg[0] != '=') usage(EXIT_FAILURE);
 			comma = optarg[1];
@@ -291,6 +364,13 @@ main(int argc, char* argv[])
 		case 'x':
 			pageInSeq = 1;
 			break;
+		case 'G':   /* IFDs and strile arrays at the head of the file */
+			cloudoptimized = TRUE;
+			break;
+		case 'H':   /* same, with a strile index after the header */
+			cloudoptimized = TRUE;
+			strileindex = TRUE;
+			break;
 		case 'h':
 			usage(EXIT_SUCCESS);
 			/*NOTREACHED*/
@@ -302,9 +382,31 @@ main(int argc, char* argv[])
 		}
 	if (argc - optind < 2)
 		usage(EXIT_FAILURE);
-	out = TIFFOpen(argv[argc-1], mode);
+	if (cloudoptimized) {
+		/*
+		 * The images are first copied as usual to a temporary file,
+		 * which is then laid out again into the output file.
+		 */
+		if (mode[0] == 'a') {
+			fputs("Can't append to a file in the -G/-H layout\n",
+			    stderr);
+			exit(EXIT_FAILURE);
+		}
+		tmpfilename = createTempFile(argv[argc-1]);
+		if (tmpfilename == NULL) {
+			fprintf(stderr, "%s: Cannot create a temporary file\n",
+			    argv[argc-1]);
+			exit(EXIT_FAILURE);
+		}
+		atexit(removeTempFile);
+	}
+	out = TIFFOpen(tmpfilename ? tmpfilename : argv[argc-1], mode);
 	if (out == NULL)
 		return (EXIT_FAILURE);
+	if (!TIFFSetWriteBufferSize(out, writeBufferSize)) {
+		(void) TIFFClose(out);
+		return (EXIT_FAILURE);
+	}
 	if ((argc - optind) == 2)
 		pageNum = -1;
 	for (; optind < argc-1 ; optind++) {
@@ -345,6 +447,8 @@ main(int argc, char* argv[])
 	}
 
 	(void) TIFFClose(out);
+	if (tmpfilename && !cpCloudOptimized(tmpfilename, argv[argc-1], mode))
+		return (EXIT_FAILURE);
 	return (EXIT_SUCCESS);
 }
 
@@ -360,6 +464,8 @@ processZIPOptions(char* cp)
 				defpreset = atoi(++cp);
 			else if (*cp == 's')
 				subcodec = atoi(++cp);
+			else if (*cp == 'd')
+				zstddict = atoi(++cp);
 			else
 				usage(EXIT_FAILURE);
 		} while( (cp = strchr(cp, ':')) );
@@ -407,6 +513,7 @@ processG3Options(char* cp)
 static int
 processCompressOptions(char* opt)
 {
+	compressopts = (strchr(opt, ':') != NULL);
 	if (streq(opt, "none")) {
 		defcompression = COMPRESSION_NONE;
 	} else if (streq(opt, "packbits")) {
@@ -421,6 +528,8 @@ processCompressOptions(char* opt)
 				quality = atoi(cp+1);
 			else if (cp[1] == 'r' )
 				jpegcolormode = JPEGCOLORMODE_RAW;
+			else if (cp[1] == 't' )
+				jpegtranscode = TRUE;
 			else
 				usage(EXIT_FAILURE);
 
@@ -480,6 +589,11 @@ static const char usage_info[] =
 " -b file[,#]     bias (dark) monochrome image to be subtracted from all others\n"
 " -,=%            use % rather than , to separate image #'s (per Note below)\n"
 " -m size         set maximum memory allocation size (MiB). 0 to disable limit.\n"
+" -W size         set output write buffer size (MiB). 0 to disable buffering.\n"
+" -G              write all IFDs and strip/tile arrays at the head of the file,\n"
+"                 followed by the image data, smallest images first\n"
+" -H              same as -G, with an index of the images after the header\n"
+"                 and the size of each strip/tile just before its data\n"
 "\n"
 " -r #            make each strip have no more than # rows\n"
 " -w #            set output tile width (pixels)\n"
@@ -526,6 +640,8 @@ static const char usage_info[] =
 /* "    ZSTD options:", */
 "    #            set predictor value\n"
 "    p#           set compression level (preset)\n"
+"    d#           train a dictionary of # KiB on input tiles/strips\n"
+"    For example, -c zstd:p19:d112 for small tiles sharing a dictionary\n"
 #endif
 #ifdef WEBP_SUPPORT
 " -c webp[:opts]  compress output with WEBP encoding\n"
@@ -538,6 +654,8 @@ static const char usage_info[] =
 /* "    JPEG options:", */
 "    #            set compression quality level (0-100, default 75)\n"
 "    r            output color image as RGB rather than YCbCr\n"
+"    t            re-tile JPEG input losslessly by copying DCT coefficients\n"
+"                 (tiles/strips must be MCU aligned; quality is ignored)\n"
 "    For example, -c jpeg:r:50 for JPEG-encoded RGB with 50% comp. quality\n"
 #endif
 #ifdef JBIG_SUPPORT
@@ -688,6 +806,48 @@ static const struct cpTag {
 typedef int (*copyFunc)
     (TIFF* in, TIFF* out, uint32_t l, uint32_t w, uint16_t samplesperpixel);
 static	copyFunc pickCopyFunc(TIFF*, TIFF*, uint16_t, uint16_t);
+static	int canKeepJPEGYCbCr(TIFF*, TIFF*, uint16_t, uint16_t, uint16_t, uint16_t);
+static	int canCopyRaw(TIFF*, TIFF*, uint16_t, uint16_t, uint16_t, uint32_t);
+static	int cpRawStriles(TIFF*, TIFF*, uint32_t, uint32_t, tsample_t);
+static	int cpRawStrileData(TIFF*, TIFF*);
+static	int cpRawCodecTags(TIFF*, TIFF*);
+#ifdef ZSTD_SUPPORT
+static	ttag_t zstdDictionaryTag(TIFF*);
+static	int trainZSTDDictionary(TIFF*, TIFF*);
+#endif
+#ifdef JPEG_SUPPORT
+static	int canTranscodeJPEG(TIFF*, TIFF*, uint16_t, uint16_t, uint16_t, uint32_t);
+static	int cpJPEGCoefficients(TIFF*, TIFF*, uint32_t, uint32_t, tsample_t);
+#endif
+
+static void
+cpProfileAndInks(TIFF* in, TIFF* out)
+{
+	{
+		uint32_t len32;
+		void** data;
+		if (TIFFGetField(in, TIFFTAG_ICCPROFILE, &len32, &data))
+			TIFFSetField(out, TIFFTAG_ICCPROFILE, len32, data);
+	}
+	{
+		uint16_t ninks;
+		const char* inknames;
+		if (TIFFGetField(in, TIFFTAG_NUMBEROFINKS, &ninks)) {
+			TIFFSetField(out, TIFFTAG_NUMBEROFINKS, ninks);
+			if (TIFFGetField(in, TIFFTAG_INKNAMES, &inknames)) {
+				int inknameslen = strlen(inknames) + 1;
+				const char* cp = inknames;
+				while (ninks > 1) {
+					cp = strchr(cp, '\0');
+                                        cp++;
+                                        inknameslen += (strlen(cp) + 1);
+					ninks--;
+				}
+				TIFFSetField(out, TIFFTAG_INKNAMES, inknameslen, inknames);
+			}
+		}
+	}
+}
 
 /* PODD */
 
@@ -696,7 +856,7 @@ tiffcp(TIFF* in, TIFF* out)
 {
 	uint16_t bitspersample = 1, samplesperpixel = 1;
 	uint16_t input_compression, input_photometric = PHOTOMETRIC_MINISBLACK;
-	copyFunc cf;
+	copyFunc cf = NULL;
 	uint32_t width, length;
 	const struct cpTag* p;
 
@@ -824,7 +984,38 @@ tiffcp(TIFF* in, TIFF* out)
 	switch (compression) {
 		case COMPRESSION_JPEG:
 			TIFFSetField(out, TIFFTAG_JPEGQUALITY, quality);
-			TIFFSetField(out, TIFFTAG_JPEGCOLORMODE, jpegcolormode);
+#ifdef JPEG_SUPPORT
+			if (jpegtranscode) {
+				if (canTranscodeJPEG(in, out, input_compression,
+				    input_photometric, bitspersample, length)) {
+					/*
+					 * The compressed data is kept as is, so
+					 * is its photometric interpretation.
+					 */
+					TIFFSetField(out, TIFFTAG_PHOTOMETRIC,
+					    input_photometric);
+					cf = cpJPEGCoefficients;
+					break;
+				}
+				TIFFWarning(TIFFFileName(in),
+				    "Can't copy DCT coefficients, "
+				    "recompressing JPEG data");
+			}
+#endif
+			if (canKeepJPEGYCbCr(in, out, input_compression,
+			    input_photometric, bitspersample, samplesperpixel)) {
+				/*
+				 * Hand the subsampled YCbCr data straight
+				 * from the decoder to the encoder instead of
+				 * going through RGB.
+				 */
+				TIFFSetField(in, TIFFTAG_JPEGCOLORMODE,
+				    JPEGCOLORMODE_RAW);
+				TIFFSetField(out, TIFFTAG_JPEGCOLORMODE,
+				    JPEGCOLORMODE_RAW);
+			} else
+				TIFFSetField(out, TIFFTAG_JPEGCOLORMODE,
+				    jpegcolormode);
 			break;
 		case COMPRESSION_JBIG:
 			CopyTag(TIFFTAG_FAXRECVPARAMS, 1, TIFF_LONG);
@@ -885,6 +1076,13 @@ tiffcp(TIFF* in, TIFF* out)
                                 }
                             }
                         }
+#ifdef ZSTD_SUPPORT
+			if (compression == COMPRESSION_ZSTD && zstddict > 0 &&
+			    !trainZSTDDictionary(in, out))
+				TIFFWarning(TIFFFileName(in),
+				    "Can't train a ZSTD dictionary, "
+				    "compressing without one");
+#endif
 			/*fallthrough*/
 		case COMPRESSION_WEBP:
 			if (preset != -1) {
@@ -922,30 +1120,7 @@ tiffcp(TIFF* in, TIFF* out)
 			CopyTag(TIFFTAG_FAXSUBADDRESS, 1, TIFF_ASCII);
 			break;
 	}
-	{
-		uint32_t len32;
-		void** data;
-		if (TIFFGetField(in, TIFFTAG_ICCPROFILE, &len32, &data))
-			TIFFSetField(out, TIFFTAG_ICCPROFILE, len32, data);
-	}
-	{
-		uint16_t ninks;
-		const char* inknames;
-		if (TIFFGetField(in, TIFFTAG_NUMBEROFINKS, &ninks)) {
-			TIFFSetField(out, TIFFTAG_NUMBEROFINKS, ninks);
-			if (TIFFGetField(in, TIFFTAG_INKNAMES, &inknames)) {
-				int inknameslen = strlen(inknames) + 1;
-				const char* cp = inknames;
-				while (ninks > 1) {
-					cp = strchr(cp, '\0');
-                                        cp++;
-                                        inknameslen += (strlen(cp) + 1);
-					ninks--;
-				}
-				TIFFSetField(out, TIFFTAG_INKNAMES, inknameslen, inknames);
-			}
-		}
-	}
+	cpProfileAndInks(in, out);
 	{
 		unsigned short pg0, pg1;
 
@@ -969,10 +1144,255 @@ tiffcp(TIFF* in, TIFF* out)
 	for (p = tags; p < &tags[NTAGS]; p++)
 		CopyTag(p->tag, p->count, p->type);
 
-	cf = pickCopyFunc(in, out, bitspersample, samplesperpixel);
+	if (canCopyRaw(in, out, input_compression, input_photometric,
+	    bitspersample, length))
+		cf = cpRawStriles;
+	else if (cf == NULL)
+		cf = pickCopyFunc(in, out, bitspersample, samplesperpixel);
 	return (cf ? (*cf)(in, out, length, width, samplesperpixel) : FALSE);
 }
 
+/*
+ * Cloud optimized layout (-G).
+ *
+ * The images have been copied by tiffcp() to a temporary file, from which
+ * they are laid out again without decoding: first all the IFDs, with the
+ * strip/tile arrays deferred (TIFFDeferStrileArrayWriting()), then these
+ * arrays, reserved just after the IFDs (TIFFForceStrileArrayWriting()),
+ * then the image data, smallest images first so that overviews precede
+ * the full resolution levels.  The arrays are finally rewritten in place
+ * when each image's data has been copied.  A reader thus finds everything
+ * it needs to locate the data of any image in the first bytes of the file.
+ */
+typedef struct {
+	uint64_t npixels;
+	tdir_t dir;
+	uint64_t diroff;
+	uint32_t width, length;
+	uint32_t blockwidth, blocklength;	/* tile, or strip */
+	uint16_t planes;
+} LayoutImage;
+
+static int
+compareLayoutImagesSmallestFirst(const void* a, const void* b)
+{
+	const LayoutImage* la = (const LayoutImage*) a;
+	const LayoutImage* lb = (const LayoutImage*) b;
+
+	if (la->npixels != lb->npixels)
+		return la->npixels < lb->npixels ? -1 : 1;
+	return (int) la->dir - (int) lb->dir;
+}
+
+/*
+ * With -H, the gap between the file header and the first IFD holds a text
+ * index of the images, in directory order, all numbers having a fixed width
+ * so that its size is known before the IFDs are written:
+ *
+ *	LIBTIFF_STRILE_INDEX_SIZE=0000000412 bytes
+ *	LAYOUT=IFDS_BEFORE_DATA
+ *	BLOCK_LEADER=SIZE_AS_UINT4
+ *	IMAGES=00002
+ *	IMAGE=00000 IFD=... SIZE=<width>x<length> BLOCK=<width>x<length>
+ *	    GRID=<across>x<down>x<planes>
+ *
+ * (one line per image).  Each strip or tile is preceded by its byte count
+ * as a 4-byte integer in the byte order of the file.
+ */
+#define	INDEXHEADER	"LIBTIFF_STRILE_INDEX_SIZE=%010"PRIu64" bytes\n" \
+			"LAYOUT=IFDS_BEFORE_DATA\n" \
+			"BLOCK_LEADER=SIZE_AS_UINT4\n" \
+			"IMAGES=%05u\n"
+#define	INDEXIMAGE	"IMAGE=%05u IFD=%020"PRIu64 \
+			" SIZE=%010"PRIu32"x%010"PRIu32 \
+			" BLOCK=%010"PRIu32"x%010"PRIu32 \
+			" GRID=%010"PRIu32"x%010"PRIu32"x%05u\n"
+
+static uint32_t
+howMany(uint32_t x, uint32_t y)
+{
+	return y ? (uint32_t) (((uint64_t) x + y - 1) / y) : 0;
+}
+
+static char*
+formatStrileIndex(const LayoutImage* images, tdir_t ndirs, tmsize_t* size)
+{
+	const LayoutImage* li;
+	tmsize_t headersize, imagesize;
+	char* index;
+	char* cp;
+	tdir_t i;
+
+	headersize = snprintf(NULL, 0, INDEXHEADER, (uint64_t) 0, 0u);
+	imagesize = snprintf(NULL, 0, INDEXIMAGE, 0u, (uint64_t) 0,
+	    (uint32_t) 0, (uint32_t) 0, (uint32_t) 0, (uint32_t) 0,
+	    (uint32_t) 0, (uint32_t) 0, 0u);
+	*size = headersize + ndirs * imagesize;
+	index = (char*) _TIFFmalloc(*size + 1);
+	if (index == NULL)
+		return NULL;
+	sprintf(index, INDEXHEADER, (uint64_t) *size, (unsigned) ndirs);
+	for (i = 0; i < ndirs; i++) {
+		li = &images[i];
+		cp = index + headersize + li->dir * imagesize;
+		sprintf(cp, INDEXIMAGE, (unsigned) li->dir, li->diroff,
+		    li->width, li->length, li->blockwidth, li->blocklength,
+		    howMany(li->width, li->blockwidth),
+		    howMany(li->length, li->blocklength),
+		    (unsigned) li->planes);
+	}
+	return index;
+}
+
+/*
+ * Copies the tags of a directory written by tiffcp().
+ */
+static void
+cpLayoutTags(TIFF* in, TIFF* out)
+{
+	const struct cpTag* p;
+	uint32_t longv;
+	uint16_t shortv, shortv1, shortv2;
+
+	CopyField(TIFFTAG_IMAGEWIDTH, longv);
+	CopyField(TIFFTAG_IMAGELENGTH, longv);
+	CopyField(TIFFTAG_BITSPERSAMPLE, shortv);
+	CopyField(TIFFTAG_SAMPLESPERPIXEL, shortv);
+	CopyField(TIFFTAG_COMPRESSION, shortv);
+	CopyField(TIFFTAG_PHOTOMETRIC, shortv);
+	CopyField(TIFFTAG_FILLORDER, shortv);
+	CopyField(TIFFTAG_ORIENTATION, shortv);
+	CopyField(TIFFTAG_PLANARCONFIG, shortv);
+	if (TIFFIsTiled(in)) {
+		CopyField(TIFFTAG_TILEWIDTH, longv);
+		CopyField(TIFFTAG_TILELENGTH, longv);
+	} else
+		CopyField(TIFFTAG_ROWSPERSTRIP, longv);
+	CopyTag(TIFFTAG_TRANSFERFUNCTION, 4, TIFF_SHORT);
+	CopyTag(TIFFTAG_COLORMAP, 4, TIFF_SHORT);
+	CopyField(TIFFTAG_PREDICTOR, shortv);
+	CopyTag(TIFFTAG_GROUP3OPTIONS, 1, TIFF_LONG);
+	CopyTag(TIFFTAG_GROUP4OPTIONS, 1, TIFF_LONG);
+	CopyTag(TIFFTAG_BADFAXLINES, 1, TIFF_LONG);
+	CopyTag(TIFFTAG_CLEANFAXDATA, 1, TIFF_LONG);
+	CopyTag(TIFFTAG_CONSECUTIVEBADFAXLINES, 1, TIFF_LONG);
+	CopyTag(TIFFTAG_FAXRECVPARAMS, 1, TIFF_LONG);
+	CopyTag(TIFFTAG_FAXRECVTIME, 1, TIFF_LONG);
+	CopyTag(TIFFTAG_FAXSUBADDRESS, 1, TIFF_ASCII);
+	CopyTag(TIFFTAG_FAXDCS, 1, TIFF_ASCII);
+	cpProfileAndInks(in, out);
+	CopyField2(TIFFTAG_PAGENUMBER, shortv1, shortv2);
+	for (p = tags; p < &tags[NTAGS]; p++)
+		CopyTag(p->tag, p->count, p->type);
+}
+
+static int
+cpCloudOptimized(const char* tmpname, const char* outname, const char* mode)
+{
+	TIFF* in;
+	TIFF* out;
+	LayoutImage* images = NULL;
+	char* index = NULL;
+	tmsize_t indexsize = 0;
+	tdir_t ndirs, i;
+	int ok = FALSE;
+
+	in = TIFFOpen(tmpname, "r");
+	if (in == NULL)
+		return FALSE;
+	out = TIFFOpen(outname, mode);
+	if (out == NULL) {
+		(void) TIFFClose(in);
+		return FALSE;
+	}
+	if (!TIFFSetWriteBufferSize(out, writeBufferSize))
+		goto done;
+	ndirs = TIFFNumberOfDirectories(in);
+	images = (LayoutImage*) _TIFFcalloc(ndirs, sizeof (LayoutImage));
+	if (images == NULL) {
+		TIFFError(outname, "Insufficient memory for the list of images");
+		goto done;
+	}
+	if (strileindex) {
+		/* Room for the index, filled in at the end */
+		index = formatStrileIndex(images, ndirs, &indexsize);
+		if (index == NULL) {
+			TIFFError(outname, "Insufficient memory for the index");
+			goto done;
+		}
+		if (!TIFFSetHeaderGap(out, index, indexsize))
+			goto done;
+	}
+
+	/* The IFDs, with no strip/tile arrays yet */
+	for (i = 0; i < ndirs; i++) {
+		LayoutImage* li = &images[i];
+		uint16_t planarconfig, spp;
+
+		if (i > 0 && !TIFFReadDirectory(in))
+			goto done;
+		TIFFGetField(in, TIFFTAG_IMAGEWIDTH, &li->width);
+		TIFFGetField(in, TIFFTAG_IMAGELENGTH, &li->length);
+		li->npixels = (uint64_t) li->width * li->length;
+		li->dir = i;
+		if (TIFFIsTiled(in)) {
+			TIFFGetField(in, TIFFTAG_TILEWIDTH, &li->blockwidth);
+			TIFFGetField(in, TIFFTAG_TILELENGTH, &li->blocklength);
+		} else {
+			li->blockwidth = li->width;
+			TIFFGetFieldDefaulted(in, TIFFTAG_ROWSPERSTRIP,
+			    &li->blocklength);
+			if (li->blocklength > li->length)
+				li->blocklength = li->length;
+		}
+		TIFFGetFieldDefaulted(in, TIFFTAG_PLANARCONFIG, &planarconfig);
+		TIFFGetFieldDefaulted(in, TIFFTAG_SAMPLESPERPIXEL, &spp);
+		li->planes = planarconfig == PLANARCONFIG_SEPARATE ? spp : 1;
+		cpLayoutTags(in, out);
+		if (!cpRawCodecTags(in, out) ||
+		    !TIFFDeferStrileArrayWriting(out) ||
+		    !TIFFWriteCheck(out, TIFFIsTiled(out), "tiffcp") ||
+		    !TIFFWriteDirectory(out))
+			goto done;
+	}
+
+	/* The strip/tile arrays, filled with zeroes for now */
+	for (i = 0; i < ndirs; i++) {
+		if (!TIFFSetDirectory(out, i) || !TIFFForceStrileArrayWriting(out))
+			goto done;
+		images[i].diroff = TIFFCurrentDirOffset(out);
+	}
+
+	/* The image data; flushing rewrites the arrays in place */
+	TIFFSetStrileLeaders(out, strileindex);
+	qsort(images, ndirs, sizeof (LayoutImage),
+	    compareLayoutImagesSmallestFirst);
+	for (i = 0; i < ndirs; i++)
+		if (!TIFFSetDirectory(in, images[i].dir) ||
+		    !TIFFSetDirectory(out, images[i].dir) ||
+		    !cpRawStrileData(in, out) || !TIFFFlush(out))
+			goto done;
+
+	if (strileindex) {
+		_TIFFfree(index);
+		index = formatStrileIndex(images, ndirs, &indexsize);
+		if (index == NULL) {
+			TIFFError(outname, "Insufficient memory for the index");
+			goto done;
+		}
+		if (!TIFFSetHeaderGap(out, index, indexsize))
+			goto done;
+	}
+	ok = TRUE;
+
+done:
+	_TIFFfree(index);
+	_TIFFfree(images);
+	(void) TIFFClose(in);
+	(void) TIFFClose(out);
+	return ok;
+}
+
 /*
  * Copy Functions.
  */
@@ -1175,6 +1595,644 @@ bad:
 	return 0;
 }
 
+/*
+ * Contig tiles -> contig tiles of the same size.
+ */
+DECLAREcpFunc(cpDecodedTiles)
+{
+	tsize_t tilesize = TIFFTileSize(in);
+	tdata_t buf = limitMalloc(tilesize);
+
+	(void) imagewidth; (void) imagelength; (void) spp;
+	if (buf) {
+		ttile_t t, nt = TIFFNumberOfTiles(in);
+		_TIFFmemset(buf, 0, tilesize);
+		for (t = 0; t < nt; t++) {
+			if (TIFFReadEncodedTile(in, t, buf, tilesize) < 0
+			    && !ignore) {
+				TIFFError(TIFFFileName(in),
+				    "Error, can't read tile %"PRIu32,
+				    t);
+				goto bad;
+			}
+			if (TIFFWriteEncodedTile(out, t, buf, tilesize) < 0) {
+				TIFFError(TIFFFileName(out),
+				    "Error, can't write tile %"PRIu32,
+				    t);
+				goto bad;
+			}
+		}
+		_TIFFfree(buf);
+		return 1;
+	} else {
+		TIFFError(TIFFFileName(in),
+		    "Error, can't allocate memory buffer of size %"TIFF_SSIZE_FORMAT
+		    " to read tiles", tilesize);
+		return 0;
+	}
+
+bad:
+	_TIFFfree(buf);
+	return 0;
+}
+
+/*
+ * Codec tags that the compressed data depends on and that must follow
+ * it when it is copied as is.  All are (count, pointer) pairs.
+ */
+static const ttag_t rawcodectags[] = {
+	TIFFTAG_JPEGTABLES,
+	TIFFTAG_LERC_PARAMETERS,
+};
+#define	NRAWCODECTAGS	(sizeof (rawcodectags) / sizeof (rawcodectags[0]))
+
+/*
+ * Strips/tiles -> strips/tiles without decoding (see canCopyRaw()).
+ */
+DECLAREcpFunc(cpRawStriles)
+{
+	(void) imagewidth; (void) imagelength; (void) spp;
+	return cpRawCodecTags(in, out) && cpRawStrileData(in, out);
+}
+
+static int
+cpRawCodecTags(TIFF* in, TIFF* out)
+{
+	size_t i;
+
+	for (i = 0; i < NRAWCODECTAGS; i++) {
+		uint32_t count;
+		void* data;
+
+		if (TIFFFindField(in, rawcodectags[i], TIFF_ANY) &&
+		    TIFFGetField(in, rawcodectags[i], &count, &data) &&
+		    !TIFFSetField(out, rawcodectags[i], count, data))
+			return 0;
+	}
+#ifdef ZSTD_SUPPORT
+	{
+		ttag_t tag = zstdDictionaryTag(in);
+		uint32_t count;
+		void* data;
+
+		if (tag != 0 && TIFFGetField(in, tag, &count, &data) &&
+		    !TIFFSetField(out, tag, count, data))
+			return 0;
+	}
+#endif
+	return 1;
+}
+
+/*
+ * Copies the compressed strips or tiles of the current input directory
+ * to the same ones of the current output directory.
+ */
+static int
+cpRawStrileData(TIFF* in, TIFF* out)
+{
+	int tiled = TIFFIsTiled(in);
+	uint32_t s, ns = tiled ? TIFFNumberOfTiles(in) : TIFFNumberOfStrips(in);
+	tmsize_t bufsize = 0;
+	tdata_t buf = NULL;
+
+	for (s = 0; s < ns; s++) {
+		uint64_t bytecount = TIFFGetStrileByteCount(in, s);
+		tmsize_t cc;
+
+		if (bytecount == 0)
+			continue;	/* keep sparse striles sparse */
+		if (bytecount > (uint64_t) TIFF_TMSIZE_T_MAX) {
+			TIFFError(TIFFFileName(in),
+			    "Error, %s %"PRIu32" is too large",
+			    tiled ? "tile" : "strip", s);
+			goto bad;
+		}
+		if ((tmsize_t) bytecount > bufsize) {
+			_TIFFfree(buf);
+			bufsize = (tmsize_t) bytecount;
+			buf = limitMalloc(bufsize);
+			if (buf == NULL) {
+				TIFFError(TIFFFileName(in),
+				    "Error, can't allocate memory buffer of size %"TIFF_SSIZE_FORMAT
+				    " to read raw data", bufsize);
+				return 0;
+			}
+		}
+		cc = tiled ? TIFFReadRawTile(in, s, buf, (tmsize_t) bytecount)
+			   : TIFFReadRawStrip(in, s, buf, (tmsize_t) bytecount);
+		if (cc < 0) {
+			if (ignore)
+				continue;
+			TIFFError(TIFFFileName(in),
+			    "Error, can't read %s %"PRIu32,
+			    tiled ? "tile" : "strip", s);
+			goto bad;
+		}
+		if ((tiled ? TIFFWriteRawTile(out, s, buf, cc)
+			   : TIFFWriteRawStrip(out, s, buf, cc)) < 0) {
+			TIFFError(TIFFFileName(out),
+			    "Error, can't write %s %"PRIu32,
+			    tiled ? "tile" : "strip", s);
+			goto bad;
+		}
+	}
+	_TIFFfree(buf);
+	return 1;
+
+bad:
+	_TIFFfree(buf);
+	return 0;
+}
+
+#ifdef JPEG_SUPPORT
+/*
+ * JPEG -> JPEG by DCT coefficients.
+ *
+ * The entropy-coded data of every input tile (or strip) is decoded
+ * only as far as the quantized DCT coefficients, the 8x8 blocks are
+ * rearranged into the output tile (or strip) grid and entropy-coded
+ * again.  There is no IDCT/FDCT and no requantization, so the output
+ * decodes to exactly the same samples as the input.  This requires
+ * every input and output tile/strip origin to fall on an MCU boundary
+ * (see canTranscodeJPEG()).  The coefficients of the input tiles
+ * under one row of output tiles are kept in a band, so every input
+ * tile is decoded at most twice whatever the two tilings are, and
+ * memory use is bounded by that band.
+ */
+typedef struct {
+	struct jpeg_error_mgr err;	/* must be first */
+	jmp_buf jmpbuf;
+	const char* filename;
+	struct jpeg_decompress_struct d;
+	struct jpeg_compress_struct c;
+	struct jpeg_source_mgr src;
+	struct jpeg_destination_mgr dest;
+	uint8_t* outbuf;		/* compressed output tile */
+	tmsize_t outbufsize;
+	int outbuferror;
+} JPEGTranscodeState;
+
+#define	CALLJPEG(st, fail, op)	(setjmp((st)->jmpbuf) ? (fail) : (op))
+#define	CALLVJPEG(st, op)	CALLJPEG(st, 0, ((op),1))
+
+#define	jtHowMany(x, y)	(((x) + (y) - 1) / (y))
+#define	jtMin(a, b)	((a) < (b) ? (a) : (b))
+#define	jtMax(a, b)	((a) > (b) ? (a) : (b))
+
+static void
+jtErrorExit(j_common_ptr cinfo)
+{
+	JPEGTranscodeState* st = (JPEGTranscodeState*) cinfo->err;
+	char buffer[JMSG_LENGTH_MAX];
+
+	(*cinfo->err->format_message) (cinfo, buffer);
+	TIFFError(st->filename, "%s", buffer);
+	longjmp(st->jmpbuf, 1);
+}
+
+static void
+jtOutputMessage(j_common_ptr cinfo)
+{
+	JPEGTranscodeState* st = (JPEGTranscodeState*) cinfo->err;
+	char buffer[JMSG_LENGTH_MAX];
+
+	(*cinfo->err->format_message) (cinfo, buffer);
+	TIFFWarning(st->filename, "%s", buffer);
+}
+
+static void
+jtInitSource(j_decompress_ptr cinfo)
+{
+	(void) cinfo;
+}
+
+static boolean
+jtFillInputBuffer(j_decompress_ptr cinfo)
+{
+	static const JOCTET dummy_EOI[2] = { 0xFF, JPEG_EOI };
+
+	/* Premature end of data: let libjpeg see an EOI marker */
+	cinfo->src->next_input_byte = dummy_EOI;
+	cinfo->src->bytes_in_buffer = 2;
+	return (TRUE);
+}
+
+static void
+jtSkipInputData(j_decompress_ptr cinfo, long num_bytes)
+{
+	struct jpeg_source_mgr* src = cinfo->src;
+
+	if (num_bytes > 0) {
+		if ((size_t)num_bytes > src->bytes_in_buffer) {
+			(void) jtFillInputBuffer(cinfo);
+		} else {
+			src->next_input_byte += (size_t) num_bytes;
+			src->bytes_in_buffer -= (size_t) num_bytes;
+		}
+	}
+}
+
+static void
+jtTermSource(j_decompress_ptr cinfo)
+{
+	(void) cinfo;
+}
+
+static void
+jtSetSource(JPEGTranscodeState* st, const void* data, tmsize_t size)
+{
+	st->src.init_source = jtInitSource;
+	st->src.fill_input_buffer = jtFillInputBuffer;
+	st->src.skip_input_data = jtSkipInputData;
+	st->src.resync_to_restart = jpeg_resync_to_restart;
+	st->src.term_source = jtTermSource;
+	st->src.next_input_byte = (const JOCTET*) data;
+	st->src.bytes_in_buffer = (size_t) size;
+	st->d.src = &st->src;
+}
+
+static void
+jtInitDestination(j_compress_ptr cinfo)
+{
+	JPEGTranscodeState* st = (JPEGTranscodeState*) cinfo->err;
+
+	cinfo->dest->next_output_byte = (JOCTET*) st->outbuf;
+	cinfo->dest->free_in_buffer = (size_t) st->outbufsize;
+}
+
+static boolean
+jtEmptyOutputBuffer(j_compress_ptr cinfo)
+{
+	JPEGTranscodeState* st = (JPEGTranscodeState*) cinfo->err;
+	tmsize_t newsize = st->outbufsize * 2;
+	uint8_t* newbuf;
+
+	if (maxMalloc != 0 && newsize > maxMalloc)
+		newsize = maxMalloc;
+	newbuf = newsize > st->outbufsize ?
+	    (uint8_t*) _TIFFrealloc(st->outbuf, newsize) : NULL;
+	if (newbuf == NULL) {
+		/* Drop the data: the tile is reported as failed afterwards */
+		st->outbuferror = 1;
+		cinfo->dest->next_output_byte = (JOCTET*) st->outbuf;
+		cinfo->dest->free_in_buffer = (size_t) st->outbufsize;
+		return (TRUE);
+	}
+	cinfo->dest->next_output_byte = (JOCTET*) newbuf + st->outbufsize;
+	cinfo->dest->free_in_buffer = (size_t) (newsize - st->outbufsize);
+	st->outbuf = newbuf;
+	st->outbufsize = newsize;
+	return (TRUE);
+}
+
+static void
+jtTermDestination(j_compress_ptr cinfo)
+{
+	(void) cinfo;
+}
+
+/*
+ * Check that a freshly decoded input tile has the same JPEG layout
+ * (components, sampling, quantization) as the output we are building:
+ * mixing blocks quantized with different tables would not be lossless.
+ */
+static int
+jtSameLayout(JPEGTranscodeState* st)
+{
+	int ci;
+
+	if (st->d.num_components != st->c.num_components ||
+	    st->d.data_precision != 8)
+		return (FALSE);
+	for (ci = 0; ci < st->d.num_components; ci++) {
+		jpeg_component_info* dc = &st->d.comp_info[ci];
+		jpeg_component_info* cc = &st->c.comp_info[ci];
+		JQUANT_TBL* qt = st->c.quant_tbl_ptrs[cc->quant_tbl_no];
+
+		if (dc->h_samp_factor != cc->h_samp_factor ||
+		    dc->v_samp_factor != cc->v_samp_factor ||
+		    dc->quant_table == NULL || qt == NULL ||
+		    memcmp(dc->quant_table->quantval, qt->quantval,
+			   sizeof (qt->quantval)) != 0)
+			return (FALSE);
+	}
+	return (TRUE);
+}
+
+DECLAREcpFunc(cpJPEGCoefficients)
+{
+	JPEGTranscodeState st;
+	jvirt_barray_ptr dstcoef[MAX_COMPONENTS];
+	uint32_t icw, ich, ocw, och, iacross, idown;
+	uint32_t ox, oy;
+	uint32_t nchunks, i;
+	uint64_t maxbytes = 0;
+	uint8_t* inbuf = NULL;
+	int intiled = TIFFIsTiled(in), outtiled = TIFFIsTiled(out);
+	int havetables = FALSE, ok = FALSE;
+	uint32_t count;
+	void* tables;
+	JBLOCK* band[MAX_COMPONENTS];	/* blocks of one row of output tiles */
+	uint32_t bandw[MAX_COMPONENTS], bandh[MAX_COMPONENTS];
+	uint32_t blkw[MAX_COMPONENTS], blkh[MAX_COMPONENTS];
+	uint32_t bandrows, bandsy0 = (uint32_t) -1, bandsy1 = (uint32_t) -1;
+
+	(void) spp;
+	if (intiled) {
+		TIFFGetField(in, TIFFTAG_TILEWIDTH, &icw);
+		TIFFGetField(in, TIFFTAG_TILELENGTH, &ich);
+	} else {
+		icw = imagewidth;
+		TIFFGetFieldDefaulted(in, TIFFTAG_ROWSPERSTRIP, &ich);
+		if (ich > imagelength)
+			ich = imagelength;
+	}
+	if (outtiled) {
+		TIFFGetField(out, TIFFTAG_TILEWIDTH, &ocw);
+		TIFFGetField(out, TIFFTAG_TILELENGTH, &och);
+	} else {
+		ocw = imagewidth;
+		TIFFGetFieldDefaulted(out, TIFFTAG_ROWSPERSTRIP, &och);
+		if (och > imagelength)
+			och = imagelength;
+	}
+	if (icw == 0 || ich == 0 || ocw == 0 || och == 0)
+		return (FALSE);
+	iacross = jtHowMany(imagewidth, icw);
+	idown = jtHowMany(imagelength, ich);
+
+	nchunks = intiled ? TIFFNumberOfTiles(in) : TIFFNumberOfStrips(in);
+	for (i = 0; i < nchunks; i++) {
+		uint64_t bytes = TIFFGetStrileByteCount(in, i);
+		if (bytes > maxbytes)
+			maxbytes = bytes;
+	}
+	if (maxbytes == 0 || maxbytes > (uint64_t) TIFF_TMSIZE_T_MAX) {
+		TIFFError(TIFFFileName(in), "Error, no compressed data to copy");
+		return (FALSE);
+	}
+	inbuf = (uint8_t*) limitMalloc((tmsize_t) maxbytes);
+	memset(&st, 0, sizeof (st));
+	memset(band, 0, sizeof (band));
+	st.filename = TIFFFileName(in);
+	st.outbufsize = outtiled ? TIFFTileSize(out) : TIFFStripSize(out);
+	if (st.outbufsize < 4096)
+		st.outbufsize = 4096;
+	st.outbuf = (uint8_t*) limitMalloc(st.outbufsize);
+	if (inbuf == NULL || st.outbuf == NULL) {
+		TIFFError(TIFFFileName(in),
+		    "Error, can't allocate memory buffers to transcode");
+		goto done;
+	}
+
+	st.d.err = jpeg_std_error(&st.err);
+	st.err.error_exit = jtErrorExit;
+	st.err.output_message = jtOutputMessage;
+	st.c.err = &st.err;
+	if (!CALLVJPEG(&st, jpeg_create_decompress(&st.d)))
+		goto done;
+	if (!CALLVJPEG(&st, jpeg_create_compress(&st.c))) {
+		jpeg_destroy_decompress(&st.d);
+		goto done;
+	}
+	st.dest.init_destination = jtInitDestination;
+	st.dest.empty_output_buffer = jtEmptyOutputBuffer;
+	st.dest.term_destination = jtTermDestination;
+	st.c.dest = &st.dest;
+
+	/* Tables shared by all tiles of the input image */
+	if (TIFFGetField(in, TIFFTAG_JPEGTABLES, &count, &tables) && count > 2) {
+		jtSetSource(&st, tables, (tmsize_t) count);
+		if (CALLJPEG(&st, -1, jpeg_read_header(&st.d, FALSE)) !=
+		    JPEG_HEADER_TABLES_ONLY)
+			goto bad;
+	}
+
+	bandrows = (jtHowMany(och, ich) + 1) * ich;
+	for (oy = 0; oy < imagelength; oy += och) {
+		uint32_t oh = outtiled ? och : jtMin(och, imagelength - oy);
+		uint32_t sx, sy, sy0, sy1;
+		int ci;
+		size_t len;
+
+		/* input tile rows under this row of output tiles */
+		sy0 = oy / ich;
+		sy1 = jtMin((oy + oh - 1) / ich, idown - 1);
+		if (sy0 != bandsy0 || sy1 != bandsy1) {
+			for (ci = 0; ci < MAX_COMPONENTS && band[ci]; ci++)
+				memset(band[ci], 0, (size_t) bandw[ci] *
+				    bandh[ci] * sizeof (JBLOCK));
+			for (sy = sy0; sy <= sy1; sy++)
+			for (sx = 0; sx < iacross; sx++) {
+				uint32_t s = intiled ?
+				    TIFFComputeTile(in, sx * icw, sy * ich, 0, 0) :
+				    TIFFComputeStrip(in, sy * ich, 0);
+				tmsize_t cc;
+				jvirt_barray_ptr* srccoef;
+
+				cc = intiled ?
+				    TIFFReadRawTile(in, s, inbuf, (tmsize_t) maxbytes) :
+				    TIFFReadRawStrip(in, s, inbuf, (tmsize_t) maxbytes);
+				if (cc <= 0) {
+					if (ignore)
+						continue;
+					TIFFError(TIFFFileName(in),
+					    "Error, can't read %s %"PRIu32,
+					    intiled ? "tile" : "strip", s);
+					goto bad;
+				}
+				jtSetSource(&st, inbuf, cc);
+				if (CALLJPEG(&st, -1, jpeg_read_header(&st.d, TRUE))
+				    != JPEG_HEADER_OK)
+					goto bad;
+				srccoef = CALLJPEG(&st, NULL,
+				    jpeg_read_coefficients(&st.d));
+				if (srccoef == NULL)
+					goto bad;
+
+				if (!havetables) {
+					/*
+					 * Take the JPEG parameters of the first
+					 * input tile for the whole output and
+					 * emit the tables once as JPEGTABLES.
+					 */
+					if (!CALLVJPEG(&st,
+					    jpeg_copy_critical_parameters(&st.d, &st.c)))
+						goto bad;
+					st.c.write_JFIF_header = FALSE;
+					st.c.write_Adobe_marker = FALSE;
+					if (!CALLVJPEG(&st, jpeg_write_tables(&st.c)) ||
+					    st.outbuferror)
+						goto bad;
+					len = (size_t) st.outbufsize -
+					    st.dest.free_in_buffer;
+					TIFFSetField(out, TIFFTAG_JPEGTABLES,
+					    (uint32_t) len, st.outbuf);
+					havetables = TRUE;
+				}
+				if (!jtSameLayout(&st)) {
+					TIFFError(TIFFFileName(in),
+					    "Error, %s %"PRIu32" has a different "
+					    "JPEG layout, can't transcode it",
+					    intiled ? "tile" : "strip", s);
+					goto bad;
+				}
+				if (band[0] == NULL) {
+					/* the layout is known from the first tile */
+					for (ci = 0; ci < st.d.num_components; ci++) {
+						jpeg_component_info* sc = &st.d.comp_info[ci];
+						uint64_t bytes;
+
+						blkw[ci] = (uint32_t) (st.d.max_h_samp_factor *
+						    DCTSIZE / sc->h_samp_factor);
+						blkh[ci] = (uint32_t) (st.d.max_v_samp_factor *
+						    DCTSIZE / sc->v_samp_factor);
+						bandw[ci] = (uint32_t) jtHowMany(
+						    (uint64_t) iacross * icw, blkw[ci]);
+						bandh[ci] = jtHowMany(bandrows, blkh[ci]);
+						bytes = (uint64_t) bandw[ci] * bandh[ci] *
+						    sizeof (JBLOCK);
+						if (bytes <= (uint64_t) TIFF_TMSIZE_T_MAX)
+							band[ci] = (JBLOCK*) limitMalloc(
+							    (tmsize_t) bytes);
+						if (band[ci] == NULL) {
+							TIFFError(TIFFFileName(in),
+							    "Error, can't allocate memory "
+							    "for a row of DCT coefficients");
+							goto bad;
+						}
+						memset(band[ci], 0, (size_t) bytes);
+					}
+				}
+
+				/* copy the blocks of the input tile into the band */
+				for (ci = 0; ci < st.d.num_components; ci++) {
+					jpeg_component_info* sc = &st.d.comp_info[ci];
+					uint32_t sbx = sx * icw / blkw[ci];
+					uint32_t sby = (sy - sy0) * ich / blkh[ci];
+					uint32_t w = jtMin(sc->width_in_blocks,
+					    bandw[ci] - sbx);
+					uint32_t h = jtMin(sc->height_in_blocks,
+					    bandh[ci] - sby);
+					uint32_t y;
+
+					for (y = 0; y < h; y++) {
+						JBLOCKARRAY srow;
+
+						srow = CALLJPEG(&st, NULL,
+						    (*st.d.mem->access_virt_barray)(
+						    (j_common_ptr) &st.d, srccoef[ci],
+						    y, 1, FALSE));
+						if (srow == NULL)
+							goto bad;
+						memcpy(band[ci] + (size_t) (sby + y) *
+						    bandw[ci] + sbx, srow[0],
+						    w * sizeof (JBLOCK));
+					}
+				}
+				jpeg_abort_decompress(&st.d);
+			}
+			bandsy0 = sy0;
+			bandsy1 = sy1;
+		}
+		if (band[0] == NULL) {
+			/* nothing could be read for these tiles */
+			continue;
+		}
+
+		for (ox = 0; ox < imagewidth; ox += ocw) {
+			st.c.image_width = ocw;
+			st.c.image_height = oh;
+			for (ci = 0; ci < st.c.num_components; ci++) {
+				jpeg_component_info* comp = &st.c.comp_info[ci];
+				/* whole MCUs, as libjpeg accesses them */
+				JDIMENSION w = (JDIMENSION) (jtHowMany(
+				    jtHowMany(ocw, blkw[ci]),
+				    (uint32_t) comp->h_samp_factor) *
+				    comp->h_samp_factor);
+				JDIMENSION h = (JDIMENSION) (jtHowMany(
+				    jtHowMany(oh, blkh[ci]),
+				    (uint32_t) comp->v_samp_factor) *
+				    comp->v_samp_factor);
+
+				dstcoef[ci] = CALLJPEG(&st, NULL,
+				    (*st.c.mem->request_virt_barray)(
+				    (j_common_ptr) &st.c, JPOOL_IMAGE,
+				    TRUE, w, h,
+				    (JDIMENSION) comp->v_samp_factor));
+				if (dstcoef[ci] == NULL)
+					goto bad;
+			}
+			if (!CALLVJPEG(&st, (*st.c.mem->realize_virt_arrays)(
+			    (j_common_ptr) &st.c)))
+				goto bad;
+
+			/* cut the output tile from the band */
+			for (ci = 0; ci < st.c.num_components; ci++) {
+				uint32_t dbx = ox / blkw[ci];
+				uint32_t dby = (oy - sy0 * ich) / blkh[ci];
+				uint32_t dw = jtHowMany(ocw, blkw[ci]);
+				uint32_t dh = jtHowMany(oh, blkh[ci]);
+				uint32_t y;
+
+				if (dbx + dw > bandw[ci])
+					dw = bandw[ci] - dbx;
+				for (y = 0; y < dh && dby + y < bandh[ci]; y++) {
+					JBLOCKARRAY drow;
+
+					drow = CALLJPEG(&st, NULL,
+					    (*st.c.mem->access_virt_barray)(
+					    (j_common_ptr) &st.c, dstcoef[ci],
+					    y, 1, TRUE));
+					if (drow == NULL)
+						goto bad;
+					memcpy(drow[0], band[ci] + (size_t) (dby + y) *
+					    bandw[ci] + dbx, dw * sizeof (JBLOCK));
+				}
+			}
+
+			if (!CALLVJPEG(&st, jpeg_write_coefficients(&st.c, dstcoef)))
+				goto bad;
+			/* tables went out once in JPEGTABLES */
+			jpeg_suppress_tables(&st.c, TRUE);
+			if (!CALLVJPEG(&st, jpeg_finish_compress(&st.c)))
+				goto bad;
+			if (st.outbuferror) {
+				TIFFError(TIFFFileName(out),
+				    "Error, can't allocate memory for compressed data");
+				goto bad;
+			}
+			len = (size_t) st.outbufsize - st.dest.free_in_buffer;
+			if ((outtiled ?
+			    TIFFWriteRawTile(out,
+				TIFFComputeTile(out, ox, oy, 0, 0),
+				st.outbuf, (tmsize_t) len) :
+			    TIFFWriteRawStrip(out,
+				TIFFComputeStrip(out, oy, 0),
+				st.outbuf, (tmsize_t) len)) < 0) {
+				TIFFError(TIFFFileName(out),
+				    "Error, can't write %s at %"PRIu32" %"PRIu32,
+				    outtiled ? "tile" : "strip", ox, oy);
+				goto bad;
+			}
+		}
+	}
+	ok = TRUE;
+bad:
+	jpeg_destroy_compress(&st.c);
+	jpeg_destroy_decompress(&st.d);
+done:
+	for (i = 0; i < MAX_COMPONENTS; i++)
+		if (band[i])
+			_TIFFfree(band[i]);
+	if (inbuf)
+		_TIFFfree(inbuf);
+	if (st.outbuf)
+		_TIFFfree(st.outbuf);
+	return (ok);
+}
+#endif /* JPEG_SUPPORT */
+
 /*
  * Separate -> separate by row for rows/strip change.
  */
@@ -2015,8 +3073,9 @@ pickCopyFunc(TIFF* in, TIFF* out, uint16_t bitspersample, uint16_t samplesperpix
 			return cpSeparateStrips2SeparateTiles;
 		/* Tiles -> Tiles */
 		case pack(PLANARCONFIG_CONTIG,   PLANARCONFIG_CONTIG,   T,T,F):
-		case pack(PLANARCONFIG_CONTIG,   PLANARCONFIG_CONTIG,   T,T,T):
 			return cpContigTiles2ContigTiles;
+		case pack(PLANARCONFIG_CONTIG,   PLANARCONFIG_CONTIG,   T,T,T):
+			return cpDecodedTiles;
 		case pack(PLANARCONFIG_CONTIG,   PLANARCONFIG_SEPARATE, T,T,F):
 		case pack(PLANARCONFIG_CONTIG,   PLANARCONFIG_SEPARATE, T,T,T):
 			return cpContigTiles2SeparateTiles;
@@ -2062,6 +3121,503 @@ pickCopyFunc(TIFF* in, TIFF* out, uint16_t bitspersample, uint16_t samplesperpix
 	return (NULL);
 }
 
+/*
+ * JPEG-compressed YCbCr input that is written out as JPEG with the same
+ * strip or tile layout can be copied in the codec's raw, subsampled YCbCr
+ * form: this skips the YCbCr->RGB conversion and chroma upsampling done by
+ * the decoder and the RGB->YCbCr conversion and downsampling done by the
+ * encoder.  The output keeps the input's YCbCrSubsampling.  Only tiles
+ * are copied this way: libtiff does not give scanline access to
+ * subsampled data, and raw strips do not survive cpDecodedStrips intact.
+ */
+static int
+canKeepJPEGYCbCr(TIFF* in, TIFF* out, uint16_t input_compression,
+    uint16_t input_photometric, uint16_t bitspersample,
+    uint16_t samplesperpixel)
+{
+	uint16_t input_config;
+	uint32_t tw, tl;
+
+	if (input_compression != COMPRESSION_JPEG ||
+	    input_photometric != PHOTOMETRIC_YCBCR ||
+	    jpegcolormode != JPEGCOLORMODE_RGB ||
+	    bitspersample != 8 || samplesperpixel != 3 || bias)
+		return FALSE;
+	TIFFGetFieldDefaulted(in, TIFFTAG_PLANARCONFIG, &input_config);
+	if (input_config != PLANARCONFIG_CONTIG ||
+	    config != PLANARCONFIG_CONTIG)
+		return FALSE;
+	if (!TIFFIsTiled(in) || !TIFFIsTiled(out))
+		return FALSE;
+	if (!TIFFGetField(in, TIFFTAG_TILEWIDTH, &tw) ||
+	    !TIFFGetField(in, TIFFTAG_TILELENGTH, &tl))
+		return FALSE;
+	return (tw == tilewidth && tl == tilelength);
+}
+
+/*
+ * The compressed strips/tiles can be copied as they are when nothing
+ * that goes into them changes: same codec with no new codec options,
+ * same layout, photometric, fill order, predictor and Group 3 options,
+ * and, for samples wider than a byte, the same byte order.  This is
+ * what a plain "tiffcp in.tif out.tif" (or -8 to go to BigTIFF) asks
+ * for, and it saves a full decode/encode cycle.
+ */
+static int
+canCopyRaw(TIFF* in, TIFF* out, uint16_t input_compression,
+    uint16_t input_photometric, uint16_t bitspersample, uint32_t length)
+{
+	uint16_t input_config, output_photometric;
+	uint16_t input_fillorder, output_fillorder;
+
+	if (compression != input_compression || compressopts || bias ||
+	    input_compression == COMPRESSION_OJPEG)
+		return FALSE;
+	if (!TIFFGetField(out, TIFFTAG_PHOTOMETRIC, &output_photometric) ||
+	    output_photometric != input_photometric)
+		return FALSE;
+	TIFFGetFieldDefaulted(in, TIFFTAG_PLANARCONFIG, &input_config);
+	if (input_config != config)
+		return FALSE;
+	TIFFGetFieldDefaulted(in, TIFFTAG_FILLORDER, &input_fillorder);
+	TIFFGetFieldDefaulted(out, TIFFTAG_FILLORDER, &output_fillorder);
+	if (input_fillorder != output_fillorder)
+		return FALSE;
+	if (bitspersample > 8 && TIFFIsByteSwapped(in) != TIFFIsByteSwapped(out))
+		return FALSE;
+	if (TIFFFindField(in, TIFFTAG_PREDICTOR, TIFF_ANY)) {
+		uint16_t ipred, opred;
+
+		TIFFGetFieldDefaulted(in, TIFFTAG_PREDICTOR, &ipred);
+		TIFFGetFieldDefaulted(out, TIFFTAG_PREDICTOR, &opred);
+		if (ipred != opred)
+			return FALSE;
+	}
+	if (input_compression == COMPRESSION_CCITTFAX3) {
+		uint32_t iopts = 0, oopts = 0;
+
+		TIFFGetField(in, TIFFTAG_GROUP3OPTIONS, &iopts);
+		TIFFGetField(out, TIFFTAG_GROUP3OPTIONS, &oopts);
+		if (iopts != oopts)
+			return FALSE;
+	}
+	if (TIFFIsTiled(in) != TIFFIsTiled(out))
+		return FALSE;
+	if (TIFFIsTiled(in)) {
+		uint32_t tw, tl;
+
+		if (!TIFFGetField(in, TIFFTAG_TILEWIDTH, &tw) ||
+		    !TIFFGetField(in, TIFFTAG_TILELENGTH, &tl))
+			return FALSE;
+		return (tw == tilewidth && tl == tilelength);
+	} else {
+		uint32_t irps = (uint32_t) -1L;
+
+		TIFFGetField(in, TIFFTAG_ROWSPERSTRIP, &irps);
+		if (irps >= length && rowsperstrip >= length)
+			return TRUE;	/* a single strip either way */
+		return (rowsperstrip == irps);
+	}
+}
+
+#ifdef JPEG_SUPPORT
+/*
+ * DCT coefficients can be moved between tiles only if every input and
+ * output tile (or strip) starts on an MCU boundary: 8x8 pixels, times
+ * the chroma subsampling factors for YCbCr.  The coefficients of one
+ * row of output tiles, two bytes per sample, must also fit in the -m
+ * limit; otherwise the image is recompressed tile by tile.
+ */
+static int
+canTranscodeJPEG(TIFF* in, TIFF* out, uint16_t input_compression,
+    uint16_t input_photometric, uint16_t bitspersample, uint32_t length)
+{
+	uint16_t input_config, nsamples;
+	uint16_t hs = 1, vs = 1;
+	uint32_t mcuw, mcuh, width;
+	uint32_t iw, il, ow, ol;
+	uint64_t bandbytes;
+
+	if (input_compression != COMPRESSION_JPEG ||
+	    bitspersample != 8 || bias)
+		return FALSE;
+	TIFFGetFieldDefaulted(in, TIFFTAG_PLANARCONFIG, &input_config);
+	if (input_config != PLANARCONFIG_CONTIG ||
+	    config != PLANARCONFIG_CONTIG)
+		return FALSE;
+	if (input_photometric == PHOTOMETRIC_YCBCR)
+		TIFFGetFieldDefaulted(in, TIFFTAG_YCBCRSUBSAMPLING, &hs, &vs);
+	mcuw = 8 * hs;
+	mcuh = 8 * vs;
+	TIFFGetField(in, TIFFTAG_IMAGEWIDTH, &width);
+	if (TIFFIsTiled(in)) {
+		if (!TIFFGetField(in, TIFFTAG_TILEWIDTH, &iw) ||
+		    !TIFFGetField(in, TIFFTAG_TILELENGTH, &il) ||
+		    iw == 0 || il == 0 || iw % mcuw != 0 || il % mcuh != 0)
+			return FALSE;
+	} else {
+		iw = width;
+		il = (uint32_t) -1L;
+		TIFFGetField(in, TIFFTAG_ROWSPERSTRIP, &il);
+		if (il >= length)
+			il = length;
+		else if (il == 0 || il % mcuh != 0)
+			return FALSE;
+	}
+	if (TIFFIsTiled(out)) {
+		if (tilewidth % mcuw != 0 || tilelength % mcuh != 0)
+			return FALSE;
+		ow = tilewidth;
+		ol = tilelength;
+	} else {
+		if (rowsperstrip < length && rowsperstrip % mcuh != 0)
+			return FALSE;
+		ow = width;
+		ol = rowsperstrip < length ? rowsperstrip : length;
+	}
+	if (maxMalloc == 0 || ow == 0 || ol == 0)
+		return TRUE;
+	/* the input tile rows one row of output tiles may overlap */
+	TIFFGetFieldDefaulted(in, TIFFTAG_SAMPLESPERPIXEL, &nsamples);
+	bandbytes = ((uint64_t) (ol + il - 1) / il + 1) * il *
+	    ((uint64_t) width + iw) * nsamples * 2;
+	if (bandbytes > (uint64_t) maxMalloc) {
+		TIFFWarning(TIFFFileName(in),
+		    "A row of %"PRIu32"x%"PRIu32" tiles needs %"PRIu64" bytes "
+		    "of DCT coefficients, more than the -m limit",
+		    ow, ol, bandbytes);
+		return FALSE;
+	}
+	return TRUE;
+}
+#endif /* JPEG_SUPPORT */
+
+#ifdef ZSTD_SUPPORT
+/*
+ * Train a ZSTD dictionary on a sample of the output tiles (or strips),
+ * decoded from the input and run through the output predictor as the
+ * codec will see them, and store it in the output directory, where the
+ * codec shares it across all tiles.  Small tiles otherwise pay for their
+ * own entropy tables every time.  Only the start of large tiles is used,
+ * in pieces, so that each tile keeps its share of the training data.
+ */
+#define	ZSTD_DICT_SAMPLES	256
+
+/*
+ * The dictionary tag is private to the ZSTD codec, which names it
+ * "ZSTDDictionary".  Return its number, or 0 when tif is not ZSTD
+ * compressed.
+ */
+static ttag_t
+zstdDictionaryTag(TIFF* tif)
+{
+	uint16_t compression;
+	const TIFFField* fip;
+
+	if (!TIFFGetField(tif, TIFFTAG_COMPRESSION, &compression) ||
+	    compression != COMPRESSION_ZSTD)
+		return 0;
+	fip = TIFFFieldWithName(tif, "ZSTDDictionary");
+	return fip ? TIFFFieldTag(fip) : 0;
+}
+
+/*
+ * Copy rows [y, y+nrows) and columns [x, x+ncols) of output plane s, or
+ * of all planes when contig, into buf, rowsize bytes apart, decoding the
+ * input strips or tiles that hold them into inbuf.
+ */
+static int
+readZSTDTrainingChunk(TIFF* in, uint8_t* inbuf, tmsize_t inbufsize,
+    uint8_t* buf, tmsize_t rowsize, uint32_t x, uint32_t y,
+    uint32_t ncols, uint32_t nrows, tsample_t s, int contig)
+{
+	int intiled = TIFFIsTiled(in);
+	uint16_t bitspersample, samplesperpixel, inconfig;
+	uint32_t cw, ch, cx, cy, r;
+	uint64_t pixbits;
+	tsample_t p, firstplane, lastplane;
+	tmsize_t inrowsize;
+	size_t bps;
+	int incontig;
+
+	TIFFGetFieldDefaulted(in, TIFFTAG_BITSPERSAMPLE, &bitspersample);
+	TIFFGetFieldDefaulted(in, TIFFTAG_SAMPLESPERPIXEL, &samplesperpixel);
+	TIFFGetFieldDefaulted(in, TIFFTAG_PLANARCONFIG, &inconfig);
+	incontig = (inconfig == PLANARCONFIG_CONTIG || samplesperpixel == 1);
+	if (intiled) {
+		TIFFGetField(in, TIFFTAG_TILEWIDTH, &cw);
+		TIFFGetField(in, TIFFTAG_TILELENGTH, &ch);
+		inrowsize = TIFFTileRowSize(in);
+	} else {
+		TIFFGetField(in, TIFFTAG_IMAGEWIDTH, &cw);
+		TIFFGetFieldDefaulted(in, TIFFTAG_ROWSPERSTRIP, &ch);
+		inrowsize = TIFFScanlineSize(in);
+	}
+	if (cw == 0 || ch == 0 || inrowsize <= 0)
+		return FALSE;
+	/* A contig output pixel gathers all the planes of a separate input */
+	if (incontig)
+		firstplane = lastplane = 0;
+	else if (contig) {
+		firstplane = 0;
+		lastplane = samplesperpixel - 1;
+	} else
+		firstplane = lastplane = s;
+	pixbits = (uint64_t) bitspersample * (contig ? samplesperpixel : 1);
+	bps = bitspersample / 8;
+	for (p = firstplane; p <= lastplane; p++)
+	for (cy = y - y % ch; cy < y + nrows; cy += ch)
+	for (cx = x - x % cw; cx < x + ncols; cx += cw) {
+		uint32_t x0 = cx > x ? cx : x;
+		uint32_t x1 = cx + cw < x + ncols ? cx + cw : x + ncols;
+		uint32_t y0 = cy > y ? cy : y;
+		uint32_t y1 = cy + ch < y + nrows ? cy + ch : y + nrows;
+		uint32_t c = intiled ? TIFFComputeTile(in, cx, cy, 0, p) :
+		    TIFFComputeStrip(in, cy, p);
+
+		if ((intiled ? TIFFReadEncodedTile(in, c, inbuf, inbufsize) :
+		    TIFFReadEncodedStrip(in, c, inbuf, inbufsize)) < 0)
+			return FALSE;
+		for (r = y0; r < y1; r++) {
+			const uint8_t* src = inbuf + (r - cy) * inrowsize;
+			uint8_t* dst = buf + (r - y) * rowsize;
+			uint32_t i;
+
+			/*
+			 * Tiles are a multiple of 16 pixels wide, so both
+			 * ends start on a byte.
+			 */
+			if (incontig == contig) {
+				_TIFFmemcpy(dst + (x0 - x) * pixbits / 8,
+				    src + (x0 - cx) * pixbits / 8,
+				    (tmsize_t) (((x1 - x0) * pixbits + 7) / 8));
+				continue;
+			}
+			for (i = x0; i < x1; i++) {
+				if (incontig)
+					_TIFFmemcpy(dst + (i - x) * bps,
+					    src + ((i - cx) * samplesperpixel + s) * bps,
+					    (tmsize_t) bps);
+				else
+					_TIFFmemcpy(dst + ((i - x) * samplesperpixel + p) * bps,
+					    src + (i - cx) * bps, (tmsize_t) bps);
+			}
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * Do to nrows rows of buf, rowsize bytes each, what the output codec
+ * does before compressing them: apply the predictor of tif_predict.c,
+ * then swap the bytes of samples into the byte order of the file.
+ */
+static int
+predictZSTDTrainingChunk(TIFF* out, uint8_t* buf, tmsize_t rowsize,
+    uint32_t nrows)
+{
+	uint16_t predictor = PREDICTOR_NONE;
+	uint16_t bitspersample, samplesperpixel, config;
+	tmsize_t stride, n, i;
+	uint8_t* tmp = NULL;
+	uint32_t r;
+
+	TIFFGetField(out, TIFFTAG_PREDICTOR, &predictor);
+	TIFFGetFieldDefaulted(out, TIFFTAG_BITSPERSAMPLE, &bitspersample);
+	TIFFGetFieldDefaulted(out, TIFFTAG_SAMPLESPERPIXEL, &samplesperpixel);
+	TIFFGetFieldDefaulted(out, TIFFTAG_PLANARCONFIG, &config);
+	stride = config == PLANARCONFIG_CONTIG ? samplesperpixel : 1;
+	if (predictor == PREDICTOR_FLOATINGPOINT) {
+		tmp = (uint8_t*) limitMalloc(rowsize);
+		if (tmp == NULL)
+			return FALSE;
+	}
+	for (r = 0; r < nrows; r++, buf += rowsize) {
+		switch (predictor) {
+		case PREDICTOR_HORIZONTAL:
+			switch (bitspersample) {
+			case 8:
+				for (i = rowsize - 1; i >= stride; i--)
+					buf[i] = (uint8_t) (buf[i] - buf[i - stride]);
+				break;
+			case 16:
+			{
+				uint16_t* wp = (uint16_t*) buf;
+
+				for (i = rowsize / 2 - 1; i >= stride; i--)
+					wp[i] = (uint16_t) (wp[i] - wp[i - stride]);
+				break;
+			}
+			case 32:
+			{
+				uint32_t* wp = (uint32_t*) buf;
+
+				for (i = rowsize / 4 - 1; i >= stride; i--)
+					wp[i] -= wp[i - stride];
+				break;
+			}
+			}
+			break;
+		case PREDICTOR_FLOATINGPOINT:
+			/* bytes of equal weight together, most significant first */
+			n = rowsize / (bitspersample / 8);
+			_TIFFmemcpy(tmp, buf, rowsize);
+			for (i = 0; i < n; i++) {
+				uint32_t byte;
+
+				for (byte = 0; byte < bitspersample / 8U; byte++)
+#if WORDS_BIGENDIAN
+					buf[byte * n + i] =
+					    tmp[bitspersample / 8 * i + byte];
+#else
+					buf[(bitspersample / 8 - byte - 1) * n + i] =
+					    tmp[bitspersample / 8 * i + byte];
+#endif
+			}
+			for (i = rowsize - 1; i >= stride; i--)
+				buf[i] = (uint8_t) (buf[i] - buf[i - stride]);
+			continue;
+		}
+		if (TIFFIsByteSwapped(out)) {
+			switch (bitspersample) {
+			case 16:
+				TIFFSwabArrayOfShort((uint16_t*) buf, rowsize / 2);
+				break;
+			case 24:
+				TIFFSwabArrayOfTriples(buf, rowsize / 3);
+				break;
+			case 32:
+				TIFFSwabArrayOfLong((uint32_t*) buf, rowsize / 4);
+				break;
+			case 64:
+				TIFFSwabArrayOfLong8((uint64_t*) buf, rowsize / 8);
+				break;
+			}
+		}
+	}
+	if (tmp)
+		_TIFFfree(tmp);
+	return TRUE;
+}
+
+static int
+trainZSTDDictionary(TIFF* in, TIFF* out)
+{
+	int outtiled = TIFFIsTiled(out);
+	uint16_t bitspersample, samplesperpixel, inconfig, outconfig;
+	uint32_t width, length, cw, ch, across, perplane, nchunks, rows;
+	uint32_t nchosen, i, n = 0;
+	tmsize_t rowsize, chunksize, insize;
+	size_t dictcap = (size_t) zstddict * 1024;
+	size_t samplecap = 100 * dictcap;	/* zstd's recommended ratio */
+	size_t share, piececap, maxpieces, used = 0, dictsize;
+	size_t* sizes = NULL;
+	uint8_t *samples = NULL, *chunk = NULL, *inbuf = NULL;
+	void* dict = NULL;
+	int contig, incontig, ok = FALSE;
+
+	TIFFGetField(out, TIFFTAG_IMAGEWIDTH, &width);
+	TIFFGetField(out, TIFFTAG_IMAGELENGTH, &length);
+	TIFFGetFieldDefaulted(out, TIFFTAG_BITSPERSAMPLE, &bitspersample);
+	TIFFGetFieldDefaulted(out, TIFFTAG_SAMPLESPERPIXEL, &samplesperpixel);
+	TIFFGetFieldDefaulted(out, TIFFTAG_PLANARCONFIG, &outconfig);
+	TIFFGetFieldDefaulted(in, TIFFTAG_PLANARCONFIG, &inconfig);
+	contig = (outconfig == PLANARCONFIG_CONTIG || samplesperpixel == 1);
+	incontig = (inconfig == PLANARCONFIG_CONTIG || samplesperpixel == 1);
+	if (contig != incontig && bitspersample % 8 != 0)
+		return FALSE;
+	if (outtiled) {
+		TIFFGetField(out, TIFFTAG_TILEWIDTH, &cw);
+		TIFFGetField(out, TIFFTAG_TILELENGTH, &ch);
+		rowsize = TIFFTileRowSize(out);
+		chunksize = TIFFTileSize(out);
+		nchunks = TIFFNumberOfTiles(out);
+	} else {
+		cw = width;
+		TIFFGetFieldDefaulted(out, TIFFTAG_ROWSPERSTRIP, &ch);
+		if (ch > length)
+			ch = length;
+		rowsize = TIFFScanlineSize(out);
+		chunksize = TIFFStripSize(out);
+		nchunks = TIFFNumberOfStrips(out);
+	}
+	insize = TIFFIsTiled(in) ? TIFFTileSize(in) : TIFFStripSize(in);
+	if (nchunks == 0 || cw == 0 || ch == 0 || rowsize <= 0 ||
+	    chunksize <= 0 || insize <= 0)
+		return FALSE;
+	across = howMany(width, cw);
+	perplane = across * howMany(length, ch);
+	nchosen = nchunks < ZSTD_DICT_SAMPLES ? nchunks : ZSTD_DICT_SAMPLES;
+	if ((uint64_t) nchosen * (uint64_t) chunksize < samplecap)
+		samplecap = (size_t) nchosen * (size_t) chunksize;
+	share = samplecap / nchosen;
+	piececap = samplecap / ZSTD_DICT_SAMPLES;
+	if (piececap == 0)
+		piececap = share;
+	maxpieces = (size_t) nchosen * ((share + piececap - 1) / piececap);
+	rows = (uint32_t) ((share + (size_t) rowsize - 1) / (size_t) rowsize);
+	if (rows > ch)
+		rows = ch;
+	sizes = (size_t*) limitMalloc((tmsize_t) (maxpieces * sizeof (size_t)));
+	samples = (uint8_t*) limitMalloc((tmsize_t) samplecap);
+	chunk = (uint8_t*) limitMalloc(rowsize * (tmsize_t) rows);
+	inbuf = (uint8_t*) limitMalloc(insize);
+	dict = limitMalloc((tmsize_t) dictcap);
+	if (sizes == NULL || samples == NULL || chunk == NULL ||
+	    inbuf == NULL || dict == NULL)
+		goto done;
+
+	/* evenly spread samples so that the whole image is represented */
+	for (i = 0; i < nchosen; i++) {
+		uint32_t c = (uint32_t) ((uint64_t) i * nchunks / nchosen);
+		uint32_t k = c % perplane;
+		uint32_t x = (k % across) * cw, y = (k / across) * ch;
+		uint32_t ncols = width - x < cw ? width - x : cw;
+		uint32_t nrows = length - y < rows ? length - y : rows;
+		tsample_t s = (tsample_t) (contig ? 0 : c / perplane);
+		size_t len, off;
+
+		_TIFFmemset(chunk, 0, rowsize * (tmsize_t) rows);
+		if (!readZSTDTrainingChunk(in, inbuf, insize, chunk, rowsize,
+		    x, y, ncols, nrows, s, contig))
+			continue;
+		if (!predictZSTDTrainingChunk(out, chunk, rowsize, nrows))
+			goto done;
+		len = (size_t) rowsize * nrows;
+		if (len > share)
+			len = share;
+		for (off = 0; off < len && n < maxpieces; off += piececap) {
+			sizes[n] = len - off < piececap ? len - off : piececap;
+			_TIFFmemcpy(samples + used, chunk + off,
+			    (tmsize_t) sizes[n]);
+			used += sizes[n++];
+		}
+	}
+	if (n == 0)
+		goto done;
+	dictsize = ZDICT_trainFromBuffer(dict, dictcap, samples, sizes, n);
+	if (ZDICT_isError(dictsize)) {
+		TIFFWarning(TIFFFileName(in), "ZDICT_trainFromBuffer(): %s",
+		    ZDICT_getErrorName(dictsize));
+		goto done;
+	}
+	ok = zstdDictionaryTag(out) != 0 &&
+	    TIFFSetField(out, zstdDictionaryTag(out), (uint32_t) dictsize, dict);
+done:
+	if (sizes)
+		_TIFFfree(sizes);
+	if (samples)
+		_TIFFfree(samples);
+	if (chunk)
+		_TIFFfree(chunk);
+	if (inbuf)
+		_TIFFfree(inbuf);
+	if (dict)
+		_TIFFfree(dict);
+	return ok;
+}
+#endif /* ZSTD_SUPPORT */
+
 /* vim: set ts=8 sts=8 sw=8 noet: */
 /*
  * Local Variables:
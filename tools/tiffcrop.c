@@ -499,10 +499,18 @@ static int  writeImageSections(TIFF *, TIFF *, struct image_data *,
 /* Whole image functions */
 static int  createCroppedImage(struct image_data *, struct crop_mask *, 
                                unsigned char **, unsigned char **);
+static int  writeCroppedImageTags(TIFF *, TIFF *, struct image_data *,
+                                  uint32_t, uint32_t, int, int);
 static int  writeCroppedImage(TIFF *, TIFF *, struct image_data *image,
                               struct dump_opts * dump,
                               uint32_t, uint32_t, unsigned char *, int, int);
 
+/* Streaming functions for images too large to load whole */
+static int  canStreamImage(struct image_data *, struct crop_mask *,
+                           struct pagedef *, struct dump_opts *);
+static int  streamCroppedImage(TIFF *, TIFF *, struct image_data *,
+                               struct crop_mask *, int, int);
+
 /* Image manipulation functions */
 static int rotateContigSamples8bits(uint16_t, uint16_t, uint16_t, uint32_t,
                                     uint32_t, uint32_t, uint8_t *, uint8_t *);
@@ -614,6 +622,10 @@ static int  dump_buffer (FILE *, int, uint32_t, uint32_t, uint32_t, unsigned cha
  * disabled when set to 0 */
 static tmsize_t maxMalloc = DEFAULT_MAX_MALLOC;
 
+/* tile cache size (in bytes) for streamCroppedImage
+ * images are loaded whole when set to 0 */
+static tmsize_t streamCache = 0;
+
 /**
  * This custom malloc function enforce a maximum allocation size
  */
@@ -644,6 +656,8 @@ static const char usage_info[] =
 " -t       Write output in tiles\n"
 " -i       Ignore read errors\n"
 " -k size  set the memory allocation limit in MiB. 0 to disable limit\n"
+" -T size  crop/flip/rotate through a tile cache of size MiB instead of\n"
+"          loading whole images (single selection, byte aligned samples)\n"
 " \n"
 " -r #     Make each strip have no more than # rows\n"
 " -w #     Set output tile width (pixels)\n"
@@ -1635,7 +1649,7 @@ void  process_command_opts (int argc, char *argv[], char *mp, char *mode, uint32
     *mp++ = 'w';
     *mp = '\0';
     while ((c = getopt(argc, argv,
-       "ac:d:e:f:hik:l:m:p:r:stvw:z:BCD:E:F:H:I:J:K:LMN:O:P:R:S:U:V:X:Y:Z:")) != -1)
+       "ac:d:e:f:hik:l:m:p:r:stvw:z:BCD:E:F:H:I:J:K:LMN:O:P:R:S:T:U:V:X:Y:Z:")) != -1)
       {
     good_args++;
     switch (c) {
@@ -1696,6 +1710,8 @@ void  process_command_opts (int argc, char *argv[], char *mp, char *mode, uint32
 		break;
       case 'k':	maxMalloc = (tmsize_t)strtoul(optarg, NULL, 0) << 20;
 		break;
+      case 'T':	streamCache = (tmsize_t)strtoul(optarg, NULL, 0) << 20;
+		break;
       case 'l':	outtiled = TRUE;	 /* tile length */
 		*deftilelength = atoi(optarg);
 		break;
@@ -2235,6 +2251,7 @@ main(int argc, char* argv[])
   unsigned int  total_pages  = 0;
   unsigned int  total_images = 0;
   unsigned int  end_of_input = FALSE;
+  int    streamed, autoindex;
   int    seg;
   size_t length;
   char   temp_filename[PATH_MAX + 16]; /* Extra space keeps the compiler from complaining */
@@ -2373,88 +2390,129 @@ main(int argc, char* argv[])
       if (dump.debug)
          TIFFError("main", "Reading image %4d of %4d total pages.", dirnum + 1, total_pages);
 
-      if (loadImage(in, &image, &dump, &read_buff))
-        {
-        TIFFError("main", "Unable to load source image");
-        exit (EXIT_FAILURE);
-        }
-
-      /* Correct the image orientation if it was not ORIENTATION_TOPLEFT.
+      /* With a tile cache, a single selection is cropped, flipped and
+       * rotated strip by strip or tile by tile without loading the image.
        */
-      if (image.adjustments != 0)
-        {
-	if (correct_orientation(&image, &read_buff))
-	    TIFFError("main", "Unable to correct image orientation");
-        }
-
-      if (getCropOffsets(&image, &crop, &dump))
+      streamed = FALSE;
+      if (streamCache > 0)
         {
-        TIFFError("main", "Unable to define crop regions");
-        exit (EXIT_FAILURE);
-	}
-
-      if (crop.selections > 0)
-        {
-        if (processCropSelections(&image, &crop, &read_buff, seg_buffs))
+        if (loadImage(in, &image, &dump, NULL))
           {
-          TIFFError("main", "Unable to process image selections");
+          TIFFError("main", "Unable to load source image");
           exit (EXIT_FAILURE);
-	  }
-	}
-      else  /* Single image segment without zones or regions */
-        {
-        if (createCroppedImage(&image, &crop, &read_buff, &crop_buff))
+          }
+        if (getCropOffsets(&image, &crop, &dump))
           {
-          TIFFError("main", "Unable to create output image");
+          TIFFError("main", "Unable to define crop regions");
           exit (EXIT_FAILURE);
-	  }
-	}
-      if (page.mode == PAGE_MODE_NONE)
-        {  /* Whole image or sections not based on output page size */
-        if (crop.selections > 0)
-          {
-	  writeSelections(in, &out, &crop, &image, &dump, seg_buffs,
-                          mp, argv[argc - 1], &next_page, total_pages);
           }
-	else  /* One file all images and sections */
+        if (canStreamImage(&image, &crop, &page, &dump))
           {
-	  if (update_output_file (&out, mp, crop.exp_mode, argv[argc - 1],
+          if (crop.selections == 0)
+            autoindex = crop.exp_mode;
+          else
+            autoindex = (crop.exp_mode != ONE_FILE_COMPOSITE &&
+                         crop.exp_mode != ONE_FILE_SEPARATED);
+          if (update_output_file (&out, mp, autoindex, argv[argc - 1],
                                   &next_page))
-             exit (EXIT_FAILURE);
-          if (writeCroppedImage(in, out, &image, &dump,crop.combined_width, 
-                                crop.combined_length, crop_buff, next_page, total_pages))
+            exit (EXIT_FAILURE);
+          if (streamCroppedImage(in, out, &image, &crop, next_page,
+                                 (crop.selections > 0 &&
+                                  crop.exp_mode >= FILE_PER_IMAGE_SEPARATED) ?
+                                 1 : total_pages))
             {
-             TIFFError("main", "Unable to write new image");
-             exit (EXIT_FAILURE);
-	    }
+            TIFFError("main", "Unable to write new image");
+            exit (EXIT_FAILURE);
+            }
+          streamed = TRUE;
           }
-	}
-      else
+        }
+
+      if (!streamed)
         {
-	/* If we used a crop buffer, our data is there, otherwise it is
-         * in the read_buffer
-         */
-	if (crop_buff != NULL)  
-	  sect_src = crop_buff;
-        else
-          sect_src = read_buff;
-        /* Break input image into pages or rows and columns */
-        if (computeOutputPixelOffsets(&crop, &image, &page, sections, &dump))
+        if (loadImage(in, &image, &dump, &read_buff))
           {
-          TIFFError("main", "Unable to compute output section data");
+          TIFFError("main", "Unable to load source image");
           exit (EXIT_FAILURE);
-	  }
-        /* If there are multiple files on the command line, the final one is assumed 
-         * to be the output filename into which the images are written.
+          }
+
+        /* Correct the image orientation if it was not ORIENTATION_TOPLEFT.
          */
-	if (update_output_file (&out, mp, crop.exp_mode, argv[argc - 1], &next_page))
-          exit (EXIT_FAILURE);
+        if (image.adjustments != 0)
+          {
+	  if (correct_orientation(&image, &read_buff))
+	      TIFFError("main", "Unable to correct image orientation");
+          }
 
-	if (writeImageSections(in, out, &image, &page, sections, &dump, sect_src, &sect_buff))
+        if (getCropOffsets(&image, &crop, &dump))
           {
-          TIFFError("main", "Unable to write image sections");
+          TIFFError("main", "Unable to define crop regions");
           exit (EXIT_FAILURE);
 	  }
+
+        if (crop.selections > 0)
+          {
+          if (processCropSelections(&image, &crop, &read_buff, seg_buffs))
+            {
+            TIFFError("main", "Unable to process image selections");
+            exit (EXIT_FAILURE);
+	    }
+	  }
+        else  /* Single image segment without zones or regions */
+          {
+          if (createCroppedImage(&image, &crop, &read_buff, &crop_buff))
+            {
+            TIFFError("main", "Unable to create output image");
+            exit (EXIT_FAILURE);
+	    }
+	  }
+        if (page.mode == PAGE_MODE_NONE)
+          {  /* Whole image or sections not based on output page size */
+          if (crop.selections > 0)
+            {
+	    writeSelections(in, &out, &crop, &image, &dump, seg_buffs,
+                            mp, argv[argc - 1], &next_page, total_pages);
+            }
+	  else  /* One file all images and sections */
+            {
+	    if (update_output_file (&out, mp, crop.exp_mode, argv[argc - 1],
+                                    &next_page))
+               exit (EXIT_FAILURE);
+            if (writeCroppedImage(in, out, &image, &dump,crop.combined_width, 
+                                  crop.combined_length, crop_buff, next_page, total_pages))
+              {
+               TIFFError("main", "Unable to write new image");
+               exit (EXIT_FAILURE);
+	      }
+            }
+	  }
+        else
+          {
+	  /* If we used a crop buffer, our data is there, otherwise it is
+           * in the read_buffer
+           */
+	  if (crop_buff != NULL)  
+	    sect_src = crop_buff;
+          else
+            sect_src = read_buff;
+          /* Break input image into pages or rows and columns */
+          if (computeOutputPixelOffsets(&crop, &image, &page, sections, &dump))
+            {
+            TIFFError("main", "Unable to compute output section data");
+            exit (EXIT_FAILURE);
+	    }
+          /* If there are multiple files on the command line, the final one is assumed 
+           * to be the output filename into which the images are written.
+           */
+	  if (update_output_file (&out, mp, crop.exp_mode, argv[argc - 1], &next_page))
+            exit (EXIT_FAILURE);
+
+	  if (writeImageSections(in, out, &image, &page, sections, &dump, sect_src, &sect_buff))
+            {
+            TIFFError("main", "Unable to write image sections");
+            exit (EXIT_FAILURE);
+	    }
+          }
         }
 
       /* No image list specified, just read the next image */
@@ -6168,6 +6226,10 @@ loadImage(TIFF* in, struct image_data *image, struct dump_opts *dump, unsigned c
 	}
     }
  
+  /* Only the image parameters are wanted, see streamCroppedImage */
+  if (read_ptr == NULL)
+    return (0);
+
   read_buff = *read_ptr;
   /* +3 : add a few guard bytes since reverseSamples16bits() can read a bit */
   /* outside buffer */
@@ -7773,9 +7835,9 @@ createCroppedImage(struct image_data *image, struct crop_mask *crop,
  * then passed in as an argument.
  */
 static int  
-writeCroppedImage(TIFF *in, TIFF *out, struct image_data *image,
-                  struct dump_opts *dump, uint32_t width, uint32_t length,
-                  unsigned char *crop_buff, int pagenum, int total_pages)
+writeCroppedImageTags(TIFF *in, TIFF *out, struct image_data *image,
+                      uint32_t width, uint32_t length,
+                      int pagenum, int total_pages)
   {
   uint16_t bps, spp;
   uint16_t input_compression, input_photometric;
@@ -8011,6 +8073,21 @@ writeCroppedImage(TIFF *in, TIFF *out, struct image_data *image,
   for (p = tags; p < &tags[NTAGS]; p++)
 		CopyTag(p->tag, p->count, p->type);
 
+  return (0);
+  } /* end writeCroppedImageTags */
+
+/* Set up the output IFD and write the crop buffer to it */
+static int  
+writeCroppedImage(TIFF *in, TIFF *out, struct image_data *image,
+                  struct dump_opts *dump, uint32_t width, uint32_t length,
+                  unsigned char *crop_buff, int pagenum, int total_pages)
+  {
+  uint16_t spp = image->spp;
+
+  if (writeCroppedImageTags(in, out, image, width, length,
+                            pagenum, total_pages))
+    return (-1);
+
   /* Compute the tile or strip dimensions and write to disk */
   if (outtiled)
     {
@@ -8048,6 +8125,457 @@ writeCroppedImage(TIFF *in, TIFF *out, struct image_data *image,
   return (0);
   } /* end writeCroppedImage */
 
+/* Streaming crop, mirror and rotation
+ *
+ * When a tile cache is requested with -T, a single selection (or the
+ * whole image) of byte aligned, contiguous data is cropped, mirrored
+ * and rotated one output strip or tile at a time.  Each output chunk
+ * is assembled from the input strips or tiles that map onto it, which
+ * are decoded through a small LRU cache, so memory use is bounded by
+ * the cache size rather than by the size of the image.
+ */
+
+/* Selection in input pixels and the mirror and rotation applied to it,
+ * in that order, as in createCroppedImage and processCropSelections.
+ */
+struct streamgeom {
+  uint32_t x1;        /* left edge of the selection in the input */
+  uint32_t y1;        /* top edge of the selection in the input */
+  uint32_t width;     /* width of the selection */
+  uint32_t length;    /* length of the selection */
+  uint16_t mirror;    /* MIRROR_HORIZ, MIRROR_VERT, MIRROR_BOTH or 0 */
+  uint16_t rotation;  /* 0, 90, 180 or 270 degrees clockwise */
+};
+
+/* One decoded input strip or tile */
+struct chunkslot {
+  uint32_t chunk;     /* strip or tile number, (uint32_t)-1 if unused */
+  uint32_t lastuse;   /* cache clock at last access */
+  unsigned char *data;
+};
+
+struct chunkcache {
+  TIFF    *in;
+  int      tiled;
+  uint32_t cw;        /* width of a strip or tile in pixels */
+  uint32_t cl;        /* length of a strip or tile in pixels */
+  uint32_t across;    /* strips or tiles per row of them */
+  tmsize_t chunksize; /* size of one decoded strip or tile */
+  uint32_t nslots;
+  uint32_t clock;
+  struct chunkslot *slots;
+  uint32_t *slotof;   /* slot of each chunk, (uint32_t)-1 if not cached */
+};
+
+/* Map a pixel of the selection to the output image */
+static void
+streamMapPixel(struct streamgeom *geom, int64_t cx, int64_t cy,
+               int64_t *ox, int64_t *oy)
+  {
+  int64_t w = geom->width;
+  int64_t l = geom->length;
+
+  if (geom->mirror & MIRROR_HORIZ)
+    cx = w - 1 - cx;
+  if (geom->mirror & MIRROR_VERT)
+    cy = l - 1 - cy;
+  switch (geom->rotation)
+    {
+    case 90:  *ox = l - 1 - cy;
+              *oy = cx;
+              break;
+    case 180: *ox = w - 1 - cx;
+              *oy = l - 1 - cy;
+              break;
+    case 270: *ox = cy;
+              *oy = w - 1 - cx;
+              break;
+    default:  *ox = cx;
+              *oy = cy;
+              break;
+    }
+  } /* end streamMapPixel */
+
+/* Map a pixel of the output image back to the selection */
+static void
+streamUnmapPixel(struct streamgeom *geom, int64_t ox, int64_t oy,
+                 int64_t *cx, int64_t *cy)
+  {
+  int64_t w = geom->width;
+  int64_t l = geom->length;
+
+  switch (geom->rotation)
+    {
+    case 90:  *cx = oy;
+              *cy = l - 1 - ox;
+              break;
+    case 180: *cx = w - 1 - ox;
+              *cy = l - 1 - oy;
+              break;
+    case 270: *cx = w - 1 - oy;
+              *cy = ox;
+              break;
+    default:  *cx = ox;
+              *cy = oy;
+              break;
+    }
+  if (geom->mirror & MIRROR_HORIZ)
+    *cx = w - 1 - *cx;
+  if (geom->mirror & MIRROR_VERT)
+    *cy = l - 1 - *cy;
+  } /* end streamUnmapPixel */
+
+/* Return the decoded data of an input strip or tile, reading it into
+ * the least recently used cache slot if it is not cached.
+ */
+static unsigned char *
+getCachedChunk(struct chunkcache *cache, uint32_t chunk)
+  {
+  struct chunkslot *slot = NULL;
+  tmsize_t bytes_read;
+  uint32_t i;
+
+  cache->clock++;
+  if (cache->slotof[chunk] != (uint32_t)-1)
+    {
+    slot = &cache->slots[cache->slotof[chunk]];
+    slot->lastuse = cache->clock;
+    return (slot->data);
+    }
+  for (i = 0; i < cache->nslots; i++)
+    {
+    if (slot == NULL || cache->slots[i].lastuse < slot->lastuse)
+      slot = &cache->slots[i];
+    }
+  if (slot->chunk != (uint32_t)-1)
+    {
+    cache->slotof[slot->chunk] = (uint32_t)-1;
+    slot->chunk = (uint32_t)-1;
+    }
+
+  if (slot->data == NULL)
+    {
+    slot->data = (unsigned char *)limitMalloc(cache->chunksize);
+    if (slot->data == NULL)
+      {
+      TIFFError("getCachedChunk", "Unable to allocate %s cache buffer",
+                cache->tiled ? "tile" : "strip");
+      return (NULL);
+      }
+    }
+  _TIFFmemset(slot->data, 0, cache->chunksize);
+  if (cache->tiled)
+    bytes_read = TIFFReadEncodedTile(cache->in, chunk, slot->data, cache->chunksize);
+  else
+    bytes_read = TIFFReadEncodedStrip(cache->in, chunk, slot->data, cache->chunksize);
+  if (bytes_read < 0 && !ignore)
+    {
+    TIFFError("getCachedChunk", "Error reading %s %"PRIu32,
+              cache->tiled ? "tile" : "strip", chunk);
+    return (NULL);
+    }
+  slot->chunk = chunk;
+  slot->lastuse = cache->clock;
+  cache->slotof[chunk] = (uint32_t)(slot - cache->slots);
+  return (slot->data);
+  } /* end getCachedChunk */
+
+/* Return the largest number of input strips or tiles that map onto one
+ * row of output strips or tiles.  A cache smaller than that decodes them
+ * again for every output chunk of the row.  After a 90 or 270 degree
+ * rotation, a row of output chunks is a column band of the input, which
+ * for input strips is the whole image.
+ */
+static uint32_t
+streamBandChunks(struct streamgeom *geom, struct chunkcache *cache,
+                 uint32_t outwidth, uint32_t outlength, uint32_t ocl)
+  {
+  uint32_t oy0, oy1, ix0, iy0, ix1, iy1;
+  uint64_t n, maxn = 0;
+  int64_t  ax, ay, bx, by;
+
+  for (oy0 = 0; oy0 < outlength; oy0 += ocl)
+    {
+    oy1 = ((outlength - oy0 > ocl) ? oy0 + ocl : outlength) - 1;
+    streamUnmapPixel(geom, 0, oy0, &ax, &ay);
+    streamUnmapPixel(geom, outwidth - 1, oy1, &bx, &by);
+    ix0 = geom->x1 + (uint32_t)((ax < bx) ? ax : bx);
+    ix1 = geom->x1 + (uint32_t)((ax < bx) ? bx : ax);
+    iy0 = geom->y1 + (uint32_t)((ay < by) ? ay : by);
+    iy1 = geom->y1 + (uint32_t)((ay < by) ? by : ay);
+    n = (uint64_t)(iy1 / cache->cl - iy0 / cache->cl + 1) *
+        (ix1 / cache->cw - ix0 / cache->cw + 1);
+    if (n > maxn)
+      maxn = n;
+    if (oy1 + 1 >= outlength)
+      break;
+    }
+  return ((maxn > UINT32_MAX) ? UINT32_MAX : (uint32_t)maxn);
+  } /* end streamBandChunks */
+
+/* Check whether the current image and processing options can be handled
+ * by streamCroppedImage. Anything else goes through the whole image
+ * buffer as before.
+ */
+static int
+canStreamImage(struct image_data *image, struct crop_mask *crop,
+               struct pagedef *page, struct dump_opts *dump)
+  {
+  if (crop->selections > 1 || page->mode != PAGE_MODE_NONE ||
+      dump->format != DUMP_NONE)
+    return (FALSE);
+  if (image->adjustments != 0 || (crop->crop_mode & CROP_INVERT))
+    return (FALSE);
+  if ((image->bps % 8) != 0 || image->planar != PLANARCONFIG_CONTIG)
+    return (FALSE);
+  if (config != (uint16_t)-1 && config != PLANARCONFIG_CONTIG)
+    return (FALSE);
+  return (TRUE);
+  } /* end canStreamImage */
+
+static int
+streamCroppedImage(TIFF *in, TIFF *out, struct image_data *image,
+                   struct crop_mask *crop, int pagenum, int total_pages)
+  {
+  struct streamgeom geom;
+  struct chunkcache cache;
+  uint32_t inwidth = image->width;
+  uint32_t inlength = image->length;
+  uint32_t pixbytes = (image->bps * image->spp) / 8;
+  uint32_t outwidth, outlength, nchunks, ochunk = 0;
+  uint32_t ocw, ocl, ox0, oy0, ox1, oy1;
+  uint32_t ix0, iy0, ix1, iy1, rx0, ry0, rx1, ry1;
+  uint32_t cx, cy, x, y, i, bandslots;
+  int64_t  ax, ay, bx, by, ox, oy, step;
+  tmsize_t orowsize, obufsize, cachesize;
+  unsigned char *obuf = NULL;
+  unsigned char *data, *src, *dst;
+  float    res_temp;
+  int      status = -1;
+
+  memset(&cache, 0, sizeof(cache));
+  if (crop->selections == 0)
+    {
+    geom.x1 = 0;
+    geom.y1 = 0;
+    geom.width = image->width;
+    geom.length = image->length;
+    }
+  else
+    {
+    geom.x1 = crop->regionlist[0].x1;
+    geom.y1 = crop->regionlist[0].y1;
+    geom.width = crop->regionlist[0].x2 - crop->regionlist[0].x1 + 1;
+    geom.length = crop->regionlist[0].y2 - crop->regionlist[0].y1 + 1;
+    }
+  geom.mirror = (crop->crop_mode & CROP_MIRROR) ? crop->mirror : 0;
+  geom.rotation = (crop->crop_mode & CROP_ROTATE) ? crop->rotation : 0;
+
+  if (geom.rotation == 90 || geom.rotation == 270)
+    {
+    outwidth = geom.length;
+    outlength = geom.width;
+    /* Same bookkeeping as rotateImage */
+    image->width = outwidth;
+    image->length = outlength;
+    res_temp = image->xres;
+    image->xres = image->yres;
+    image->yres = res_temp;
+    }
+  else
+    {
+    outwidth = geom.width;
+    outlength = geom.length;
+    }
+  crop->combined_width = outwidth;
+  crop->combined_length = outlength;
+
+  if (writeCroppedImageTags(in, out, image, outwidth, outlength,
+                            pagenum, total_pages))
+    return (-1);
+
+  /* Output strips or tiles as set up by writeCroppedImageTags */
+  if (TIFFIsTiled(out))
+    {
+    TIFFGetField(out, TIFFTAG_TILEWIDTH, &ocw);
+    TIFFGetField(out, TIFFTAG_TILELENGTH, &ocl);
+    }
+  else
+    {
+    ocw = outwidth;
+    TIFFGetFieldDefaulted(out, TIFFTAG_ROWSPERSTRIP, &ocl);
+    if (ocl > outlength)
+      ocl = outlength;
+    }
+  if (ocw == 0 || ocl == 0 ||
+      (uint64_t)ocw * ocl * pixbytes > (uint64_t)TIFF_TMSIZE_T_MAX)
+    {
+    TIFFError("streamCroppedImage", "Invalid output strip or tile size");
+    return (-1);
+    }
+  orowsize = (tmsize_t)ocw * pixbytes;
+  obufsize = orowsize * ocl;
+  obuf = (unsigned char *)limitMalloc(obufsize);
+  if (obuf == NULL)
+    {
+    TIFFError("streamCroppedImage", "Unable to allocate output buffer");
+    return (-1);
+    }
+
+  /* Input strips or tiles */
+  cache.in = in;
+  cache.tiled = TIFFIsTiled(in);
+  if (cache.tiled)
+    {
+    TIFFGetField(in, TIFFTAG_TILEWIDTH, &cache.cw);
+    TIFFGetField(in, TIFFTAG_TILELENGTH, &cache.cl);
+    cache.chunksize = TIFFTileSize(in);
+    nchunks = TIFFNumberOfTiles(in);
+    }
+  else
+    {
+    cache.cw = inwidth;
+    TIFFGetFieldDefaulted(in, TIFFTAG_ROWSPERSTRIP, &cache.cl);
+    if (cache.cl > inlength)
+      cache.cl = inlength;
+    cache.chunksize = TIFFStripSize(in);
+    nchunks = TIFFNumberOfStrips(in);
+    }
+  if (cache.cw == 0 || cache.cl == 0 || cache.chunksize == 0 || nchunks == 0)
+    {
+    TIFFError("streamCroppedImage", "Invalid input strip or tile size");
+    goto done;
+    }
+  cache.across = (inwidth + cache.cw - 1) / cache.cw;
+
+  cachesize = streamCache / cache.chunksize;
+  cache.nslots = (cachesize < 1) ? 1 :
+                 ((cachesize > (tmsize_t)nchunks) ? nchunks : (uint32_t)cachesize);
+  /* Hold at least one row of output chunks worth of input, within -k */
+  bandslots = streamBandChunks(&geom, &cache, outwidth, outlength, ocl);
+  if (bandslots > cache.nslots)
+    {
+    if (maxMalloc == 0 ||
+        (uint64_t)bandslots * (uint64_t)cache.chunksize <= (uint64_t)maxMalloc)
+      cache.nslots = bandslots;
+    else
+      TIFFWarning("streamCroppedImage",
+                  "%"PRIu32" input %ss map onto each row of output %ss, "
+                  "more than fit in the -k limit; they will be decoded "
+                  "again for every output %s",
+                  bandslots, cache.tiled ? "tile" : "strip",
+                  TIFFIsTiled(out) ? "tile" : "strip",
+                  TIFFIsTiled(out) ? "tile" : "strip");
+    }
+  cache.slots = (struct chunkslot *)limitMalloc(cache.nslots * sizeof(struct chunkslot));
+  cache.slotof = (uint32_t *)limitMalloc(nchunks * sizeof(uint32_t));
+  if (cache.slots == NULL || cache.slotof == NULL)
+    {
+    TIFFError("streamCroppedImage", "Unable to allocate tile cache");
+    goto done;
+    }
+  for (i = 0; i < cache.nslots; i++)
+    {
+    cache.slots[i].chunk = (uint32_t)-1;
+    cache.slots[i].lastuse = 0;
+    cache.slots[i].data = NULL;
+    }
+  for (i = 0; i < nchunks; i++)
+    cache.slotof[i] = (uint32_t)-1;
+
+  /* Output offset between horizontally adjacent selection pixels */
+  streamMapPixel(&geom, 0, 0, &ax, &ay);
+  streamMapPixel(&geom, 1, 0, &bx, &by);
+  step = (by - ay) * orowsize + (bx - ax) * pixbytes;
+
+  for (oy0 = 0; oy0 < outlength; oy0 += ocl)
+    {
+    oy1 = ((outlength - oy0 > ocl) ? oy0 + ocl : outlength) - 1;
+    for (ox0 = 0; ox0 < outwidth; ox0 += ocw)
+      {
+      ox1 = ((outwidth - ox0 > ocw) ? ox0 + ocw : outwidth) - 1;
+
+      /* Input area that maps onto this output strip or tile */
+      streamUnmapPixel(&geom, ox0, oy0, &ax, &ay);
+      streamUnmapPixel(&geom, ox1, oy1, &bx, &by);
+      ix0 = geom.x1 + (uint32_t)((ax < bx) ? ax : bx);
+      ix1 = geom.x1 + (uint32_t)((ax < bx) ? bx : ax);
+      iy0 = geom.y1 + (uint32_t)((ay < by) ? ay : by);
+      iy1 = geom.y1 + (uint32_t)((ay < by) ? by : ay);
+
+      _TIFFmemset(obuf, 0, obufsize);
+      for (cy = iy0 / cache.cl; cy <= iy1 / cache.cl; cy++)
+        {
+        ry0 = (cy * cache.cl > iy0) ? cy * cache.cl : iy0;
+        ry1 = (cy * cache.cl + cache.cl - 1 < iy1) ? cy * cache.cl + cache.cl - 1 : iy1;
+        for (cx = ix0 / cache.cw; cx <= ix1 / cache.cw; cx++)
+          {
+          rx0 = (cx * cache.cw > ix0) ? cx * cache.cw : ix0;
+          rx1 = (cx * cache.cw + cache.cw - 1 < ix1) ? cx * cache.cw + cache.cw - 1 : ix1;
+          data = getCachedChunk(&cache, cy * cache.across + cx);
+          if (data == NULL)
+            goto done;
+          for (y = ry0; y <= ry1; y++)
+            {
+            src = data + ((tmsize_t)(y - cy * cache.cl) * cache.cw +
+                          (rx0 - cx * cache.cw)) * pixbytes;
+            streamMapPixel(&geom, rx0 - geom.x1, y - geom.y1, &ox, &oy);
+            dst = obuf + (oy - oy0) * orowsize + (ox - ox0) * pixbytes;
+            if (step == (int64_t)pixbytes)
+              _TIFFmemcpy(dst, src, (tmsize_t)(rx1 - rx0 + 1) * pixbytes);
+            else
+              {
+              for (x = rx0; x <= rx1; x++)
+                {
+                _TIFFmemcpy(dst, src, pixbytes);
+                src += pixbytes;
+                dst += step;
+                }
+              }
+            }
+          }
+        }
+
+      if (TIFFIsTiled(out))
+        {
+        if (TIFFWriteEncodedTile(out, ochunk, obuf, obufsize) < 0)
+          {
+          TIFFError("streamCroppedImage", "Unable to write tile %"PRIu32, ochunk);
+          goto done;
+          }
+        }
+      else
+        {
+        if (TIFFWriteEncodedStrip(out, ochunk, obuf,
+                                  (tmsize_t)(oy1 - oy0 + 1) * orowsize) < 0)
+          {
+          TIFFError("streamCroppedImage", "Unable to write strip %"PRIu32, ochunk);
+          goto done;
+          }
+        }
+      ochunk++;
+      }
+    }
+
+  if (!TIFFWriteDirectory(out))
+    {
+    TIFFError("streamCroppedImage", "Failed to write IFD for page number %d", pagenum);
+    goto done;
+    }
+  status = 0;
+
+ done:
+  if (cache.slots)
+    {
+    for (i = 0; i < cache.nslots; i++)
+      _TIFFfree(cache.slots[i].data);
+    _TIFFfree(cache.slots);
+    }
+  _TIFFfree(cache.slotof);
+  _TIFFfree(obuf);
+  return (status);
+  } /* end streamCroppedImage */
+
 static int
 rotateContigSamples8bits(uint16_t rotation, uint16_t spp, uint16_t bps, uint32_t width,
                          uint32_t length, uint32_t col, uint8_t *src, uint8_t *dst)
@@ -25,6 +25,7 @@
 #include "tif_config.h"
 #include "libport.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -53,9 +54,11 @@ static int rawdata = 0;			/* show raw/decoded data */
 static int showwords = 0;		/* show data as bytes/words */
 static int readdata = 0;		/* read data in file */
 static int stoponerr = 1;		/* stop on first read error */
+static int jsonsummary = 0;		/* JSON summary of the headers only */
 
 static	void usage(int);
 static	void tiffinfo(TIFF*, uint16_t, long, int);
+static	void tiffinfojson(TIFF*, const char*);
 
 static void
 PrivateErrorHandler(const char* module, const char* fmt, va_list ap)
@@ -79,7 +82,7 @@ main(int argc, char* argv[])
 	uint64_t diroff = 0;
 	int chopstrips = 0;		/* disable strip chopping */
 
-	while ((c = getopt(argc, argv, "f:o:cdDSjilmrsvwz0123456789h")) != -1)
+	while ((c = getopt(argc, argv, "f:o:cdDSjJilmrsvwz0123456789h")) != -1)
 		switch (c) {
 		case '0': case '1': case '2': case '3':
 		case '4': case '5': case '6': case '7':
@@ -114,6 +117,9 @@ main(int argc, char* argv[])
 				 TIFFPRINT_JPEGACTABLES |
 				 TIFFPRINT_JPEGDCTABLES;
 			break;
+		case 'J':
+			jsonsummary = 1;
+			break;
 		case 'r':
 			rawdata = 1;
 			break;
@@ -142,6 +148,18 @@ main(int argc, char* argv[])
 
 	multiplefiles = (argc - optind > 1);
 	for (; optind < argc; optind++) {
+		if (jsonsummary) {
+			/*
+			 * Only the directories are read: strip and tile
+			 * arrays are left on disk and never chopped.
+			 */
+			tif = TIFFOpen(argv[optind], "rcO");
+			if (tif != NULL) {
+				tiffinfojson(tif, argv[optind]);
+				TIFFClose(tif);
+			}
+			continue;
+		}
 		if (multiplefiles)
 			printf("%s:\n", argv[optind]);
 		tif = TIFFOpen(argv[optind], chopstrips ? "rC" : "rc");
@@ -182,6 +200,8 @@ static const char usage_info[] =
 " -f lsb2msb	force lsb-to-msb FillOrder for input\n"
 " -f msb2lsb	force msb-to-lsb FillOrder for input\n"
 " -j		show JPEG tables\n"
+" -J		only read the directories and print a JSON summary of them,\n"
+"		one line per file\n"
 " -o offset	set initial directory offset\n"
 " -r		read/display raw image data instead of decoded data\n"
 " -s		display strip offsets and byte counts\n"
@@ -542,6 +562,110 @@ tiffinfo(TIFF* tif, uint16_t order, long flags, int is_image)
 	}
 }
 
+static void
+PrintJSONString(const char* s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		unsigned char c = (unsigned char) *s;
+
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
+/*
+ * Print one JSON object describing all the directories of the file:
+ * dimensions, layout, coding and, for NDPI files, the magnification,
+ * z-offset and kind of each image.  The file is expected to be opened
+ * with lazy strile loading, so nothing but the directories is read.
+ */
+static void
+tiffinfojson(TIFF* tif, const char* filename)
+{
+	int index = 0;
+
+	printf("{\"file\":");
+	PrintJSONString(filename);
+	printf(",\"bigtiff\":%s,\"directories\":[",
+	    (tif->tif_flags & TIFF_BIGTIFF) ? "true" : "false");
+	do {
+		uint32_t width = 0, length = 0, subfiletype = 0, v;
+		uint16_t bps, spp, compression, photometric, planar;
+		float magnification;
+		int32_t zoffset;
+		char* label;
+		const TIFFCodec* codec;
+
+		TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+		TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &length);
+		TIFFGetField(tif, TIFFTAG_SUBFILETYPE, &subfiletype);
+		TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bps);
+		TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &spp);
+		TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+		TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+		if (!TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric))
+			photometric = (uint16_t) -1;
+
+		printf("%s{\"index\":%d,\"offset\":%"PRIu64
+		    ",\"width\":%"PRIu32",\"length\":%"PRIu32
+		    ",\"subfiletype\":%"PRIu32,
+		    index ? "," : "", index,
+		    (uint64_t) TIFFCurrentDirOffset(tif),
+		    width, length, subfiletype);
+		if (TIFFIsTiled(tif)) {
+			TIFFGetField(tif, TIFFTAG_TILEWIDTH, &v);
+			printf(",\"tilewidth\":%"PRIu32, v);
+			TIFFGetField(tif, TIFFTAG_TILELENGTH, &v);
+			printf(",\"tilelength\":%"PRIu32",\"tiles\":%"PRIu32,
+			    v, TIFFNumberOfTiles(tif));
+		} else {
+			TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &v);
+			printf(",\"rowsperstrip\":%"PRIu32",\"strips\":%"PRIu32,
+			    v, TIFFNumberOfStrips(tif));
+		}
+		printf(",\"bitspersample\":%"PRIu16
+		    ",\"samplesperpixel\":%"PRIu16
+		    ",\"planarconfig\":%"PRIu16
+		    ",\"compression\":%"PRIu16,
+		    bps, spp, planar, compression);
+		codec = TIFFFindCODEC(compression);
+		if (codec != NULL) {
+			printf(",\"compressionname\":");
+			PrintJSONString(codec->name);
+		}
+		if (photometric != (uint16_t) -1)
+			printf(",\"photometric\":%"PRIu16, photometric);
+		if (TIFFGetField(tif, NDPITAG_MAGNIFICATION, &magnification)) {
+			/*
+			 * NDPI source lens: -1 is the macro image, -2 the map.
+			 * JSON has no NaN or infinity, so those print as null.
+			 */
+			if (isfinite(magnification))
+				printf(",\"magnification\":%g", magnification);
+			else
+				printf(",\"magnification\":null");
+			printf(",\"kind\":\"%s\"",
+			    magnification == -1 ? "macro" :
+			    magnification == -2 ? "map" : "level");
+		}
+		if (TIFFGetField(tif, NDPITAG_ZOFFSET, &zoffset))
+			printf(",\"zoffset\":%"PRId32, zoffset);
+		if (TIFFGetField(tif, NDPITAG_USERGIVENSLIDELABEL, &label)) {
+			printf(",\"label\":");
+			PrintJSONString(label);
+		}
+		printf("}");
+		index++;
+	} while (TIFFReadDirectory(tif));
+	printf("]}\n");
+}
+
 /* vim: set ts=8 sts=8 sw=8 noet: */
 /*
  * Local Variables:
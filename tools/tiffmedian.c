@@ -101,11 +101,16 @@ static uint16_t	samplesperpixel;
 static uint32_t	imagewidth;
 static uint32_t	imagelength;
 static uint16_t	predictor = 0;
+static uint32_t	tilewidth;		/* 0 if the input has strips */
+static uint32_t	tilelength;
+static unsigned char *tileband;		/* one row of tiles of the input */
+static uint32_t	tilebandrow = (uint32_t) -1; /* first row in tileband */
 
+static	int read_row(TIFF*, unsigned char*, uint32_t);
 static	void get_histogram(TIFF*, Colorbox*);
 static	void splitbox(Colorbox*);
 static	void shrinkbox(Colorbox*);
-static	void map_colortable(void);
+static	void map_colortable(int);
 static	void quant(TIFF*, TIFF*);
 static	void quant_fsdither(TIFF*, TIFF*);
 static	Colorbox* largest_box(void);
@@ -186,6 +191,22 @@ main(int argc, char* argv[])
 		    argv[optind]);
 		return (EXIT_FAILURE);
 	}
+	if (TIFFIsTiled(in)) {
+		tmsize_t tilesize = TIFFTileSize(in);
+		uint32_t across;
+
+		TIFFGetField(in, TIFFTAG_TILEWIDTH, &tilewidth);
+		TIFFGetField(in, TIFFTAG_TILELENGTH, &tilelength);
+		across = tilewidth ? (imagewidth + tilewidth - 1) / tilewidth : 0;
+		if (tilesize > 0 && across > 0 && tilelength > 0 &&
+		    (uint64_t) tilesize * across <= (uint64_t) TIFF_TMSIZE_T_MAX)
+			tileband = (unsigned char *)_TIFFmalloc(tilesize * across);
+		if (tileband == NULL) {
+			fprintf(stderr, "%s: No space for a row of tiles\n",
+			    argv[optind]);
+			return (EXIT_FAILURE);
+		}
+	}
 
 	/*
 	 * STEP 1:  create empty boxes
@@ -247,7 +268,7 @@ main(int argc, char* argv[])
 	_TIFFmemset(ColorCells, 0, C_LEN*C_LEN*C_LEN*sizeof (C_cell*));
 	/* 5b: create mapping from truncated pixel space to color
 	   table entries */
-	map_colortable();
+	map_colortable(dither);
 
 	/*
 	 * STEP 6: scan image, match input values to table entries
@@ -299,6 +320,8 @@ main(int argc, char* argv[])
 	}
 	TIFFSetField(out, TIFFTAG_COLORMAP, rm, gm, bm);
 	(void) TIFFClose(out);
+	if (tileband)
+		_TIFFfree(tileband);
 	return (EXIT_SUCCESS);
 }
 
@@ -362,57 +385,121 @@ usage(int code)
 	exit(code);
 }
 
+/*
+ * Read row 'row' of the input into buf.  Tiled input is decoded one row
+ * of tiles at a time into tileband; since rows are read in order, each
+ * tile is decoded once per pass.
+ */
+static int
+read_row(TIFF* in, unsigned char* buf, uint32_t row)
+{
+	tmsize_t tilesize, tilerowsize, rowsize, off;
+	uint32_t band, x;
+	unsigned char *tile;
+
+	if (tilewidth == 0)
+		return (TIFFReadScanline(in, buf, row, 0) > 0);
+	tilesize = TIFFTileSize(in);
+	band = row - row % tilelength;
+	if (band != tilebandrow) {
+		tilebandrow = (uint32_t) -1;
+		for (x = 0, tile = tileband; x < imagewidth;
+		     x += tilewidth, tile += tilesize)
+			if (TIFFReadTile(in, tile, x, band, 0, 0) < 0)
+				return (0);
+		tilebandrow = band;
+	}
+	tilerowsize = TIFFTileRowSize(in);
+	rowsize = TIFFScanlineSize(in);
+	tile = tileband + (row - band) * tilerowsize;
+	for (off = 0; off < rowsize; off += tilerowsize, tile += tilesize)
+		_TIFFmemcpy(buf + off, tile, rowsize - off < tilerowsize ?
+		    rowsize - off : tilerowsize);
+	return (1);
+}
+
+/*
+ * Count n pixels in the histogram.
+ */
+static void
+count_pixels(register const unsigned char *inptr, register uint32_t n)
+{
+	register uint32_t *hist = &histogram[0][0][0];
+
+	/* The 8-bit samples can't index out of the histogram */
+	for (; n-- > 0; inptr += samplesperpixel)
+		hist[((inptr[0] >> COLOR_SHIFT) << (2*B_DEPTH)) |
+		     ((inptr[1] >> COLOR_SHIFT) << B_DEPTH) |
+		     (inptr[2] >> COLOR_SHIFT)]++;
+}
+
 static void
 get_histogram(TIFF* in, Colorbox* box)
 {
-	register unsigned char *inptr;
-	register int red, green, blue;
-	register uint32_t j, i;
+	register uint32_t *hist = &histogram[0][0][0];
+	register uint32_t i;
 	unsigned char *inputline;
+	int ir, ig, ib;
 
-	inputline = (unsigned char *)_TIFFmalloc(TIFFScanlineSize(in));
-	if (inputline == NULL) {
-		fprintf(stderr, "No space for scanline buffer\n");
-		exit(EXIT_FAILURE);
-	}
-	box->rmin = box->gmin = box->bmin = 999;
-	box->rmax = box->gmax = box->bmax = -1;
 	box->total = imagewidth * imagelength;
 
-	{ register uint32_t *ptr = &histogram[0][0][0];
-	  for (i = B_LEN*B_LEN*B_LEN; i-- > 0;)
-		*ptr++ = 0;
-	}
-	for (i = 0; i < imagelength; i++) {
-		if (TIFFReadScanline(in, inputline, i, 0) <= 0)
-			break;
-		inptr = inputline;
-		for (j = imagewidth; j-- > 0;) {
-			red = (*inptr++) & 0xff >> COLOR_SHIFT;
-			green = (*inptr++) & 0xff >> COLOR_SHIFT;
-			blue = (*inptr++) & 0xff >> COLOR_SHIFT;
-                        if ((red | green | blue) >= B_LEN) {
-                                fprintf(stderr,
-                                        "Logic error. "
-                                        "Histogram array overflow!\n");
-                                exit(EXIT_FAILURE);
-                        }
-			if (red < box->rmin)
-				box->rmin = red;
-		        if (red > box->rmax)
-				box->rmax = red;
-		        if (green < box->gmin)
-				box->gmin = green;
-		        if (green > box->gmax)
-				box->gmax = green;
-		        if (blue < box->bmin)
-				box->bmin = blue;
-		        if (blue > box->bmax)
-				box->bmax = blue;
-		        histogram[red][green][blue]++;
+	_TIFFmemset(histogram, 0, sizeof (histogram));
+	if (tilewidth != 0) {
+		/* Count each tile as it is decoded, without assembling rows */
+		tmsize_t tilerowsize = TIFFTileRowSize(in);
+		uint32_t x, y;
+
+		for (y = 0; y < imagelength; y += tilelength)
+			for (x = 0; x < imagewidth; x += tilewidth) {
+				uint32_t nrows = imagelength - y < tilelength ?
+				    imagelength - y : tilelength;
+				uint32_t ncols = imagewidth - x < tilewidth ?
+				    imagewidth - x : tilewidth;
+
+				if (TIFFReadTile(in, tileband, x, y, 0, 0) < 0)
+					goto bound;
+				for (i = 0; i < nrows; i++)
+					count_pixels(tileband + i * tilerowsize,
+					    ncols);
+			}
+	} else {
+		inputline = (unsigned char *)_TIFFmalloc(TIFFScanlineSize(in));
+		if (inputline == NULL) {
+			fprintf(stderr, "No space for scanline buffer\n");
+			exit(EXIT_FAILURE);
 		}
+		for (i = 0; i < imagelength; i++) {
+			if (TIFFReadScanline(in, inputline, i, 0) <= 0)
+				break;
+			count_pixels(inputline, imagewidth);
+		}
+		_TIFFfree(inputline);
 	}
-	_TIFFfree(inputline);
+
+bound:
+	/*
+	 * Bound the first box from the histogram rather than
+	 * comparing every pixel.
+	 */
+	box->rmin = box->gmin = box->bmin = 999;
+	box->rmax = box->gmax = box->bmax = -1;
+	for (ir = 0; ir < B_LEN; ++ir)
+		for (ig = 0; ig < B_LEN; ++ig)
+			for (ib = 0; ib < B_LEN; ++ib, hist++) {
+				if (*hist == 0)
+					continue;
+				if (ir < box->rmin)
+					box->rmin = ir;
+				box->rmax = ir;
+				if (ig < box->gmin)
+					box->gmin = ig;
+				if (ig > box->gmax)
+					box->gmax = ig;
+				if (ib < box->bmin)
+					box->bmin = ib;
+				if (ib > box->bmax)
+					box->bmax = ib;
+			}
 }
 
 static Colorbox *
@@ -725,8 +812,13 @@ create_colorcell(int red, int green, int blue)
 	return (ptr);
 }
 
+/*
+ * Map each histogram cell to the index of its closest color.  Empty cells
+ * are marked -1, unless all is set: error diffusion can produce any color,
+ * so the dithering looks colors up in a complete inverse colormap.
+ */
 static void
-map_colortable(void)
+map_colortable(int all)
 {
 	register uint32_t *histp = &histogram[0][0][0];
 	register C_cell *cell;
@@ -736,7 +828,7 @@ map_colortable(void)
 	for (ir = 0; ir < B_LEN; ++ir)
 		for (ig = 0; ig < B_LEN; ++ig)
 			for (ib = 0; ib < B_LEN; ++ib, histp++) {
-				if (*histp == 0) {
+				if (*histp == 0 && !all) {
 					*histp = -1;
 					continue;
 				}
@@ -783,14 +875,14 @@ quant(TIFF* in, TIFF* out)
 	inputline = (unsigned char *)_TIFFmalloc(TIFFScanlineSize(in));
 	outline = (unsigned char *)_TIFFmalloc(imagewidth);
 	for (i = 0; i < imagelength; i++) {
-		if (TIFFReadScanline(in, inputline, i, 0) <= 0)
+		if (!read_row(in, inputline, i))
 			break;
 		inptr = inputline;
 		outptr = outline;
-		for (j = 0; j < imagewidth; j++) {
-			red = *inptr++ >> COLOR_SHIFT;
-			green = *inptr++ >> COLOR_SHIFT;
-			blue = *inptr++ >> COLOR_SHIFT;
+		for (j = 0; j < imagewidth; j++, inptr += samplesperpixel) {
+			red = inptr[0] >> COLOR_SHIFT;
+			green = inptr[1] >> COLOR_SHIFT;
+			blue = inptr[2] >> COLOR_SHIFT;
 			*outptr++ = (unsigned char)histogram[red][green][blue];
 		}
 		if (TIFFWriteScanline(out, outline, i, 0) < 0)
@@ -802,27 +894,31 @@ quant(TIFF* in, TIFF* out)
 
 #define	SWAP(type,a,b)	{ type p; p = a; a = b; b = p; }
 
+/*
+ * The error lines hold one pad pixel on each side, so that the error of
+ * the first and last pixels can be diffused without tests; the pads are
+ * cleared with each new line and never read.
+ */
 #define	GetInputLine(tif, row, bad)                                     \
         do {                                                            \
-                if (TIFFReadScanline(tif, inputline, row, 0) <= 0)	\
+                if (!read_row(tif, inputline, row))			\
                         bad;						\
                 inptr = inputline;					\
                 nextptr = nextline;					\
+                *nextptr++ = 0; *nextptr++ = 0; *nextptr++ = 0;		\
                 for (j = 0; j < imagewidth; ++j) {			\
-                        *nextptr++ = *inptr++;				\
-                        *nextptr++ = *inptr++;				\
-                        *nextptr++ = *inptr++;				\
+                        *nextptr++ = inptr[0];				\
+                        *nextptr++ = inptr[1];				\
+                        *nextptr++ = inptr[2];				\
+                        inptr += samplesperpixel;			\
                 }                                                       \
+                *nextptr++ = 0; *nextptr++ = 0; *nextptr++ = 0;		\
         } while (0);
-#define	GetComponent(raw, cshift, c)				\
-        do {                                                    \
-                cshift = raw;                                   \
-                if (cshift < 0)                                 \
-                        cshift = 0;                             \
-                else if (cshift >= MAX_COLOR)                   \
-                        cshift = MAX_COLOR-1;                   \
-                c = cshift;                                     \
-                cshift >>= COLOR_SHIFT;                         \
+
+#define	GetComponent(raw, c)						\
+        do {                                                            \
+                c = raw;                                                \
+                c = (c < 0) ? 0 : (c >= MAX_COLOR) ? MAX_COLOR-1 : c;	\
         } while (0);
 
 static void
@@ -833,87 +929,71 @@ quant_fsdither(TIFF* in, TIFF* out)
 	register unsigned char	*outptr;
 	register short *thisptr, *nextptr;
 	register uint32_t i, j;
-	uint32_t imax, jmax;
-	int lastline, lastpixel;
+	uint32_t imax;
+	uint8_t *colormap;
+	short scratch[3*3];
 
 	imax = imagelength - 1;
-	jmax = imagewidth - 1;
 	inputline = (unsigned char *)_TIFFmalloc(TIFFScanlineSize(in));
-	thisline = (short *)_TIFFmalloc(imagewidth * 3 * sizeof (short));
-	nextline = (short *)_TIFFmalloc(imagewidth * 3 * sizeof (short));
+	thisline = (short *)_TIFFmalloc((imagewidth + 2) * 3 * sizeof (short));
+	nextline = (short *)_TIFFmalloc((imagewidth + 2) * 3 * sizeof (short));
 	outline = (unsigned char *) _TIFFmalloc(TIFFScanlineSize(out));
+	colormap = (uint8_t *)_TIFFmalloc(B_LEN*B_LEN*B_LEN);
+	if (!inputline || !thisline || !nextline || !outline || !colormap) {
+		fprintf(stderr, "No space for dithering buffers\n");
+		goto bad;
+	}
+	/*
+	 * Byte copy of the inverse colormap: at 32 KiB it stays in the
+	 * level 1 cache, which matters since each pixel waits for the
+	 * color of the previous one.
+	 */
+	{ uint32_t *histp = &histogram[0][0][0];
+	  for (i = 0; i < B_LEN*B_LEN*B_LEN; i++)
+		colormap[i] = (uint8_t) histp[i];
+	}
 
 	GetInputLine(in, 0, goto bad);		/* get first line */
 	for (i = 1; i <= imagelength; ++i) {
+		/* The last line diffuses its error nowhere */
+		int nextstep = (i >= imax) ? 0 : 3;
+		/* Error carried to the right, kept out of memory */
+		int rerr = 0, gerr = 0, berr = 0;
+
 		SWAP(short *, thisline, nextline);
-		lastline = (i >= imax);
 		if (i <= imax)
 			GetInputLine(in, i, break);
-		thisptr = thisline;
-		nextptr = nextline;
+		thisptr = thisline + 3;
+		nextptr = nextstep ? nextline + 3 : scratch + 3;
 		outptr = outline;
 		for (j = 0; j < imagewidth; ++j) {
 			int red, green, blue;
-			register int oval, r2, g2, b2;
-
-			lastpixel = (j == jmax);
-			GetComponent(*thisptr++, r2, red);
-			GetComponent(*thisptr++, g2, green);
-			GetComponent(*thisptr++, b2, blue);
-			oval = histogram[r2][g2][b2];
-			if (oval == -1) {
-				int ci;
-				register int cj, tmp, d2, dist;
-				register C_cell	*cell;
-
-				cell = *(ColorCells +
-				    (((r2>>(B_DEPTH-C_DEPTH)) << C_DEPTH*2) +
-				    ((g2>>(B_DEPTH-C_DEPTH)) << C_DEPTH ) +
-				    (b2>>(B_DEPTH-C_DEPTH))));
-				if (cell == NULL)
-					cell = create_colorcell(red,
-					    green, blue);
-				dist = 9999999;
-				for (ci = 0; ci < cell->num_ents && dist > cell->entries[ci][1]; ++ci) {
-					cj = cell->entries[ci][0];
-					d2 = (rm[cj] >> COLOR_SHIFT) - r2;
-					d2 *= d2;
-					tmp = (gm[cj] >> COLOR_SHIFT) - g2;
-					d2 += tmp*tmp;
-					tmp = (bm[cj] >> COLOR_SHIFT) - b2;
-					d2 += tmp*tmp;
-					if (d2 < dist) {
-						dist = d2;
-						oval = cj;
-					}
-				}
-				histogram[r2][g2][b2] = oval;
-			}
+			register int oval;
+
+			GetComponent(thisptr[0] + rerr, red);
+			GetComponent(thisptr[1] + gerr, green);
+			GetComponent(thisptr[2] + berr, blue);
+			thisptr += 3;
+			oval = colormap[((red >> COLOR_SHIFT) << (2*B_DEPTH)) |
+					((green >> COLOR_SHIFT) << B_DEPTH) |
+					(blue >> COLOR_SHIFT)];
 			*outptr++ = oval;
 			red -= rm[oval];
 			green -= gm[oval];
 			blue -= bm[oval];
-			if (!lastpixel) {
-				thisptr[0] += blue * 7 / 16;
-				thisptr[1] += green * 7 / 16;
-				thisptr[2] += red * 7 / 16;
-			}
-			if (!lastline) {
-				if (j != 0) {
-					nextptr[-3] += blue * 3 / 16;
-					nextptr[-2] += green * 3 / 16;
-					nextptr[-1] += red * 3 / 16;
-				}
-				nextptr[0] += blue * 5 / 16;
-				nextptr[1] += green * 5 / 16;
-				nextptr[2] += red * 5 / 16;
-				if (!lastpixel) {
-					nextptr[3] += blue / 16;
-				        nextptr[4] += green / 16;
-				        nextptr[5] += red / 16;
-				}
-				nextptr += 3;
-			}
+			rerr = red * 7 / 16;
+			gerr = green * 7 / 16;
+			berr = blue * 7 / 16;
+			nextptr[-3] += red * 3 / 16;
+			nextptr[-2] += green * 3 / 16;
+			nextptr[-1] += blue * 3 / 16;
+			nextptr[0] += red * 5 / 16;
+			nextptr[1] += green * 5 / 16;
+			nextptr[2] += blue * 5 / 16;
+			nextptr[3] += red / 16;
+			nextptr[4] += green / 16;
+			nextptr[5] += blue / 16;
+			nextptr += nextstep;
 		}
 		if (TIFFWriteScanline(out, outline, i-1, 0) < 0)
 			break;
@@ -923,6 +1003,7 @@ bad:
 	_TIFFfree(thisline);
 	_TIFFfree(nextline);
 	_TIFFfree(outline);
+	_TIFFfree(colormap);
 }
 /*
  * Local Variables: